@@ -0,0 +1,81 @@
+#include "actions/cache.h"
+#include "helpers/argc.h"
+#include "helpers/cache.h"
+#include "helpers/log.h"
+#include "helpers/strings.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+static const char *gible_cache_usage[] = {
+    "cache stat <dir>",
+    "cache prune <dir> [-l <limit>]",
+    NULL,
+};
+
+static void cache_print(const char *what, const cache_stat_t *s)
+{
+    gible_msg("%s %lu entries, %llu bytes.", what, s->entries, s->bytes);
+
+    if (!s->entries)
+        return;
+
+    char oldest[32], newest[32];
+    strftime(oldest, sizeof(oldest), "%Y-%m-%d %H:%M:%S", localtime(&s->oldest));
+    strftime(newest, sizeof(newest), "%Y-%m-%d %H:%M:%S", localtime(&s->newest));
+    gible_msg("Last used between %s and %s.", oldest, newest);
+}
+
+int gible_cache(const char *execname, int argc, char *argv[])
+{
+    int limit = 0;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_INTEGER('l', "limit", &limit, 0, "Size in MB prune keeps the cache under, 0 empties it (default).", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_cache_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 2)
+        return (argc_parser_print_usage(&parser), 1);
+
+    const char *command = parser.positional[0];
+    const char *dir = parser.positional[1];
+
+    if (limit < 0)
+        return (gible_error("The cache limit cannot be negative."), 1);
+
+#if defined(_WIN32)
+    (void)command, (void)dir;
+    return (gible_error("cache is not supported on Windows."), 1);
+#else
+    cache_stat_t s;
+
+    if (strcmp(command, "stat") == 0)
+    {
+        if (!cache_stat(dir, &s))
+            return (gible_error("Cannot read the cache directory %s.", dir), 1);
+
+        cache_print("Cache holds", &s);
+        return 0;
+    }
+
+    if (strcmp(command, "prune") == 0)
+    {
+        if (!cache_prune(dir, (unsigned long long)limit << 20, &s))
+            return (gible_error("Cannot read the cache directory %s.", dir), 1);
+
+        cache_print("Pruned", &s);
+        return 0;
+    }
+
+    return (argc_parser_print_usage(&parser), 1);
+#endif
+}
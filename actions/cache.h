@@ -0,0 +1,6 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+int gible_cache(const char *execname, int argc, char *argv[]);
+
+#endif // CACHE_H
@@ -0,0 +1,165 @@
+#include "actions/cat.h"
+#include "helpers/argc.h"
+#include "helpers/format.h"
+#include "helpers/strings.h"
+#include "helpers/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *gible_cat_usage[] = {
+    "cat <patch> <input> [-r <start>[:<length> | -<end>]] [-o <output>] [-b]",
+    NULL,
+};
+
+// Bytes decoded and written at a time.
+#define CAT_CHUNK (64UL * 1024)
+
+static int cat(const char *pfn, const char *ifn, const char *range, const char *ofn, int use_buffer);
+
+int gible_cat(const char *execname, int argc, char *argv[])
+{
+    const char *range = NULL, *ofn = NULL;
+    int use_buffer = 0;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_STRING('r', "range", &range, 0, "Bytes to print, as start, start:length or start-end. Numbers may be hex with 0x.", 0, NULL),
+        ARGC_OPT_STRING('o', "output", &ofn, 0, "Writes to the given file instead of stdout.", 0, NULL),
+        ARGC_OPT_BOOLEAN('b', "filebuffer", &use_buffer, 0, "Uses a heap allocated buffer instead of memory mapping.", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_cat_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 2)
+        return (argc_parser_print_usage(&parser), 1);
+
+    char *pfn = parser.positional[0];
+    char *ifn = parser.positional[1];
+
+    if (strcmp(pfn, ifn) == 0)
+        return (gible_error(same_filename_errors[0]), 1);
+
+    if (!file_exists(pfn))
+        return (gible_error("Patch file does not exist."), 1);
+
+    if (!file_exists(ifn))
+        return (gible_error("Input file does not exist."), 1);
+
+    return cat(pfn, ifn, range, ofn, use_buffer);
+}
+
+// The patched bytes may go to stdout, so every message goes to stderr.
+static void cat_log_handler(void *user, int level, const char *msg)
+{
+    static const char *level_strings[] = { "", "INFO", "WARN", "ERROR" };
+    (void)user;
+
+    if (level == LOG_LVL_MSG)
+        fprintf(stderr, "%s\n", msg);
+    else
+        fprintf(stderr, "[%s] %s\n", level_strings[level], msg);
+}
+
+// Parses start, start:length or start-end against the patched size.
+static int cat_parse_range(const char *range, unsigned long size, unsigned long *start, unsigned long *end)
+{
+    char *rest;
+
+    *start = 0;
+    *end = size;
+
+    if (!range)
+        return 1;
+
+    *start = strtoul(range, &rest, 0);
+
+    if (rest == range)
+        return 0;
+
+    if (*rest == ':' || *rest == '-')
+    {
+        char separator = *rest;
+        const char *number = rest + 1;
+        unsigned long value = strtoul(number, &rest, 0);
+
+        if (rest == number)
+            return 0;
+
+        *end = separator == ':' ? *start + value : value;
+    }
+
+    if (*rest || *start > *end || *end > size)
+        return 0;
+
+    return 1;
+}
+
+static int cat(const char *pfn, const char *ifn, const char *range, const char *ofn, int use_buffer)
+{
+    const filemap_api_t *fmap_api = use_buffer ? filemap_buffer_api : filemap_mmap_api;
+
+    gible_log_set_handler(cat_log_handler, NULL);
+
+    filemap_t patch = filemap_new(pfn, 1, fmap_api);
+    filemap_t input = filemap_new(ifn, 1, fmap_api);
+
+    filemap_open(&patch);
+    filemap_open(&input);
+
+    if (patch.status != FILEMAP_OK || input.status != FILEMAP_OK)
+    {
+        filemap_close(&patch);
+        filemap_close(&input);
+        return (gible_error("Cannot open the given patch or input file."), 1);
+    }
+
+    patch_view_t view;
+
+    if (patch_view_open(&view, patch, input) != APPLY_RET_SUCCESS)
+        return 1;
+
+    unsigned long start, end;
+
+    if (!cat_parse_range(range, view.size, &start, &end))
+    {
+        gible_error("Invalid range, the patched file is %lu bytes.", view.size);
+        patch_view_close(&view);
+        return 1;
+    }
+
+    FILE *out = ofn ? fopen(ofn, "wb") : stdout;
+    unsigned char *chunk = malloc(CAT_CHUNK);
+    int failed = !out || !chunk;
+
+    if (!out)
+        gible_error("Cannot open the given output file.");
+    else if (!chunk)
+        gible_error("Not enough memory.");
+
+    for (unsigned long at = start; !failed && at < end;)
+    {
+        unsigned long length = end - at < CAT_CHUNK ? end - at : CAT_CHUNK;
+
+        failed = patch_view_read(&view, at, chunk, length) != APPLY_RET_SUCCESS;
+
+        if (!failed && fwrite(chunk, 1, length, out) != length)
+            failed = (gible_error("Cannot write the patched bytes."), 1);
+
+        at += length;
+    }
+
+    free(chunk);
+
+    if (out && out != stdout && fclose(out) != 0 && !failed)
+        failed = (gible_error("Cannot write the patched bytes."), 1);
+
+    patch_view_close(&view);
+    return failed;
+}
@@ -0,0 +1,6 @@
+#ifndef CAT_H
+#define CAT_H
+
+int gible_cat(const char *execname, int argc, char *argv[]);
+
+#endif // CAT_H
@@ -0,0 +1,121 @@
+#include "actions/compose.h"
+#include "helpers/argc.h"
+#include "helpers/format.h"
+#include "helpers/strings.h"
+#include "helpers/utils.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *gible_compose_usage[] = {
+    "compose <patch> <patch> [<patch>...] -o <output> [-b]",
+    NULL,
+};
+
+static int compose(char **pfns, int count, const char *ofn, int use_buffer);
+
+int gible_compose(const char *execname, int argc, char *argv[])
+{
+    const char *ofn = NULL;
+    int use_buffer = 0;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_STRING('o', "output", &ofn, 0, "File the composed patch is written to.", 0, NULL),
+        ARGC_OPT_BOOLEAN('b', "filebuffer", &use_buffer, 0, "Uses a heap allocated buffer instead of memory mapping.", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_compose_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 2 || !ofn)
+        return (argc_parser_print_usage(&parser), 1);
+
+    for (int i = 0; i < parser.pcount; ++i)
+    {
+        if (strcmp(parser.positional[i], ofn) == 0)
+            return (gible_error(same_filename_errors[2]), 1);
+
+        if (!file_exists(parser.positional[i]))
+            return (gible_error("Patch file %s does not exist.", parser.positional[i]), 1);
+    }
+
+    return compose(parser.positional, parser.pcount, ofn, use_buffer);
+}
+
+static const patch_format_t *compose_detect(filemap_t *patch)
+{
+    patch_apply_context_t c;
+    memset(&c, 0, sizeof(patch_apply_context_t));
+    c.patch = *patch;
+
+    return patch_format_detect(&c);
+}
+
+// Folds the patches left to right, each intermediate patch kept in memory.
+static int compose(char **pfns, int count, const char *ofn, int use_buffer)
+{
+    const filemap_api_t *fmap_api = use_buffer ? filemap_buffer_api : filemap_mmap_api;
+
+    filemap_t current = filemap_new(pfns[0], 1, fmap_api);
+    filemap_open(&current);
+
+    if (current.status != FILEMAP_OK)
+        return (gible_error("Cannot open %s.", pfns[0]), 1);
+
+    const patch_format_t *format = compose_detect(&current);
+
+    if (!format || !format->compose)
+    {
+        filemap_close(&current);
+
+        if (format)
+            return (gible_error("%s patches cannot be composed.", format->name), 1);
+
+        return (gible_error("Unsupported Patch Type."), 1);
+    }
+
+    int return_code = CREATE_RET_SUCCESS;
+
+    for (int i = 1; i < count && return_code == CREATE_RET_SUCCESS; ++i)
+    {
+        filemap_t next = filemap_new(pfns[i], 1, fmap_api);
+        filemap_open(&next);
+
+        if (next.status != FILEMAP_OK)
+        {
+            gible_error("Cannot open %s.", pfns[i]);
+            return_code = CREATE_RET_FAILURE;
+            break;
+        }
+
+        if (compose_detect(&next) != format)
+        {
+            gible_error("%s is not a %s patch, only patches of the same format can be composed.", pfns[i],
+                format->name);
+            filemap_close(&next);
+            return_code = CREATE_RET_FAILURE;
+            break;
+        }
+
+        filemap_t output = i == count - 1 ? filemap_new(ofn, 0, fmap_api) : filemap_new(NULL, 0, filemap_memory_api);
+        return_code = format->compose(&current, &next, &output);
+
+        filemap_close(&next);
+        filemap_close(&current);
+        current = output;
+    }
+
+    filemap_close(&current);
+
+    if (return_code == CREATE_RET_SUCCESS)
+        gible_msg("%d %s patches successfully composed.", count, format->name);
+    else if (return_code == CREATE_RET_INVALID_OUTPUT)
+        gible_error("Cannot open the given output file.");
+
+    return return_code != CREATE_RET_SUCCESS;
+}
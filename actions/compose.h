@@ -0,0 +1,6 @@
+#ifndef COMPOSE_H
+#define COMPOSE_H
+
+int gible_compose(const char *execname, int argc, char *argv[]);
+
+#endif // COMPOSE_H
@@ -0,0 +1,159 @@
+#include "actions/convert.h"
+#include "helpers/argc.h"
+#include "helpers/crc32.h"
+#include "helpers/format.h"
+#include "helpers/strings.h"
+#include "helpers/utils.h"
+#include <stdio.h>
+#include <string.h>
+
+static const char *gible_convert_usage[] = {
+    "convert <patch> <input> <output> [-b]",
+    NULL,
+};
+
+static int convert(const char *pfn, const char *ifn, const char *ofn, int use_buffer);
+
+int gible_convert(const char *execname, int argc, char *argv[])
+{
+    int use_buffer = 0;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_BOOLEAN('b', "filebuffer", &use_buffer, 0, "Uses a heap allocated buffer instead of memory mapping.", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_convert_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 3)
+        return (argc_parser_print_usage(&parser), 1);
+
+    char *pfn = parser.positional[0];
+    char *ifn = parser.positional[1];
+    char *ofn = parser.positional[2];
+
+    int ret;
+    if ((ret = are_filenames_same(pfn, ifn, ofn)))
+        return (gible_error(same_filename_errors[ret - 1]), 1);
+
+    if (!file_exists(pfn))
+        return (gible_error("Patch file does not exist."), 1);
+
+    if (!file_exists(ifn))
+        return (gible_error("Input file does not exist."), 1);
+
+    return convert(pfn, ifn, ofn, use_buffer);
+}
+
+// Views leave the checksums alone, warn like patching would.
+static void convert_check_crcs(patch_view_t *v)
+{
+    if ((v->crc_stored & FLAG_CRC_PATCH) && crc32(v->patch.handle, v->patch.size - 4, 0) != v->expected_crc[CRC_PATCH])
+        gible_warn("Patch CRCs don't match.");
+
+    if ((v->crc_stored & FLAG_CRC_INPUT) && filemap_crc32(&v->input, v->input.size) != v->expected_crc[CRC_INPUT])
+        gible_warn("Input CRCs don't match.");
+}
+
+// Assembles the whole patched file in memory for formats that can only
+// create from a map.
+static int convert_mapped(patch_create_context_t *c, const patch_format_t *format, const patch_view_t *v)
+{
+    c->patched = filemap_new(NULL, 0, filemap_memory_api);
+
+    if (!filemap_create(&c->patched, v->size))
+        return CREATE_ERROR("Not enough memory to convert the patch.");
+
+    if (patch_view_read(v, 0, c->patched.handle, v->size) != APPLY_RET_SUCCESS)
+    {
+        filemap_close(&c->patched);
+        return CREATE_RET_FAILURE;
+    }
+
+    if ((v->crc_stored & FLAG_CRC_OUTPUT) && crc32(c->patched.handle, v->size, 0) != v->expected_crc[CRC_OUTPUT])
+        gible_warn("Output CRCs don't match.");
+
+    c->base = filemap_new_memory(v->input.handle, v->input.size);
+    filemap_open(&c->base);
+
+    int return_code = format->create_main(c);
+
+    filemap_close(&c->patched);
+    filemap_close(&c->base);
+    return return_code;
+}
+
+static int convert(const char *pfn, const char *ifn, const char *ofn, int use_buffer)
+{
+    const filemap_api_t *fmap_api = use_buffer ? filemap_buffer_api : filemap_mmap_api;
+
+    filemap_t patch = filemap_new(pfn, 1, fmap_api);
+    filemap_t input = filemap_new(ifn, 1, fmap_api);
+
+    filemap_open(&patch);
+    filemap_open(&input);
+
+    if (patch.status != FILEMAP_OK || input.status != FILEMAP_OK)
+    {
+        filemap_close(&patch);
+        filemap_close(&input);
+        return (gible_error("Cannot open the given patch or input file."), 1);
+    }
+
+    patch_view_t view;
+
+    if (patch_view_open(&view, patch, input) != APPLY_RET_SUCCESS)
+        return 1;
+
+    convert_check_crcs(&view);
+
+    create_flags_t flags;
+    memset(&flags, 0, sizeof(create_flags_t));
+    flags.use_buffer = use_buffer;
+
+    patch_create_context_t c;
+    memset(&c, 0, sizeof(patch_create_context_t));
+    c.flags = &flags;
+    c.stats = NULL;
+    c.progress = NULL;
+
+    // Only the sizes, for create_check.
+    c.patched = filemap_new(NULL, 1, filemap_memory_api);
+    c.base = filemap_new(NULL, 1, filemap_memory_api);
+    c.patched.size = view.size;
+    c.base.size = view.input.size;
+    c.output = filemap_new(ofn, 0, fmap_api);
+
+    // IPS refuses a view shorter than its input, it cannot truncate.
+    const patch_format_t *format = patch_format_for_create(&c, ofn);
+
+    if (!format)
+    {
+        const char *error = patch_format_create_error(&c, ofn);
+        patch_view_close(&view);
+        return (gible_error(error ? error : "Unsupported Patch Type."), 1);
+    }
+
+    int return_code;
+
+    if (format->create_view)
+        return_code = format->create_view(&c, &view);
+    else
+        return_code = convert_mapped(&c, format, &view);
+
+    filemap_close(&c.output);
+
+    if (return_code == CREATE_RET_SUCCESS)
+        gible_msg("%s successfully converted to %s.", view.format->name, format->name);
+    else if (return_code == CREATE_RET_INVALID_OUTPUT)
+        gible_error("Cannot open the given output file.");
+
+    patch_view_close(&view);
+    return return_code != CREATE_RET_SUCCESS;
+}
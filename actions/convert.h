@@ -0,0 +1,6 @@
+#ifndef CONVERT_H
+#define CONVERT_H
+
+int gible_convert(const char *execname, int argc, char *argv[]);
+
+#endif // CONVERT_H
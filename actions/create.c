@@ -2,13 +2,15 @@
 #include "helpers/argc.h"
 #include "helpers/format.h"
 #include "helpers/strings.h"
+#include "helpers/trace.h"
 #include "helpers/utils.h"
+#include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static const char *gible_create_usage[] = {
-    "create <patched> <base> <output>",
+    "create <patched> <base> <output> [-b | -w] [-B [-v]] [-sSp] [-PJ] [-T <trace>]",
     NULL,
 };
 
@@ -20,6 +22,11 @@ static const char *general_errors[] = {
 };
 
 static int create(const char *pfn, const char *bfn, const char *ofn, const create_flags_t *const flags);
+static int create_run(const char *pfn, const char *bfn, const char *ofn, const create_flags_t *const flags,
+    stats_t *stats, progress_t *progress);
+static int create_streamed(patch_create_context_t *c, const char *pfn, const char *bfn, const char *ofn, int *failed);
+static int create_report(const patch_format_t *format, int return_code);
+static int create_best(patch_create_context_t *c, const char *ofn);
 
 int gible_create(const char *execname, int argc, char *argv[])
 {
@@ -29,6 +36,15 @@ int gible_create(const char *execname, int argc, char *argv[])
     const argc_option_t options[] = {
         ARGC_OPT_HELP(),
         ARGC_OPT_BOOLEAN('b', "filebuffer", &flags.use_buffer, 0, "Uses a heap allocated buffer instead of memory mapping.", 0, NULL),
+        ARGC_OPT_BOOLEAN('w', "stream", &flags.stream, 0, "Reads the inputs a block at a time for UPS and IPS, in constant memory.", 0, NULL),
+        ARGC_OPT_BOOLEAN('B', "best", &flags.best, 0, "Creates every eligible format in parallel and keeps the smallest, appending its extension unless the output names one.", 0, NULL),
+        ARGC_OPT_BOOLEAN('v', "verify", &flags.verify, 0, "With --best, applies each candidate in memory before accepting it.", 0, NULL),
+        ARGC_OPT_FLAG('s', "stats", &flags.stats, STATS_OUTPUT_TEXT, "Prints per phase timings, action counts and resource usage to stderr.", 0, NULL),
+        ARGC_OPT_FLAG('S', "stats-json", &flags.stats, STATS_OUTPUT_JSON, "Same as --stats, as a JSON object.", 0, NULL),
+        ARGC_OPT_FLAG('P', "progress", &flags.progress, PROGRESS_OUTPUT_TEXT, "Shows a progress line on stderr for long runs.", 0, NULL),
+        ARGC_OPT_FLAG('J', "progress-json", &flags.progress, PROGRESS_OUTPUT_JSON, "Prints progress to stderr as one JSON object per line.", 0, NULL),
+        ARGC_OPT_STRING('T', "trace", &flags.trace, 0, "Writes a Chrome trace event timeline of the run to the given file.", 0, NULL),
+        ARGC_OPT_FLAG('p', "perf-counters", &flags.stats, STATS_PERF_COUNTERS, "Adds cycles, instructions and cache, branch and dTLB misses per phase to the stats.", 0, NULL),
         ARGC_OPT_END(),
     };
     argc_parser_t parser =
@@ -45,6 +61,9 @@ int gible_create(const char *execname, int argc, char *argv[])
     char *bfn = parser.positional[1];
     char *ofn = parser.positional[2];
 
+    if (flags.stream && flags.best)
+        return (gible_error("--stream cannot be combined with --best."), 1);
+
     int ret;
     if ((ret = are_filenames_same(pfn, bfn, ofn)))
         return (gible_error(same_filename_errors[ret - 1]), 1);
@@ -58,30 +77,66 @@ int gible_create(const char *execname, int argc, char *argv[])
     return create(pfn, bfn, ofn, &flags);
 }
 
-static int check_extension(const char *fname, const char *ext)
+static int create(const char *pfn, const char *bfn, const char *ofn, const create_flags_t *const flags)
 {
-    if (fname == NULL || ext == NULL)
-        return 0;
-    unsigned long length = strlen(fname), ext_len = strlen(ext);
-    if (!length || !ext_len || length < ext_len)
-        return 0;
-    return strcmp(fname + length - ext_len, ext) == 0;
+    stats_t stats;
+    stats_init(&stats);
+
+    if ((flags->stats & STATS_PERF_COUNTERS) && !stats_enable_perf(&stats))
+        gible_warn("Performance counters are unavailable: %s.", strerror(stats.perf.error));
+
+    if (flags->trace)
+        trace_start();
+
+    progress_t progress;
+    progress_reporter_t reporter;
+    memset(&progress, 0, sizeof(progress_t));
+
+    if (flags->progress)
+        progress_reporter_start(&reporter, &progress, flags->progress);
+
+    int failed = create_run(pfn, bfn, ofn, flags, flags->stats || flags->trace ? &stats : NULL,
+        flags->progress ? &progress : NULL);
+
+    if (flags->progress)
+        progress_reporter_stop(&reporter);
+
+    if (flags->trace && !trace_stop(flags->trace))
+        gible_warn("Cannot write the trace to %s.", flags->trace);
+
+    if (flags->stats)
+    {
+        stats_finish(&stats);
+        stats_print(&stats, flags->stats);
+    }
+
+    return failed;
 }
 
-static int create(const char *pfn, const char *bfn, const char *ofn, const create_flags_t *const flags)
+static int create_run(const char *pfn, const char *bfn, const char *ofn, const create_flags_t *const flags,
+    stats_t *stats, progress_t *progress)
 {
     patch_create_context_t c;
 
     const filemap_api_t *fmap_api = flags->use_buffer ? filemap_buffer_api : filemap_mmap_api;
 
     c.flags = flags;
+    c.stats = stats;
+    c.progress = progress;
+    c.candidates = NULL;
 
     c.patched = filemap_new(pfn, 1, fmap_api);
     c.base = filemap_new(bfn, 1, fmap_api);
     c.output = filemap_new(ofn, 0, fmap_api);
 
+    int failed;
+    if (flags->stream && create_streamed(&c, pfn, bfn, ofn, &failed))
+        return failed;
+
+    stats_phase_begin(stats, STATS_PHASE_OPEN);
     filemap_open(&c.patched);
     filemap_open(&c.base);
+    stats_phase_end(stats);
 
     if (c.patched.status != FILEMAP_OK)
         return (gible_error(general_errors[CREATE_RET_INVALID_PATCHED]), 1);
@@ -89,37 +144,305 @@ static int create(const char *pfn, const char *bfn, const char *ofn, const creat
     if (c.base.status != FILEMAP_OK)
         return (gible_error(general_errors[CREATE_RET_INVALID_BASE]), 1);
 
+    if (flags->best)
+    {
+        stats_phase_begin(stats, STATS_PHASE_CREATE);
+        int failed = create_best(&c, ofn);
+        stats_phase_end(stats);
+
+        filemap_close(&c.patched);
+        filemap_close(&c.base);
+        return failed;
+    }
+
+    const patch_format_t *format = patch_format_for_create(&c, ofn);
+
+    if (!format)
+    {
+        const char *error = patch_format_create_error(&c, ofn);
+        filemap_close(&c.patched);
+        filemap_close(&c.base);
+        gible_error(error ? error : "Unsupported Patch Type.");
+        return 1;
+    }
+
+    stats_phase_begin(stats, STATS_PHASE_CREATE);
+    int return_code = format->create_main(&c);
+    stats_phase_end(stats);
+
+    stats_phase_begin(stats, STATS_PHASE_CLOSE);
+    filemap_close(&c.patched);
+    filemap_close(&c.base);
+    filemap_close(&c.output);
+    stats_phase_end(stats);
+
+    return create_report(format, return_code);
+}
+
+static int create_report(const patch_format_t *format, int return_code)
+{
+    switch (return_code)
+    {
+    case 0:
+        gible_msg("%s successfully created.", format->name);
+        break;
+    case -1:
+        break;
+    default:
+        gible_error(general_errors[return_code]);
+        break;
+    }
+
+    return return_code != CREATE_RET_SUCCESS;
+}
+
+// -------------------------------------------------
+// Streaming
+// -------------------------------------------------
+
+// Creates the patch from two streams when the format allows it. Returns 0
+// without touching anything when it does not, for the caller to map instead.
+static int create_streamed(patch_create_context_t *c, const char *pfn, const char *bfn, const char *ofn, int *failed)
+{
+    stream_t patched, base;
+
+    stats_phase_begin(c->stats, STATS_PHASE_OPEN);
+    int patched_ok = stream_open(&patched, pfn);
+    int base_ok = patched_ok && stream_open(&base, bfn);
+    stats_phase_end(c->stats);
+
+    if (!patched_ok || !base_ok)
+    {
+        if (patched_ok)
+            stream_close(&patched);
+
+        *failed = 1;
+        gible_error(general_errors[patched_ok ? CREATE_RET_INVALID_BASE : CREATE_RET_INVALID_PATCHED]);
+        return 1;
+    }
+
+    // Only the sizes, for create_check.
+    c->patched.size = patched.size;
+    c->base.size = base.size;
+
+    const patch_format_t *format = patch_format_for_create(c, ofn);
+
+    if (!format || !format->create_stream)
+    {
+        stream_close(&patched);
+        stream_close(&base);
+
+        c->patched.size = 0;
+        c->base.size = 0;
+
+        if (format)
+            gible_info("%s cannot be streamed, mapping the inputs instead.", format->name);
+
+        return 0;
+    }
+
+    stats_phase_begin(c->stats, STATS_PHASE_CREATE);
+    int return_code = format->create_stream(c, &patched, &base);
+    stats_phase_end(c->stats);
+
+    stats_phase_begin(c->stats, STATS_PHASE_CLOSE);
+    stream_close(&patched);
+    stream_close(&base);
+    filemap_close(&c->output);
+    stats_phase_end(c->stats);
+
+    *failed = create_report(format, return_code);
+    return 1;
+}
+
+// -------------------------------------------------
+// Best Format Search
+// -------------------------------------------------
+
+typedef struct create_candidate
+{
+    const patch_format_t *format;
+    patch_create_context_t c;
+    pthread_t thread;
+    int return_code;
+    char error[256];
+} create_candidate_t;
+
+// Keeps the last error of a candidate, the rest of its chatter is dropped.
+static void create_candidate_log(void *user, int level, const char *msg)
+{
+    create_candidate_t *candidate = user;
+
+    if (level == LOG_LVL_ERROR)
+        snprintf(candidate->error, sizeof(candidate->error), "%s", msg);
+}
+
+static void *create_candidate_run(void *arg)
+{
+    create_candidate_t *candidate = arg;
+
+    trace_thread_name("create candidate");
+    double traced = trace_begin();
+
+    gible_log_set_handler(create_candidate_log, candidate);
+    candidate->return_code = candidate->format->create_main(&candidate->c);
+    gible_log_set_handler(NULL, NULL);
+
+    trace_end("candidate", candidate->format->name, traced);
+
+    return NULL;
+}
+
+// Applies the candidate to the base in memory and compares against the patched file.
+static int create_candidate_verify(create_candidate_t *candidate)
+{
+    apply_flags_t flags;
+    memset(&flags, 0, sizeof(apply_flags_t));
+
+    patch_apply_context_t a;
+    a.flags = &flags;
+    a.stats = NULL;
+    a.progress = NULL;
+    a.touched = NULL;
+    a.digest = NULL;
+    a.patch = filemap_new_memory(candidate->c.output.handle, candidate->c.output.size);
+    a.input = filemap_new_memory(candidate->c.base.handle, candidate->c.base.size);
+    a.output = filemap_new(NULL, 0, filemap_memory_api);
+
+    filemap_open(&a.patch);
+    filemap_open(&a.input);
+
+    double traced = trace_begin();
+
+    gible_log_set_handler(create_candidate_log, candidate);
+    int return_code = candidate->format->apply_main(&a);
+    gible_log_set_handler(NULL, NULL);
+
+    trace_end("verify", candidate->format->name, traced);
+
+    const filemap_t *patched = &candidate->c.patched;
+    int ok = return_code == APPLY_RET_SUCCESS && a.output.size == patched->size &&
+             memcmp(a.output.handle, patched->handle, patched->size) == 0;
+
+    if (!ok && !candidate->error[0])
+        snprintf(candidate->error, sizeof(candidate->error), "Does not reproduce the patched file.");
+
+    filemap_close(&a.output);
+    return ok;
+}
+
+// Runs every eligible create_main in its own thread over the shared
+// read-only inputs, each into a memory output, then writes the smallest.
+// An output named after a format only takes that format's flavours, any
+// other name gets the winner's extension appended.
+static int create_best(patch_create_context_t *c, const char *ofn)
+{
+    create_candidate_t candidates[16];
+    int count = 0, named = 0;
+
     for (const patch_format_t *const *format = patch_formats; *format; format++)
+        named |= patch_format_matches_extension(*format, ofn);
+
+    for (const patch_format_t *const *format = patch_formats; *format && count < 16; format++)
     {
-        if (!check_extension(ofn, (*format)->ext))
+        if (!(*format)->create_main)
             continue;
 
-        if ((*format)->create_check && !(*format)->create_check(&c))
+        if (named && !patch_format_matches_extension(*format, ofn))
             continue;
 
-        int return_code = (*format)->create_main(&c);
+        if ((*format)->create_check && !(*format)->create_check(c))
+            continue;
 
-        filemap_close(&c.patched);
-        filemap_close(&c.base);
-        filemap_close(&c.output);
+        create_candidate_t *candidate = &candidates[count++];
+        candidate->format = *format;
+        candidate->c = *c;
+        candidate->c.stats = NULL;
+        candidate->c.progress = NULL;
+        candidate->c.output = filemap_new(NULL, 0, filemap_memory_api);
+        candidate->return_code = CREATE_RET_FAILURE;
+        candidate->error[0] = '\0';
 
-        switch (return_code)
+        if (pthread_create(&candidate->thread, NULL, create_candidate_run, candidate) != 0)
         {
-        case 0:
-            gible_msg("%s successfully created.", (*format)->name);
-            break;
-        case -1:
-            break;
-        default:
-            gible_error(general_errors[return_code]);
-            break;
+            // Out of threads, run it inline instead.
+            create_candidate_run(candidate);
+            candidate->thread = pthread_self();
         }
+    }
+
+    create_candidate_t *best = NULL;
+
+    for (int i = 0; i < count; ++i)
+    {
+        create_candidate_t *candidate = &candidates[i];
 
-        return return_code != CREATE_RET_SUCCESS;
+        if (!pthread_equal(candidate->thread, pthread_self()))
+            pthread_join(candidate->thread, NULL);
+
+        int ok = candidate->return_code == CREATE_RET_SUCCESS && candidate->c.output.status == FILEMAP_OK;
+
+        if (ok && c->flags->verify)
+            ok = create_candidate_verify(candidate);
+
+        if (!ok)
+        {
+            gible_info("%s skipped: %s", candidate->format->name, candidate->error[0] ? candidate->error : "Creation failed.");
+            continue;
+        }
+
+        gible_info("%s: %lu bytes.", candidate->format->name, candidate->c.output.size);
+
+        if (!best || candidate->c.output.size < best->c.output.size)
+            best = candidate;
     }
 
-    filemap_close(&c.patched);
-    filemap_close(&c.base);
-    gible_error("Unsupported Patch Type.");
-    return 1;
+    int failed = 1;
+
+    char *path = best && !named ? malloc(strlen(ofn) + strlen(best->format->ext) + 2) : NULL;
+    int same = 0;
+
+    if (path)
+    {
+        sprintf(path, "%s.%s", ofn, best->format->ext);
+        same = are_filenames_same(c->patched.fn, c->base.fn, path);
+    }
+
+    if (!best)
+    {
+        const char *error = named ? patch_format_create_error(c, ofn) : NULL;
+        gible_error(error ? error : "No format could create the patch.");
+    }
+    else if (!named && !path)
+    {
+        gible_error("Not enough memory for the output filename.");
+    }
+    else if (same)
+    {
+        gible_error(same_filename_errors[same - 1]);
+    }
+    else
+    {
+        c->output = filemap_new(path ? path : ofn, 0, c->flags->use_buffer ? filemap_buffer_api : filemap_mmap_api);
+
+        if (filemap_create(&c->output, best->c.output.size))
+        {
+            memcpy(c->output.handle, best->c.output.handle, best->c.output.size);
+            gible_msg("%s successfully created as %s.", best->format->name, path ? path : ofn);
+            failed = 0;
+        }
+        else
+        {
+            gible_error(general_errors[CREATE_RET_INVALID_OUTPUT]);
+        }
+
+        filemap_close(&c->output);
+    }
+
+    free(path);
+
+    for (int i = 0; i < count; ++i)
+        filemap_close(&candidates[i].c.output);
+
+    return failed;
 }
@@ -0,0 +1,73 @@
+#include "actions/index.h"
+#include "helpers/argc.h"
+#include "helpers/library.h"
+#include "helpers/log.h"
+#include "helpers/strings.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *gible_index_usage[] = {
+    "index <dir> [<dir>...] [-I <library>]",
+    NULL,
+};
+
+int gible_index(const char *execname, int argc, char *argv[])
+{
+    const char *library = NULL;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_STRING('I', "library", &library, 0, "Library to update (default $GIBLE_LIBRARY or ~/.gible-library).", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_index_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 1)
+        return (argc_parser_print_usage(&parser), 1);
+
+#if defined(_WIN32)
+    return (gible_error("index is not supported on Windows."), 1);
+#else
+    if (!library)
+        library = library_default_path();
+
+    // Stored paths are absolute, so lookups work from anywhere.
+    char **dirs = calloc(parser.pcount, sizeof(char *));
+    int failed = !dirs;
+
+    for (int i = 0; !failed && i < parser.pcount; ++i)
+    {
+        if (!(dirs[i] = realpath(parser.positional[i], NULL)))
+        {
+            gible_error("Directory %s does not exist.", parser.positional[i]);
+            failed = 1;
+        }
+    }
+
+    library_update_stats_t stats;
+
+    if (!failed && !library_update(library, dirs, parser.pcount, &stats))
+    {
+        gible_error("Cannot update the library %s.", library);
+        failed = 1;
+    }
+
+    if (!failed)
+        gible_msg("Indexed %lu files, %lu hashed and %lu gone since the last run. %lu entries in %s.", stats.files,
+            stats.hashed, stats.removed, stats.total, library);
+
+    for (int i = 0; dirs && i < parser.pcount; ++i)
+        free(dirs[i]);
+
+    free(dirs);
+    return failed;
+#endif
+}
@@ -0,0 +1,6 @@
+#ifndef INDEX_H
+#define INDEX_H
+
+int gible_index(const char *execname, int argc, char *argv[]);
+
+#endif // INDEX_H
@@ -1,14 +1,21 @@
 #include "actions/patch.h"
 #include "helpers/argc.h"
+#include "helpers/cache.h"
+#include "helpers/crc32.h"
+#include "helpers/digest.h"
 #include "helpers/format.h"
+#include "helpers/library.h"
 #include "helpers/strings.h"
+#include "helpers/trace.h"
 #include "helpers/utils.h"
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 static const char *gible_patch_usage[] = {
-    "patch <patch> <input> <output> [-tyui] [-fgjk] [-b] [-v]",
+    "patch <patch> [<patch>...] <input> <output> [-tyui] [-fgjk] [-b] [-sSp] [-PJ] [-T <trace>] [-U <undo>] [-C <cache> [-L <limit>] [-H]] [-D <hashes>] [-X <dat>]",
+    "patch -A <patch> [<patch>...] <output> [-I <library>] [...]",
     NULL,
 };
 
@@ -19,13 +26,35 @@ static const char *general_errors[] = {
     [APPLY_RET_INVALID_OUTPUT] = "Cannot open the given output file.",
 };
 
-static int patch(const char *pfn, const char *ifn, const char *ofn, const apply_flags_t *const flags);
+static int patch(char *const *pfns, int pcount, const char *ifn, const char *ofn, const apply_flags_t *const flags);
+static int patch_chain(char *const *pfns, int pcount, const char *ifn, const char *ofn, const apply_flags_t *const flags,
+    stats_t *stats, progress_t *progress);
+
+// What the chain picks up on the way for the undo patch.
+typedef struct patch_undo
+{
+    diff_runs_t touched; // Output ranges any stage wrote
+    unsigned long shortest; // Of the input and every output, bytes past it may differ unwritten
+    unsigned int crc[2]; // Of the input and the final output, when a stage computed them
+    unsigned char has_crc[2];
+} patch_undo_t;
+
+static int patch_undo(const char *ifn, const char *ofn, const apply_flags_t *const flags, patch_undo_t *undo);
+static int patch_cache_key(char *const *pfns, int pcount, filemap_t *input, const apply_flags_t *const flags,
+    char *key);
+static void patch_cache_store(const apply_flags_t *const flags, const char *key, const char *ofn);
+static int patch_find_input(const char *pfn, const char *lfn, char *found, size_t size);
+static int patch_digest_report(const apply_flags_t *const flags, const char *ofn, digest_t *d);
 
 int gible_patch(const char *execname, int argc, char *argv[])
 {
     apply_flags_t flags;
     memset(&flags, 0, sizeof(apply_flags_t));
 
+    int auto_input = 0;
+    const char *library = NULL;
+    const char *hash = NULL;
+
     // clang-format off
 
     const argc_option_t options[] = {
@@ -39,6 +68,20 @@ int gible_patch(const char *execname, int argc, char *argv[])
         ARGC_OPT_FLAG('j', "strict-output-crc", &flags.strict_crc, FLAG_CRC_OUTPUT, "Aborts on output crc mismatch (Not really useful).", 0, NULL),
         ARGC_OPT_FLAG('k', "strict-crc", &flags.strict_crc, FLAG_CRC_ALL, "Ignores all crc checks.", 0, NULL),
         ARGC_OPT_BOOLEAN('b', "filebuffer", &flags.use_buffer, 0, "Uses a heap allocated buffer instead of memory mapping.", 0, NULL),
+        ARGC_OPT_FLAG('s', "stats", &flags.stats, STATS_OUTPUT_TEXT, "Prints per phase timings, action counts and resource usage to stderr.", 0, NULL),
+        ARGC_OPT_FLAG('S', "stats-json", &flags.stats, STATS_OUTPUT_JSON, "Same as --stats, as a JSON object.", 0, NULL),
+        ARGC_OPT_FLAG('P', "progress", &flags.progress, PROGRESS_OUTPUT_TEXT, "Shows a progress line on stderr for long runs.", 0, NULL),
+        ARGC_OPT_FLAG('J', "progress-json", &flags.progress, PROGRESS_OUTPUT_JSON, "Prints progress to stderr as one JSON object per line.", 0, NULL),
+        ARGC_OPT_STRING('T', "trace", &flags.trace, 0, "Writes a Chrome trace event timeline of the run to the given file.", 0, NULL),
+        ARGC_OPT_FLAG('p', "perf-counters", &flags.stats, STATS_PERF_COUNTERS, "Adds cycles, instructions and cache, branch and dTLB misses per phase to the stats.", 0, NULL),
+        ARGC_OPT_STRING('U', "undo", &flags.undo, 0, "Also writes a patch turning the output back into the input, its format picked by extension.", 0, NULL),
+        ARGC_OPT_STRING('C', "cache", &flags.cache, 0, "Reuses outputs of earlier runs with the same patches, input and crc flags from this directory.", 0, NULL),
+        ARGC_OPT_INTEGER('L', "cache-limit", &flags.cache_limit, 0, "Prunes the least recently used cache entries beyond this many MB.", 0, NULL),
+        ARGC_OPT_BOOLEAN('H', "cache-hardlink", &flags.cache_link, 0, "Hardlinks cache hits into place, the output is then read only.", 0, NULL),
+        ARGC_OPT_BOOLEAN('A', "auto-input", &auto_input, 0, "Finds the input in the library by the checksum the first patch records.", 0, NULL),
+        ARGC_OPT_STRING('I', "library", &library, 0, "Library built by gible index (default $GIBLE_LIBRARY or ~/.gible-library).", 0, NULL),
+        ARGC_OPT_STRING('D', "hash", &hash, 0, "Prints the output's crc32, md5, sha1 and sha256 (comma separated, or all) from the same pass as its crc.", 0, NULL),
+        ARGC_OPT_STRING('X', "hash-dat", &flags.hash_dat, 0, "Writes the output's digests to the given file as a DAT entry, all of them unless --hash narrows it.", 0, NULL),
         ARGC_OPT_END(),
     };
 
@@ -51,81 +94,476 @@ int gible_patch(const char *execname, int argc, char *argv[])
     if (!argc_parser_parse(&parser, argc, argv))
         return 1;
 
-    if (parser.pcount < 3)
+    if (parser.pcount < (auto_input ? 2 : 3))
         return (argc_parser_print_usage(&parser), 1);
 
-    char *pfn = parser.positional[0];
-    char *ifn = parser.positional[1];
-    char *ofn = parser.positional[2];
+    // Every positional before the input and output is a patch, applied in order.
+    int pcount = parser.pcount - (auto_input ? 1 : 2);
+    char **pfns = parser.positional;
+    char *ifn = parser.positional[pcount];
+    char *ofn = parser.positional[parser.pcount - 1];
+    char found[PATH_MAX];
+
+    if (auto_input && !patch_find_input(pfns[0], library ? library : library_default_path(), found, sizeof(found)))
+        return 1;
 
-    int ret;
-    if ((ret = are_filenames_same(pfn, ifn, ofn)))
-        return (gible_error(same_filename_errors[ret - 1]), 1);
+    if (auto_input)
+        ifn = found;
 
-    if (!file_exists(pfn))
-        return (gible_error("Patch file does not exist."), 1);
+    for (int i = 0; i < pcount; ++i)
+    {
+        int ret;
+        if ((ret = are_filenames_same(pfns[i], ifn, ofn)))
+            return (gible_error(same_filename_errors[ret - 1]), 1);
+
+        if (!file_exists(pfns[i]))
+            return (gible_error("Patch file %s does not exist.", pfns[i]), 1);
+    }
 
     if (!file_exists(ifn))
         return (gible_error("Input file does not exist."), 1);
 
-    return patch(pfn, ifn, ofn, &flags);
+    if (flags.undo && (strcmp(flags.undo, ifn) == 0 || strcmp(flags.undo, ofn) == 0))
+        return (gible_error("Undo patch and input or output filenames are the same."), 1);
+
+    if (flags.cache_limit < 0)
+        return (gible_error("The cache limit cannot be negative."), 1);
+
+    if (hash && !digest_parse(hash, &flags.hash))
+        return (gible_error("Unknown hash in %s, expected crc32, md5, sha1, sha256 or all.", hash), 1);
+
+    if (flags.hash_dat && !hash)
+        flags.hash = DIGEST_ALL;
+
+    if (flags.hash_dat && (strcmp(flags.hash_dat, ifn) == 0 || strcmp(flags.hash_dat, ofn) == 0))
+        return (gible_error("DAT and input or output filenames are the same."), 1);
+
+    return patch(pfns, pcount, ifn, ofn, &flags);
+}
+
+// Applies a single patch from c->patch onto c->input, creating c->output.
+int gible_patch_apply(patch_apply_context_t *c)
+{
+    const patch_format_t *format = patch_format_detect(c);
+
+    if (!format)
+        return (gible_error("Unsupported Patch Type."), 1);
+
+    stats_phase_begin(c->stats, STATS_PHASE_APPLY);
+    int return_code = format->apply_main(c);
+    stats_phase_end(c->stats);
+
+    switch (return_code)
+    {
+    case 0:
+        gible_msg("%s successfully patched.", format->name);
+        break;
+    case -1:
+        break;
+    default:
+        gible_error(general_errors[return_code]);
+        break;
+    }
+
+    return return_code != APPLY_RET_SUCCESS;
+}
+
+static int patch(char *const *pfns, int pcount, const char *ifn, const char *ofn, const apply_flags_t *const flags)
+{
+    stats_t stats;
+    stats_init(&stats);
+
+    if ((flags->stats & STATS_PERF_COUNTERS) && !stats_enable_perf(&stats))
+        gible_warn("Performance counters are unavailable: %s.", strerror(stats.perf.error));
+
+    if (flags->trace)
+        trace_start();
+
+    progress_t progress;
+    progress_reporter_t reporter;
+    memset(&progress, 0, sizeof(progress_t));
+
+    if (flags->progress)
+        progress_reporter_start(&reporter, &progress, flags->progress);
+
+    int failed = patch_chain(pfns, pcount, ifn, ofn, flags, flags->stats || flags->trace ? &stats : NULL,
+        flags->progress ? &progress : NULL);
+
+    if (flags->progress)
+        progress_reporter_stop(&reporter);
+
+    if (flags->trace && !trace_stop(flags->trace))
+        gible_warn("Cannot write the trace to %s.", flags->trace);
+
+    if (flags->stats)
+    {
+        stats_finish(&stats);
+        stats_print(&stats, flags->stats);
+    }
+
+    return failed;
 }
 
-static int patch(const char *pfn, const char *ifn, const char *ofn, const apply_flags_t *const flags)
+// Chains the patches through in-memory outputs, only the last stage is
+// written to ofn. Each stage closes its input, so at most two intermediate
+// buffers are alive at once.
+static int patch_chain(char *const *pfns, int pcount, const char *ifn, const char *ofn, const apply_flags_t *const flags,
+    stats_t *stats, progress_t *progress)
 {
     patch_apply_context_t c;
 
     const filemap_api_t *fmap_api = flags->use_buffer ? filemap_buffer_api : filemap_mmap_api;
 
-    c.flags = flags;
+    patch_undo_t undo;
+    memset(&undo, 0, sizeof(patch_undo_t));
 
-    c.patch = filemap_new(pfn, 1, fmap_api);
-    c.input = filemap_new(ifn, 1, fmap_api);
-    c.output = filemap_new(ofn, 0, fmap_api);
+    digest_t digest;
+    digest_init(&digest, flags->hash);
 
-    filemap_open(&c.patch);
-    filemap_open(&c.input);
+    c.flags = flags;
+    c.stats = stats;
+    c.progress = progress;
+    c.touched = flags->undo ? &undo.touched : NULL;
+    c.digest = NULL;
 
-    if (c.patch.status != FILEMAP_OK)
-        return (gible_error(general_errors[APPLY_RET_INVALID_PATCH]), 1);
+    // A compressed input keeps inflating while the patch is read and decoded.
+    stats_phase_begin(stats, STATS_PHASE_OPEN);
+    c.input = filemap_new(ifn, 1, fmap_api);
+    filemap_open_async(&c.input);
+    stats_phase_end(stats);
 
     if (c.input.status != FILEMAP_OK)
         return (gible_error(general_errors[APPLY_RET_INVALID_INPUT]), 1);
 
-    for (const patch_format_t *const *format = patch_formats; *format; format++)
+    undo.shortest = c.input.size;
+
+    char key[CACHE_KEY_MAX];
+    stats_phase_begin(stats, STATS_PHASE_CRC);
+    int keyed = flags->cache && patch_cache_key(pfns, pcount, &c.input, flags, key);
+    stats_phase_end(stats);
+
+    if (keyed && cache_fetch(flags->cache, key, ofn, flags->cache_link))
     {
-        const char *header = (*format)->header;
+        gible_msg("Output restored from the cache.");
 
-        if (strncmp((char *)c.patch.handle, header, strlen(header)) != 0)
-            continue;
+        undo.crc[0] = c.input.crc, undo.has_crc[0] = c.input.has_crc;
+        filemap_close(&c.input);
 
-        if ((*format)->apply_check && !(*format)->apply_check(&c))
-            continue;
+        if (flags->hash && patch_digest_report(flags, ofn, &digest))
+            return 1;
+
+        // Nothing was decoded, the undo patch has to diff everything.
+        undo.touched.failed = 1;
+        return flags->undo ? patch_undo(ifn, ofn, flags, &undo) : 0;
+    }
+
+    for (int i = 0; i < pcount; ++i)
+    {
+        int last = i == pcount - 1;
+
+        c.patch = filemap_new(pfns[i], 1, fmap_api);
+        c.output = last ? filemap_new(ofn, 0, fmap_api) : filemap_new(NULL, 0, filemap_memory_api);
+
+        stats_phase_begin(stats, STATS_PHASE_OPEN);
+        filemap_open(&c.patch);
+        stats_phase_end(stats);
+
+        if (c.patch.status != FILEMAP_OK)
+        {
+            filemap_close(&c.input);
+            diff_runs_close(&undo.touched);
+            return (gible_error(general_errors[APPLY_RET_INVALID_PATCH]), 1);
+        }
+
+        if (pcount > 1)
+            gible_info("Applying %s (%d/%d).", pfns[i], i + 1, pcount);
+
+        if (progress)
+            progress->stage = i + 1;
+
+        // Only the final output is reported, the format fills the digests in
+        // while it checks the output crc.
+        c.digest = last && flags->hash ? &digest : NULL;
 
-        int return_code = (*format)->apply_main(&c);
+        double traced = trace_begin();
+        int failed = gible_patch_apply(&c);
 
+        if (i == 0)
+            undo.crc[0] = c.input.crc, undo.has_crc[0] = c.input.has_crc;
+
+        if (last)
+            undo.crc[1] = c.output.crc, undo.has_crc[1] = c.output.has_crc;
+
+        if (!failed && c.output.size < undo.shortest)
+            undo.shortest = c.output.size;
+
+        // Formats without an output crc, or told to skip it, left them out.
+        if (!failed && last && flags->hash && !digest.done)
+            digest_buffer(&digest, c.output.handle, c.output.size);
+
+        stats_phase_begin(stats, STATS_PHASE_CLOSE);
         filemap_close(&c.patch);
         filemap_close(&c.input);
-        filemap_close(&c.output);
 
-        switch (return_code)
+        if (failed || last)
+            filemap_close(&c.output);
+
+        stats_phase_end(stats);
+        trace_end("stage", pfns[i], traced);
+
+        if (!failed && last && keyed)
+            patch_cache_store(flags, key, ofn);
+
+        if (!failed && last && flags->hash)
+            failed = patch_digest_report(flags, ofn, &digest);
+
+        if (!failed && last && flags->undo)
+            failed = patch_undo(ifn, ofn, flags, &undo);
+
+        if (failed || last)
+        {
+            diff_runs_close(&undo.touched);
+            return failed;
+        }
+
+        c.input = c.output;
+        c.input.readonly = 1;
+    }
+
+    return 0;
+}
+
+// Diffs the original input against the patched output, but only where the
+// ops wrote or the size changed, everything else is known to be equal.
+static int patch_undo(const char *ifn, const char *ofn, const apply_flags_t *const flags, patch_undo_t *undo)
+{
+    const filemap_api_t *fmap_api = flags->use_buffer ? filemap_buffer_api : filemap_mmap_api;
+
+    create_flags_t create_flags;
+    memset(&create_flags, 0, sizeof(create_flags_t));
+    create_flags.use_buffer = flags->use_buffer;
+
+    patch_create_context_t c;
+    memset(&c, 0, sizeof(patch_create_context_t));
+    c.flags = &create_flags;
+    c.patched = filemap_new(ifn, 1, fmap_api);
+    c.base = filemap_new(ofn, 1, fmap_api);
+    c.output = filemap_new(flags->undo, 0, fmap_api);
+
+    filemap_open(&c.patched);
+    filemap_open(&c.base);
+
+    if (c.patched.status != FILEMAP_OK || c.base.status != FILEMAP_OK)
+    {
+        filemap_close(&c.patched);
+        filemap_close(&c.base);
+        return (gible_error("Cannot reopen the input and output for the undo patch."), 1);
+    }
+
+    c.patched.crc = undo->crc[0], c.patched.has_crc = undo->has_crc[0];
+    c.base.crc = undo->crc[1], c.base.has_crc = undo->has_crc[1];
+
+    // A failed allocation lost some ranges, diff everything instead.
+    if (!undo->touched.failed)
+    {
+        diff_runs_add(&undo->touched, undo->shortest, c.patched.size);
+        diff_runs_normalise(&undo->touched);
+        c.candidates = undo->touched.failed ? NULL : &undo->touched;
+    }
+
+    // IPS refuses when the output grew, it has no way to cut it back.
+    const patch_format_t *format = patch_format_for_create(&c, flags->undo);
+    const char *error = format ? NULL : patch_format_create_error(&c, flags->undo);
+    int return_code = format ? format->create_main(&c) : CREATE_RET_FAILURE;
+
+    filemap_close(&c.patched);
+    filemap_close(&c.base);
+    filemap_close(&c.output);
+
+    if (!format)
+        gible_error(error ? error : "Unsupported undo patch type.");
+    else if (return_code == CREATE_RET_SUCCESS)
+        gible_msg("%s undo patch written to %s.", format->name, flags->undo);
+    else if (return_code == CREATE_RET_INVALID_OUTPUT)
+        gible_error("Cannot open the given undo patch file.");
+
+    return return_code != CREATE_RET_SUCCESS;
+}
+
+// Keys the output by every patch of the chain, folded into one checksum,
+// and the input. Patches are only open long enough to be hashed.
+static int patch_cache_key(char *const *pfns, int pcount, filemap_t *input, const apply_flags_t *const flags,
+    char *key)
+{
+    const filemap_api_t *fmap_api = flags->use_buffer ? filemap_buffer_api : filemap_mmap_api;
+    const patch_format_t *format = NULL;
+    unsigned int crc = 0;
+    unsigned long long size = 0;
+
+    for (int i = 0; i < pcount; ++i)
+    {
+        patch_apply_context_t c;
+        memset(&c, 0, sizeof(patch_apply_context_t));
+        c.patch = filemap_new(pfns[i], 1, fmap_api);
+
+        if (!filemap_open(&c.patch))
+            return 0;
+
+        if (i == 0)
+            format = patch_format_detect(&c);
+
+        unsigned char sum[4];
+        write32le(sum, filemap_crc32(&c.patch, c.patch.size));
+        crc = crc32(sum, 4, crc);
+        size += c.patch.size;
+
+        filemap_close(&c.patch);
+    }
+
+    if (!format)
+        return 0;
+
+    cache_key(key, format->ext, crc, size, filemap_crc32(input, input->size), input->size,
+        flags->ignore_crc << 8 | flags->strict_crc);
+    return 1;
+}
+
+static void patch_cache_store(const apply_flags_t *const flags, const char *key, const char *ofn)
+{
+    if (!cache_store(flags->cache, key, ofn))
+        gible_warn("Cannot add the output to the cache in %s.", flags->cache);
+    else if (flags->cache_limit)
+        cache_prune(flags->cache, (unsigned long long)flags->cache_limit << 20, NULL);
+}
+
+// Looks the input up in the library by the checksum the patch records.
+static int patch_find_input(const char *pfn, const char *lfn, char *found, size_t size)
+{
+    patch_apply_context_t c;
+    memset(&c, 0, sizeof(patch_apply_context_t));
+    c.patch = filemap_new(pfn, 1, filemap_mmap_api);
+    filemap_open(&c.patch);
+
+    if (c.patch.status != FILEMAP_OK)
+        return (gible_error("Cannot open the patch file %s.", pfn), 0);
+
+    const patch_format_t *format = patch_format_detect(&c);
+    unsigned int crc;
+    unsigned long input_size;
+    int recorded = format && format->apply_input && format->apply_input(&c.patch, &crc, &input_size);
+
+    filemap_close(&c.patch);
+
+    if (!recorded)
+        return (gible_error("%s does not record its input, pass it by hand.", pfn), 0);
+
+    library_t l;
+    if (!library_open(&l, lfn))
+        return (gible_error("Cannot open the library %s, build it with gible index.", lfn), 0);
+
+    const char *path = library_find(&l, crc, input_size);
+
+    if (path)
+        snprintf(found, size, "%s", path);
+
+    library_close(&l);
+
+    if (!path)
+        return (gible_error("No file with CRC32 %08X and size %lu in the library.", crc, input_size), 0);
+
+    gible_info("Found the input at %s.", found);
+    return 1;
+}
+
+// -------------------------------------------------
+// Digests
+// -------------------------------------------------
+
+static void patch_dat_escape(FILE *fp, const char *text)
+{
+    for (; *text; ++text)
+    {
+        switch (*text)
         {
-        case 0:
-            gible_msg("%s successfully patched.", (*format)->name);
+        case '&':
+            fputs("&amp;", fp);
+            break;
+        case '<':
+            fputs("&lt;", fp);
+            break;
+        case '>':
+            fputs("&gt;", fp);
             break;
-        case -1:
+        case '"':
+            fputs("&quot;", fp);
             break;
         default:
-            gible_error(general_errors[return_code]);
+            fputc(*text, fp);
             break;
         }
+    }
+}
+
+// Writes a Logiqx style DAT with the output as its only game and rom,
+// named after the output file without its directories.
+static int patch_dat_write(const char *fn, const char *ofn, const digest_t *d)
+{
+    static const char *attributes[DIGEST_COUNT] = { "crc", "md5", "sha1", "sha256" };
+    const char *name = strrchr(ofn, '/') ? strrchr(ofn, '/') + 1 : ofn;
+    char hex[DIGEST_HEX_MAX];
+    FILE *fp = fopen(fn, "w");
+
+    if (!fp)
+        return 0;
 
-        return return_code != APPLY_RET_SUCCESS;
+    fputs("<?xml version=\"1.0\"?>\n<datafile>\n\t<game name=\"", fp);
+    patch_dat_escape(fp, name);
+    fputs("\">\n\t\t<rom name=\"", fp);
+    patch_dat_escape(fp, name);
+    fprintf(fp, "\" size=\"%llu\"", d->size);
+
+    for (int i = 0; i < DIGEST_COUNT; ++i)
+    {
+        if (!(d->types & DIGEST_FLAG(i)))
+            continue;
+
+        digest_hex(d, i, hex);
+        fprintf(fp, " %s=\"%s\"", attributes[i], hex);
     }
 
-    filemap_close(&c.patch);
-    filemap_close(&c.input);
+    fputs("/>\n\t</game>\n</datafile>\n", fp);
+    return fclose(fp) == 0;
+}
 
-    gible_error("Unsupported Patch Type.");
-    return 1;
+// Prints the digests asked for, digesting ofn when nothing filled them in,
+// and writes the DAT when there is one.
+static int patch_digest_report(const apply_flags_t *const flags, const char *ofn, digest_t *d)
+{
+    if (!d->done)
+    {
+        filemap_t output = filemap_new(ofn, 1, flags->use_buffer ? filemap_buffer_api : filemap_mmap_api);
+        filemap_open(&output);
+
+        if (output.status != FILEMAP_OK)
+            return (gible_error("Cannot reopen the output to hash it."), 1);
+
+        digest_buffer(d, output.handle, output.size);
+        filemap_close(&output);
+    }
+
+    char hex[DIGEST_HEX_MAX];
+
+    for (int i = 0; i < DIGEST_COUNT; ++i)
+    {
+        if (!(flags->hash & DIGEST_FLAG(i)))
+            continue;
+
+        digest_hex(d, i, hex);
+        gible_msg("%-6s %s", digest_name(i), hex);
+    }
+
+    if (flags->hash_dat && !patch_dat_write(flags->hash_dat, ofn, d))
+        return (gible_error("Cannot write the DAT to %s.", flags->hash_dat), 1);
+
+    return 0;
 }
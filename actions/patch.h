@@ -1,6 +1,9 @@
 #ifndef PATCH_H
 #define PATCH_H
 
+#include "helpers/format.h"
+
 int gible_patch(const char *execname, int argc, char *argv[]);
+int gible_patch_apply(patch_apply_context_t *c);
 
 #endif // PATCH_H
\ No newline at end of file
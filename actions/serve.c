@@ -0,0 +1,836 @@
+#include "actions/serve.h"
+#include "actions/patch.h"
+#include "helpers/argc.h"
+#include "helpers/bytearray.h"
+#include "helpers/filemap.h"
+#include "helpers/format.h"
+#include "helpers/strings.h"
+#include "helpers/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *gible_serve_usage[] = {
+    "serve <socket> [-w workers] [-c cached bases]",
+    NULL,
+};
+
+static const char *gible_client_usage[] = {
+    "client <socket> <patch> <input> <output> [-tyui] [-fgjk]",
+    NULL,
+};
+
+#if defined(_WIN32)
+
+int gible_serve(const char *execname, int argc, char *argv[])
+{
+    (void)execname, (void)argc, (void)argv;
+    return (gible_error("serve is not supported on Windows."), 1);
+}
+
+int gible_client(const char *execname, int argc, char *argv[])
+{
+    (void)execname, (void)argc, (void)argv;
+    return (gible_error("client is not supported on Windows."), 1);
+}
+
+#else
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#define SERVE_QUEUE_SIZE 64
+// Open connections past which new ones wait in the listen backlog.
+#define SERVE_MAX_CONNECTIONS 1024
+// Seconds a started request or its reply may stall before the connection drops.
+#define SERVE_TIMEOUT 5
+#define SERVE_MAX_PATH 4096
+
+typedef struct serve_base
+{
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    int64_t mtime, ctime; // Nanoseconds where the platform has them
+    filemap_t map;
+    unsigned long last_used;
+    int refs;
+} serve_base_t;
+
+/* Idle connections are polled by the main thread, which hands one to a
+ * worker only once a request starts to arrive. The worker serves that one
+ * request and gives the connection back, so clients holding a connection
+ * open between requests never tie up a worker. */
+typedef struct serve
+{
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+
+    int queue[SERVE_MAX_CONNECTIONS]; // Connections with a request waiting
+    int queue_head, queue_count;
+    int returned[SERVE_MAX_CONNECTIONS]; // Served, back to polling
+    int returned_count;
+    int connections; // Open, wherever they are
+    int wake[2]; // Pipe workers poke once they return or close a connection
+    int stopping; // Workers exit instead of taking the next connection
+
+    serve_base_t **bases;
+    int base_count, base_limit;
+    unsigned long tick;
+} serve_t;
+
+static volatile sig_atomic_t serve_stop = 0;
+
+// -------------------------------------------------
+// Socket I/O
+// -------------------------------------------------
+
+// Returns 1 once size bytes are read, 0 on a clean EOF, -1 on error.
+static int read_full(int fd, void *data, unsigned long size)
+{
+    unsigned char *p = data;
+    unsigned long done = 0;
+
+    while (done < size)
+    {
+        ssize_t n = read(fd, p + done, size - done);
+
+        if (n == 0)
+            return done ? -1 : 0;
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+
+        done += n;
+    }
+
+    return 1;
+}
+
+static int write_full(int fd, const void *data, unsigned long size)
+{
+    const unsigned char *p = data;
+
+    while (size)
+    {
+        ssize_t n = write(fd, p, size);
+
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return 0;
+        }
+
+        p += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+static int socket_address(struct sockaddr_un *addr, const char *path)
+{
+    memset(addr, 0, sizeof(struct sockaddr_un));
+    addr->sun_family = AF_UNIX;
+
+    if (strlen(path) >= sizeof(addr->sun_path))
+        return 0;
+
+    strcpy(addr->sun_path, path);
+    return 1;
+}
+
+// -------------------------------------------------
+// Base File Cache
+// -------------------------------------------------
+
+static void serve_base_close(serve_base_t *b)
+{
+    filemap_close(&b->map);
+    free(b->path);
+}
+
+static int64_t serve_mtime(const struct stat *st)
+{
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#else
+    return (int64_t)st->st_mtime * 1000000000;
+#endif
+}
+
+// Changes with any write or metadata update, even one that restores the mtime.
+static int64_t serve_ctime(const struct stat *st)
+{
+#if defined(__APPLE__)
+    return (int64_t)st->st_ctimespec.tv_sec * 1000000000 + st->st_ctimespec.tv_nsec;
+#elif defined(__linux__)
+    return (int64_t)st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+#else
+    return (int64_t)st->st_ctime * 1000000000;
+#endif
+}
+
+static int serve_base_matches(const serve_base_t *b, const char *path, const struct stat *st)
+{
+    return strcmp(b->path, path) == 0 && b->dev == st->st_dev && b->ino == st->st_ino && b->size == st->st_size &&
+           b->mtime == serve_mtime(st) && b->ctime == serve_ctime(st);
+}
+
+// Drops the least recently used idle entry, if any.
+static void serve_base_evict(serve_t *s)
+{
+    int victim = -1;
+
+    for (int i = 0; i < s->base_count; ++i)
+    {
+        if (s->bases[i]->refs)
+            continue;
+
+        if (victim < 0 || s->bases[i]->last_used < s->bases[victim]->last_used)
+            victim = i;
+    }
+
+    if (victim < 0)
+        return;
+
+    serve_base_close(s->bases[victim]);
+    free(s->bases[victim]);
+    s->bases[victim] = s->bases[--s->base_count];
+}
+
+// Returns a referenced cache entry, mapping the file and hashing it on a miss.
+static serve_base_t *serve_base_acquire(serve_t *s, const char *path)
+{
+    struct stat st;
+    if (stat(path, &st) != 0)
+        return NULL;
+
+    pthread_mutex_lock(&s->lock);
+
+    for (int i = 0; i < s->base_count; ++i)
+    {
+        serve_base_t *b = s->bases[i];
+
+        if (serve_base_matches(b, path, &st))
+        {
+            b->refs++;
+            b->last_used = s->tick++;
+            pthread_mutex_unlock(&s->lock);
+            return b;
+        }
+    }
+
+    pthread_mutex_unlock(&s->lock);
+
+    // Map and hash outside of the lock, other requests keep going meanwhile.
+    serve_base_t fresh;
+    fresh.path = strdup(path);
+    fresh.dev = st.st_dev;
+    fresh.ino = st.st_ino;
+    fresh.size = st.st_size;
+    fresh.mtime = serve_mtime(&st);
+    fresh.ctime = serve_ctime(&st);
+    fresh.refs = 1;
+    fresh.map = filemap_new(fresh.path, 1, filemap_mmap_api);
+
+    if (!fresh.path || !filemap_open(&fresh.map))
+    {
+        free(fresh.path);
+        return NULL;
+    }
+
+    filemap_crc32(&fresh.map, fresh.map.size);
+
+    pthread_mutex_lock(&s->lock);
+
+    while (s->base_count >= s->base_limit)
+    {
+        int count = s->base_count;
+        serve_base_evict(s);
+
+        if (count == s->base_count)
+            break;
+    }
+
+    serve_base_t *b = malloc(sizeof(serve_base_t));
+    *b = fresh;
+
+    if (s->base_count < s->base_limit)
+    {
+        s->bases[s->base_count++] = b;
+        b->last_used = s->tick++;
+    }
+    else
+    {
+        // Every slot is busy, serve this one uncached.
+        b->refs = -1;
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return b;
+}
+
+static void serve_base_release(serve_t *s, serve_base_t *b)
+{
+    if (b->refs < 0)
+    {
+        serve_base_close(b);
+        free(b);
+        return;
+    }
+
+    pthread_mutex_lock(&s->lock);
+    b->refs--;
+    pthread_mutex_unlock(&s->lock);
+}
+
+// -------------------------------------------------
+// Reusable Output Buffer
+// -------------------------------------------------
+
+// Each worker patches into the same heap buffer, which only ever grows.
+static __thread bytearray_t serve_scratch;
+
+static int serve_output_create(filemap_t *f)
+{
+    unsigned long size = f->size ? f->size : 1;
+
+    if (serve_scratch.capacity < size && !bytearray_resize(&serve_scratch, size))
+    {
+        f->status = FILEMAP_ERROR;
+        return 0;
+    }
+
+    f->handle = serve_scratch.data;
+    f->status = FILEMAP_OK;
+    return 1;
+}
+
+static int serve_output_open(filemap_t *f)
+{
+    f->status = FILEMAP_ERROR;
+    return 0;
+}
+
+static void serve_output_close(filemap_t *f)
+{
+    f->handle = NULL;
+    f->status = FILEMAP_NOT_OPENED;
+}
+
+static const filemap_api_t serve_output_api = {
+    .create = serve_output_create,
+    .open = serve_output_open,
+    .close = serve_output_close
+};
+
+// -------------------------------------------------
+// Request Handling
+// -------------------------------------------------
+
+static void serve_log_handler(void *user, int level, const char *msg)
+{
+    static const char *level_strings[] = { "", "[INFO] ", "[WARN] ", "[ERROR] " };
+
+    bytearray_t *messages = user;
+    bytearray_push_string(messages, level_strings[level]);
+    bytearray_push_string(messages, msg);
+    bytearray_push(messages, '\n');
+}
+
+static int serve_reply(int fd, unsigned int status, bytearray_t *messages, const filemap_t *output)
+{
+    unsigned char header[SERVE_REPLY_HEADER_SIZE];
+    unsigned long long output_size = output ? output->size : 0;
+
+    memcpy(header, SERVE_REPLY_MAGIC, 4);
+    write32le(header + 4, status);
+    write32le(header + 8, messages->size);
+    write32le(header + 12, output_size);
+    write32le(header + 16, output_size >> 32);
+
+    return write_full(fd, header, sizeof(header)) && write_full(fd, messages->data, messages->size) &&
+           write_full(fd, output ? output->handle : NULL, output_size);
+}
+
+// Serves the next request on a connection, 0 once it should be closed.
+static int serve_request(serve_t *s, int fd, bytearray_t *patch, bytearray_t *messages)
+{
+    unsigned char header[SERVE_REQUEST_HEADER_SIZE];
+    char path[SERVE_MAX_PATH + 1];
+
+    if (read_full(fd, header, sizeof(header)) <= 0 || memcmp(header, SERVE_REQUEST_MAGIC, 4) != 0)
+        return 0;
+
+    apply_flags_t flags;
+    memset(&flags, 0, sizeof(apply_flags_t));
+    flags.strict_crc = header[4];
+    flags.ignore_crc = header[5];
+
+    unsigned int path_size = read32le(header + 8);
+    unsigned int patch_size = read32le(header + 12);
+
+    if (path_size > SERVE_MAX_PATH || read_full(fd, path, path_size) <= 0)
+        return 0;
+
+    path[path_size] = '\0';
+
+    if (patch_size > patch->capacity && !bytearray_resize(patch, patch_size))
+        return 0;
+
+    if (patch_size && read_full(fd, patch->data, patch_size) <= 0)
+        return 0;
+
+    messages->size = 0;
+
+    serve_base_t *base = serve_base_acquire(s, path);
+
+    if (!base)
+    {
+        gible_error("Cannot open the given input file.");
+        return serve_reply(fd, 1, messages, NULL);
+    }
+
+    patch_apply_context_t c;
+    c.flags = &flags;
+    c.stats = NULL;
+    c.progress = NULL;
+    c.touched = NULL;
+    c.digest = NULL;
+    c.patch = filemap_new_memory(patch->data, patch_size);
+    c.input = filemap_new_memory(base->map.handle, base->map.size);
+    c.output = filemap_new(NULL, 0, &serve_output_api);
+
+    c.input.crc = base->map.crc;
+    c.input.has_crc = base->map.has_crc;
+
+    filemap_open(&c.patch);
+    filemap_open(&c.input);
+
+    int failed = gible_patch_apply(&c);
+    int sent = serve_reply(fd, failed, messages, failed ? NULL : &c.output);
+
+    filemap_close(&c.output);
+    serve_base_release(s, base);
+
+    return sent;
+}
+
+static void *serve_worker(void *arg)
+{
+    serve_t *s = arg;
+    bytearray_t patch = bytearray_new();
+    bytearray_t messages = bytearray_new();
+
+    serve_scratch = bytearray_new();
+    gible_log_set_handler(serve_log_handler, &messages);
+
+    while (1)
+    {
+        pthread_mutex_lock(&s->lock);
+
+        while (!s->queue_count && !s->stopping)
+            pthread_cond_wait(&s->ready, &s->lock);
+
+        if (s->stopping)
+        {
+            pthread_mutex_unlock(&s->lock);
+            break;
+        }
+
+        int fd = s->queue[s->queue_head];
+        s->queue_head = (s->queue_head + 1) % SERVE_MAX_CONNECTIONS;
+        s->queue_count--;
+
+        pthread_mutex_unlock(&s->lock);
+
+        int keep = serve_request(s, fd, &patch, &messages);
+
+        pthread_mutex_lock(&s->lock);
+
+        if (keep)
+        {
+            s->returned[s->returned_count++] = fd;
+        }
+        else
+        {
+            close(fd);
+            s->connections--;
+        }
+
+        pthread_mutex_unlock(&s->lock);
+
+        // A full pipe already has the main thread on its way.
+        if (write(s->wake[1], "", 1) < 0 && errno != EAGAIN)
+            gible_warn("Cannot wake the listening thread.");
+    }
+
+    gible_log_set_handler(NULL, NULL);
+    bytearray_close(&patch);
+    bytearray_close(&messages);
+    bytearray_close(&serve_scratch);
+    return NULL;
+}
+
+static void serve_signal_handler(int sig)
+{
+    (void)sig;
+    serve_stop = 1;
+}
+
+// Closes every connection left, wherever it waits, then the cached bases.
+// Workers must be gone by then.
+static void serve_close(serve_t *s, int listen_fd, const char *socket_path, const int *idle, int idle_count)
+{
+    for (int i = 0; i < idle_count; ++i)
+        close(idle[i]);
+
+    for (int i = 0; i < s->queue_count; ++i)
+        close(s->queue[(s->queue_head + i) % SERVE_MAX_CONNECTIONS]);
+
+    for (int i = 0; i < s->returned_count; ++i)
+        close(s->returned[i]);
+
+    for (int i = 0; i < s->base_count; ++i)
+    {
+        serve_base_close(s->bases[i]);
+        free(s->bases[i]);
+    }
+
+    free(s->bases);
+    close(s->wake[0]);
+    close(s->wake[1]);
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->ready);
+
+    close(listen_fd);
+    unlink(socket_path);
+}
+
+static int serve(const char *socket_path, int workers, int cached)
+{
+    struct sockaddr_un addr;
+    if (!socket_address(&addr, socket_path))
+        return (gible_error("Socket path is too long."), 1);
+
+    int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd < 0)
+        return (gible_error("Cannot create the socket."), 1);
+
+    unlink(socket_path);
+
+    if (bind(listen_fd, (struct sockaddr *)&addr, sizeof(addr)) != 0 || listen(listen_fd, SERVE_QUEUE_SIZE) != 0)
+    {
+        close(listen_fd);
+        return (gible_error("Cannot listen on %s.", socket_path), 1);
+    }
+
+    serve_t s;
+    memset(&s, 0, sizeof(serve_t));
+    pthread_mutex_init(&s.lock, NULL);
+    pthread_cond_init(&s.ready, NULL);
+    s.base_limit = cached;
+    s.bases = calloc(cached, sizeof(serve_base_t *));
+
+    if (pipe(s.wake) != 0)
+    {
+        free(s.bases);
+        close(listen_fd);
+        return (gible_error("Cannot start the workers."), 1);
+    }
+
+    fcntl(s.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(s.wake[1], F_SETFL, O_NONBLOCK);
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = serve_signal_handler;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    // Workers start with the stop signals blocked, so they always reach
+    // the main thread and interrupt its poll.
+    sigset_t stop_signals, previous;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &stop_signals, &previous);
+
+    pthread_t *threads = malloc(workers * sizeof(pthread_t));
+    int started = 0;
+
+    while (threads && started < workers && pthread_create(&threads[started], NULL, serve_worker, &s) == 0)
+        started++;
+
+    pthread_sigmask(SIG_SETMASK, &previous, NULL);
+
+    if (!started)
+    {
+        free(threads);
+        serve_close(&s, listen_fd, socket_path, NULL, 0);
+        return (gible_error("Cannot start the workers."), 1);
+    }
+
+    gible_msg("Listening on %s with %d workers.", socket_path, workers);
+
+    // Connections waiting for their next request, only ever touched here.
+    int idle[SERVE_MAX_CONNECTIONS];
+    int idle_count = 0;
+    struct pollfd fds[SERVE_MAX_CONNECTIONS + 2];
+
+    while (!serve_stop)
+    {
+        pthread_mutex_lock(&s.lock);
+        int accepting = s.connections < SERVE_MAX_CONNECTIONS;
+        pthread_mutex_unlock(&s.lock);
+
+        fds[0].fd = s.wake[0];
+        fds[0].events = POLLIN;
+        fds[1].fd = accepting ? listen_fd : -1;
+        fds[1].events = POLLIN;
+
+        for (int i = 0; i < idle_count; ++i)
+        {
+            fds[i + 2].fd = idle[i];
+            fds[i + 2].events = POLLIN;
+        }
+
+        if (poll(fds, idle_count + 2, -1) < 0)
+            continue;
+
+        // Hand connections with a request arriving, or hung up, to the workers.
+        int polled = idle_count;
+        idle_count = 0;
+        pthread_mutex_lock(&s.lock);
+
+        for (int i = 0; i < polled; ++i)
+        {
+            if (fds[i + 2].revents)
+            {
+                s.queue[(s.queue_head + s.queue_count++) % SERVE_MAX_CONNECTIONS] = fds[i + 2].fd;
+                pthread_cond_signal(&s.ready);
+            }
+            else
+            {
+                idle[idle_count++] = fds[i + 2].fd;
+            }
+        }
+
+        if (fds[0].revents)
+        {
+            char drain[64];
+            while (read(s.wake[0], drain, sizeof(drain)) > 0)
+                ;
+
+            memcpy(idle + idle_count, s.returned, s.returned_count * sizeof(int));
+            idle_count += s.returned_count;
+            s.returned_count = 0;
+        }
+
+        pthread_mutex_unlock(&s.lock);
+
+        if (!fds[1].revents)
+            continue;
+
+        int fd = accept(listen_fd, NULL, NULL);
+
+        if (fd < 0)
+            continue;
+
+        // Only bounds how long a started request may take, idle time is free.
+        struct timeval timeout = { SERVE_TIMEOUT, 0 };
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+        pthread_mutex_lock(&s.lock);
+        s.connections++;
+        pthread_mutex_unlock(&s.lock);
+
+        idle[idle_count++] = fd;
+    }
+
+    // Workers finish the request they are on, bounded by SERVE_TIMEOUT.
+    pthread_mutex_lock(&s.lock);
+    s.stopping = 1;
+    pthread_cond_broadcast(&s.ready);
+    pthread_mutex_unlock(&s.lock);
+
+    for (int i = 0; i < started; ++i)
+        pthread_join(threads[i], NULL);
+
+    free(threads);
+    serve_close(&s, listen_fd, socket_path, idle, idle_count);
+    return 0;
+}
+
+int gible_serve(const char *execname, int argc, char *argv[])
+{
+    int workers = 4;
+    int cached = 16;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_INTEGER('w', "workers", &workers, 0, "Number of worker threads (default 4).", 0, NULL),
+        ARGC_OPT_INTEGER('c', "cache", &cached, 0, "Number of base files kept mapped (default 16).", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_serve_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 1)
+        return (argc_parser_print_usage(&parser), 1);
+
+    if (workers < 1 || cached < 1)
+        return (gible_error("Worker and cache counts must be positive."), 1);
+
+    return serve(parser.positional[0], workers, cached);
+}
+
+// -------------------------------------------------
+// Client
+// -------------------------------------------------
+
+static int client(const char *socket_path, const char *pfn, const char *ifn, const char *ofn,
+    const apply_flags_t *const flags)
+{
+    char path[PATH_MAX];
+    if (!realpath(ifn, path))
+        return (gible_error("Input file does not exist."), 1);
+
+    filemap_t patch = filemap_new(pfn, 1, filemap_mmap_api);
+    if (!filemap_open(&patch))
+        return (gible_error("Cannot open the given patch file."), 1);
+
+    struct sockaddr_un addr;
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+
+    if (fd < 0 || !socket_address(&addr, socket_path) || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0)
+    {
+        filemap_close(&patch);
+        return (gible_error("Cannot connect to %s.", socket_path), 1);
+    }
+
+    unsigned char header[SERVE_REPLY_HEADER_SIZE];
+    memcpy(header, SERVE_REQUEST_MAGIC, 4);
+    header[4] = flags->strict_crc;
+    header[5] = flags->ignore_crc;
+    header[6] = header[7] = 0;
+    write32le(header + 8, strlen(path));
+    write32le(header + 12, patch.size);
+
+    int ok = write_full(fd, header, SERVE_REQUEST_HEADER_SIZE) && write_full(fd, path, strlen(path)) &&
+             write_full(fd, patch.handle, patch.size) && read_full(fd, header, SERVE_REPLY_HEADER_SIZE) > 0 &&
+             memcmp(header, SERVE_REPLY_MAGIC, 4) == 0;
+
+    filemap_close(&patch);
+
+    if (!ok)
+    {
+        close(fd);
+        return (gible_error("Malformed reply from the server."), 1);
+    }
+
+    unsigned int status = read32le(header + 4);
+    unsigned long message_size = read32le(header + 8);
+    unsigned long output_size = read32le(header + 12) | (unsigned long long)read32le(header + 16) << 32;
+
+    // A clean EOF reads 0 bytes, which is as malformed as an error here.
+    char *messages = malloc(message_size + 1);
+    int received = messages && (message_size == 0 || read_full(fd, messages, message_size) > 0);
+
+    if (received)
+        fwrite(messages, 1, message_size, stdout);
+
+    free(messages);
+
+    if (!received)
+    {
+        close(fd);
+        return (gible_error("Malformed reply from the server."), 1);
+    }
+
+    if (status == 0)
+    {
+        filemap_t output = filemap_new(ofn, 0, filemap_mmap_api);
+
+        if (!filemap_create(&output, output_size))
+            status = (gible_error("Cannot write the given output file."), 1);
+        else if (output_size && read_full(fd, output.handle, output_size) <= 0)
+            status = (gible_error("Malformed reply from the server."), 1);
+
+        filemap_close(&output);
+    }
+
+    close(fd);
+    return status != 0;
+}
+
+int gible_client(const char *execname, int argc, char *argv[])
+{
+    apply_flags_t flags;
+    memset(&flags, 0, sizeof(apply_flags_t));
+
+    // clang-format off
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_FLAG('t', "ignore-patch-crc", &flags.ignore_crc, FLAG_CRC_PATCH, "Ignores patch file crc.", 0, NULL),
+        ARGC_OPT_FLAG('y', "ignore-input-crc", &flags.ignore_crc, FLAG_CRC_INPUT, "Ignores input file crc.", 0, NULL),
+        ARGC_OPT_FLAG('u', "ignore-output-crc", &flags.ignore_crc, FLAG_CRC_OUTPUT, "Ignores output file crc.", 0, NULL),
+        ARGC_OPT_FLAG('i', "ignore-crc", &flags.ignore_crc, FLAG_CRC_ALL, "Ignores all crc checks.", 0, NULL),
+        ARGC_OPT_FLAG('f', "strict-patch-crc", &flags.strict_crc, FLAG_CRC_PATCH, "Aborts on patch crc mismatch.", 0, NULL),
+        ARGC_OPT_FLAG('g', "strict-input-crc", &flags.strict_crc, FLAG_CRC_INPUT, "Aborts on input crc mismatch.", 0, NULL),
+        ARGC_OPT_FLAG('j', "strict-output-crc", &flags.strict_crc, FLAG_CRC_OUTPUT, "Aborts on output crc mismatch (Not really useful).", 0, NULL),
+        ARGC_OPT_FLAG('k', "strict-crc", &flags.strict_crc, FLAG_CRC_ALL, "Ignores all crc checks.", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    // clang-format on
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_client_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 4)
+        return (argc_parser_print_usage(&parser), 1);
+
+    char *pfn = parser.positional[1];
+    char *ifn = parser.positional[2];
+    char *ofn = parser.positional[3];
+
+    int ret;
+    if ((ret = are_filenames_same(pfn, ifn, ofn)))
+        return (gible_error(same_filename_errors[ret - 1]), 1);
+
+    return client(parser.positional[0], pfn, ifn, ofn, &flags);
+}
+
+#endif
@@ -0,0 +1,33 @@
+#ifndef SERVE_H
+#define SERVE_H
+
+// Framed protocol spoken over the unix socket, all integers little endian.
+// A connection may carry any number of requests, each answered in order.
+// It may sit idle between requests, but once a request starts it has to
+// arrive in full, and its reply be read, without stalling for 5 seconds.
+//
+// Request:
+//   0  4  "GBRQ"
+//   4  1  strict crc flags (see apply_flags_t)
+//   5  1  ignore crc flags
+//   6  2  reserved, zero
+//   8  4  input path length
+//   12 4  patch length
+//   16    input path (absolute, not NUL terminated), then the patch bytes
+//
+// Reply:
+//   0  4  "GBRP"
+//   4  4  status, 0 on success
+//   8  4  message length
+//   12 8  output length
+//   20    log messages, then the patched output
+
+#define SERVE_REQUEST_MAGIC "GBRQ"
+#define SERVE_REPLY_MAGIC "GBRP"
+#define SERVE_REQUEST_HEADER_SIZE 16
+#define SERVE_REPLY_HEADER_SIZE 20
+
+int gible_serve(const char *execname, int argc, char *argv[]);
+int gible_client(const char *execname, int argc, char *argv[]);
+
+#endif // SERVE_H
@@ -0,0 +1,152 @@
+#include "actions/verify.h"
+#include "helpers/argc.h"
+#include "helpers/format.h"
+#include "helpers/strings.h"
+#include "helpers/utils.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char *gible_verify_usage[] = {
+    "verify <patch> <input> [-b]",
+    NULL,
+};
+
+static int verify(const char *pfn, const char *ifn, int use_buffer);
+
+int gible_verify(const char *execname, int argc, char *argv[])
+{
+    int use_buffer = 0;
+
+    const argc_option_t options[] = {
+        ARGC_OPT_HELP(),
+        ARGC_OPT_BOOLEAN('b', "filebuffer", &use_buffer, 0, "Uses a heap allocated buffer instead of memory mapping.", 0, NULL),
+        ARGC_OPT_END(),
+    };
+
+    argc_parser_t parser =
+        argc_parser_new(execname, options, ARGC_PARSER_FLAGS_STOP_UNKNOWN | ARGC_PARSER_FLAGS_HELP_ON_UNKNOWN);
+    argc_parser_set_messages(&parser, gible_description, gible_verify_usage);
+
+    if (!argc_parser_parse(&parser, argc, argv))
+        return 1;
+
+    if (parser.pcount < 2)
+        return (argc_parser_print_usage(&parser), 1);
+
+    char *pfn = parser.positional[0];
+    char *ifn = parser.positional[1];
+
+    if (strcmp(pfn, ifn) == 0)
+        return (gible_error(same_filename_errors[0]), 1);
+
+    if (!file_exists(pfn))
+        return (gible_error("Patch file does not exist."), 1);
+
+    if (!file_exists(ifn))
+        return (gible_error("Input file does not exist."), 1);
+
+    return verify(pfn, ifn, use_buffer);
+}
+
+// The report below covers mismatches, keep the formats' own warnings quiet.
+static void verify_log_handler(void *user, int level, const char *msg)
+{
+    (void)user;
+
+    if (level == LOG_LVL_ERROR)
+        printf("[ERROR] %s\n", msg);
+}
+
+// Prints one checksum line, returns 1 on a mismatch.
+static int verify_report(const patch_apply_context_t *c, int crc, const char *name)
+{
+    if (!(c->crc_known & (1 << crc)))
+        return 0;
+
+    if (!(c->crc_stored & (1 << crc)))
+    {
+        gible_msg("%-6s CRC32: %08X", name, c->crc[crc]);
+        return 0;
+    }
+
+    int mismatch = c->crc[crc] != c->expected_crc[crc];
+    gible_msg("%-6s CRC32: %08X (expected %08X)%s", name, c->crc[crc], c->expected_crc[crc], mismatch ? " MISMATCH" : "");
+    return mismatch;
+}
+
+static int verify(const char *pfn, const char *ifn, int use_buffer)
+{
+    apply_flags_t flags;
+    memset(&flags, 0, sizeof(apply_flags_t));
+
+    patch_apply_context_t c;
+
+    const filemap_api_t *fmap_api = use_buffer ? filemap_buffer_api : filemap_mmap_api;
+
+    c.flags = &flags;
+    c.stats = NULL;
+    c.progress = NULL;
+    c.touched = NULL;
+    c.digest = NULL;
+    c.crc_known = c.crc_stored = 0;
+
+    c.patch = filemap_new(pfn, 1, fmap_api);
+    c.input = filemap_new(ifn, 1, fmap_api);
+    c.output = filemap_new(NULL, 0, filemap_memory_api);
+
+    filemap_open(&c.patch);
+    filemap_open(&c.input);
+
+    if (c.patch.status != FILEMAP_OK || c.input.status != FILEMAP_OK)
+    {
+        filemap_close(&c.patch);
+        filemap_close(&c.input);
+        return (gible_error("Cannot open the given patch or input file."), 1);
+    }
+
+    const patch_format_t *format = patch_format_detect(&c);
+    int return_code = APPLY_RET_FAILURE;
+
+    gible_log_set_handler(verify_log_handler, NULL);
+
+    if (!format)
+    {
+        gible_error("Unsupported Patch Type.");
+    }
+    else if (format->apply_verify)
+    {
+        return_code = format->apply_verify(&c);
+    }
+    else
+    {
+        // No streaming verifier, patch into memory and hash the result.
+        return_code = format->apply_main(&c);
+
+        if (return_code == APPLY_RET_SUCCESS && !(c.crc_known & FLAG_CRC_OUTPUT))
+        {
+            c.crc[CRC_OUTPUT] = filemap_crc32(&c.output, c.output.size);
+            c.crc_known |= FLAG_CRC_OUTPUT;
+        }
+    }
+
+    gible_log_set_handler(NULL, NULL);
+
+    filemap_close(&c.patch);
+    filemap_close(&c.input);
+    filemap_close(&c.output);
+
+    if (return_code != APPLY_RET_SUCCESS)
+        return (gible_error("%s patch cannot be applied.", format ? format->name : "The"), 1);
+
+    int mismatches = 0;
+    mismatches += verify_report(&c, CRC_PATCH, "Patch");
+    mismatches += verify_report(&c, CRC_INPUT, "Input");
+    mismatches += verify_report(&c, CRC_OUTPUT, "Output");
+
+    if (mismatches)
+        return (gible_error("%s patch has %d checksum mismatch(es).", format->name, mismatches), 1);
+
+    gible_msg("%s patch verified.", format->name);
+    return 0;
+}
@@ -0,0 +1,6 @@
+#ifndef VERIFY_H
+#define VERIFY_H
+
+int gible_verify(const char *execname, int argc, char *argv[]);
+
+#endif // VERIFY_H
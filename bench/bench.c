@@ -0,0 +1,395 @@
+/* End to end benchmark, run through `make bench`.
+ *
+ * Generates reproducible corpora, then creates and applies every format with
+ * both file backends by running the gible binary, and prints one JSON
+ * document with wall time, throughput, peak RSS and page faults per run.
+ *
+ * usage: gible-bench <gible> [-s max size] [-d work dir] [-r repeats] */
+
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define KB (1024ULL)
+#define MB (1024ULL * KB)
+#define GB (1024ULL * MB)
+
+typedef struct corpus
+{
+    const char *name;
+    void (*make)(unsigned char *base, unsigned char **patched, unsigned long long *patched_size,
+        unsigned long long size);
+} corpus_t;
+
+typedef struct run_result
+{
+    int ok;
+    double wall_ms;
+    long max_rss_kb;
+    long minflt, majflt;
+} run_result_t;
+
+// -------------------------------------------------
+// Deterministic Data
+// -------------------------------------------------
+
+static uint64_t rng_state;
+
+static void rng_seed(uint64_t seed)
+{
+    rng_state = seed * 0x9E3779B97F4A7C15ULL + 1;
+}
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void fill_random(unsigned char *p, unsigned long long size)
+{
+    unsigned long long i = 0;
+
+    for (; i + 8 <= size; i += 8)
+    {
+        uint64_t x = rng_next();
+        memcpy(p + i, &x, 8);
+    }
+
+    for (; i < size; i++)
+        p[i] = rng_next();
+}
+
+static unsigned char *copy_of(const unsigned char *base, unsigned long long size)
+{
+    unsigned char *p = malloc(size ? size : 1);
+    memcpy(p, base, size);
+    return p;
+}
+
+// Nothing in common with the base at all.
+static void make_random(unsigned char *base, unsigned char **patched, unsigned long long *patched_size,
+    unsigned long long size)
+{
+    (void)base;
+    *patched = malloc(size);
+    fill_random(*patched, size);
+    *patched_size = size;
+}
+
+// A handful of short edits every few KB, the typical romhack.
+static void make_sparse(unsigned char *base, unsigned char **patched, unsigned long long *patched_size,
+    unsigned long long size)
+{
+    unsigned char *p = copy_of(base, size);
+
+    for (unsigned long long i = 0; i < size / (4 * KB) + 1; ++i)
+    {
+        unsigned long long at = rng_next() % size;
+        unsigned long long length = 1 + rng_next() % 16;
+
+        for (unsigned long long j = at; j < at + length && j < size; ++j)
+            p[j] ^= 1 + rng_next() % 255;
+    }
+
+    *patched = p;
+    *patched_size = size;
+}
+
+// Big blocks inserted, shifting everything after them.
+static void make_shifted(unsigned char *base, unsigned char **patched, unsigned long long *patched_size,
+    unsigned long long size)
+{
+    unsigned long long inserted = size / 8 + 1;
+    unsigned long long at = size / 3;
+    unsigned char *p = malloc(size + inserted);
+
+    memcpy(p, base, at);
+    fill_random(p + at, inserted);
+    memcpy(p + at + inserted, base + at, size - at);
+
+    *patched = p;
+    *patched_size = size + inserted;
+}
+
+// Long runs of a single byte, which favours IPS RLE records.
+static void make_rle(unsigned char *base, unsigned char **patched, unsigned long long *patched_size,
+    unsigned long long size)
+{
+    unsigned char *p = copy_of(base, size);
+
+    for (unsigned long long i = 0; i < size / (64 * KB) + 1; ++i)
+    {
+        unsigned long long at = rng_next() % size;
+        unsigned long long length = 256 + rng_next() % (16 * KB);
+
+        if (length > size - at)
+            length = size - at;
+
+        memset(p + at, rng_next(), length);
+    }
+
+    *patched = p;
+    *patched_size = size;
+}
+
+static const corpus_t corpora[] = {
+    { "random", make_random },
+    { "sparse", make_sparse },
+    { "shifted", make_shifted },
+    { "rle", make_rle },
+};
+
+static const unsigned long long sizes[] = { 1 * KB, 64 * KB, 1 * MB, 16 * MB, 256 * MB, 1 * GB, 4 * GB };
+static const char *formats[] = { "ips", "ups", "bps", "gbl" };
+
+// -------------------------------------------------
+// Running gible
+// -------------------------------------------------
+
+static int write_file(const char *fn, const unsigned char *data, unsigned long long size)
+{
+    FILE *fp = fopen(fn, "wb");
+    if (!fp)
+        return 0;
+
+    int ok = fwrite(data, 1, size, fp) == size;
+    return fclose(fp) == 0 && ok;
+}
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+// Runs argv with stdout silenced and collects the child's own rusage.
+static run_result_t run(char *const argv[])
+{
+    run_result_t r;
+    memset(&r, 0, sizeof(r));
+
+    double start = now_ms();
+    pid_t pid = fork();
+
+    if (pid == 0)
+    {
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    struct rusage usage;
+
+    if (pid < 0 || wait4(pid, &status, 0, &usage) < 0)
+        return r;
+
+    r.wall_ms = now_ms() - start;
+    r.ok = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+    r.max_rss_kb = usage.ru_maxrss;
+    r.minflt = usage.ru_minflt;
+    r.majflt = usage.ru_majflt;
+    return r;
+}
+
+static int same_as(const char *fn, const unsigned char *data, unsigned long long size)
+{
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return 0;
+
+    struct stat st;
+    int same = fstat(fd, &st) == 0 && (unsigned long long)st.st_size == size;
+
+    if (same && size)
+    {
+        void *p = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        same = p != MAP_FAILED && memcmp(p, data, size) == 0;
+
+        if (p != MAP_FAILED)
+            munmap(p, size);
+    }
+
+    close(fd);
+    return same;
+}
+
+static int first_result = 1;
+
+static void report(const char *corpus, unsigned long long size, const char *format, const char *backend,
+    const char *op, const run_result_t *r, unsigned long long bytes, long long patch_size)
+{
+    printf("%s\n    {\"corpus\": \"%s\", \"size\": %llu, \"format\": \"%s\", \"backend\": \"%s\", \"op\": \"%s\", "
+           "\"ok\": %s, \"wall_ms\": %.3f, \"mb_per_s\": %.2f, \"max_rss_kb\": %ld, \"minflt\": %ld, "
+           "\"majflt\": %ld, \"patch_size\": %lld}",
+        first_result ? "" : ",", corpus, size, format, backend, op, r->ok ? "true" : "false", r->wall_ms,
+        r->wall_ms > 0 ? (double)bytes / MB / (r->wall_ms / 1e3) : 0.0, r->max_rss_kb, r->minflt, r->majflt, patch_size);
+    first_result = 0;
+}
+
+static long long file_size(const char *fn)
+{
+    struct stat st;
+    return stat(fn, &st) == 0 ? (long long)st.st_size : -1;
+}
+
+static void build_argv(char **argv, char *gible, char *command, int buffered, char *a, char *b, char *c)
+{
+    int n = 0;
+    argv[n++] = gible;
+    argv[n++] = command;
+
+    if (buffered)
+        argv[n++] = "-b";
+
+    argv[n++] = a;
+    argv[n++] = b;
+    argv[n++] = c;
+    argv[n] = NULL;
+}
+
+// Keeps the fastest of the repeats, the others only warm the page cache.
+static run_result_t run_best(char *const argv[], int repeats)
+{
+    run_result_t best = run(argv);
+
+    for (int i = 1; i < repeats && best.ok; ++i)
+    {
+        run_result_t r = run(argv);
+
+        if (r.ok && r.wall_ms < best.wall_ms)
+            best = r;
+    }
+
+    return best;
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long long max_size = 16 * MB;
+    const char *dir = "/tmp";
+    int repeats = 3;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "s:d:r:")) != -1)
+    {
+        switch (opt)
+        {
+        case 's':
+            max_size = strtoull(optarg, NULL, 0);
+            break;
+        case 'd':
+            dir = optarg;
+            break;
+        case 'r':
+            repeats = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        default:
+            return 1;
+        }
+    }
+
+    if (optind >= argc)
+    {
+        fprintf(stderr, "usage: %s <gible> [-s max size] [-d work dir] [-r repeats]\n", argv[0]);
+        return 1;
+    }
+
+    char *gible = argv[optind];
+    char base_fn[4096], patched_fn[4096], patch_fn[4096], output_fn[4096];
+
+    // Before the JSON starts, so a bad directory never leaves half a document.
+    struct stat st;
+
+    if ((mkdir(dir, 0777) != 0 && errno != EEXIST) || stat(dir, &st) != 0 || !S_ISDIR(st.st_mode) ||
+        access(dir, W_OK) != 0)
+    {
+        fprintf(stderr, "Cannot use %s as the work directory.\n", dir);
+        return 1;
+    }
+
+    snprintf(base_fn, sizeof(base_fn), "%s/gible-bench-%d.base", dir, (int)getpid());
+    snprintf(patched_fn, sizeof(patched_fn), "%s/gible-bench-%d.patched", dir, (int)getpid());
+    snprintf(output_fn, sizeof(output_fn), "%s/gible-bench-%d.output", dir, (int)getpid());
+
+    printf("{\n  \"gible\": \"%s\",\n  \"results\": [", gible);
+
+    for (unsigned long s = 0; s < sizeof(sizes) / sizeof(*sizes) && sizes[s] <= max_size; ++s)
+    {
+        unsigned long long size = sizes[s];
+        unsigned char *base = malloc(size);
+
+        for (unsigned long k = 0; k < sizeof(corpora) / sizeof(*corpora); ++k)
+        {
+            unsigned char *patched;
+            unsigned long long patched_size;
+
+            rng_seed(size ^ k);
+            fill_random(base, size);
+            corpora[k].make(base, &patched, &patched_size, size);
+
+            if (!write_file(base_fn, base, size) || !write_file(patched_fn, patched, patched_size))
+            {
+                fprintf(stderr, "Cannot write the corpus to %s.\n", dir);
+                printf("\n  ]\n}\n");
+                unlink(base_fn);
+                unlink(patched_fn);
+                return 1;
+            }
+
+            for (unsigned long f = 0; f < sizeof(formats) / sizeof(*formats); ++f)
+            {
+                snprintf(patch_fn, sizeof(patch_fn), "%s/gible-bench-%d.%s", dir, (int)getpid(), formats[f]);
+
+                for (int buffered = 0; buffered < 2; ++buffered)
+                {
+                    const char *backend = buffered ? "buffer" : "mmap";
+                    char *create_argv[8], *apply_argv[8];
+                    build_argv(create_argv, gible, "create", buffered, patched_fn, base_fn, patch_fn);
+                    build_argv(apply_argv, gible, "patch", buffered, patch_fn, base_fn, output_fn);
+
+                    run_result_t r = run_best(create_argv, repeats);
+                    report(corpora[k].name, size, formats[f], backend, "create", &r, patched_size,
+                        r.ok ? file_size(patch_fn) : -1);
+
+                    if (!r.ok)
+                        continue;
+
+                    r = run_best(apply_argv, repeats);
+                    r.ok = r.ok && same_as(output_fn, patched, patched_size);
+                    report(corpora[k].name, size, formats[f], backend, "apply", &r, patched_size,
+                        file_size(patch_fn));
+                }
+
+                unlink(patch_fn);
+            }
+
+            free(patched);
+        }
+
+        free(base);
+    }
+
+    printf("\n  ]\n}\n");
+
+    unlink(base_fn);
+    unlink(patched_fn);
+    unlink(output_fn);
+    return 0;
+}
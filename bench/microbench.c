@@ -0,0 +1,489 @@
+/* Kernel microbenchmarks, run through `make microbench`.
+ *
+ * Times the hot loops in isolation: crc32, readvint, the bytearray pushes,
+ * each format's apply through the op executor and the create diff scan.
+ * Every kernel and variant runs over a range of sizes and source alignments,
+ * with warmup and repeated samples, and reports min / median / p90 / p99
+ * per call along with throughput and cycles per byte.
+ *
+ * usage: gible-microbench [-k kernel] [-m max size] [-n samples] */
+
+#define _GNU_SOURCE
+#include "helpers/bytearray.h"
+#include "helpers/crc32.h"
+#include "helpers/diff.h"
+#include "helpers/utils.h"
+#include "lib/gible.h"
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#elif defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#endif
+
+#define KB (1024UL)
+#define MB (1024UL * KB)
+
+typedef struct bench_case
+{
+    unsigned long size;
+    unsigned long align;
+
+    unsigned char *base;    // size random bytes, offset by align
+    unsigned char *patched; // base with sparse edits, same size
+    unsigned char *data;    // Kernel specific input, e.g. an encoded patch
+    unsigned long data_size;
+
+    unsigned long sink; // Results go here so nothing is optimised away
+} bench_case_t;
+
+typedef struct kernel
+{
+    const char *name;
+    const char *variant;
+    int aligned; // Also run at odd alignments
+    int (*prepare)(bench_case_t *c);
+    void (*run)(bench_case_t *c);
+} kernel_t;
+
+// -------------------------------------------------
+// Clocks
+// -------------------------------------------------
+
+static double now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+// Reference cycles, which match core cycles only at the nominal frequency.
+static int cycles_init(void)
+{
+    return 1;
+}
+
+static uint64_t cycles_now(void)
+{
+    return __rdtsc();
+}
+
+#elif defined(__linux__)
+
+static int cycles_fd = -1;
+
+static int cycles_init(void)
+{
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HARDWARE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CPU_CYCLES;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+
+    cycles_fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    return cycles_fd >= 0;
+}
+
+static uint64_t cycles_now(void)
+{
+    uint64_t count = 0;
+
+    if (cycles_fd < 0 || read(cycles_fd, &count, sizeof(count)) != sizeof(count))
+        return 0;
+
+    return count;
+}
+
+#else
+
+static int cycles_init(void)
+{
+    return 0;
+}
+
+static uint64_t cycles_now(void)
+{
+    return 0;
+}
+
+#endif
+
+// -------------------------------------------------
+// Test Data
+// -------------------------------------------------
+
+static uint64_t rng_state = 0x9E3779B97F4A7C15ULL;
+
+static uint64_t rng_next(void)
+{
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 0x2545F4914F6CDD1DULL;
+}
+
+static void fill_random(unsigned char *p, unsigned long size)
+{
+    for (unsigned long i = 0; i < size; ++i)
+        p[i] = rng_next();
+}
+
+// Roughly one short edit every 256 bytes, so the apply loops switch between
+// copies and patched data often enough to matter.
+static void fill_patched(unsigned char *p, const unsigned char *base, unsigned long size)
+{
+    memcpy(p, base, size);
+
+    for (unsigned long i = 0; i < size / 256 + 1; ++i)
+    {
+        unsigned long at = rng_next() % size;
+        unsigned long length = 1 + rng_next() % 8;
+
+        for (unsigned long j = at; j < at + length && j < size; ++j)
+            p[j] ^= 1 + rng_next() % 255;
+    }
+}
+
+static int prepare_vints(bench_case_t *c)
+{
+    bytearray_t b = bytearray_new();
+
+    // A mix of magnitudes, weighted towards the short offsets patches use.
+    while (b.size < c->size)
+    {
+        unsigned int bits = 1 + rng_next() % 28;
+        bytearray_push_vle(&b, rng_next() & ((1UL << bits) - 1));
+    }
+
+    c->data = b.data;
+    c->data_size = b.size;
+    return 1;
+}
+
+static int prepare_patch(bench_case_t *c, const char *format)
+{
+    gible_buffer_t patch;
+
+    if (gible_create_patch(c->patched, c->size, c->base, c->size, format, NULL, &patch) != GIBLE_OK)
+        return 0;
+
+    c->data = patch.data;
+    c->data_size = patch.size;
+    return 1;
+}
+
+static int prepare_ips(bench_case_t *c)
+{
+    return prepare_patch(c, "ips");
+}
+
+static int prepare_ups(bench_case_t *c)
+{
+    return prepare_patch(c, "ups");
+}
+
+// gible can't create BPS patches, so encode the runs by hand as SourceRead
+// and TargetRead actions.
+static int prepare_bps(bench_case_t *c)
+{
+    diff_runs_t runs;
+    if (!diff_scan(&runs, c->patched, c->size, c->base, c->size))
+        return 0;
+
+    bytearray_t b = bytearray_new();
+    unsigned long offset = 0;
+
+    bytearray_push_string(&b, "BPS1");
+    bytearray_push_vle(&b, c->size);
+    bytearray_push_vle(&b, c->size);
+    bytearray_push_vle(&b, 0);
+
+    for (unsigned long i = 0; i <= runs.count; ++i)
+    {
+        unsigned long start = i < runs.count ? runs.runs[i].start : c->size;
+
+        if (start > offset)
+            bytearray_push_vle(&b, (start - offset - 1) << 2 | 0);
+
+        if (i == runs.count)
+            break;
+
+        bytearray_push_vle(&b, (runs.runs[i].end - start - 1) << 2 | 1);
+        bytearray_push_data(&b, c->patched + start, runs.runs[i].end - start);
+        offset = runs.runs[i].end;
+    }
+
+    diff_runs_close(&runs);
+
+    unsigned char crcs[12];
+    write32le(crcs, crc32(c->base, c->size, 0));
+    write32le(crcs + 4, crc32(c->patched, c->size, 0));
+    bytearray_push_data(&b, crcs, 8);
+    write32le(crcs + 8, crc32(b.data, b.size, 0));
+    bytearray_push_data(&b, crcs + 8, 4);
+
+    c->data = b.data;
+    c->data_size = b.size;
+    return 1;
+}
+
+// -------------------------------------------------
+// Kernels
+// -------------------------------------------------
+
+static void run_crc32(bench_case_t *c)
+{
+    c->sink += crc32(c->base, c->size, 0);
+}
+
+static void run_crc32_fill(bench_case_t *c)
+{
+    c->sink += crc32_fill(0, c->size, 0);
+}
+
+static void run_readvint(bench_case_t *c)
+{
+    unsigned char *p = c->data, *end = c->data + c->data_size;
+
+    while (p < end)
+        c->sink += readvint(&p);
+}
+
+static void run_push(bench_case_t *c)
+{
+    bytearray_t b = bytearray_new();
+
+    for (unsigned long i = 0; i < c->size; ++i)
+        bytearray_push(&b, c->base[i]);
+
+    c->sink += b.size;
+    bytearray_close(&b);
+}
+
+static void run_push_data(bench_case_t *c)
+{
+    bytearray_t b = bytearray_new();
+
+    bytearray_push_data(&b, c->base, c->size);
+
+    c->sink += b.size;
+    bytearray_close(&b);
+}
+
+// Pushes size / 4 values of mixed magnitude, about size bytes of output.
+static void run_push_vle(bench_case_t *c)
+{
+    bytearray_t b = bytearray_new();
+    const unsigned int *values = (const unsigned int *)c->base;
+
+    for (unsigned long i = 0; i < c->size / 4; ++i)
+        bytearray_push_vle(&b, values[i] >> (values[i] & 31));
+
+    c->sink += b.size;
+    bytearray_close(&b);
+}
+
+// Leaves the CRCs out so only the format's own loop is timed.
+static void run_apply(bench_case_t *c)
+{
+    gible_options_t options;
+    memset(&options, 0, sizeof(options));
+    options.ignore_crc = GIBLE_CRC_ALL;
+
+    gible_buffer_t output;
+
+    if (gible_apply(c->data, c->data_size, c->base, c->size, &options, &output) == GIBLE_OK)
+    {
+        c->sink += output.data[output.size / 2];
+        free(output.data);
+    }
+}
+
+static void run_diff_scan(bench_case_t *c)
+{
+    diff_runs_t runs;
+
+    if (diff_scan(&runs, c->patched, c->size, c->base, c->size))
+    {
+        c->sink += runs.changed;
+        diff_runs_close(&runs);
+    }
+}
+
+static const kernel_t kernels[] = {
+    { "crc32", "table", 1, NULL, run_crc32 },
+    { "crc32_fill", "table", 0, NULL, run_crc32_fill },
+    { "readvint", "scalar", 0, prepare_vints, run_readvint },
+    { "bytearray_push", "scalar", 0, NULL, run_push },
+    { "bytearray_push_data", "scalar", 1, NULL, run_push_data },
+    { "bytearray_push_vle", "scalar", 0, NULL, run_push_vle },
+    { "apply_ips", "ops", 0, prepare_ips, run_apply },
+    { "apply_ups", "ops", 0, prepare_ups, run_apply },
+    { "apply_bps", "ops", 0, prepare_bps, run_apply },
+    { "diff_scan", "word", 1, NULL, run_diff_scan },
+};
+
+static const unsigned long sizes[] = { 64, 1 * KB, 16 * KB, 256 * KB, 4 * MB, 64 * MB };
+static const unsigned long alignments[] = { 0, 1, 3, 8 };
+
+// -------------------------------------------------
+// Timing
+// -------------------------------------------------
+
+typedef struct sample
+{
+    double ns;
+    double cycles;
+} sample_t;
+
+static int compare_samples(const void *a, const void *b)
+{
+    double x = ((const sample_t *)a)->ns, y = ((const sample_t *)b)->ns;
+    return (x > y) - (x < y);
+}
+
+// Calls per sample, grown until a sample lasts at least 200us so that the
+// clock resolution stays negligible.
+static unsigned long calibrate(const kernel_t *k, bench_case_t *c)
+{
+    unsigned long calls = 1;
+
+    while (calls < (1UL << 24))
+    {
+        double start = now_ns();
+
+        for (unsigned long i = 0; i < calls; ++i)
+            k->run(c);
+
+        if (now_ns() - start >= 200e3)
+            break;
+
+        calls *= 2;
+    }
+
+    return calls;
+}
+
+static void measure(const kernel_t *k, bench_case_t *c, int samples, int has_cycles)
+{
+    sample_t *s = malloc(samples * sizeof(sample_t));
+
+    // The calibration runs double as the warmup.
+    unsigned long calls = calibrate(k, c);
+
+    for (int n = 0; n < samples; ++n)
+    {
+        uint64_t cycles = cycles_now();
+        double start = now_ns();
+
+        for (unsigned long i = 0; i < calls; ++i)
+            k->run(c);
+
+        s[n].ns = (now_ns() - start) / calls;
+        s[n].cycles = (double)(cycles_now() - cycles) / calls;
+    }
+
+    qsort(s, samples, sizeof(sample_t), compare_samples);
+
+#define percentile(p) (s[(samples - 1) * (p) / 100])
+
+    sample_t median = percentile(50);
+
+    printf("%-20s %-7s %9lu %5lu %12.1f %12.1f %12.1f %12.1f %9.2f", k->name, k->variant, c->size, c->align,
+        s[0].ns, median.ns, percentile(90).ns, percentile(99).ns, c->size / median.ns);
+
+    if (has_cycles)
+        printf(" %8.3f\n", median.cycles / c->size);
+    else
+        printf(" %8s\n", "-");
+
+#undef percentile
+
+    free(s);
+}
+
+int main(int argc, char *argv[])
+{
+    const char *only = NULL;
+    unsigned long max_size = 4 * MB;
+    int samples = 31;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "k:m:n:")) != -1)
+    {
+        switch (opt)
+        {
+        case 'k':
+            only = optarg;
+            break;
+        case 'm':
+            max_size = strtoul(optarg, NULL, 0);
+            break;
+        case 'n':
+            samples = atoi(optarg) > 0 ? atoi(optarg) : 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-k kernel] [-m max size] [-n samples]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    int has_cycles = cycles_init();
+
+    printf("%-20s %-7s %9s %5s %12s %12s %12s %12s %9s %8s\n", "kernel", "variant", "size", "align", "min ns",
+        "median ns", "p90 ns", "p99 ns", "GB/s", "cyc/B");
+
+    for (unsigned long s = 0; s < ARRAY_COUNT(sizes) && sizes[s] <= max_size; ++s)
+    {
+        unsigned long size = sizes[s];
+        unsigned char *base_block = malloc(size + 64);
+        unsigned char *patched = malloc(size);
+
+        fill_random(base_block, size + 64);
+
+        for (unsigned long k = 0; k < ARRAY_COUNT(kernels); ++k)
+        {
+            const kernel_t *kernel = &kernels[k];
+
+            if (only && !strstr(kernel->name, only))
+                continue;
+
+            for (unsigned long a = 0; a < (kernel->aligned ? ARRAY_COUNT(alignments) : 1); ++a)
+            {
+                bench_case_t c;
+                memset(&c, 0, sizeof(c));
+                c.size = size;
+                c.align = alignments[a];
+                c.base = base_block + c.align;
+                c.patched = patched;
+
+                fill_patched(patched, c.base, size);
+
+                if (kernel->prepare && !kernel->prepare(&c))
+                {
+                    fprintf(stderr, "Cannot prepare %s for %lu bytes.\n", kernel->name, size);
+                    continue;
+                }
+
+                measure(kernel, &c, samples, has_cycles);
+                free(c.data);
+            }
+        }
+
+        free(base_block);
+        free(patched);
+    }
+
+    return 0;
+}
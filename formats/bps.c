@@ -1,9 +1,14 @@
 #include "helpers/crc32.h"
+#include "helpers/diff.h"
 #include "helpers/filemap.h"
 #include "helpers/format.h"
+#include "helpers/ops.h"
 #include "helpers/utils.h"
+#include "helpers/writer.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
 enum bps_action
 {
@@ -15,6 +20,12 @@ enum bps_action
 
 static int bps_apply(patch_apply_context_t *c);
 static int bps_create(patch_create_context_t *c);
+static int bps_create_view(patch_create_context_t *c, patch_view_t *patched);
+static int bps_compose(filemap_t *first, filemap_t *second, filemap_t *output);
+static int bps_view_open(patch_view_t *v);
+static int bps_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length);
+static void bps_view_close(patch_view_t *v);
+static int bps_apply_input(const filemap_t *patch, unsigned int *crc, unsigned long *size);
 
 const patch_format_t bps_format = 
 { 
@@ -24,7 +35,14 @@ const patch_format_t bps_format =
     .apply_main = bps_apply, 
     .create_main = bps_create, 
     .apply_check = NULL, 
-    .create_check = NULL 
+    .create_check = NULL,
+    .apply_verify = NULL,
+    .create_view = bps_create_view,
+    .compose = bps_compose,
+    .view_open = bps_view_open,
+    .view_read = bps_view_read,
+    .view_close = bps_view_close,
+    .apply_input = bps_apply_input
 };
 
 // -------------------------------------------------
@@ -34,6 +52,7 @@ const patch_format_t bps_format =
 static int bps_apply(patch_apply_context_t *c)
 {
 #define check_crc32(a, err) \
+    c->crc_known |= FLAG_##a, c->crc_stored |= FLAG_##a; \
     if ((scrc[a] != acrc[a])) \
     { \
         if ((flags->strict_crc & FLAG_##a)) \
@@ -47,17 +66,17 @@ static int bps_apply(patch_apply_context_t *c)
     }
 
 #define patch8() (patch < patchend ? *(patch++) : 0)
-#define input8() (input < inputend ? *(input++) : 0)
 #define sign(b) ((b & 1 ? -1 : +1) * (b >> 1))
 
     const apply_flags_t *flags = c->flags;
 
     unsigned char *patch, *patchstart, *patchend, *patchcrc;
     unsigned char *input;
-    unsigned char *output, *outputstart;
 
-    unsigned int acrc[3] = { 0, 0, 0 };
-    unsigned int scrc[3] = { 0, 0, 0 };
+    unsigned int *acrc = c->crc;
+    unsigned int *scrc = c->expected_crc;
+
+    c->crc_known = c->crc_stored = 0;
 
     if (c->patch.size < 19)
         return APPLY_ERROR("Patch file is too small to be a BPS file.");
@@ -69,8 +88,10 @@ static int bps_apply(patch_apply_context_t *c)
 
     if (~flags->ignore_crc & FLAG_CRC_PATCH)
     {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
         scrc[CRC_PATCH] = read32le(patchcrc + 8);
         acrc[CRC_PATCH] = crc32(patchstart, c->patch.size - 4, 0);
+        stats_phase_end(c->stats);
         check_crc32(CRC_PATCH, "Patch CRCs don't match.");
     }
 
@@ -87,16 +108,20 @@ static int bps_apply(patch_apply_context_t *c)
 
     if (~flags->ignore_crc & FLAG_CRC_INPUT)
     {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
         scrc[CRC_INPUT] = read32le(patchcrc);
-        acrc[CRC_INPUT] = crc32(input, input_size, 0);
+        acrc[CRC_INPUT] = filemap_crc32(&c->input, input_size);
+        stats_phase_end(c->stats);
         check_crc32(CRC_INPUT, "Input CRCs don't match.");
     }
 
     if (!filemap_create(&c->output, output_size))
         return APPLY_RET_INVALID_OUTPUT;
 
-    output = c->output.handle;
-    outputstart = c->output.handle;
+    patch_ops_t ops;
+    patch_ops_init(&ops, input, c->input.size, c->output.handle, output_size);
+    ops.touched = c->touched;
+    ops.input_map = &c->input;
 
     unsigned long metadata_size = readvint(&patch);
     patch += metadata_size;
@@ -104,6 +129,7 @@ static int bps_apply(patch_apply_context_t *c)
     unsigned long output_off = 0;
     unsigned long source_rel_off = 0;
     unsigned long target_rel_off = 0;
+    unsigned long long next_progress = progress_start(c->progress, output_size);
 
     while (patch < patchcrc)
     {
@@ -111,63 +137,1123 @@ static int bps_apply(patch_apply_context_t *c)
         uint64_t action = data & 3;
         uint64_t length = (data >> 2) + 1;
 
+        if (length > output_size - output_off)
+            return APPLY_ERROR("BPS action writes past the end of the output.");
+
+        stats_count(c->stats, STATS_BPS_SOURCE_READ + action, length);
+        progress_tick(c->progress, next_progress, output_off);
+
         switch (action)
         {
         case BPS_SOURCE_READ:
-            while (length--)
-            {
-                outputstart[output_off] = input[output_off];
-                output_off++;
-            }
+            patch_ops_copy_input(&ops, output_off, output_off, length);
             break;
 
         case BPS_TARGET_READ:
-            while (length--)
-                output[output_off++] = patch8();
+        {
+            // Data cut off by the end of the patch reads as zero.
+            unsigned long avail = (uint64_t)(patchend - patch) < length ? (unsigned long)(patchend - patch) : length;
+            patch_ops_literal(&ops, output_off, patch, avail);
+            patch_ops_fill(&ops, output_off + avail, 0, length - avail);
+            patch += avail;
             break;
+        }
 
         case BPS_SOURCE_COPY:
             data = readvint(&patch);
             source_rel_off += sign(data);
 
-            while (length--)
-                output[output_off++] = input[source_rel_off++];
+            patch_ops_copy_input(&ops, output_off, source_rel_off, length);
+            source_rel_off += length;
             break;
 
         case BPS_TARGET_COPY:
             data = readvint(&patch);
             target_rel_off += sign(data);
 
-            while (length--)
-                output[output_off++] = output[target_rel_off++];
+            if (target_rel_off >= output_off)
+                return APPLY_ERROR("BPS target copy reads past the written output.");
+
+            patch_ops_copy_output(&ops, output_off, target_rel_off, length);
+            target_rel_off += length;
             break;
 
         default:
             return APPLY_ERROR("Invalid BPS patching action.");
         }
+
+        output_off += length;
     }
 
+    // Whatever the actions left out stays zero.
+    patch_ops_fill(&ops, output_off, 0, output_size - output_off);
+    progress_finish(c->progress);
+
+    if (!patch_ops_finish(&ops))
+        return APPLY_ERROR("Cannot decompress the input.");
+
     if (~flags->ignore_crc & FLAG_CRC_OUTPUT)
     {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
         scrc[CRC_OUTPUT] = read32le(patchcrc + 4);
-        acrc[CRC_OUTPUT] = crc32(c->output.handle, c->output.size, 0);
+        acrc[CRC_OUTPUT] = patch_output_crc32(c);
+        stats_phase_end(c->stats);
         check_crc32(CRC_OUTPUT, "Output CRCs don't match.");
     }
 
 #undef check_crc32
 #undef patch8
-#undef input8
 #undef sign
 
     return APPLY_RET_SUCCESS;
 }
 
+static int bps_apply_input(const filemap_t *patch, unsigned int *crc, unsigned long *size)
+{
+    unsigned char *p = patch->handle;
+
+    if (patch->size < 19 || memcmp(p, "BPS1", 4) != 0)
+        return 0;
+
+    p += 4;
+    *size = readvint(&p);
+    *crc = read32le(patch->handle + patch->size - 12);
+    return 1;
+}
+
+// -------------------------------------------------
+// Patched View
+// -------------------------------------------------
+
+// Output between two checkpoints, decoded from scratch on every read.
+#define BPS_VIEW_CHECKPOINT (64UL * 1024)
+// Actions between two checkpoints, so following a target copy back to the
+// bytes it copies only ever scans this many.
+#define BPS_VIEW_CHECKPOINT_ACTIONS 64
+
+// Decoder state at the start of an action.
+typedef struct bps_checkpoint
+{
+    unsigned long patch;
+    unsigned long output;
+    unsigned long source_rel;
+    unsigned long target_rel;
+} bps_checkpoint_t;
+
+typedef struct bps_index
+{
+    bps_checkpoint_t *checkpoints;
+    unsigned long count;
+    unsigned long decoded; // Output the actions cover, the rest reads as zero
+    unsigned long actions_end; // Offset of the footer in the patch
+} bps_index_t;
+
+// Output still to decode into dest or, with distance set, the tail of a
+// target copy to fill by repeating the distance bytes before each byte.
+typedef struct bps_view_work
+{
+    unsigned long offset;
+    unsigned char *dest;
+    unsigned long length;
+    unsigned long distance;
+} bps_view_work_t;
+
+typedef struct bps_view_stack
+{
+    bps_view_work_t *items;
+    unsigned long count;
+    unsigned long capacity;
+} bps_view_stack_t;
+
+#define sign(b) ((b & 1 ? -1 : +1) * (b >> 1))
+
+// Checks every action like bps_apply and keeps a checkpoint at least every
+// BPS_VIEW_CHECKPOINT bytes of output.
+static int bps_view_open(patch_view_t *v)
+{
+    unsigned char *patch, *patchstart, *patchend, *patchcrc;
+
+    if (v->patch.size < 19)
+        return APPLY_ERROR("Patch file is too small to be a BPS file.");
+
+    patch = v->patch.handle;
+    patchstart = patch;
+    patchend = patch + v->patch.size;
+    patchcrc = patchend - 12;
+
+    if (patch[0] != 'B' || patch[1] != 'P' || patch[2] != 'S' || patch[3] != '1')
+        return APPLY_ERROR("Invalid header for a BPS file.");
+
+    patch += 4;
+    readvint(&patch);
+
+    unsigned long output_size = v->size = readvint(&patch);
+
+    v->expected_crc[CRC_INPUT] = read32le(patchcrc);
+    v->expected_crc[CRC_OUTPUT] = read32le(patchcrc + 4);
+    v->expected_crc[CRC_PATCH] = read32le(patchcrc + 8);
+    v->crc_stored = FLAG_CRC_ALL;
+
+    unsigned long metadata_size = readvint(&patch);
+    patch += metadata_size;
+
+    bps_index_t *index = calloc(1, sizeof(bps_index_t));
+    unsigned long capacity = 0;
+
+    if (!index)
+        return APPLY_ERROR("Not enough memory to index the patch.");
+
+    v->index = index;
+    index->actions_end = patchcrc - patchstart;
+
+    unsigned long output_off = 0, source_rel_off = 0, target_rel_off = 0, next_checkpoint = 0, actions = 0;
+
+    while (patch < patchcrc)
+    {
+        if (output_off >= next_checkpoint || actions == BPS_VIEW_CHECKPOINT_ACTIONS)
+        {
+            if (index->count == capacity)
+            {
+                capacity = capacity ? capacity * 2 : 64;
+                bps_checkpoint_t *checkpoints = realloc(index->checkpoints, capacity * sizeof(bps_checkpoint_t));
+
+                if (!checkpoints)
+                    return APPLY_ERROR("Not enough memory to index the patch.");
+
+                index->checkpoints = checkpoints;
+            }
+
+            bps_checkpoint_t *cp = &index->checkpoints[index->count++];
+            cp->patch = patch - patchstart;
+            cp->output = output_off;
+            cp->source_rel = source_rel_off;
+            cp->target_rel = target_rel_off;
+
+            next_checkpoint = output_off + BPS_VIEW_CHECKPOINT;
+            actions = 0;
+        }
+
+        actions++;
+
+        unsigned long data = readvint(&patch);
+        uint64_t action = data & 3;
+        uint64_t length = (data >> 2) + 1;
+
+        if (length > output_size - output_off)
+            return APPLY_ERROR("BPS action writes past the end of the output.");
+
+        switch (action)
+        {
+        case BPS_SOURCE_READ:
+            break;
+
+        case BPS_TARGET_READ:
+            patch = length < (unsigned long)(patchend - patch) ? patch + length : patchend;
+            break;
+
+        case BPS_SOURCE_COPY:
+            data = readvint(&patch);
+            source_rel_off += sign(data) + length;
+            break;
+
+        case BPS_TARGET_COPY:
+            data = readvint(&patch);
+            target_rel_off += sign(data);
+
+            if (target_rel_off >= output_off)
+                return APPLY_ERROR("BPS target copy reads past the written output.");
+
+            target_rel_off += length;
+            break;
+        }
+
+        output_off += length;
+    }
+
+    index->decoded = output_off;
+    return APPLY_RET_SUCCESS;
+}
+
+static int bps_view_push(bps_view_stack_t *stack, unsigned long offset, unsigned char *dest, unsigned long length,
+    unsigned long distance)
+{
+    if (stack->count == stack->capacity)
+    {
+        unsigned long capacity = stack->capacity ? stack->capacity * 2 : 64;
+        bps_view_work_t *items = realloc(stack->items, capacity * sizeof(bps_view_work_t));
+
+        if (!items)
+            return 0;
+
+        stack->items = items;
+        stack->capacity = capacity;
+    }
+
+    bps_view_work_t *w = &stack->items[stack->count++];
+    w->offset = offset;
+    w->dest = dest;
+    w->length = length;
+    w->distance = distance;
+    return 1;
+}
+
+// Decodes [offset, offset + length) into out, but for the bytes target
+// copies take from earlier on, which are pushed as work of their own.
+static int bps_view_decode(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length,
+    bps_view_stack_t *stack)
+{
+    const bps_index_t *index = v->index;
+    const unsigned char *input = v->input.handle;
+    unsigned char *patchstart = v->patch.handle;
+    unsigned long patch_size = v->patch.size;
+
+#define input8(i) ((i) < v->input.size ? input[i] : 0)
+
+    unsigned long end = offset + length;
+
+    // Nothing decodes past the last action.
+    if (end > index->decoded)
+    {
+        unsigned long from = offset > index->decoded ? offset : index->decoded;
+        memset(out + (from - offset), 0, end - from);
+        end = from;
+    }
+
+    // Last checkpoint at or before offset.
+    unsigned long lo = 0, hi = index->count;
+
+    while (lo < hi)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
+
+        if (index->checkpoints[mid].output <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    if (!lo || offset >= end)
+        return 1;
+
+    const bps_checkpoint_t *cp = &index->checkpoints[lo - 1];
+    unsigned char *patch = patchstart + cp->patch;
+    unsigned long output_off = cp->output;
+    unsigned long source_rel_off = cp->source_rel;
+    unsigned long target_rel_off = cp->target_rel;
+
+    while (output_off < end)
+    {
+        unsigned long data = readvint(&patch);
+        uint64_t action = data & 3;
+        uint64_t length = (data >> 2) + 1;
+
+        if (action == BPS_SOURCE_COPY || action == BPS_TARGET_COPY)
+        {
+            data = readvint(&patch);
+
+            if (action == BPS_SOURCE_COPY)
+                source_rel_off += sign(data);
+            else
+                target_rel_off += sign(data);
+        }
+
+        // The part of this action inside the range, relative to its start.
+        unsigned long from = offset > output_off ? offset - output_off : 0;
+        unsigned long to = end - output_off < length ? end - output_off : length;
+        unsigned char *dest = out + (output_off + from - offset);
+
+        for (unsigned long k = from; k < to && action != BPS_TARGET_COPY; ++k)
+        {
+            unsigned long at = patch - patchstart + k;
+
+            if (action == BPS_SOURCE_READ)
+                *dest++ = input8(output_off + k);
+            else if (action == BPS_TARGET_READ)
+                *dest++ = at < patch_size ? patchstart[at] : 0;
+            else
+                *dest++ = input8(source_rel_off + k);
+        }
+
+        // Byte k of a target copy repeats byte k - distance once it reads its
+        // own output, so only the first distance bytes come from earlier on,
+        // in at most two pieces. The repeat goes first to run after them.
+        if (action == BPS_TARGET_COPY && from < to)
+        {
+            unsigned long distance = output_off - target_rel_off;
+            unsigned long fresh = to - from < distance ? to - from : distance;
+            unsigned long start = from % distance;
+            unsigned long first = fresh < distance - start ? fresh : distance - start;
+
+            if (to - from > fresh && !bps_view_push(stack, 0, dest, to - from, distance))
+                return 0;
+
+            if (!bps_view_push(stack, target_rel_off + start, dest, first, 0))
+                return 0;
+
+            if (fresh > first && !bps_view_push(stack, target_rel_off, dest + first, fresh - first, 0))
+                return 0;
+        }
+
+        if (action == BPS_TARGET_READ)
+            patch += length < patch_size - (patch - patchstart) ? length : patch_size - (patch - patchstart);
+        else if (action == BPS_SOURCE_COPY)
+            source_rel_off += length;
+        else if (action == BPS_TARGET_COPY)
+            target_rel_off += length;
+
+        output_off += length;
+    }
+
+#undef input8
+
+    return 1;
+}
+
+// Chains of target copies can run thousands deep, so the bytes they copy are
+// resolved off a stack instead of by recursion.
+static int bps_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length)
+{
+    bps_view_stack_t stack;
+    memset(&stack, 0, sizeof(bps_view_stack_t));
+
+    int ok = bps_view_push(&stack, offset, out, length, 0);
+
+    while (ok && stack.count)
+    {
+        bps_view_work_t w = stack.items[--stack.count];
+
+        if (!w.distance)
+        {
+            ok = bps_view_decode(v, w.offset, w.dest, w.length, &stack);
+            continue;
+        }
+
+        for (unsigned long k = w.distance; k < w.length; ++k)
+            w.dest[k] = w.dest[k - w.distance];
+    }
+
+    free(stack.items);
+    return ok ? APPLY_RET_SUCCESS : APPLY_ERROR("Not enough memory to read the patch.");
+}
+
+static void bps_view_close(patch_view_t *v)
+{
+    bps_index_t *index = v->index;
+
+    free(index->checkpoints);
+    free(index);
+}
+
+#undef sign
+
 // -------------------------------------------------
 // Patch Creation
 // -------------------------------------------------
 
+// Output encoded between two scans, so only one is ever in memory for views.
+#define BPS_CREATE_CHUNK (1UL << 20)
+// Unchanged bytes folded into a target read, a new action costs as much.
+#define BPS_CREATE_GAP 2
+
+// Source reads up to start, then the changed bytes [start, end) as a target read.
+static void bps_create_action(writer_t *w, stats_t *stats, unsigned long *written, unsigned long start,
+    unsigned long end, const unsigned char *data)
+{
+    if (start > *written)
+    {
+        writer_push_vle(w, (start - *written - 1) << 2 | BPS_SOURCE_READ);
+        stats_count(stats, STATS_BPS_SOURCE_READ, start - *written);
+    }
+
+    writer_push_vle(w, (end - start - 1) << 2 | BPS_TARGET_READ);
+    writer_push_data(w, data, end - start);
+    stats_count(stats, STATS_BPS_TARGET_READ, end - start);
+
+    *written = end;
+}
+
+// Encodes one chunk of the patched file starting at offset. Bytes past the
+// end of the base are always target reads, source reads never go past it.
+static void bps_create_chunk(writer_t *w, stats_t *stats, unsigned long *written, const unsigned char *chunk,
+    unsigned long offset, unsigned long length, const unsigned char *base, unsigned long base_size)
+{
+    unsigned long base_length = offset < base_size ? base_size - offset : 0;
+    unsigned long limit = length < base_length ? length : base_length;
+    const unsigned char *b = base_length ? base + offset : NULL;
+
+    for (unsigned long i = 0; i < length;)
+    {
+        unsigned long start = i < limit ? diff_find_change(chunk, b, base_length, i, limit) : i;
+
+        if (start >= length)
+            break;
+
+        unsigned long end = start;
+
+        for (;;)
+        {
+            end = end < limit ? diff_find_same(chunk, b, base_length, end, limit) : length;
+
+            if (end >= limit)
+                end = length;
+
+            if (end >= length)
+                break;
+
+            unsigned long next = diff_find_change(chunk, b, base_length, end, limit);
+
+            if (next >= length || next - end > BPS_CREATE_GAP)
+                break;
+
+            end = next;
+        }
+
+        bps_create_action(w, stats, written, offset + start, offset + end, chunk + start);
+        i = end;
+    }
+}
+
+// Same encoding over the runs of a candidate limited diff, for callers that
+// know where the files may differ.
+static int bps_create_runs(patch_create_context_t *c, writer_t *w, unsigned long *written)
+{
+    const unsigned char *patched = c->patched.handle;
+    unsigned long patched_size = c->patched.size, base_size = c->base.size;
+
+    diff_runs_t runs;
+    if (!diff_scan_candidates(&runs, patched, patched_size, c->base.handle, base_size, c->candidates))
+        return 0;
+
+    // Past the base everything ends up in one last target read, zeros included.
+    unsigned long tail = patched_size > base_size ? base_size : patched_size;
+
+    for (unsigned long i = 0; i < runs.count;)
+    {
+        unsigned long start = runs.runs[i].start, end = runs.runs[i++].end;
+
+        // Same gap folding as bps_create_chunk, the tail counts as a change.
+        while (end < tail)
+        {
+            unsigned long next = i < runs.count && runs.runs[i].start < tail ? runs.runs[i].start : tail;
+
+            if (next >= patched_size || next - end > BPS_CREATE_GAP)
+                break;
+
+            end = next < tail ? runs.runs[i++].end : tail;
+        }
+
+        if (tail < patched_size && end >= tail)
+        {
+            tail = start < tail ? start : tail;
+            break;
+        }
+
+        bps_create_action(w, c->stats, written, start, end, patched + start);
+    }
+
+    if (tail < patched_size)
+        bps_create_action(w, c->stats, written, tail, patched_size, patched + tail);
+
+    diff_runs_close(&runs);
+    return 1;
+}
+
+// Only ever uses source and target reads. Patched bytes come straight from
+// the map, or from a view when converting another patch.
+static int bps_create_write(patch_create_context_t *c, patch_view_t *view)
+{
+    unsigned long patched_size = view ? view->size : c->patched.size;
+    const unsigned char *base = view ? view->input.handle : c->base.handle;
+    unsigned long base_size = view ? view->input.size : c->base.size;
+
+    unsigned char *buffer = view ? malloc(BPS_CREATE_CHUNK) : NULL;
+
+    if (view && !buffer)
+        return CREATE_ERROR("Not enough memory to convert the patch.");
+
+    writer_t w;
+    if (!writer_open(&w, &c->output))
+    {
+        free(buffer);
+        return CREATE_RET_INVALID_OUTPUT;
+    }
+
+    writer_push_string(&w, "BPS1");
+    writer_push_vle(&w, base_size);
+    writer_push_vle(&w, patched_size);
+    writer_push_vle(&w, 0); // No metadata
+
+    unsigned int crc_output = 0;
+    unsigned long written = 0;
+    unsigned long long next_progress = progress_start(c->progress, patched_size);
+
+    if (!view && c->candidates)
+    {
+        if (!bps_create_runs(c, &w, &written))
+        {
+            writer_abort(&w);
+            return CREATE_ERROR("Not enough memory to diff the files.");
+        }
+
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
+        crc_output = filemap_crc32(&c->patched, patched_size);
+        stats_phase_end(c->stats);
+    }
+    else
+    {
+        for (unsigned long offset = 0; offset < patched_size; offset += BPS_CREATE_CHUNK)
+        {
+            progress_tick(c->progress, next_progress, offset);
+
+            unsigned long length = patched_size - offset < BPS_CREATE_CHUNK ? patched_size - offset : BPS_CREATE_CHUNK;
+            const unsigned char *chunk = c->patched.handle + offset;
+
+            if (view)
+            {
+                if (patch_view_read(view, offset, buffer, length) != APPLY_RET_SUCCESS)
+                {
+                    free(buffer);
+                    writer_abort(&w);
+                    return CREATE_RET_FAILURE;
+                }
+
+                chunk = buffer;
+            }
+
+            crc_output = crc32(chunk, length, crc_output);
+            bps_create_chunk(&w, c->stats, &written, chunk, offset, length, base, base_size);
+        }
+    }
+
+    if (written < patched_size)
+    {
+        writer_push_vle(&w, (patched_size - written - 1) << 2 | BPS_SOURCE_READ);
+        stats_count(c->stats, STATS_BPS_SOURCE_READ, patched_size - written);
+    }
+
+    free(buffer);
+    progress_finish(c->progress);
+
+    if (view && (view->crc_stored & FLAG_CRC_OUTPUT) && view->expected_crc[CRC_OUTPUT] != crc_output)
+        gible_warn("Output CRCs don't match.");
+
+    stats_phase_begin(c->stats, STATS_PHASE_CRC);
+    unsigned int crc_input = filemap_crc32(view ? &view->input : &c->base, base_size);
+    stats_phase_end(c->stats);
+
+    writer_push_le32(&w, crc_input);
+    writer_push_le32(&w, crc_output);
+    writer_push_le32(&w, writer_crc32(&w));
+
+    if (!writer_finish(&w))
+        return CREATE_ERROR("Cannot write the patch.");
+
+    return CREATE_RET_SUCCESS;
+}
+
 static int bps_create(patch_create_context_t *c)
 {
-    (void)c;
-    return APPLY_ERROR("BPS patch creation not implemented yet.");
+    return bps_create_write(c, NULL);
+}
+
+static int bps_create_view(patch_create_context_t *c, patch_view_t *patched)
+{
+    return bps_create_write(c, patched);
+}
+
+// -------------------------------------------------
+// Patch Composition
+// -------------------------------------------------
+
+// No action pending in the composed patch.
+#define BPS_COMPOSE_NONE 4
+// Literal bytes held back before they go out as one target read.
+#define BPS_COMPOSE_LITERAL WRITER_CHUNK
+
+// One action of the first patch, by the range of its output it writes.
+typedef struct bps_segment
+{
+    unsigned long output;
+    unsigned long length;
+    unsigned long from; // Source or output offset read, or patch offset of the data
+    unsigned char action;
+} bps_segment_t;
+
+// Output of the first patch still to emit, with where the range it was cut
+// from started, in both patches, for target copies of what it emitted.
+typedef struct bps_compose_range
+{
+    unsigned long offset;
+    unsigned long length;
+    unsigned long start;
+    unsigned long position;
+} bps_compose_range_t;
+
+typedef struct bps_composer
+{
+    // First patch, indexed, and where its bytes are.
+    const unsigned char *first;
+    unsigned long first_size;
+    unsigned long source_size;
+    unsigned long middle_size;
+    bps_segment_t *segments;
+    unsigned long count;
+
+    // Ranges being resolved, the innermost last.
+    bps_compose_range_t *ranges;
+    unsigned long range_count;
+    unsigned long range_capacity;
+
+    // Composed patch, with the last action held back in case the next one
+    // carries on from it.
+    writer_t w;
+    unsigned long written; // Output covered by the actions written
+    unsigned long source_rel, target_rel;
+    unsigned char pending;
+    unsigned long pending_length;
+    unsigned long pending_from;
+    bytearray_t literal;
+} bps_composer_t;
+
+#define sign(b) ((b & 1 ? -1 : +1) * (b >> 1))
+
+static void bps_compose_push_relative(writer_t *w, unsigned long from, unsigned long *rel)
+{
+    unsigned long delta = from - *rel;
+    writer_push_vle(w, (long)delta < 0 ? (0 - delta) << 1 | 1 : delta << 1);
+}
+
+static void bps_compose_flush(bps_composer_t *k)
+{
+    unsigned long length = k->pending_length;
+
+    if (k->pending == BPS_COMPOSE_NONE)
+        return;
+
+    switch (k->pending)
+    {
+    case BPS_SOURCE_COPY:
+        // A source copy of the bytes right under the output is a source read.
+        if (k->pending_from == k->written)
+        {
+            writer_push_vle(&k->w, (length - 1) << 2 | BPS_SOURCE_READ);
+            break;
+        }
+
+        writer_push_vle(&k->w, (length - 1) << 2 | BPS_SOURCE_COPY);
+        bps_compose_push_relative(&k->w, k->pending_from, &k->source_rel);
+        k->source_rel = k->pending_from + length;
+        break;
+
+    case BPS_TARGET_READ:
+        writer_push_vle(&k->w, (length - 1) << 2 | BPS_TARGET_READ);
+        writer_push_data(&k->w, k->literal.data, length);
+        k->literal.size = 0;
+        break;
+
+    case BPS_TARGET_COPY:
+        writer_push_vle(&k->w, (length - 1) << 2 | BPS_TARGET_COPY);
+        bps_compose_push_relative(&k->w, k->pending_from, &k->target_rel);
+        k->target_rel = k->pending_from + length;
+        break;
+    }
+
+    k->written += length;
+    k->pending = BPS_COMPOSE_NONE;
+    k->pending_length = 0;
+}
+
+// Queues a copy, extending the pending one when it reads on from it.
+static void bps_compose_copy(bps_composer_t *k, unsigned char action, unsigned long from, unsigned long length)
+{
+    if (k->pending != action || k->pending_from + k->pending_length != from)
+    {
+        bps_compose_flush(k);
+        k->pending = action;
+        k->pending_from = from;
+    }
+
+    k->pending_length += length;
+}
+
+// Queues literal bytes, zeros when data is NULL.
+static void bps_compose_literal(bps_composer_t *k, const unsigned char *data, unsigned long length)
+{
+    while (length)
+    {
+        if (k->pending != BPS_TARGET_READ || k->literal.size == BPS_COMPOSE_LITERAL)
+        {
+            bps_compose_flush(k);
+            k->pending = BPS_TARGET_READ;
+        }
+
+        unsigned long n = BPS_COMPOSE_LITERAL - k->literal.size;
+        if (n > length)
+            n = length;
+
+        unsigned char *p = bytearray_extend(&k->literal, n);
+
+        if (p && data)
+            memcpy(p, data, n);
+        else if (p)
+            memset(p, 0, n);
+
+        k->pending_length += n;
+        data = data ? data + n : NULL;
+        length -= n;
+    }
+}
+
+// Input bytes of the first patch, zero past its end.
+static void bps_compose_source(bps_composer_t *k, unsigned long from, unsigned long length)
+{
+    unsigned long inside = from < k->source_size ? k->source_size - from : 0;
+
+    if (inside > length)
+        inside = length;
+
+    if (inside)
+        bps_compose_copy(k, BPS_SOURCE_COPY, from, inside);
+
+    if (length > inside)
+        bps_compose_literal(k, NULL, length - inside);
+}
+
+static int bps_compose_push(bps_composer_t *k, unsigned long offset, unsigned long length)
+{
+    if (k->range_count == k->range_capacity)
+    {
+        unsigned long capacity = k->range_capacity ? k->range_capacity * 2 : 64;
+        bps_compose_range_t *ranges = realloc(k->ranges, capacity * sizeof(bps_compose_range_t));
+
+        if (!ranges)
+            return 0;
+
+        k->ranges = ranges;
+        k->range_capacity = capacity;
+    }
+
+    bps_compose_range_t *r = &k->ranges[k->range_count++];
+    r->offset = r->start = offset;
+    r->length = length;
+    r->position = k->written + k->pending_length;
+    return 1;
+}
+
+// Emits the first patch's output [offset, offset + length) in terms of its
+// input and its literal bytes. Target copies of bytes a range already
+// emitted become target copies of the composed output, earlier ones are
+// emitted first as a range of their own. Chains of copies can run
+// thousands deep, so ranges wait on a stack instead of recursing.
+static int bps_compose_resolve(bps_composer_t *k, unsigned long offset, unsigned long length)
+{
+    if (!bps_compose_push(k, offset, length))
+        return CREATE_ERROR("Not enough memory to compose the patches.");
+
+    while (k->range_count)
+    {
+        bps_compose_range_t *r = &k->ranges[k->range_count - 1];
+
+        if (!r->length)
+        {
+            k->range_count--;
+            continue;
+        }
+
+        // Last segment starting at or before the range.
+        unsigned long lo = 0, hi = k->count;
+
+        while (lo < hi)
+        {
+            unsigned long mid = lo + (hi - lo) / 2;
+
+            if (k->segments[mid].output <= r->offset)
+                lo = mid + 1;
+            else
+                hi = mid;
+        }
+
+        const bps_segment_t *seg = lo ? &k->segments[lo - 1] : NULL;
+
+        // Past the last action, or past the end of the output, reads as zero.
+        if (!seg || r->offset >= seg->output + seg->length)
+        {
+            bps_compose_literal(k, NULL, r->length);
+            k->range_count--;
+            continue;
+        }
+
+        unsigned long skip = r->offset - seg->output;
+        unsigned long n = seg->length - skip < r->length ? seg->length - skip : r->length;
+
+        switch (seg->action)
+        {
+        case BPS_SOURCE_READ:
+            bps_compose_source(k, r->offset, n);
+            break;
+
+        case BPS_SOURCE_COPY:
+            bps_compose_source(k, seg->from + skip, n);
+            break;
+
+        case BPS_TARGET_READ:
+        {
+            unsigned long at = seg->from + skip;
+            unsigned long avail = at < k->first_size ? k->first_size - at : 0;
+
+            if (avail > n)
+                avail = n;
+
+            bps_compose_literal(k, k->first + at, avail);
+            bps_compose_literal(k, NULL, n - avail);
+            break;
+        }
+
+        case BPS_TARGET_COPY:
+        {
+            unsigned long from = r->offset - (seg->output - seg->from);
+
+            if (from >= r->start)
+            {
+                bps_compose_copy(k, BPS_TARGET_COPY, r->position + (from - r->start), n);
+                break;
+            }
+
+            // Bytes from before the range go out first, then it carries on.
+            if (r->start - from < n)
+                n = r->start - from;
+
+            r->offset += n;
+            r->length -= n;
+
+            if (!bps_compose_push(k, from, n))
+                return CREATE_ERROR("Not enough memory to compose the patches.");
+
+            continue;
+        }
+        }
+
+        r->offset += n;
+        r->length -= n;
+    }
+
+    return CREATE_RET_SUCCESS;
+}
+
+// Walks the first patch's actions into segments, checking them like bps_apply.
+static int bps_compose_index(bps_composer_t *k, const filemap_t *patch_map)
+{
+    unsigned char *patch, *patchstart, *patchcrc;
+
+    if (patch_map->size < 19)
+        return CREATE_ERROR("Patch file is too small to be a BPS file.");
+
+    patch = patch_map->handle;
+    patchstart = patch;
+    patchcrc = patch + patch_map->size - 12;
+
+    if (memcmp(patch, "BPS1", 4) != 0)
+        return CREATE_ERROR("Invalid header for a BPS file.");
+
+    patch += 4;
+    k->first = patchstart;
+    k->first_size = patch_map->size;
+    k->source_size = readvint(&patch);
+    k->middle_size = readvint(&patch);
+
+    unsigned long metadata_size = readvint(&patch);
+    patch += metadata_size;
+
+    unsigned long capacity = 0, output_off = 0, source_rel_off = 0, target_rel_off = 0;
+
+    while (patch < patchcrc)
+    {
+        unsigned long data = readvint(&patch);
+        unsigned char action = data & 3;
+        unsigned long length = (data >> 2) + 1;
+
+        if (length > k->middle_size - output_off)
+            return CREATE_ERROR("BPS action writes past the end of the output.");
+
+        if (k->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 256;
+            bps_segment_t *segments = realloc(k->segments, capacity * sizeof(bps_segment_t));
+
+            if (!segments)
+                return CREATE_ERROR("Not enough memory to compose the patches.");
+
+            k->segments = segments;
+        }
+
+        bps_segment_t *seg = &k->segments[k->count++];
+        seg->output = output_off;
+        seg->length = length;
+        seg->action = action;
+        seg->from = 0;
+
+        switch (action)
+        {
+        case BPS_TARGET_READ:
+            seg->from = patch - patchstart;
+            patch = length < (unsigned long)(patchstart + k->first_size - patch) ? patch + length
+                                                                                  : patchstart + k->first_size;
+            break;
+
+        case BPS_SOURCE_COPY:
+            data = readvint(&patch);
+            source_rel_off += sign(data);
+            seg->from = source_rel_off;
+            source_rel_off += length;
+            break;
+
+        case BPS_TARGET_COPY:
+            data = readvint(&patch);
+            target_rel_off += sign(data);
+
+            if (target_rel_off >= output_off)
+                return CREATE_ERROR("BPS target copy reads past the written output.");
+
+            seg->from = target_rel_off;
+            target_rel_off += length;
+            break;
+        }
+
+        output_off += length;
+    }
+
+    return CREATE_RET_SUCCESS;
+}
+
+// Walks the second patch, passing its literals and target copies through
+// and resolving every read of its input through the first patch.
+static int bps_compose_write(bps_composer_t *k, const filemap_t *first, const filemap_t *second)
+{
+    unsigned char *patch, *patchend, *patchcrc;
+
+    if (second->size < 19)
+        return CREATE_ERROR("Patch file is too small to be a BPS file.");
+
+    patch = second->handle;
+    patchend = patch + second->size;
+    patchcrc = patchend - 12;
+
+    if (memcmp(patch, "BPS1", 4) != 0)
+        return CREATE_ERROR("Invalid header for a BPS file.");
+
+    patch += 4;
+    unsigned long middle_size = readvint(&patch);
+    unsigned long output_size = readvint(&patch);
+    unsigned char *metadata = patch;
+    unsigned long metadata_size = readvint(&patch);
+
+    if (metadata_size > (unsigned long)(patchcrc - patch))
+        return CREATE_ERROR("BPS metadata runs past the end of the patch.");
+
+    patch += metadata_size;
+
+    if (middle_size != k->middle_size)
+        gible_warn("The second patch expects a %lu byte input, the first one outputs %lu bytes.", middle_size,
+            k->middle_size);
+
+    if (read32le(patchcrc) != read32le(first->handle + first->size - 8))
+        gible_warn("The second patch does not apply to the output of the first one.");
+
+    writer_push_string(&k->w, "BPS1");
+    writer_push_vle(&k->w, k->source_size);
+    writer_push_vle(&k->w, output_size);
+    writer_push_data(&k->w, metadata, patch - metadata); // The second patch's metadata describes the result
+
+    unsigned long output_off = 0, source_rel_off = 0, target_rel_off = 0;
+
+    while (patch < patchcrc)
+    {
+        unsigned long data = readvint(&patch);
+        unsigned char action = data & 3;
+        unsigned long length = (data >> 2) + 1;
+        int return_code = CREATE_RET_SUCCESS;
+
+        if (length > output_size - output_off)
+            return CREATE_ERROR("BPS action writes past the end of the output.");
+
+        switch (action)
+        {
+        case BPS_SOURCE_READ:
+            return_code = bps_compose_resolve(k, output_off, length);
+            break;
+
+        case BPS_TARGET_READ:
+        {
+            unsigned long avail = length < (unsigned long)(patchend - patch) ? length : (unsigned long)(patchend - patch);
+            bps_compose_literal(k, patch, avail);
+            bps_compose_literal(k, NULL, length - avail);
+            patch += avail;
+            break;
+        }
+
+        case BPS_SOURCE_COPY:
+            data = readvint(&patch);
+            source_rel_off += sign(data);
+            return_code = bps_compose_resolve(k, source_rel_off, length);
+            source_rel_off += length;
+            break;
+
+        case BPS_TARGET_COPY:
+            data = readvint(&patch);
+            target_rel_off += sign(data);
+
+            if (target_rel_off >= output_off)
+                return CREATE_ERROR("BPS target copy reads past the written output.");
+
+            bps_compose_copy(k, BPS_TARGET_COPY, target_rel_off, length);
+            target_rel_off += length;
+            break;
+        }
+
+        if (return_code != CREATE_RET_SUCCESS)
+            return return_code;
+
+        output_off += length;
+    }
+
+    bps_compose_flush(k);
+
+    if (k->literal.failed)
+        return CREATE_ERROR("Not enough memory to compose the patches.");
+
+    // The input of the first patch and the output of the second.
+    writer_push_le32(&k->w, read32le(first->handle + first->size - 12));
+    writer_push_le32(&k->w, read32le(patchcrc + 4));
+    writer_push_le32(&k->w, writer_crc32(&k->w));
+
+    return CREATE_RET_SUCCESS;
+}
+
+#undef sign
+
+static int bps_compose(filemap_t *first, filemap_t *second, filemap_t *output)
+{
+    bps_composer_t k;
+    memset(&k, 0, sizeof(bps_composer_t));
+    k.pending = BPS_COMPOSE_NONE;
+    k.literal = bytearray_new();
+
+    int return_code = bps_compose_index(&k, first);
+
+    if (return_code == CREATE_RET_SUCCESS && !writer_open(&k.w, output))
+        return_code = CREATE_RET_INVALID_OUTPUT;
+    else if (return_code == CREATE_RET_SUCCESS)
+    {
+        return_code = bps_compose_write(&k, first, second);
+
+        if (return_code != CREATE_RET_SUCCESS)
+            writer_abort(&k.w);
+        else if (!writer_finish(&k.w))
+            return_code = CREATE_ERROR("Cannot write the patch.");
+    }
+
+    free(k.segments);
+    free(k.ranges);
+    bytearray_close(&k.literal);
+    return return_code;
 }
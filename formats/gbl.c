@@ -0,0 +1,1252 @@
+#include "helpers/bytearray.h"
+#include "helpers/crc32.h"
+#include "helpers/diff.h"
+#include "helpers/filemap.h"
+#include "helpers/format.h"
+#include "helpers/ops.h"
+#include "helpers/trace.h"
+#include "helpers/utils.h"
+#include "helpers/writer.h"
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* Gible's own block format, made to be applied on every core at once.
+ *
+ * The patch is the "GBL1" magic, the block payloads, an index with one
+ * fixed size entry per block and a fixed size footer, integers little
+ * endian. Each block rewrites its own range of the output from its payload
+ * and the input at the same offsets alone, so blocks decode independently
+ * and in any order. Output bytes outside every block are copied from the
+ * input, zero past its end.
+ *
+ * Index entry (GBL_ENTRY_SIZE):
+ *   u64 offset, u32 length        Output range, blocks sorted and disjoint
+ *   u8 type, u8 flags, u16 zero   GBL_BLOCK_*, GBL_FLAG_*
+ *   u64 data, u32 data_length     Payload in the patch
+ *   u32 crc                       Of the block's output, with GBL_FLAG_CRC
+ *
+ * Footer (GBL_FOOTER_SIZE):
+ *   u64 index, u32 count, u64 input size, u64 output size,
+ *   u32 input crc, u32 output crc, u32 crc of the patch before it */
+
+#define GBL_MAGIC "GBL1"
+#define GBL_ENTRY_SIZE 32
+#define GBL_FOOTER_SIZE 40
+// Longest output range one block covers.
+#define GBL_BLOCK_SIZE (256UL << 10)
+// Output bytes per thread below which another thread isn't worth it.
+#define GBL_MIN_SLICE (4UL << 20)
+#define GBL_MAX_THREADS 64
+
+enum gbl_block_type
+{
+    GBL_BLOCK_XOR, // Payload xor'ed with the input, one byte per output byte
+    GBL_BLOCK_SPARSE, // Pairs of vle skip and length then xor'ed bytes, skips copy the input
+    GBL_BLOCK_FILL, // One byte repeated over the block
+    GBL_BLOCK_TYPE_COUNT
+};
+
+#define GBL_FLAG_CRC (1 << 0)
+
+typedef struct gbl_block
+{
+    unsigned long offset;
+    unsigned long length;
+    unsigned long data; // Offset of the payload in the patch
+    unsigned long data_length;
+    unsigned char type;
+    unsigned char flags;
+    unsigned int crc;
+} gbl_block_t;
+
+typedef struct gbl_patch
+{
+    gbl_block_t *blocks; // NULL when only the footer was read
+    unsigned long count;
+    unsigned long index; // Offset of the index in the patch
+    unsigned long input_size;
+    unsigned long output_size;
+    unsigned int input_crc;
+    unsigned int output_crc;
+    unsigned int patch_crc;
+} gbl_patch_t;
+
+static int gbl_apply(patch_apply_context_t *c);
+static int gbl_verify(patch_apply_context_t *c);
+static int gbl_create(patch_create_context_t *c);
+static int gbl_view_open(patch_view_t *v);
+static int gbl_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length);
+static void gbl_view_close(patch_view_t *v);
+static int gbl_apply_input(const filemap_t *patch, unsigned int *crc, unsigned long *size);
+
+const patch_format_t gbl_format =
+{
+    .name = "GBL",
+    .header = GBL_MAGIC,
+    .ext = "gbl",
+    .apply_main = gbl_apply,
+    .create_main = gbl_create,
+    .apply_check = NULL,
+    .create_check = NULL,
+    .apply_verify = gbl_verify,
+    .view_open = gbl_view_open,
+    .view_read = gbl_view_read,
+    .view_close = gbl_view_close,
+    .apply_input = gbl_apply_input
+};
+
+// -------------------------------------------------
+// Shared
+// -------------------------------------------------
+
+static int gbl_read64(const unsigned char *p, unsigned long *value)
+{
+    uint64_t v = read32le(p) | (uint64_t)read32le(p + 4) << 32;
+    *value = v;
+    return v <= ULONG_MAX;
+}
+
+static void gbl_push64(writer_t *w, uint64_t value)
+{
+    writer_push_le32(w, (unsigned int)value);
+    writer_push_le32(w, (unsigned int)(value >> 32));
+}
+
+// Same encoding as readvint, but never reads past end.
+static int gbl_vle(const unsigned char **p, const unsigned char *end, unsigned long *value)
+{
+    unsigned long result = 0, shift = 0;
+
+    while (*p < end && shift < sizeof(unsigned long) * 8)
+    {
+        unsigned char octet = *(*p)++;
+
+        if (octet & 0x80)
+        {
+            *value = result + ((unsigned long)(octet & 0x7f) << shift);
+            return 1;
+        }
+
+        result += (unsigned long)(octet | 0x80) << shift;
+        shift += 7;
+    }
+
+    return 0;
+}
+
+static unsigned long gbl_threads(unsigned long bytes)
+{
+    unsigned long threads = cpu_count();
+
+    if (threads > GBL_MAX_THREADS)
+        threads = GBL_MAX_THREADS;
+    if (threads > bytes / GBL_MIN_SLICE)
+        threads = bytes / GBL_MIN_SLICE;
+
+    return threads ? threads : 1;
+}
+
+// Runs worker over count items of size bytes each, the calling thread
+// taking the first, and any thread that cannot start running inline.
+static void gbl_run(void *(*worker)(void *), void *items, size_t size, unsigned long count)
+{
+    pthread_t handles[GBL_MAX_THREADS];
+    int started[GBL_MAX_THREADS];
+
+    for (unsigned long i = 1; i < count; ++i)
+        started[i] = pthread_create(&handles[i], NULL, worker, (char *)items + i * size) == 0;
+
+    if (count)
+        worker(items);
+
+    for (unsigned long i = 1; i < count; ++i)
+    {
+        if (started[i])
+            pthread_join(handles[i], NULL);
+        else
+            worker((char *)items + i * size);
+    }
+}
+
+typedef struct gbl_crc_chunk
+{
+    const unsigned char *data;
+    unsigned long length;
+    unsigned int crc;
+} gbl_crc_chunk_t;
+
+static void *gbl_crc_worker(void *arg)
+{
+    gbl_crc_chunk_t *chunk = arg;
+    chunk->crc = crc32(chunk->data, chunk->length, 0);
+    return NULL;
+}
+
+// CRC32 of large buffers in slices hashed in parallel and combined.
+static unsigned int gbl_crc32(const unsigned char *data, unsigned long size)
+{
+    gbl_crc_chunk_t chunks[GBL_MAX_THREADS];
+    unsigned long threads = gbl_threads(size), slice = size / threads;
+
+    for (unsigned long i = 0; i < threads; ++i)
+    {
+        chunks[i].data = data + i * slice;
+        chunks[i].length = i == threads - 1 ? size - i * slice : slice;
+    }
+
+    gbl_run(gbl_crc_worker, chunks, sizeof(gbl_crc_chunk_t), threads);
+
+    unsigned int crc = chunks[0].crc;
+
+    for (unsigned long i = 1; i < threads; ++i)
+        crc = crc32_combine(crc, chunks[i].crc, chunks[i].length);
+
+    return crc;
+}
+
+// filemap_crc32 through gbl_crc32, seeding the map's cache the same way.
+static unsigned int gbl_filemap_crc32(filemap_t *f, unsigned long size)
+{
+    // Archives come with their checksum, the prefix one waits for its bytes.
+    if (size >= f->size)
+        filemap_finish(f);
+    else
+        filemap_wait(f, size);
+
+    if (size >= f->size && f->has_crc)
+        return f->crc;
+
+    if (size < f->size)
+        return gbl_crc32(f->handle, size);
+
+    f->crc = gbl_crc32(f->handle, f->size);
+    f->has_crc = 1;
+    return f->crc;
+}
+
+static void gbl_close(gbl_patch_t *g)
+{
+    free(g->blocks);
+    memset(g, 0, sizeof(gbl_patch_t));
+}
+
+// Reads the footer, and with blocks set the index too, checking that every
+// block lies within the output and its payload within the patch.
+static int gbl_open(const filemap_t *patch, gbl_patch_t *g, int blocks)
+{
+    const unsigned char *p = patch->handle;
+    unsigned long size = patch->size;
+
+    memset(g, 0, sizeof(gbl_patch_t));
+
+    if (size < strlen(GBL_MAGIC) + GBL_FOOTER_SIZE || memcmp(p, GBL_MAGIC, strlen(GBL_MAGIC)) != 0)
+        return APPLY_ERROR("Invalid header for a GBL file.");
+
+    const unsigned char *footer = p + size - GBL_FOOTER_SIZE;
+    g->count = read32le(footer + 8);
+    g->input_crc = read32le(footer + 28);
+    g->output_crc = read32le(footer + 32);
+    g->patch_crc = read32le(footer + 36);
+
+    if (!gbl_read64(footer, &g->index) || !gbl_read64(footer + 12, &g->input_size) ||
+        !gbl_read64(footer + 20, &g->output_size))
+        return APPLY_ERROR("GBL file is too large for this platform.");
+
+    unsigned long entries = size - GBL_FOOTER_SIZE;
+
+    if (g->index < strlen(GBL_MAGIC) || g->index > entries || (entries - g->index) / GBL_ENTRY_SIZE != g->count ||
+        (entries - g->index) % GBL_ENTRY_SIZE)
+        return APPLY_ERROR("Invalid index for a GBL file.");
+
+    if (!blocks || !g->count)
+        return APPLY_RET_SUCCESS;
+
+    g->blocks = malloc(g->count * sizeof(gbl_block_t));
+
+    if (!g->blocks)
+        return APPLY_ERROR("Not enough memory to read the GBL index.");
+
+    unsigned long end = 0;
+
+    for (unsigned long i = 0; i < g->count; ++i)
+    {
+        const unsigned char *entry = p + g->index + i * GBL_ENTRY_SIZE;
+        gbl_block_t *b = &g->blocks[i];
+
+        b->length = read32le(entry + 8);
+        b->type = entry[12];
+        b->flags = entry[13];
+        b->data_length = read32le(entry + 24);
+        b->crc = read32le(entry + 28);
+
+        int valid = gbl_read64(entry, &b->offset) && gbl_read64(entry + 16, &b->data);
+
+        valid = valid && b->type < GBL_BLOCK_TYPE_COUNT && b->length && b->offset >= end &&
+            b->offset <= g->output_size && b->length <= g->output_size - b->offset;
+        valid = valid && b->data >= strlen(GBL_MAGIC) && b->data <= g->index && b->data_length <= g->index - b->data;
+        valid = valid && (b->type != GBL_BLOCK_XOR || b->data_length == b->length);
+        valid = valid && (b->type != GBL_BLOCK_FILL || b->data_length == 1);
+
+        if (!valid)
+        {
+            gbl_close(g);
+            return APPLY_ERROR("Block %lu of the GBL index is invalid.", i);
+        }
+
+        end = b->offset + b->length;
+    }
+
+    return APPLY_RET_SUCCESS;
+}
+
+// Index of the first block ending after offset.
+static unsigned long gbl_seek(const gbl_patch_t *g, unsigned long offset)
+{
+    unsigned long lo = 0, hi = g->count;
+
+    while (lo < hi)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
+
+        if (g->blocks[mid].offset + g->blocks[mid].length <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+static int gbl_apply_input(const filemap_t *patch, unsigned int *crc, unsigned long *size)
+{
+    gbl_patch_t g;
+    const unsigned char *p = patch->handle;
+
+    // Quietly, callers only ask whether the patch records its input.
+    if (patch->size < strlen(GBL_MAGIC) + GBL_FOOTER_SIZE || memcmp(p, GBL_MAGIC, strlen(GBL_MAGIC)) != 0)
+        return 0;
+
+    if (gbl_open(patch, &g, 0) != APPLY_RET_SUCCESS)
+        return 0;
+
+    *crc = g.input_crc;
+    *size = g.input_size;
+    return 1;
+}
+
+// -------------------------------------------------
+// Patch Application
+// -------------------------------------------------
+
+// A run of whole blocks and the gaps around them, applied by one thread.
+typedef struct gbl_slice
+{
+    const gbl_patch_t *g;
+    const patch_apply_context_t *c;
+    unsigned long first, last; // Blocks [first, last)
+    unsigned long start, end; // Output range
+    int check; // Checksums the output and the blocks carrying a crc
+    unsigned long long *done; // Output bytes written by every slice, for progress
+
+    unsigned int crc; // Of the output range
+    unsigned long mismatched; // Blocks whose crc differs
+    unsigned long first_mismatch; // Offset of the first of those
+    int corrupt;
+    int unreadable; // The input failed to inflate
+    unsigned char *scratch; // Holds one block at a time when verifying
+} gbl_slice_t;
+
+// Queues the ops rebuilding block b at offset at of the output, 0 when its
+// payload is malformed.
+static int gbl_block_ops(patch_ops_t *ops, const gbl_block_t *b, const unsigned char *patch, unsigned long at)
+{
+    const unsigned char *data = patch + b->data, *end = data + b->data_length;
+    unsigned long position = 0, skip, length;
+
+    switch (b->type)
+    {
+    case GBL_BLOCK_XOR:
+        patch_ops_xor_input(ops, at, b->offset, data, b->length);
+        return 1;
+
+    case GBL_BLOCK_FILL:
+        patch_ops_fill(ops, at, *data, b->length);
+        return 1;
+
+    case GBL_BLOCK_SPARSE:
+        while (data < end)
+        {
+            if (!gbl_vle(&data, end, &skip) || !gbl_vle(&data, end, &length))
+                return 0;
+
+            if (skip > b->length - position || length > b->length - position - skip ||
+                length > (unsigned long)(end - data))
+                return 0;
+
+            patch_ops_copy_input(ops, at + position, b->offset + position, skip);
+            position += skip;
+            patch_ops_xor_input(ops, at + position, b->offset + position, data, length);
+            position += length;
+            data += length;
+        }
+
+        patch_ops_copy_input(ops, at + position, b->offset + position, b->length - position);
+        return 1;
+    }
+
+    return 0;
+}
+
+static void *gbl_apply_slice(void *arg)
+{
+    gbl_slice_t *s = arg;
+    const patch_apply_context_t *c = s->c;
+    unsigned char *output = c->output.handle;
+    int reporter = s->start == 0;
+    unsigned long long next_progress = reporter ? progress_start(c->progress, s->g->output_size) : PROGRESS_NEVER;
+    double traced = trace_begin();
+
+    patch_ops_t ops;
+    patch_ops_init(&ops, c->input.handle, c->input.size, output, s->g->output_size);
+    ops.input_map = &c->input;
+
+    unsigned long position = s->start;
+    s->crc = 0;
+
+    for (unsigned long i = s->first; i <= s->last; ++i)
+    {
+        const gbl_block_t *b = i < s->last ? &s->g->blocks[i] : NULL;
+        unsigned long gap_end = b ? b->offset : s->end;
+
+        // Unchanged bytes before the block.
+        patch_ops_copy_input(&ops, position, position, gap_end - position);
+        patch_ops_flush(&ops);
+
+        if (s->check)
+            s->crc = crc32(output + position, gap_end - position, s->crc);
+
+        unsigned long long done = __atomic_add_fetch(s->done, gap_end - position, __ATOMIC_RELAXED);
+
+        if (!b)
+            break;
+
+        if (!gbl_block_ops(&ops, b, c->patch.handle, b->offset))
+        {
+            s->corrupt = 1;
+            break;
+        }
+
+        patch_ops_flush(&ops);
+        position = b->offset + b->length;
+
+        if (s->check)
+        {
+            unsigned int crc = crc32(output + b->offset, b->length, 0);
+
+            if ((b->flags & GBL_FLAG_CRC) && crc != b->crc && !s->mismatched++)
+                s->first_mismatch = b->offset;
+
+            s->crc = crc32_combine(s->crc, crc, b->length);
+        }
+
+        done = __atomic_add_fetch(s->done, b->length, __ATOMIC_RELAXED);
+
+        if (reporter)
+            progress_tick(c->progress, next_progress, done);
+    }
+
+    s->unreadable = !patch_ops_finish(&ops);
+    trace_end("gbl slice", NULL, traced);
+    return NULL;
+}
+
+// gbl_apply_slice without an output, gaps are hashed straight from the input
+// and each block is rebuilt in the slice's scratch buffer.
+static void *gbl_verify_slice(void *arg)
+{
+    gbl_slice_t *s = arg;
+    const patch_apply_context_t *c = s->c;
+    const unsigned char *input = c->input.handle;
+    unsigned long input_size = c->input.size, position = s->start;
+
+    patch_ops_t ops;
+    s->crc = 0;
+
+    for (unsigned long i = s->first; i <= s->last; ++i)
+    {
+        const gbl_block_t *b = i < s->last ? &s->g->blocks[i] : NULL;
+        unsigned long gap_end = b ? b->offset : s->end;
+
+        // Unchanged bytes before the block, zero past the end of the input.
+        unsigned long copied = gap_end < input_size ? gap_end : input_size;
+        copied = copied > position ? copied - position : 0;
+        s->crc = crc32(input + position, copied, s->crc);
+        s->crc = crc32_fill(0, gap_end - position - copied, s->crc);
+
+        if (!b)
+            break;
+
+        patch_ops_init(&ops, input, input_size, s->scratch, b->length);
+        ops.input_map = &c->input;
+
+        if (!gbl_block_ops(&ops, b, c->patch.handle, 0))
+        {
+            s->corrupt = 1;
+            break;
+        }
+
+        if (!patch_ops_finish(&ops))
+        {
+            s->unreadable = 1;
+            break;
+        }
+
+        unsigned int crc = crc32(s->scratch, b->length, 0);
+
+        if ((b->flags & GBL_FLAG_CRC) && crc != b->crc && !s->mismatched++)
+            s->first_mismatch = b->offset;
+
+        s->crc = crc32_combine(s->crc, crc, b->length);
+        position = b->offset + b->length;
+    }
+
+    return NULL;
+}
+
+// Splits the output into one range per thread, moving each cut back to the
+// start of the block it falls in so no block is shared.
+static unsigned long gbl_apply_slices(const gbl_patch_t *g, const patch_apply_context_t *c, int check,
+    unsigned long long *done, gbl_slice_t *slices)
+{
+    unsigned long threads = gbl_threads(g->output_size), count = 0, start = 0;
+
+    for (unsigned long i = 1; i <= threads; ++i)
+    {
+        unsigned long end = i == threads ? g->output_size : g->output_size / threads * i;
+        unsigned long block = gbl_seek(g, end);
+
+        if (i < threads && block < g->count && g->blocks[block].offset < end)
+            end = g->blocks[block].offset;
+
+        if (end <= start && i < threads)
+            continue;
+
+        gbl_slice_t *s = &slices[count++];
+        memset(s, 0, sizeof(gbl_slice_t));
+        s->g = g;
+        s->c = c;
+        s->check = check;
+        s->done = done;
+        s->start = start;
+        s->end = end;
+        s->first = gbl_seek(g, start);
+        s->last = gbl_seek(g, end);
+
+        start = end;
+    }
+
+    return count;
+}
+
+static int gbl_apply(patch_apply_context_t *c)
+{
+#define check_crc32(a, err) \
+    c->crc_known |= FLAG_##a, c->crc_stored |= FLAG_##a; \
+    if ((scrc[a] != acrc[a])) \
+    { \
+        if ((flags->strict_crc & FLAG_##a)) \
+        { \
+            gbl_close(&g); \
+            return APPLY_ERROR(err); \
+        } \
+        else \
+        { \
+            (gible_warn(err)); \
+        } \
+    }
+
+    const apply_flags_t *flags = c->flags;
+
+    unsigned int *acrc = c->crc;
+    unsigned int *scrc = c->expected_crc;
+
+    c->crc_known = c->crc_stored = 0;
+
+    gbl_patch_t g;
+    int return_code = gbl_open(&c->patch, &g, 1);
+
+    if (return_code != APPLY_RET_SUCCESS)
+        return return_code;
+
+    if (~flags->ignore_crc & FLAG_CRC_PATCH)
+    {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
+        scrc[CRC_PATCH] = g.patch_crc;
+        acrc[CRC_PATCH] = gbl_crc32(c->patch.handle, c->patch.size - 4);
+        stats_phase_end(c->stats);
+        check_crc32(CRC_PATCH, "Patch CRCs don't match.");
+    }
+
+    if (c->input.size != g.input_size)
+        gible_info("Input file sizes don't match.");
+
+    if (~flags->ignore_crc & FLAG_CRC_INPUT)
+    {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
+        scrc[CRC_INPUT] = g.input_crc;
+        acrc[CRC_INPUT] = gbl_filemap_crc32(&c->input, g.input_size);
+        stats_phase_end(c->stats);
+        check_crc32(CRC_INPUT, "Input CRCs don't match.");
+    }
+
+    if (!filemap_create(&c->output, g.output_size))
+    {
+        gbl_close(&g);
+        return APPLY_RET_INVALID_OUTPUT;
+    }
+
+    int check = ~flags->ignore_crc & FLAG_CRC_OUTPUT;
+    unsigned long long done = 0;
+    gbl_slice_t slices[GBL_MAX_THREADS];
+    unsigned long count = gbl_apply_slices(&g, c, check, &done, slices);
+
+    gbl_run(gbl_apply_slice, slices, sizeof(gbl_slice_t), count);
+    progress_finish(c->progress);
+
+    unsigned int crc = 0;
+    unsigned long mismatched = 0, first_mismatch = 0;
+
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        if (slices[i].corrupt)
+        {
+            gbl_close(&g);
+            return APPLY_ERROR("GBL block payload is corrupt.");
+        }
+
+        if (slices[i].unreadable)
+        {
+            gbl_close(&g);
+            return APPLY_ERROR("Cannot decompress the input.");
+        }
+
+        if (slices[i].mismatched && !mismatched)
+            first_mismatch = slices[i].first_mismatch;
+
+        mismatched += slices[i].mismatched;
+        crc = i ? crc32_combine(crc, slices[i].crc, slices[i].end - slices[i].start) : slices[i].crc;
+    }
+
+    for (unsigned long i = 0; i < g.count; ++i)
+    {
+        stats_count(c->stats, STATS_GBL_BLOCK, g.blocks[i].data_length);
+
+        if (c->touched)
+            diff_runs_add(c->touched, g.blocks[i].offset, g.blocks[i].offset + g.blocks[i].length);
+    }
+
+    // Past the end of the input the gaps read as zero instead.
+    if (c->touched && g.output_size > c->input.size)
+        diff_runs_add(c->touched, c->input.size, g.output_size);
+
+    if (check)
+    {
+        if (mismatched)
+            gible_warn("%lu blocks don't match, the first at offset 0x%lx.", mismatched, first_mismatch);
+
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
+        c->output.crc = crc;
+        c->output.has_crc = 1;
+        scrc[CRC_OUTPUT] = g.output_crc;
+        acrc[CRC_OUTPUT] = patch_output_crc32(c);
+        stats_phase_end(c->stats);
+        check_crc32(CRC_OUTPUT, "Output CRCs don't match.");
+    }
+
+    gbl_close(&g);
+
+#undef check_crc32
+
+    return APPLY_RET_SUCCESS;
+}
+
+// Checksums the output gbl_apply would write, holding a block per thread.
+static int gbl_verify(patch_apply_context_t *c)
+{
+#define check_crc32(a, err) \
+    c->crc_known |= FLAG_##a, c->crc_stored |= FLAG_##a; \
+    if ((scrc[a] != acrc[a])) \
+    { \
+        if ((flags->strict_crc & FLAG_##a)) \
+        { \
+            gbl_close(&g); \
+            return APPLY_ERROR(err); \
+        } \
+        else \
+        { \
+            (gible_warn(err)); \
+        } \
+    }
+
+    const apply_flags_t *flags = c->flags;
+
+    unsigned int *acrc = c->crc;
+    unsigned int *scrc = c->expected_crc;
+
+    c->crc_known = c->crc_stored = 0;
+
+    gbl_patch_t g;
+    int return_code = gbl_open(&c->patch, &g, 1);
+
+    if (return_code != APPLY_RET_SUCCESS)
+        return return_code;
+
+    scrc[CRC_PATCH] = g.patch_crc;
+    acrc[CRC_PATCH] = gbl_crc32(c->patch.handle, c->patch.size - 4);
+    check_crc32(CRC_PATCH, "Patch CRCs don't match.");
+
+    if (c->input.size != g.input_size)
+        gible_info("Input file sizes don't match.");
+
+    scrc[CRC_INPUT] = g.input_crc;
+    acrc[CRC_INPUT] = gbl_filemap_crc32(&c->input, g.input_size);
+    check_crc32(CRC_INPUT, "Input CRCs don't match.");
+
+    unsigned long longest = 0;
+
+    for (unsigned long i = 0; i < g.count; ++i)
+    {
+        if (g.blocks[i].length > longest)
+            longest = g.blocks[i].length;
+    }
+
+    unsigned long long done = 0;
+    gbl_slice_t slices[GBL_MAX_THREADS];
+    unsigned long count = gbl_apply_slices(&g, c, 1, &done, slices);
+    unsigned char *scratch = longest ? malloc(count * longest) : NULL;
+
+    if (longest && !scratch)
+    {
+        gbl_close(&g);
+        return APPLY_ERROR("Not enough memory to verify the GBL file.");
+    }
+
+    for (unsigned long i = 0; i < count; ++i)
+        slices[i].scratch = scratch ? scratch + i * longest : NULL;
+
+    gbl_run(gbl_verify_slice, slices, sizeof(gbl_slice_t), count);
+    free(scratch);
+
+    unsigned int crc = 0;
+    unsigned long mismatched = 0, first_mismatch = 0;
+
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        if (slices[i].corrupt)
+        {
+            gbl_close(&g);
+            return APPLY_ERROR("GBL block payload is corrupt.");
+        }
+
+        if (slices[i].unreadable)
+        {
+            gbl_close(&g);
+            return APPLY_ERROR("Cannot decompress the input.");
+        }
+
+        if (slices[i].mismatched && !mismatched)
+            first_mismatch = slices[i].first_mismatch;
+
+        mismatched += slices[i].mismatched;
+        crc = i ? crc32_combine(crc, slices[i].crc, slices[i].end - slices[i].start) : slices[i].crc;
+    }
+
+    if (mismatched)
+        gible_warn("%lu blocks don't match, the first at offset 0x%lx.", mismatched, first_mismatch);
+
+    scrc[CRC_OUTPUT] = g.output_crc;
+    acrc[CRC_OUTPUT] = crc;
+    check_crc32(CRC_OUTPUT, "Output CRCs don't match.");
+
+    gbl_close(&g);
+
+#undef check_crc32
+
+    return APPLY_RET_SUCCESS;
+}
+
+// -------------------------------------------------
+// Patched View
+// -------------------------------------------------
+
+static int gbl_view_open(patch_view_t *v)
+{
+    gbl_patch_t *g = malloc(sizeof(gbl_patch_t));
+
+    if (!g)
+        return APPLY_ERROR("Not enough memory to index the patch.");
+
+    int return_code = gbl_open(&v->patch, g, 1);
+
+    if (return_code != APPLY_RET_SUCCESS)
+    {
+        free(g);
+        return return_code;
+    }
+
+    v->index = g;
+    v->size = g->output_size;
+    v->expected_crc[CRC_INPUT] = g->input_crc;
+    v->expected_crc[CRC_OUTPUT] = g->output_crc;
+    v->expected_crc[CRC_PATCH] = g->patch_crc;
+    v->crc_stored = FLAG_CRC_ALL;
+    return APPLY_RET_SUCCESS;
+}
+
+// Xors [from, to) of the block's changes over out, which holds the input
+// bytes of that range already.
+static int gbl_view_block(const gbl_block_t *b, const unsigned char *patch, unsigned long from, unsigned long to,
+    unsigned char *out)
+{
+    const unsigned char *data = patch + b->data, *end = data + b->data_length;
+    unsigned long position = b->offset, skip, length;
+
+    switch (b->type)
+    {
+    case GBL_BLOCK_XOR:
+        for (unsigned long at = from; at < to; ++at)
+            out[at - from] ^= data[at - b->offset];
+        return 1;
+
+    case GBL_BLOCK_FILL:
+        memset(out, *data, to - from);
+        return 1;
+
+    case GBL_BLOCK_SPARSE:
+        while (data < end && position < to)
+        {
+            if (!gbl_vle(&data, end, &skip) || !gbl_vle(&data, end, &length))
+                return 0;
+
+            unsigned long left = b->offset + b->length - position;
+
+            if (skip > left || length > left - skip || length > (unsigned long)(end - data))
+                return 0;
+
+            position += skip;
+
+            for (unsigned long at = position > from ? position : from; at < position + length && at < to; ++at)
+                out[at - from] ^= data[at - position];
+
+            position += length;
+            data += length;
+        }
+        return 1;
+    }
+
+    return 0;
+}
+
+static int gbl_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length)
+{
+    const gbl_patch_t *g = v->index;
+    unsigned long end = offset + length;
+
+    // Unchanged bytes come from the input, zero past its end.
+    unsigned long copied =
+        offset < v->input.size ? (v->input.size - offset < length ? v->input.size - offset : length) : 0;
+    if (copied)
+        memcpy(out, v->input.handle + offset, copied);
+
+    memset(out + copied, 0, length - copied);
+
+    for (unsigned long i = gbl_seek(g, offset); i < g->count && g->blocks[i].offset < end; ++i)
+    {
+        const gbl_block_t *b = &g->blocks[i];
+        unsigned long from = b->offset > offset ? b->offset : offset;
+        unsigned long to = b->offset + b->length < end ? b->offset + b->length : end;
+
+        if (!gbl_view_block(b, v->patch.handle, from, to, out + (from - offset)))
+            return APPLY_ERROR("GBL block payload is corrupt.");
+    }
+
+    return APPLY_RET_SUCCESS;
+}
+
+static void gbl_view_close(patch_view_t *v)
+{
+    gbl_close(v->index);
+    free(v->index);
+}
+
+// -------------------------------------------------
+// Patch Creation
+// -------------------------------------------------
+
+// Blocks one thread encodes into its own payload buffer.
+typedef struct gbl_encoder
+{
+    gbl_block_t *blocks;
+    unsigned long count;
+    const diff_runs_t *runs;
+    unsigned long hint; // First run ending after the first block
+    const unsigned char *patched;
+    const unsigned char *base;
+    unsigned long base_size;
+    unsigned long long *done; // Patched bytes encoded by every encoder, for progress
+    progress_t *progress; // Only the first encoder reports
+    bytearray_t payload;
+
+    // With hash set, the crc of the patched range [start, end) is put
+    // together from the block crcs and the gaps between them.
+    int hash;
+    unsigned long start, end;
+    unsigned int crc;
+} gbl_encoder_t;
+
+static unsigned long gbl_vle_size(unsigned long value)
+{
+    unsigned long size = 1;
+
+    for (; value >= 0x80; value = (value >> 7) - 1)
+        size++;
+
+    return size;
+}
+
+// Xors [from, to) of the patched file with the base into out, the base
+// reading as zero past its end. Plain loop the compiler vectorises.
+static void gbl_xor(unsigned char *restrict out, const gbl_encoder_t *e, unsigned long from, unsigned long to)
+{
+    unsigned long split = to < e->base_size ? to : (from > e->base_size ? from : e->base_size);
+    const unsigned char *restrict patched = e->patched;
+    const unsigned char *restrict base = e->base;
+
+    for (unsigned long at = from; at < split; ++at)
+        *out++ = patched[at] ^ base[at];
+
+    memcpy(out, patched + split, to - split);
+}
+
+// Picks the smallest encoding of block b from the runs inside it, appends
+// its payload and fills in the type, crc and the payload's offset within
+// this encoder's buffer.
+static void gbl_encode_block(gbl_encoder_t *e, gbl_block_t *b)
+{
+    const unsigned char *patched = e->patched + b->offset;
+    unsigned long end = b->offset + b->length;
+
+    b->flags = GBL_FLAG_CRC;
+    b->crc = crc32(patched, b->length, 0);
+    b->data = e->payload.size;
+
+    if (b->length > 1 && patched[0] == patched[b->length - 1] && memcmp(patched, patched + 1, b->length - 1) == 0)
+    {
+        b->type = GBL_BLOCK_FILL;
+        b->data_length = 1;
+        bytearray_push(&e->payload, patched[0]);
+        return;
+    }
+
+    unsigned long first = e->hint = diff_runs_seek(e->runs, e->hint, b->offset);
+    unsigned long sparse = 0, position = b->offset;
+
+    for (unsigned long i = first; i < e->runs->count && e->runs->runs[i].start < end; ++i)
+    {
+        unsigned long from = e->runs->runs[i].start > position ? e->runs->runs[i].start : position;
+        unsigned long to = e->runs->runs[i].end < end ? e->runs->runs[i].end : end;
+
+        sparse += gbl_vle_size(from - position) + gbl_vle_size(to - from) + (to - from);
+        position = to;
+    }
+
+    if (sparse < b->length)
+    {
+        b->type = GBL_BLOCK_SPARSE;
+        position = b->offset;
+
+        for (unsigned long i = first; i < e->runs->count && e->runs->runs[i].start < end; ++i)
+        {
+            unsigned long from = e->runs->runs[i].start > position ? e->runs->runs[i].start : position;
+            unsigned long to = e->runs->runs[i].end < end ? e->runs->runs[i].end : end;
+
+            bytearray_push_vle(&e->payload, from - position);
+            bytearray_push_vle(&e->payload, to - from);
+
+            unsigned char *hunk = bytearray_extend(&e->payload, to - from);
+            if (hunk)
+                gbl_xor(hunk, e, from, to);
+
+            position = to;
+        }
+    }
+    else
+    {
+        b->type = GBL_BLOCK_XOR;
+
+        unsigned char *hunk = bytearray_extend(&e->payload, b->length);
+        if (hunk)
+            gbl_xor(hunk, e, b->offset, end);
+    }
+
+    b->data_length = e->payload.size - b->data;
+}
+
+static void *gbl_encode_worker(void *arg)
+{
+    gbl_encoder_t *e = arg;
+    unsigned long long next_progress = e->progress ? 0 : PROGRESS_NEVER;
+    unsigned long position = e->start;
+    double traced = trace_begin();
+
+    e->crc = 0;
+
+    for (unsigned long i = 0; i < e->count && !e->payload.failed; ++i)
+    {
+        const gbl_block_t *b = &e->blocks[i];
+        gbl_encode_block(e, &e->blocks[i]);
+
+        if (e->hash)
+        {
+            e->crc = crc32(e->patched + position, b->offset - position, e->crc);
+            e->crc = crc32_combine(e->crc, b->crc, b->length);
+            position = b->offset + b->length;
+        }
+
+        unsigned long long done = __atomic_add_fetch(e->done, e->blocks[i].length, __ATOMIC_RELAXED);
+
+        if (e->progress)
+            progress_tick(e->progress, next_progress, done);
+    }
+
+    if (e->hash)
+        e->crc = crc32(e->patched + position, e->end - position, e->crc);
+
+    trace_end("gbl encode", NULL, traced);
+    return NULL;
+}
+
+// Index of the first run ending after offset.
+static unsigned long gbl_first_run(const diff_runs_t *runs, unsigned long offset)
+{
+    unsigned long lo = 0, hi = runs->count;
+
+    while (lo < hi)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
+
+        if (runs->runs[mid].end <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// Cuts the changed runs into blocks of at most GBL_BLOCK_SIZE, each starting
+// at a change and ending with the last change it takes in.
+static gbl_block_t *gbl_layout(const diff_runs_t *runs, unsigned long *count)
+{
+    unsigned long capacity = 0;
+    gbl_block_t *blocks = NULL;
+
+    *count = 0;
+
+    for (unsigned long i = 0, start = runs->count ? runs->runs[0].start : 0; i < runs->count;)
+    {
+        unsigned long limit = start + GBL_BLOCK_SIZE, end = start;
+
+        while (i < runs->count && runs->runs[i].start < limit)
+        {
+            if (runs->runs[i].end > limit)
+            {
+                end = limit;
+                break;
+            }
+
+            end = runs->runs[i++].end;
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            gbl_block_t *grown = realloc(blocks, capacity * sizeof(gbl_block_t));
+
+            if (!grown)
+            {
+                free(blocks);
+                return NULL;
+            }
+
+            blocks = grown;
+        }
+
+        gbl_block_t *b = &blocks[(*count)++];
+        memset(b, 0, sizeof(gbl_block_t));
+        b->offset = start;
+        b->length = end - start;
+
+        // A run cut at the limit carries on in the next block.
+        start = i < runs->count ? (runs->runs[i].start > end ? runs->runs[i].start : end) : 0;
+    }
+
+    // Never NULL on success, even without blocks.
+    return blocks ? blocks : malloc(1);
+}
+
+static int gbl_create(patch_create_context_t *c)
+{
+    unsigned char *patched = c->patched.handle;
+    unsigned long patched_size = c->patched.size;
+
+    unsigned char *base = c->base.handle;
+    unsigned long base_size = c->base.size;
+
+    diff_runs_t runs;
+
+    stats_phase_begin(c->stats, STATS_PHASE_DIFF);
+    int scanned = diff_scan_candidates(&runs, patched, patched_size, base, base_size, c->candidates);
+    stats_phase_end(c->stats);
+
+    if (!scanned)
+        return CREATE_ERROR("Not enough memory to diff the files.");
+
+    unsigned long count;
+    gbl_block_t *blocks = gbl_layout(&runs, &count);
+
+    if (!blocks)
+    {
+        diff_runs_close(&runs);
+        return CREATE_ERROR("Not enough memory to lay out the blocks.");
+    }
+
+    unsigned long long total = 0, taken = 0, done = 0;
+
+    for (unsigned long i = 0; i < count; ++i)
+        total += blocks[i].length;
+
+    // Contiguous groups of blocks with about the same number of bytes each.
+    gbl_encoder_t encoders[GBL_MAX_THREADS];
+    unsigned long threads = gbl_threads(total), encoder_count = 0;
+
+    for (unsigned long i = 0; i < count || !encoder_count;)
+    {
+        gbl_encoder_t *e = &encoders[encoder_count++];
+        memset(e, 0, sizeof(gbl_encoder_t));
+        e->blocks = blocks + i;
+        e->runs = &runs;
+        e->hint = i < count ? gbl_first_run(&runs, blocks[i].offset) : 0;
+        e->patched = patched;
+        e->base = base;
+        e->base_size = base_size;
+        e->done = &done;
+        e->progress = encoder_count == 1 ? c->progress : NULL;
+        e->payload = bytearray_new();
+
+        unsigned long long share = encoder_count == threads ? total : total * encoder_count / threads;
+
+        for (; i < count && (taken < share || !e->count); ++i, e->count++)
+            taken += blocks[i].length;
+    }
+
+    // Each encoder hashes up to where the next one starts, unless the
+    // checksum is known already or there is nothing to spread the work by.
+    for (unsigned long i = 0; i < encoder_count; ++i)
+    {
+        encoders[i].hash = !c->patched.has_crc && count;
+        encoders[i].start = i ? encoders[i].blocks[0].offset : 0;
+        encoders[i].end = i + 1 < encoder_count ? encoders[i + 1].blocks[0].offset : patched_size;
+    }
+
+    progress_start(c->progress, total);
+    stats_phase_begin(c->stats, STATS_PHASE_CREATE);
+    gbl_run(gbl_encode_worker, encoders, sizeof(gbl_encoder_t), encoder_count);
+    stats_phase_end(c->stats);
+    progress_finish(c->progress);
+
+    diff_runs_close(&runs);
+
+    int failed = 0;
+    for (unsigned long i = 0; i < encoder_count; ++i)
+        failed = failed || encoders[i].payload.failed;
+
+    writer_t w;
+    int opened = !failed && writer_open(&w, &c->output);
+
+    if (!opened)
+    {
+        for (unsigned long i = 0; i < encoder_count; ++i)
+            bytearray_close(&encoders[i].payload);
+
+        free(blocks);
+        return failed ? CREATE_ERROR("Not enough memory to encode the blocks.") : CREATE_RET_INVALID_OUTPUT;
+    }
+
+    writer_push_string(&w, GBL_MAGIC);
+
+    for (unsigned long i = 0; i < encoder_count; ++i)
+    {
+        gbl_encoder_t *e = &encoders[i];
+        unsigned long long at = writer_size(&w);
+
+        for (unsigned long j = 0; j < e->count; ++j)
+            e->blocks[j].data += at;
+
+        writer_push_data(&w, e->payload.data, e->payload.size);
+        bytearray_close(&e->payload);
+    }
+
+    unsigned long long index = writer_size(&w);
+
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        const gbl_block_t *b = &blocks[i];
+
+        gbl_push64(&w, b->offset);
+        writer_push_le32(&w, b->length);
+        writer_push(&w, b->type);
+        writer_push(&w, b->flags);
+        writer_push(&w, 0);
+        writer_push(&w, 0);
+        gbl_push64(&w, b->data);
+        writer_push_le32(&w, b->data_length);
+        writer_push_le32(&w, b->crc);
+
+        stats_count(c->stats, STATS_GBL_BLOCK, b->data_length);
+    }
+
+    free(blocks);
+
+    stats_phase_begin(c->stats, STATS_PHASE_CRC);
+    unsigned int crc_input = gbl_filemap_crc32(&c->base, base_size);
+
+    if (encoders[0].hash)
+    {
+        c->patched.crc = encoders[0].crc;
+        c->patched.has_crc = 1;
+
+        for (unsigned long i = 1; i < encoder_count; ++i)
+            c->patched.crc = crc32_combine(c->patched.crc, encoders[i].crc, encoders[i].end - encoders[i].start);
+    }
+
+    unsigned int crc_output = gbl_filemap_crc32(&c->patched, patched_size);
+    stats_phase_end(c->stats);
+
+    gbl_push64(&w, index);
+    writer_push_le32(&w, count);
+    gbl_push64(&w, base_size);
+    gbl_push64(&w, patched_size);
+    writer_push_le32(&w, crc_input);
+    writer_push_le32(&w, crc_output);
+    writer_push_le32(&w, writer_crc32(&w));
+
+    if (!writer_finish(&w))
+        return CREATE_ERROR("Cannot write the patch.");
+
+    return CREATE_RET_SUCCESS;
+}
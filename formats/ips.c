@@ -1,166 +1,705 @@
-#include "helpers/bytearray.h"
+#include "helpers/crc32.h"
+#include "helpers/diff.h"
 #include "helpers/filemap.h"
 #include "helpers/format.h"
+#include "helpers/ops.h"
+#include "helpers/writer.h"
+#include <stdint.h> // UINT32_MAX
+#include <stdlib.h>
 #include <string.h> // memcpy
 
-static int ips_apply(patch_apply_context_t *c);
-static int ips_create_check(patch_create_context_t *c);
-static int ips_create(patch_create_context_t *c);
-static int ips_create_write(bytearray_t *b, unsigned char *patched, unsigned long patched_size, unsigned char *base, unsigned long base_size);
-static int ips_create_write_blocks(bytearray_t *b, unsigned int start, unsigned int end, unsigned char *patched, unsigned long patched_size, unsigned char *base, unsigned long base_size);
+// IPS and IPS32 only differ in the width of record offsets, the header and
+// footer around the records, and the output sizes they are used for.
+typedef struct ips_layout
+{
+    const char *name;
+    const char *header;
+    const char *footer;
+    unsigned int width; // Bytes in a record offset
+    unsigned long min_size; // Smallest output create picks the format for
+    unsigned long max_size; // Largest output it can describe
+    const char *max_size_text;
+} ips_layout_t;
+
+static const ips_layout_t ips_layout =
+{
+    .name = "IPS",
+    .header = "PATCH",
+    .footer = "EOF",
+    .width = 3,
+    .min_size = 0,
+    .max_size = 0x1000000,
+    .max_size_text = "16MB"
+};
+
+static const ips_layout_t ips32_layout =
+{
+    .name = "IPS32",
+    .header = "IPS32",
+    .footer = "EEOF",
+    .width = 4,
+    .min_size = 0x1000001,
+    .max_size = UINT32_MAX - 1,
+    .max_size_text = "4.29GB"
+};
+
+static int ips_apply(patch_apply_context_t *c, const ips_layout_t *l);
+static int ips_create_check(patch_create_context_t *c, const ips_layout_t *l);
+static int ips_verify(patch_apply_context_t *c, const ips_layout_t *l);
+static int ips_create(patch_create_context_t *c, const ips_layout_t *l);
+static int ips_create_stream(patch_create_context_t *c, stream_t *patched, stream_t *base, const ips_layout_t *l);
+static int ips_view_open(patch_view_t *v, const ips_layout_t *l);
+static int ips_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length);
+static void ips_view_close(patch_view_t *v);
+
+typedef struct ips_window ips_window_t;
+static int ips_create_write(writer_t *w, const diff_runs_t *runs, const ips_window_t *s);
+
+// Entry points of each format, IPS itself being the one with 24 bit offsets.
+static int ips24_apply(patch_apply_context_t *c)
+{
+    return ips_apply(c, &ips_layout);
+}
+
+static int ips24_verify(patch_apply_context_t *c)
+{
+    return ips_verify(c, &ips_layout);
+}
+
+static int ips24_create_check(patch_create_context_t *c)
+{
+    return ips_create_check(c, &ips_layout);
+}
+
+static int ips24_create(patch_create_context_t *c)
+{
+    return ips_create(c, &ips_layout);
+}
+
+static int ips24_create_stream(patch_create_context_t *c, stream_t *patched, stream_t *base)
+{
+    return ips_create_stream(c, patched, base, &ips_layout);
+}
+
+static int ips24_view_open(patch_view_t *v)
+{
+    return ips_view_open(v, &ips_layout);
+}
+
+static int ips32_apply(patch_apply_context_t *c)
+{
+    return ips_apply(c, &ips32_layout);
+}
+
+static int ips32_verify(patch_apply_context_t *c)
+{
+    return ips_verify(c, &ips32_layout);
+}
+
+static int ips32_create_check(patch_create_context_t *c)
+{
+    return ips_create_check(c, &ips32_layout);
+}
+
+static int ips32_create(patch_create_context_t *c)
+{
+    return ips_create(c, &ips32_layout);
+}
+
+static int ips32_create_stream(patch_create_context_t *c, stream_t *patched, stream_t *base)
+{
+    return ips_create_stream(c, patched, base, &ips32_layout);
+}
+
+static int ips32_view_open(patch_view_t *v)
+{
+    return ips_view_open(v, &ips32_layout);
+}
 
 const patch_format_t ips_format = 
 { 
     .name = "IPS",
     .header = "PATCH",
     .ext = "ips",
-    .apply_main = ips_apply,
-    .create_main = ips_create,
+    .apply_main = ips24_apply,
+    .create_main = ips24_create,
     .apply_check = NULL,
-    .create_check = ips_create_check 
+    .create_check = ips24_create_check,
+    .apply_verify = ips24_verify,
+    .create_stream = ips24_create_stream,
+    .view_open = ips24_view_open,
+    .view_read = ips_view_read,
+    .view_close = ips_view_close
 };
 
+const patch_format_t ips32_format = 
+{ 
+    .name = "IPS32",
+    .header = "IPS32",
+    .ext = "ips",
+    .apply_main = ips32_apply,
+    .create_main = ips32_create,
+    .apply_check = NULL,
+    .create_check = ips32_create_check,
+    .apply_verify = ips32_verify,
+    .create_stream = ips32_create_stream,
+    .view_open = ips32_view_open,
+    .view_read = ips_view_read,
+    .view_close = ips_view_close
+};
+
+// -------------------------------------------------
+// Patch Parsing
+// -------------------------------------------------
+
+// Checks the header and footer of patch, and finds the records between them.
+static int ips_records(const filemap_t *patch, const ips_layout_t *l, unsigned char **records, unsigned char **records_end)
+{
+    unsigned long header = strlen(l->header), footer = strlen(l->footer);
+
+    if (patch->size < header + footer)
+        return APPLY_ERROR("Patch file is too small to be an %s file.", l->name);
+
+    // Never gonna fail for detected patches, unless the functions get used directly.
+    if (memcmp(patch->handle, l->header, header) != 0)
+        return APPLY_ERROR("Invalid header for an %s file.", l->name);
+
+    if (memcmp(patch->handle + patch->size - footer, l->footer, footer) != 0)
+        return APPLY_ERROR("%s footer not found.", l->footer);
+
+    *records = patch->handle + header;
+    *records_end = patch->handle + patch->size - footer;
+
+    return APPLY_RET_SUCCESS;
+}
+
+// Big endian record offset of width bytes.
+static unsigned long ips_offset(const unsigned char *bytes, unsigned int width)
+{
+    unsigned long offset = 0;
+
+    for (unsigned int i = 0; i < width; ++i)
+        offset = offset << 8 | bytes[i];
+
+    return offset;
+}
+
 // -------------------------------------------------
 // Patch Application
 // -------------------------------------------------
 
-static int ips_apply(patch_apply_context_t *c)
+static int ips_apply(patch_apply_context_t *c, const ips_layout_t *l)
 {
-    unsigned char *patch, *patchend, *input, *output;
+    unsigned char *patch, *patchend, *records_end, *input;
+    unsigned int width = l->width;
+
+    int return_code = ips_records(&c->patch, l, &patch, &records_end);
 
-    if (c->patch.size < 8)
-        return APPLY_ERROR("Patch file is too small to be an IPS file.");
+    if (return_code != APPLY_RET_SUCCESS)
+        return return_code;
 
-    patch = c->patch.handle;
-    patchend = patch + c->patch.size;
+    patchend = c->patch.handle + c->patch.size;
 
 #define patch8() ((patch < patchend) ? *(patch++) : 0)
 #define patch16() ((patch + 2 < patchend) ? (patch += 2, (patch[-2] << 8 | patch[-1])) : 0)
-#define patch24() ((patch + 3 < patchend) ? (patch += 3, (patch[-3] << 16 | patch[-2] << 8 | patch[-1])) : 0)
+#define patchoffset() ((patch + width < patchend) ? (patch += width, ips_offset(patch - width, width)) : 0)
 
-    // Never gonna get called, unless the function gets used directly.
-    if (patch8() != 'P' || patch8() != 'A' || patch8() != 'T' || patch8() != 'C' || patch8() != 'H')
-        return APPLY_ERROR("Invalid header for an IPS file.");
+    input = c->input.handle;
 
-    if (patchend[-3] != 'E' || patchend[-2] != 'O' || patchend[-1] != 'F')
-        return APPLY_ERROR("EOF footer not found.");
+    // Records may extend the file, find the furthest write before creating the output.
+    unsigned char *records = patch;
+    unsigned long output_size = c->input.size;
 
-    input = c->input.handle;
+    while (patch < records_end)
+    {
+        unsigned long offset = patchoffset();
+        unsigned short size = patch16();
+
+        if (size)
+        {
+            patch += size;
+        }
+        else
+        {
+            size = patch16();
+            patch++;
+        }
 
-    if (!filemap_create(&c->output, c->input.size))
+        if (offset + size > output_size)
+            output_size = offset + size;
+    }
+
+    patch = records;
+
+    if (!filemap_create(&c->output, output_size))
         return APPLY_RET_INVALID_OUTPUT;
 
-    output = c->output.handle;
+    patch_ops_t ops;
+    patch_ops_init(&ops, input, c->input.size, c->output.handle, output_size);
+    ops.touched = c->touched;
+    ops.input_map = &c->input;
+    patch_ops_copy_input(&ops, 0, 0, output_size);
 
-    memcpy(output, input, c->output.size);
+    if (!patch_ops_finish(&ops))
+        return APPLY_ERROR("Cannot decompress the input.");
 
     filemap_close(&c->input);
 
-    while (patch < patchend - 3)
+    // Records can come in any order, so progress follows the patch instead.
+    unsigned long long next_progress = progress_start(c->progress, c->patch.size);
+
+    while (patch < records_end)
     {
-        unsigned int offset = patch24();
-        unsigned short size = patch16();
+        progress_tick(c->progress, next_progress, patch - c->patch.handle);
 
-        unsigned char *outputoff = (output + offset);
+        unsigned long offset = patchoffset();
+        unsigned short size = patch16();
 
         if (size)
         {
-            while (size--)
-                *(outputoff++) = patch8();
+            stats_count(c->stats, STATS_IPS_RECORD, size);
+
+            // Data cut off by the end of the patch reads as zero.
+            unsigned long avail = patchend - patch < size ? (unsigned long)(patchend - patch) : size;
+            patch_ops_literal(&ops, offset, patch, avail);
+            patch_ops_fill(&ops, offset + avail, 0, size - avail);
+            patch += avail;
         }
         else
         {
             size = patch16();
             unsigned char byte = patch8();
 
-            while (size--)
-                *(outputoff++) = byte;
+            stats_count(c->stats, STATS_IPS_RLE, size);
+            patch_ops_fill(&ops, offset, byte, size);
         }
     }
 
+    patch_ops_finish(&ops);
+    progress_finish(c->progress);
+
 #undef patch8
 #undef patch16
-#undef patch24
+#undef patchoffset
+
+    return APPLY_RET_SUCCESS;
+}
+
+// Continues crc over the unpatched output bytes in [from, to).
+static unsigned int ips_crc_span(unsigned char *input, unsigned long input_size, unsigned long from, unsigned long to, unsigned int crc)
+{
+    if (from >= to)
+        return crc;
+
+    if (from < input_size)
+    {
+        unsigned long length = (to < input_size ? to : input_size) - from;
+        crc = crc32(input + from, length, crc);
+        from += length;
+    }
+
+    return crc32_fill(0, to - from, crc);
+}
+
+// Checksums the patched output without creating it. Sorted records that
+// don't overlap are hashed in between spans of the input, anything else
+// falls back to patching into c->output.
+static int ips_verify(patch_apply_context_t *c, const ips_layout_t *l)
+{
+    unsigned char *patch, *patchend, *records_end, *input;
+    unsigned int width = l->width;
+
+    c->crc_known = c->crc_stored = 0;
+
+    int return_code = ips_records(&c->patch, l, &patch, &records_end);
+
+    if (return_code != APPLY_RET_SUCCESS)
+        return return_code;
+
+    patchend = c->patch.handle + c->patch.size;
+
+#define patch8() ((patch < patchend) ? *(patch++) : 0)
+#define patch16() ((patch + 2 < patchend) ? (patch += 2, (patch[-2] << 8 | patch[-1])) : 0)
+#define patchoffset() ((patch + width < patchend) ? (patch += width, ips_offset(patch - width, width)) : 0)
+
+    input = c->input.handle;
+    unsigned long input_size = c->input.size;
+
+    c->crc[CRC_PATCH] = crc32(c->patch.handle, c->patch.size, 0);
+    c->crc[CRC_INPUT] = filemap_crc32(&c->input, input_size);
+    c->crc_known = FLAG_CRC_PATCH | FLAG_CRC_INPUT;
+
+    unsigned char *records = patch;
+    unsigned long output_size = input_size, end = 0;
+    int sorted = 1;
+
+    while (patch < records_end)
+    {
+        unsigned long offset = patchoffset();
+        unsigned short size = patch16();
+
+        if (size)
+        {
+            patch += size;
+        }
+        else
+        {
+            size = patch16();
+            patch++;
+        }
+
+        if (offset < end)
+            sorted = 0;
+
+        end = offset + size;
+
+        if (end > output_size)
+            output_size = end;
+    }
+
+    if (!sorted)
+    {
+        return_code = ips_apply(c, l);
+
+        if (return_code != APPLY_RET_SUCCESS)
+            return return_code;
+
+        c->crc[CRC_OUTPUT] = patch_output_crc32(c);
+        c->crc_known |= FLAG_CRC_OUTPUT;
+        return APPLY_RET_SUCCESS;
+    }
+
+    unsigned int ocrc = 0;
+    end = 0;
+    patch = records;
+
+    while (patch < records_end)
+    {
+        unsigned long offset = patchoffset();
+        unsigned short size = patch16();
+
+        ocrc = ips_crc_span(input, input_size, end, offset, ocrc);
+
+        if (size)
+        {
+            unsigned long avail = patchend - patch < size ? (unsigned long)(patchend - patch) : size;
+            ocrc = crc32(patch, avail, ocrc);
+            ocrc = crc32_fill(0, size - avail, ocrc);
+            patch += size;
+        }
+        else
+        {
+            size = patch16();
+            unsigned char byte = patch8();
+            ocrc = crc32_fill(byte, size, ocrc);
+        }
+
+        end = offset + size;
+    }
+
+    c->crc[CRC_OUTPUT] = ips_crc_span(input, input_size, end, output_size, ocrc);
+    c->crc_known |= FLAG_CRC_OUTPUT;
+
+#undef patch8
+#undef patch16
+#undef patchoffset
 
     return APPLY_RET_SUCCESS;
 }
 
 // -------------------------------------------------
-// Patch Creation
+// Patched View
 // -------------------------------------------------
 
-static int ips_create_check(patch_create_context_t *c)
+typedef struct ips_record
 {
-    return c->patched.size <= 0x1000000;
+    unsigned long offset;
+    unsigned long size;
+    unsigned long patch; // Offset of the data, or of the RLE byte
+    unsigned long order; // Later records overwrite earlier ones
+    int rle;
+} ips_record_t;
+
+// Records sorted by offset, with the furthest end of any record up to each.
+typedef struct ips_index
+{
+    ips_record_t *records;
+    unsigned long *reach;
+    unsigned long count;
+} ips_index_t;
+
+static int ips_record_compare(const void *a, const void *b)
+{
+    const ips_record_t *x = a, *y = b;
+
+    if (x->offset != y->offset)
+        return x->offset < y->offset ? -1 : 1;
+
+    return x->order < y->order ? -1 : x->order > y->order;
 }
 
-static void ips_create_write_rle_block(bytearray_t *a, unsigned int address, unsigned short size, unsigned char byte)
+static int ips_record_compare_order(const void *a, const void *b)
 {
-    unsigned char *addressBytes = (unsigned char *)&address;
-    unsigned char *sizeBytes = (unsigned char *)&size;
+    const ips_record_t *x = *(const ips_record_t *const *)a, *y = *(const ips_record_t *const *)b;
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static int ips_view_open(patch_view_t *v, const ips_layout_t *l)
+{
+    unsigned char *patch, *patchstart, *patchend, *records_end;
+    unsigned int width = l->width;
 
-    bytearray_push(a, addressBytes[2]);
-    bytearray_push(a, addressBytes[1]);
-    bytearray_push(a, addressBytes[0]);
+    int return_code = ips_records(&v->patch, l, &patch, &records_end);
 
-    bytearray_push(a, 0);
-    bytearray_push(a, 0);
+    if (return_code != APPLY_RET_SUCCESS)
+        return return_code;
 
-    bytearray_push(a, sizeBytes[1]);
-    bytearray_push(a, sizeBytes[0]);
+    patchstart = v->patch.handle;
+    patchend = patchstart + v->patch.size;
+
+#define patch16() ((patch + 2 < patchend) ? (patch += 2, (patch[-2] << 8 | patch[-1])) : 0)
+#define patchoffset() ((patch + width < patchend) ? (patch += width, ips_offset(patch - width, width)) : 0)
 
-    bytearray_push(a, byte);
+    ips_index_t *index = calloc(1, sizeof(ips_index_t));
+    unsigned long capacity = 0;
+
+    if (!index)
+        return APPLY_ERROR("Not enough memory to index the patch.");
+
+    v->index = index;
+    v->size = v->input.size;
+
+    // Same walk as ips_apply's sizing pass.
+    while (patch < records_end)
+    {
+        if (index->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            ips_record_t *records = realloc(index->records, capacity * sizeof(ips_record_t));
+
+            if (!records)
+                return APPLY_ERROR("Not enough memory to index the patch.");
+
+            index->records = records;
+        }
+
+        ips_record_t *r = &index->records[index->count];
+        r->offset = patchoffset();
+        r->size = patch16();
+        r->order = index->count++;
+        r->rle = !r->size;
+
+        if (r->rle)
+            r->size = patch16();
+
+        r->patch = patch - patchstart;
+        patch += r->rle ? 1 : r->size;
+
+        if (r->offset + r->size > v->size)
+            v->size = r->offset + r->size;
+    }
+
+#undef patch16
+#undef patchoffset
+
+    if (!index->count)
+        return APPLY_RET_SUCCESS;
+
+    if (!(index->reach = malloc(index->count * sizeof(unsigned long))))
+        return APPLY_ERROR("Not enough memory to index the patch.");
+
+    qsort(index->records, index->count, sizeof(ips_record_t), ips_record_compare);
+
+    for (unsigned long i = 0, reach = 0; i < index->count; ++i)
+    {
+        const ips_record_t *r = &index->records[i];
+
+        if (r->offset + r->size > reach)
+            reach = r->offset + r->size;
+
+        index->reach[i] = reach;
+    }
+
+    return APPLY_RET_SUCCESS;
 }
 
-static void ips_create_write_block(bytearray_t *a, unsigned int address, unsigned short size, unsigned char *bytes)
+static int ips_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length)
 {
-    unsigned char *addressBytes = (unsigned char *)&address;
-    unsigned char *sizeBytes = (unsigned char *)&size;
+    const ips_index_t *index = v->index;
+    const unsigned char *patch = v->patch.handle;
+    unsigned long patch_size = v->patch.size;
+    unsigned long end = offset + length;
+
+    unsigned long copied = offset < v->input.size ? (v->input.size - offset < length ? v->input.size - offset : length) : 0;
+
+    if (copied)
+        memcpy(out, v->input.handle + offset, copied);
+
+    memset(out + copied, 0, length - copied);
+
+    // Records starting before end, walked back while any of them reaches offset.
+    unsigned long lo = 0, hi = index->count;
+
+    while (lo < hi)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
 
-    bytearray_push(a, addressBytes[2]);
-    bytearray_push(a, addressBytes[1]);
-    bytearray_push(a, addressBytes[0]);
+        if (index->records[mid].offset < end)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    unsigned long first = lo;
+
+    while (first && index->reach[first - 1] > offset)
+        first--;
+
+    unsigned long count = 0;
+    const ips_record_t **hits = malloc((lo - first + 1) * sizeof(ips_record_t *));
 
-    bytearray_push(a, sizeBytes[1]);
-    bytearray_push(a, sizeBytes[0]);
+    if (!hits)
+        return APPLY_ERROR("Not enough memory to read the patched file.");
 
-    bytearray_push_data(a, bytes, size);
+    for (unsigned long i = first; i < lo; ++i)
+    {
+        if (index->records[i].offset + index->records[i].size > offset)
+            hits[count++] = &index->records[i];
+    }
+
+    // Overlapping records apply in patch order.
+    qsort(hits, count, sizeof(ips_record_t *), ips_record_compare_order);
+
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        const ips_record_t *r = hits[i];
+        unsigned long from = r->offset > offset ? r->offset : offset;
+        unsigned long to = r->offset + r->size < end ? r->offset + r->size : end;
+
+        for (unsigned long at = from; at < to; ++at)
+        {
+            unsigned long source = r->rle ? r->patch : r->patch + (at - r->offset);
+            out[at - offset] = source < patch_size ? patch[source] : 0;
+        }
+    }
+
+    free(hits);
+    return APPLY_RET_SUCCESS;
+}
+
+static void ips_view_close(patch_view_t *v)
+{
+    ips_index_t *index = v->index;
+
+    free(index->records);
+    free(index->reach);
+    free(index);
+}
+
+// -------------------------------------------------
+// Patch Creation
+// -------------------------------------------------
+
+// Both files from origin on: all of them when mapped, or the part still
+// needed while streaming. The sizes are those of the whole files.
+struct ips_window
+{
+    const unsigned char *patched;
+    const unsigned char *base;
+    unsigned long origin;
+    unsigned long patched_size;
+    unsigned long base_size;
+    const ips_layout_t *layout;
+};
+
+// Records never extend past a gap this long, a new header costs less.
+#define IPS_GAP 5
+
+// Without a size in the patch, the output never ends before the input.
+static int ips_create_check(patch_create_context_t *c, const ips_layout_t *l)
+{
+    return c->patched.size >= l->min_size && c->patched.size <= l->max_size && c->patched.size >= c->base.size;
+}
+
+static void ips_create_write_offset(writer_t *w, const ips_layout_t *l, unsigned int address)
+{
+    if (l->width == 3)
+        writer_push_be24(w, address);
+    else
+        writer_push_be32(w, address);
 }
 
-static int ips_create(patch_create_context_t *c)
+static void ips_create_write_rle_block(writer_t *w, const ips_layout_t *l, unsigned int address, unsigned short size, unsigned char byte)
 {
-    bytearray_t b = bytearray_new();
+    ips_create_write_offset(w, l, address);
+    writer_push_be16(w, 0);
+    writer_push_be16(w, size);
+    writer_push(w, byte);
+}
 
-    bytearray_push_string(&b, "PATCH");
+static void ips_create_write_block(writer_t *w, const ips_layout_t *l, unsigned int address, unsigned short size, const unsigned char *bytes)
+{
+    ips_create_write_offset(w, l, address);
+    writer_push_be16(w, size);
+    writer_push_data(w, bytes, size);
+}
 
+static int ips_create(patch_create_context_t *c, const ips_layout_t *l)
+{
     unsigned char *patched = c->patched.handle;
     unsigned long patched_size = c->patched.size;
 
     unsigned char *base = c->base.handle;
     unsigned long base_size = c->base.size;
 
-    if (patched_size > 0x1000000)
-        return CREATE_ERROR("IPS cannot be used to patch files to size over 16MB.");
+    if (patched_size > l->max_size)
+        return CREATE_ERROR("IPS cannot be used to patch files to size over %s.", l->max_size_text);
+
+    diff_runs_t runs;
 
-    ips_create_write(&b, patched, patched_size, base, base_size);
-    bytearray_push_string(&b, "EOF");
+    stats_phase_begin(c->stats, STATS_PHASE_DIFF);
+    int scanned = diff_scan_candidates(&runs, patched, patched_size, base, base_size, c->candidates);
+    stats_phase_end(c->stats);
 
-    filemap_create(&c->output, b.size);
-    memcpy(c->output.handle, b.data, b.size);
+    if (!scanned)
+    {
+        return CREATE_ERROR("Not enough memory to diff the files.");
+    }
+
+    writer_t w;
+    if (!writer_open(&w, &c->output))
+    {
+        diff_runs_close(&runs);
+        return CREATE_RET_INVALID_OUTPUT;
+    }
 
-    bytearray_close(&b);
+    // Every changed byte plus a record header per run, RLE only shrinks it.
+    writer_reserve(&w, runs.changed + runs.count * 8 + 16);
+
+    ips_window_t window = { patched, base, 0, patched_size, base_size, l };
+
+    writer_push_string(&w, l->header);
+    ips_create_write(&w, &runs, &window);
+    writer_push_string(&w, l->footer);
+
+    diff_runs_close(&runs);
+
+    if (!writer_finish(&w))
+        return CREATE_ERROR("Cannot write the patch.");
 
     return CREATE_RET_SUCCESS;
 }
 
-#define patched8(i) (i < patched_size ? patched[i] : 0)
-#define base8(i) (i < base_size ? base[i] : 0)
+#define patched8(i) (i < s->patched_size ? s->patched[(i) - s->origin] : 0)
+#define base8(i) (i < s->base_size ? s->base[(i) - s->origin] : 0)
 #define changed(i) (patched8(i) != base8(i))
-#define checkoffsize(off, start) (((off) + 1) < patched_size)
+#define checkoffsize(off, start) (((off) + 1) < s->patched_size)
 
-static int ips_create_write_blocks(bytearray_t *b, unsigned int start, unsigned int end, unsigned char *patched, unsigned long patched_size, unsigned char *base, unsigned long base_size)
+// Writes the first record of the changed stretch [start, end) and returns
+// where the next one starts. Only looks at bytes up to start + UINT16_MAX + 1,
+// and only depends on end while it is closer than UINT16_MAX.
+static unsigned int ips_create_write_record(writer_t *w, const ips_window_t *s, unsigned int start, unsigned int end)
 {
-    if (start >= end) return 0;
     unsigned int length = end - start >= UINT16_MAX ? UINT16_MAX : end - start;
 
     unsigned int consecutive = 0;
@@ -171,8 +710,8 @@ static int ips_create_write_blocks(bytearray_t *b, unsigned int start, unsigned
     // The size of a RLE Block Header is 8 bytes.
     if ((consecutive > 3 && consecutive == length) || consecutive > 8)
     {
-        ips_create_write_rle_block(b, start, consecutive, patched[start]);
-        return ips_create_write_blocks(b, start + consecutive, end, patched, patched_size, base, base_size);
+        ips_create_write_rle_block(w, s->layout, start, consecutive, patched8(start));
+        return start + consecutive;
     }
     else
     {
@@ -201,49 +740,241 @@ static int ips_create_write_blocks(bytearray_t *b, unsigned int start, unsigned
         unsigned int blockLength = length;
         while (patched8(start + blockLength - 1) == base8(start + blockLength - 1)) --blockLength;
 
-        ips_create_write_block(b, start, blockLength, patched + start);
-        return ips_create_write_blocks(b, start + length, end, patched, patched_size, base, base_size);
+        ips_create_write_block(w, s->layout, start, blockLength, s->patched + (start - s->origin));
+        return start + length;
     }
+}
 
-    // ips_create_write_block(b, start, length, patched + start);
-    // return ips_create_write_blocks(b, start + length, end, patched, patched_size, base, base_size);
+static void ips_create_write_blocks(writer_t *w, const ips_window_t *s, unsigned int start, unsigned int end)
+{
+    while (start < end)
+        start = ips_create_write_record(w, s, start, end);
 }
 
-static int ips_create_write(bytearray_t *b, unsigned char *patched, unsigned long patched_size, unsigned char *base, unsigned long base_size)
+static int ips_create_write(writer_t *w, const diff_runs_t *runs, const ips_window_t *s)
 {
+    unsigned long patched_size = s->patched_size;
+
+    // Same walk as a byte by byte scan for changed(), but every changed or
+    // unchanged stretch is skipped in one step using the precomputed runs.
+    unsigned long cursor = 0;
+
+#define inside(off) ((cursor = diff_runs_seek(runs, cursor, off)) < runs->count && runs->runs[cursor].start <= (off))
 
-    for (unsigned int offset = 0, start = 0, unchanged = 0; offset < patched_size; ++offset)
+    for (unsigned long next = 0; (cursor = diff_runs_seek(runs, cursor, next)) < runs->count;)
     {
-        if (patched8(offset) == base8(offset))
-            continue;
+        unsigned int offset = runs->runs[cursor].start > next ? runs->runs[cursor].start : next;
+        unsigned int start, unchanged;
+
+        if (offset >= patched_size)
+            break;
 
-        if (memcmp(&offset, "EOF", 3) == 0)
+        if (memcmp(&offset, s->layout->footer, s->layout->width) == 0)
             offset--;
 
         start = offset;
 
         while (offset < patched_size)
         {
-            for (; changed(offset) && checkoffsize(offset, start); ++offset)
-                ;
+            if (inside(offset))
+                offset = runs->runs[cursor].end < patched_size - 1 ? runs->runs[cursor].end : patched_size - 1;
 
-            for (unchanged = 0; !changed(offset + unchanged) && checkoffsize(offset + unchanged, start); ++unchanged)
-                ;
+            if (inside(offset))
+            {
+                unchanged = 0;
+            }
+            else
+            {
+                unsigned long changed_at = cursor < runs->count ? runs->runs[cursor].start : patched_size;
+                unchanged = (changed_at < patched_size - 1 ? changed_at : patched_size - 1) - offset;
+            }
 
             // The size of a normal IPS Block Header is 5 bytes
-            if (unchanged >= 5) break;
+            if (unchanged >= IPS_GAP) break;
 
             offset += unchanged + 1;
             continue;
         }
 
-        ips_create_write_blocks(b, start, offset, patched, patched_size, base, base_size);
+        ips_create_write_blocks(w, s, start, offset);
+        next = (unsigned long)offset + 1;
     }
 
+#undef inside
+
     return CREATE_RET_SUCCESS;
 }
 
 #undef patched8
 #undef base8
-#undef changed8
+#undef changed
 #undef checkoffsize
+
+// -------------------------------------------------
+// Streaming Creation
+// -------------------------------------------------
+
+// Bytes kept from one block to the next: a whole record plus the gap after it.
+#define IPS_STREAM_KEEP (2UL * UINT16_MAX)
+
+/* Same patch as ips_create, from one pass over both files.
+ *
+ * Changed stretches end once IPS_GAP unchanged bytes follow them, and a
+ * record only depends on the UINT16_MAX bytes after its start. So records
+ * are written as soon as that much of their stretch is known, and at most
+ * IPS_STREAM_KEEP bytes of the files are held back for the next block. */
+static int ips_create_stream(patch_create_context_t *c, stream_t *patched_stream, stream_t *base_stream, const ips_layout_t *l)
+{
+    unsigned long patched_size = patched_stream->size;
+    unsigned long base_size = base_stream->size;
+
+    if (patched_size > l->max_size)
+        return CREATE_ERROR("IPS cannot be used to patch files to size over %s.", l->max_size_text);
+
+    unsigned char *patched = malloc(IPS_STREAM_KEEP + STREAM_BLOCK);
+    unsigned char *base = malloc(IPS_STREAM_KEEP + STREAM_BLOCK);
+
+    writer_t w;
+    int return_code = CREATE_RET_SUCCESS;
+
+    if (!patched || !base)
+        return_code = CREATE_ERROR("Not enough memory to diff the files.");
+    else if (!writer_open(&w, &c->output))
+        return_code = CREATE_RET_INVALID_OUTPUT;
+
+    if (return_code != CREATE_RET_SUCCESS)
+    {
+        free(patched);
+        free(base);
+        return return_code;
+    }
+
+    ips_window_t window = { patched, base, 0, patched_size, base_size, l };
+    const ips_window_t *s = &window;
+
+    // Bytes [origin, end) are in the window, [origin, base_end) for the base.
+    // A stretch is open from group_start while in_run or within IPS_GAP of
+    // last_end, with everything before record_start already written.
+    unsigned long end = 0, base_end = 0;
+    unsigned long last_end = 0, record_start = 0;
+    int in_run = 0, open = 0;
+
+    unsigned long long next_progress = progress_start(c->progress, patched_size);
+
+    writer_push_string(&w, l->header);
+
+    while (end < patched_size)
+    {
+        // Keep the open record, or the byte an offset spelling the footer backs up to.
+        unsigned long keep = open ? record_start : end ? end - 1 : 0;
+
+        memmove(patched, patched + (keep - window.origin), end - keep);
+
+        if (base_end > keep)
+            memmove(base, base + (keep - window.origin), base_end - keep);
+
+        window.origin = keep;
+
+        const unsigned char *block;
+        unsigned long length = stream_next(patched_stream, &block);
+
+        if (!length)
+            break;
+
+        memcpy(patched + (end - keep), block, length);
+
+        unsigned long base_length;
+
+        if (base_end == end && (base_length = stream_next(base_stream, &block)))
+        {
+            memcpy(base + (end - keep), block, base_length);
+            base_end += base_length;
+        }
+
+        unsigned long i = end;
+        end += length > patched_size - end ? patched_size - end : length;
+
+        // Window indexes of absolute offsets and back, the base may end before the window.
+        unsigned long base_window = base_end > keep ? base_end - keep : 0;
+
+#define at(off) ((off) - window.origin)
+#define absolute(index) ((index) + window.origin)
+
+        while (i < end)
+        {
+            if (in_run)
+            {
+                i = absolute(diff_find_same(patched, base, base_window, at(i), at(end)));
+
+                if (i < end)
+                    in_run = 0, last_end = i;
+
+                continue;
+            }
+
+            unsigned long change = absolute(diff_find_change(patched, base, base_window, at(i), at(end)));
+
+            // Close the stretch once the gap after it is long enough, which
+            // near the end of the file it never is.
+            if (open && change - last_end >= IPS_GAP && last_end + IPS_GAP + 1 <= patched_size)
+            {
+                ips_create_write_blocks(&w, s, record_start, last_end);
+                open = 0;
+            }
+
+            if (change >= end)
+                break;
+
+            if (!open)
+            {
+                unsigned int start = change;
+
+                if (memcmp(&start, l->footer, l->width) == 0)
+                    start--;
+
+                record_start = start;
+                open = 1;
+            }
+
+            in_run = 1;
+            i = change;
+        }
+
+        // Write out every record whose length no longer depends on the rest.
+        while (open)
+        {
+            unsigned long known = in_run ? end : last_end;
+
+            if (known - record_start < UINT16_MAX || end < record_start + UINT16_MAX + 2)
+                break;
+
+            record_start = ips_create_write_record(&w, s, record_start, known);
+        }
+
+#undef at
+#undef absolute
+
+        progress_tick(c->progress, next_progress, end);
+    }
+
+    // The last stretch runs to the end of the file.
+    if (open)
+        ips_create_write_blocks(&w, s, record_start, patched_size);
+
+    writer_push_string(&w, l->footer);
+    progress_finish(c->progress);
+
+    free(patched);
+    free(base);
+
+    if (end < patched_size || patched_stream->failed || base_stream->failed)
+    {
+        writer_abort(&w);
+        return CREATE_ERROR("Cannot read the input files.");
+    }
+
+    if (!writer_finish(&w))
+        return CREATE_ERROR("Cannot write the patch.");
+
+    return CREATE_RET_SUCCESS;
+}
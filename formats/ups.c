@@ -1,14 +1,23 @@
-#include "helpers/bytearray.h"
 #include "helpers/crc32.h"
+#include "helpers/diff.h"
 #include "helpers/filemap.h"
 #include "helpers/format.h"
+#include "helpers/ops.h"
 #include "helpers/utils.h"
+#include "helpers/writer.h"
 #include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 static int ups_apply(patch_apply_context_t *c);
 static int ups_create(patch_create_context_t *c);
+static int ups_verify(patch_apply_context_t *c);
+static int ups_create_stream(patch_create_context_t *c, stream_t *patched, stream_t *base);
+static int ups_view_open(patch_view_t *v);
+static int ups_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length);
+static void ups_view_close(patch_view_t *v);
+static int ups_apply_input(const filemap_t *patch, unsigned int *crc, unsigned long *size);
 
 const patch_format_t ups_format =
 { 
@@ -18,7 +27,13 @@ const patch_format_t ups_format =
     .apply_main = ups_apply, 
     .create_main = ups_create, 
     .apply_check = NULL, 
-    .create_check = NULL 
+    .create_check = NULL,
+    .apply_verify = ups_verify,
+    .create_stream = ups_create_stream,
+    .view_open = ups_view_open,
+    .view_read = ups_view_read,
+    .view_close = ups_view_close,
+    .apply_input = ups_apply_input
 };
 
 // -------------------------------------------------
@@ -28,6 +43,7 @@ const patch_format_t ups_format =
 static int ups_apply(patch_apply_context_t *c)
 {
 #define check_crc32(a, err) \
+    c->crc_known |= FLAG_##a, c->crc_stored |= FLAG_##a; \
     if ((scrc[a] != acrc[a])) \
     { \
         if ((flags->strict_crc & FLAG_##a)) \
@@ -41,16 +57,16 @@ static int ups_apply(patch_apply_context_t *c)
     }
 
 #define patch8() (patch < patchend ? *(patch++) : 0)
-#define input8() (input < inputend ? *(input++) : 0)
-#define writeout8(b) (output < outputend ? *(output++) = b : 0)
 
     const apply_flags_t *flags = c->flags;
 
     unsigned char *patch, *patchstart, *patchend, *patchcrc;
-    unsigned char *input, *inputend, *output, *outputend;
+    unsigned char *input;
+
+    unsigned int *acrc = c->crc;
+    unsigned int *scrc = c->expected_crc;
 
-    unsigned int acrc[3] = { 0, 0, 0 };
-    unsigned int scrc[3] = { 0, 0, 0 };
+    c->crc_known = c->crc_stored = 0;
 
     if (c->patch.size < 18)
         return APPLY_ERROR("Patch file is too small to be an UPS file.");
@@ -62,8 +78,10 @@ static int ups_apply(patch_apply_context_t *c)
 
     if (~flags->ignore_crc & FLAG_CRC_PATCH)
     {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
         scrc[CRC_PATCH] = read32le(patchcrc + 8);
         acrc[CRC_PATCH] = crc32(patchstart, c->patch.size - 4, 0);
+        stats_phase_end(c->stats);
 
         check_crc32(CRC_PATCH, "Patch CRCs don't match.");
     }
@@ -75,15 +93,16 @@ static int ups_apply(patch_apply_context_t *c)
     unsigned long output_size = readvint(&patch);
 
     input = c->input.handle;
-    inputend = input + c->input.size;
 
     if (c->input.size != input_size)
         gible_info("Input file sizes don't match.");
 
     if (~flags->ignore_crc & FLAG_CRC_INPUT)
     {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
         scrc[CRC_INPUT] = read32le(patchcrc);
-        acrc[CRC_INPUT] = crc32(input, input_size, 0);
+        acrc[CRC_INPUT] = filemap_crc32(&c->input, input_size);
+        stats_phase_end(c->stats);
 
         check_crc32(CRC_INPUT, "Input CRCs don't match.");
     }
@@ -91,14 +110,152 @@ static int ups_apply(patch_apply_context_t *c)
     if (!filemap_create(&c->output, output_size))
         return APPLY_RET_INVALID_OUTPUT;
 
-    output = c->output.handle;
-    outputend = output + c->output.size;
+    patch_ops_t ops;
+    patch_ops_init(&ops, input, c->input.size, c->output.handle, output_size);
+    ops.touched = c->touched;
+    ops.input_map = &c->input;
+
+    unsigned long position = 0;
+    unsigned long long next_progress = progress_start(c->progress, output_size);
+
+    // Input and output advance together, the ops drop anything past the output.
+    while (patch < patchcrc)
+    {
+        progress_tick(c->progress, next_progress, position < output_size ? position : output_size);
+
+        unsigned long offset = readvint(&patch);
+        patch_ops_copy_input(&ops, position, position, offset);
+        position += offset;
+
+        // A hunk missing its terminator runs to the end of the patch.
+        unsigned char *hunk = patch;
+        unsigned char *terminator = memchr(patch, 0, patchend - patch);
+        unsigned long length = (terminator ? terminator : patchend) - patch;
+
+        patch_ops_xor_input(&ops, position, position, patch, length);
+        patch_ops_copy_input(&ops, position + length, position + length, 1);
+        position += length + 1;
+        patch = terminator ? terminator + 1 : patchend;
+
+        stats_count(c->stats, STATS_UPS_HUNK, patch - hunk);
+    }
+
+    if (position < c->input.size)
+        patch_ops_copy_input(&ops, position, position, c->input.size - position);
+
+    progress_finish(c->progress);
+
+    if (!patch_ops_finish(&ops))
+        return APPLY_ERROR("Cannot decompress the input.");
+
+    if (~flags->ignore_crc & FLAG_CRC_OUTPUT)
+    {
+        stats_phase_begin(c->stats, STATS_PHASE_CRC);
+        scrc[CRC_OUTPUT] = read32le(patchcrc + 4);
+        acrc[CRC_OUTPUT] = patch_output_crc32(c);
+        stats_phase_end(c->stats);
+        check_crc32(CRC_OUTPUT, "Output CRCs don't match.");
+    }
+
+#undef check_crc32
+#undef patch8
+
+    return APPLY_RET_SUCCESS;
+}
+
+// Walks the patch like ups_apply, but only checksums the output. Spans
+// copied from the input are hashed in place and xor'ed hunks go through a
+// small window, so no output is ever allocated.
+static int ups_verify(patch_apply_context_t *c)
+{
+#define check_crc32(a, err) \
+    c->crc_known |= FLAG_##a, c->crc_stored |= FLAG_##a; \
+    if ((scrc[a] != acrc[a])) \
+    { \
+        if ((flags->strict_crc & FLAG_##a)) \
+        { \
+            return APPLY_ERROR(err); \
+        } \
+        else \
+        { \
+            (gible_warn(err)); \
+        } \
+    }
+
+#define patch8() (patch < patchend ? *(patch++) : 0)
+#define input8() (input < inputend ? *(input++) : 0)
+#define flush() (ocrc = crc32(window, used, ocrc), used = 0)
+#define writeout8(b) \
+    if (written < output_size) \
+    { \
+        window[used++] = (b); \
+        written++; \
+        if (used == sizeof(window)) \
+            flush(); \
+    }
+
+    const apply_flags_t *flags = c->flags;
+
+    unsigned char *patch, *patchstart, *patchend, *patchcrc;
+    unsigned char *input, *inputend;
+
+    unsigned int *acrc = c->crc;
+    unsigned int *scrc = c->expected_crc;
+
+    unsigned char window[4096];
+    unsigned long used = 0, written = 0;
+    unsigned int ocrc = 0;
+
+    c->crc_known = c->crc_stored = 0;
+
+    if (c->patch.size < 18)
+        return APPLY_ERROR("Patch file is too small to be an UPS file.");
+
+    patch = c->patch.handle;
+    patchstart = patch;
+    patchend = patch + c->patch.size;
+    patchcrc = patchend - 12;
+
+    scrc[CRC_PATCH] = read32le(patchcrc + 8);
+    acrc[CRC_PATCH] = crc32(patchstart, c->patch.size - 4, 0);
+    check_crc32(CRC_PATCH, "Patch CRCs don't match.");
+
+    if (patch8() != 'U' || patch8() != 'P' || patch8() != 'S' || patch8() != '1')
+        return APPLY_ERROR("Invalid header for an UPS file.");
+
+    unsigned long input_size = readvint(&patch);
+    unsigned long output_size = readvint(&patch);
+
+    input = c->input.handle;
+    inputend = input + c->input.size;
+
+    if (c->input.size != input_size)
+        gible_info("Input file sizes don't match.");
+
+    scrc[CRC_INPUT] = read32le(patchcrc);
+    acrc[CRC_INPUT] = filemap_crc32(&c->input, input_size);
+    check_crc32(CRC_INPUT, "Input CRCs don't match.");
 
     while (patch < patchcrc)
     {
         unsigned long offset = readvint(&patch);
-        while (offset--)
+
+        // Untouched span, hash it straight from the input.
+        unsigned long span = offset;
+        if (span > (unsigned long)(inputend - input))
+            span = inputend - input;
+        if (span > output_size - written)
+            span = output_size - written;
+
+        flush();
+        ocrc = crc32(input, span, ocrc);
+        input += span;
+        written += span;
+
+        for (offset -= span; offset; offset--)
+        {
             writeout8(input8());
+        }
 
         unsigned char b;
         do
@@ -108,34 +265,181 @@ static int ups_apply(patch_apply_context_t *c)
         } while (b);
     }
 
-    while (output < outputend && input < inputend)
-        writeout8(input8());
+    flush();
 
-    if (~flags->ignore_crc & FLAG_CRC_OUTPUT)
-    {
-        scrc[CRC_OUTPUT] = read32le(patchcrc + 4);
-        acrc[CRC_OUTPUT] = crc32(c->output.handle, c->output.size, 0);
-        check_crc32(CRC_OUTPUT, "Output CRCs don't match.");
-    }
+    unsigned long tail = inputend - input;
+    if (tail > output_size - written)
+        tail = output_size - written;
+
+    ocrc = crc32(input, tail, ocrc);
+    written += tail;
+
+    // Whatever the input doesn't cover is zero filled.
+    ocrc = crc32_fill(0, output_size - written, ocrc);
+
+    scrc[CRC_OUTPUT] = read32le(patchcrc + 4);
+    acrc[CRC_OUTPUT] = ocrc;
+    check_crc32(CRC_OUTPUT, "Output CRCs don't match.");
 
 #undef check_crc32
 #undef patch8
 #undef input8
+#undef flush
 #undef writeout8
 
     return APPLY_RET_SUCCESS;
 }
 
+static int ups_apply_input(const filemap_t *patch, unsigned int *crc, unsigned long *size)
+{
+    unsigned char *p = patch->handle;
+
+    if (patch->size < 18 || memcmp(p, "UPS1", 4) != 0)
+        return 0;
+
+    p += 4;
+    *size = readvint(&p);
+    *crc = read32le(patch->handle + patch->size - 12);
+    return 1;
+}
+
 // -------------------------------------------------
-// Patch Creation
+// Patched View
 // -------------------------------------------------
 
-static int ups_create(patch_create_context_t *c)
+// Where each hunk lands in the output and where its xor'ed bytes are.
+typedef struct ups_hunk
+{
+    unsigned long start;
+    unsigned long length; // Including the terminating zero
+    unsigned long patch; // Offset of the first byte in the patch
+} ups_hunk_t;
+
+typedef struct ups_index
+{
+    ups_hunk_t *hunks;
+    unsigned long count;
+} ups_index_t;
+
+// Indexes every hunk in one walk over the patch, without touching the input.
+static int ups_view_open(patch_view_t *v)
+{
+#define patch8() (patch < patchend ? *(patch++) : 0)
+
+    unsigned char *patch, *patchstart, *patchend, *patchcrc;
+
+    if (v->patch.size < 18)
+        return APPLY_ERROR("Patch file is too small to be an UPS file.");
+
+    patch = v->patch.handle;
+    patchstart = patch;
+    patchend = patch + v->patch.size;
+    patchcrc = patchend - 12;
+
+    if (patch8() != 'U' || patch8() != 'P' || patch8() != 'S' || patch8() != '1')
+        return APPLY_ERROR("Invalid header for an UPS file.");
+
+    readvint(&patch);
+    v->size = readvint(&patch);
+
+    v->expected_crc[CRC_INPUT] = read32le(patchcrc);
+    v->expected_crc[CRC_OUTPUT] = read32le(patchcrc + 4);
+    v->expected_crc[CRC_PATCH] = read32le(patchcrc + 8);
+    v->crc_stored = FLAG_CRC_ALL;
+
+    ups_index_t *index = calloc(1, sizeof(ups_index_t));
+    unsigned long capacity = 0, position = 0;
+
+    if (!index)
+        return APPLY_ERROR("Not enough memory to index the patch.");
+
+    v->index = index;
+
+    while (patch < patchcrc)
+    {
+        position += readvint(&patch);
+
+        unsigned char *hunk = patch;
+        while (patch8())
+            ;
+
+        if (index->count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            ups_hunk_t *hunks = realloc(index->hunks, capacity * sizeof(ups_hunk_t));
+
+            if (!hunks)
+                return APPLY_ERROR("Not enough memory to index the patch.");
+
+            index->hunks = hunks;
+        }
+
+        ups_hunk_t *h = &index->hunks[index->count++];
+        h->start = position;
+        h->length = patch - hunk;
+        h->patch = hunk - patchstart;
+
+        position += h->length;
+    }
+
+#undef patch8
+
+    return APPLY_RET_SUCCESS;
+}
+
+static int ups_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length)
 {
-    bytearray_t b = bytearray_new();
+    const ups_index_t *index = v->index;
+    const unsigned char *patch = v->patch.handle;
+    unsigned long end = offset + length;
+
+    // Unchanged bytes come from the input, zero past its end.
+    unsigned long copied = offset < v->input.size ? (v->input.size - offset < length ? v->input.size - offset : length) : 0;
+    if (copied)
+        memcpy(out, v->input.handle + offset, copied);
+
+    memset(out + copied, 0, length - copied);
+
+    // First hunk ending past offset.
+    unsigned long lo = 0, hi = index->count;
+
+    while (lo < hi)
+    {
+        unsigned long mid = lo + (hi - lo) / 2;
+
+        if (index->hunks[mid].start + index->hunks[mid].length <= offset)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    for (unsigned long i = lo; i < index->count && index->hunks[i].start < end; ++i)
+    {
+        const ups_hunk_t *h = &index->hunks[i];
+        unsigned long from = h->start > offset ? h->start : offset;
+        unsigned long to = h->start + h->length < end ? h->start + h->length : end;
+
+        for (unsigned long at = from; at < to; ++at)
+            out[at - offset] ^= patch[h->patch + (at - h->start)];
+    }
+
+    return APPLY_RET_SUCCESS;
+}
+
+static void ups_view_close(patch_view_t *v)
+{
+    ups_index_t *index = v->index;
+
+    free(index->hunks);
+    free(index);
+}
 
-    bytearray_push_string(&b, "UPS1");
+// -------------------------------------------------
+// Patch Creation
+// -------------------------------------------------
 
+static int ups_create(patch_create_context_t *c)
+{
     unsigned char *patched = c->patched.handle;
     unsigned long patched_size = c->patched.size;
 
@@ -144,48 +448,196 @@ static int ups_create(patch_create_context_t *c)
 
 #define patched8(i) (patched[i])
 #define base8(i) (i < base_size ? base[i] : 0)
-#define write32le(a, i) \
-    (bytearray_push(a, i[0]), bytearray_push(a, i[1]), bytearray_push(a, i[2]), bytearray_push(a, i[3]))
 
-    bytearray_push_vle(&b, base_size);
-    bytearray_push_vle(&b, patched_size);
+    diff_runs_t runs;
+
+    stats_phase_begin(c->stats, STATS_PHASE_DIFF);
+    int scanned = diff_scan_candidates(&runs, patched, patched_size, base, base_size, c->candidates);
+    stats_phase_end(c->stats);
 
-    for (unsigned long offset = 0, rel_offset = 0; offset < patched_size; offset++)
+    if (!scanned)
+        return CREATE_ERROR("Not enough memory to diff the files.");
+
+    writer_t w;
+    if (!writer_open(&w, &c->output))
     {
-        if (patched8(offset) == base8(offset))
-            continue;
+        diff_runs_close(&runs);
+        return CREATE_RET_INVALID_OUTPUT;
+    }
 
-        bytearray_push_vle(&b, offset - rel_offset);
+    // Header, then per run its distance, xor'ed bytes and terminator, then the footer.
+    writer_reserve(&w, 4 + 2 * BYTEARRAY_VLE_MAX + runs.changed + runs.count * (BYTEARRAY_VLE_MAX + 1) + 12);
 
-        for (; patched8(offset) != base8(offset) && offset < patched_size; ++offset)
-            bytearray_push(&b, patched8(offset) ^ base8(offset));
+    writer_push_string(&w, "UPS1");
+    writer_push_vle(&w, base_size);
+    writer_push_vle(&w, patched_size);
 
-        bytearray_push(&b, 0);
-        rel_offset = offset + 1;
-    }
+    unsigned long long next_progress = progress_start(c->progress, patched_size);
 
-    unsigned int crc_input = crc32(base, base_size, 0);
-    unsigned int crc_output = crc32(patched, patched_size, 0);
+    // Each hunk is the distance from the previous one, the xor'ed bytes and
+    // a terminating zero which stands in for the first unchanged byte.
+    for (unsigned long i = 0, rel_offset = 0; i < runs.count; i++)
+    {
+        const diff_run_t *run = &runs.runs[i];
+
+        progress_tick(c->progress, next_progress, run->start);
 
-    unsigned char *crc_input_bytes = (unsigned char *)&crc_input;
-    unsigned char *crc_output_bytes = (unsigned char *)&crc_output;
+        writer_push_vle(&w, run->start - rel_offset);
 
-    write32le(&b, crc_input_bytes);
-    write32le(&b, crc_output_bytes);
+        for (unsigned long offset = run->start; offset < run->end;)
+        {
+            unsigned long n = run->end - offset < WRITER_CHUNK ? run->end - offset : WRITER_CHUNK;
+            unsigned char *hunk = writer_extend(&w, n);
+            if (!hunk)
+                break;
 
-    unsigned int crc_patch = crc32(b.data, b.size, 0);
-    unsigned char *crc_patch_bytes = (unsigned char *)&crc_patch;
+            for (unsigned long end = offset + n; offset < end; ++offset)
+                *hunk++ = patched8(offset) ^ base8(offset);
+        }
 
-    write32le(&b, crc_patch_bytes);
+        writer_push(&w, 0);
+        rel_offset = run->end + 1;
+
+        stats_count(c->stats, STATS_UPS_HUNK, run->end - run->start + 1);
+    }
+
+    diff_runs_close(&runs);
+    progress_finish(c->progress);
+
+    stats_phase_begin(c->stats, STATS_PHASE_CRC);
+    unsigned int crc_input = filemap_crc32(&c->base, base_size);
+    unsigned int crc_output = filemap_crc32(&c->patched, patched_size);
+    stats_phase_end(c->stats);
+
+    writer_push_le32(&w, crc_input);
+    writer_push_le32(&w, crc_output);
+    writer_push_le32(&w, writer_crc32(&w));
 
 #undef patched8
 #undef base8
-#undef write32le
 
-    filemap_create(&c->output, b.size);
-    memcpy(c->output.handle, b.data, b.size);
+    if (!writer_finish(&w))
+        return CREATE_ERROR("Cannot write the patch.");
+
+    return CREATE_RET_SUCCESS;
+}
+
+// -------------------------------------------------
+// Streaming Creation
+// -------------------------------------------------
+
+// Same patch as ups_create, from one pass over both files. Hunks only ever
+// need the bytes at hand, so each block is encoded as soon as it is read
+// and the checksums are carried along.
+static int ups_create_stream(patch_create_context_t *c, stream_t *patched_stream, stream_t *base_stream)
+{
+    unsigned long patched_size = patched_stream->size;
+    unsigned long base_size = base_stream->size;
+
+    writer_t w;
+    if (!writer_open(&w, &c->output))
+        return CREATE_RET_INVALID_OUTPUT;
+
+    writer_push_string(&w, "UPS1");
+    writer_push_vle(&w, base_size);
+    writer_push_vle(&w, patched_size);
+
+    unsigned int crc_input = 0, crc_output = 0;
+    unsigned long offset = 0, rel_offset = 0, run_length = 0;
+    int in_run = 0, base_done = 0;
+
+    unsigned long long next_progress = progress_start(c->progress, patched_size);
+
+    for (;;)
+    {
+        const unsigned char *patched, *base = NULL;
+        unsigned long length = stream_next(patched_stream, &patched), base_length = 0;
+
+        if (!length)
+            break;
+
+        // Blocks of both files line up until the base runs out.
+        if (!base_done && !(base_length = stream_next(base_stream, &base)))
+            base_done = 1;
+
+        crc_output = crc32(patched, length, crc_output);
+        crc_input = crc32(base, base_length, crc_input);
+
+        for (unsigned long i = 0; i < length;)
+        {
+            if (!in_run)
+            {
+                unsigned long change = diff_find_change(patched, base, base_length, i, length);
+
+                if (change == length)
+                    break;
+
+                writer_push_vle(&w, offset + change - rel_offset);
+                in_run = 1;
+                i = change;
+            }
+
+            unsigned long same = diff_find_same(patched, base, base_length, i, length);
+
+            for (unsigned long from = i; from < same;)
+            {
+                unsigned long n = same - from < WRITER_CHUNK ? same - from : WRITER_CHUNK;
+                unsigned char *hunk = writer_extend(&w, n);
+                if (!hunk)
+                    break;
+
+                for (unsigned long end = from + n; from < end; ++from)
+                    *hunk++ = patched[from] ^ (from < base_length ? base[from] : 0);
+            }
+
+            run_length += same - i;
+
+            if (same == length)
+                break;
+
+            // The terminating zero stands in for the first unchanged byte.
+            writer_push(&w, 0);
+            stats_count(c->stats, STATS_UPS_HUNK, run_length + 1);
+            run_length = 0;
+            rel_offset = offset + same + 1;
+            in_run = 0;
+            i = same + 1;
+        }
+
+        offset += length;
+        progress_tick(c->progress, next_progress, offset);
+    }
+
+    if (in_run)
+    {
+        writer_push(&w, 0);
+        stats_count(c->stats, STATS_UPS_HUNK, run_length + 1);
+    }
+
+    // The input checksum covers all of the base, past the patched size too.
+    if (!base_done)
+    {
+        const unsigned char *base;
+        unsigned long base_length;
+
+        while ((base_length = stream_next(base_stream, &base)))
+            crc_input = crc32(base, base_length, crc_input);
+    }
+
+    progress_finish(c->progress);
+
+    if (offset != patched_size || patched_stream->failed || base_stream->failed)
+    {
+        writer_abort(&w);
+        return CREATE_ERROR("Cannot read the input files.");
+    }
+
+    writer_push_le32(&w, crc_input);
+    writer_push_le32(&w, crc_output);
+    writer_push_le32(&w, writer_crc32(&w));
 
-    bytearray_close(&b);
+    if (!writer_finish(&w))
+        return CREATE_ERROR("Cannot write the patch.");
 
     return CREATE_RET_SUCCESS;
 }
@@ -1,5 +1,12 @@
+#include "actions/cache.h"
+#include "actions/cat.h"
+#include "actions/compose.h"
+#include "actions/convert.h"
 #include "actions/create.h"
+#include "actions/index.h"
 #include "actions/patch.h"
+#include "actions/serve.h"
+#include "actions/verify.h"
 #include "helpers/argc.h"
 #include "helpers/filemap.h"
 #include "helpers/format.h"
@@ -15,12 +22,20 @@ static const struct
     const char *subcommand;
     int (*func)(const char *, int, char *[]);
 } commands[] = {
-    { "patch",  gible_patch},
-    {"create", gible_create},
+    {  "patch",   gible_patch},
+    { "create",  gible_create},
+    {  "serve",   gible_serve},
+    { "client",  gible_client},
+    { "verify",  gible_verify},
+    {    "cat",     gible_cat},
+    {"convert", gible_convert},
+    {"compose", gible_compose},
+    {  "cache",   gible_cache},
+    {  "index",   gible_index},
 };
 
 static const char *gible_usage[] = {
-    "[patch, create]",
+    "[patch, create, convert, compose, verify, cat, cache, index, serve, client]",
     NULL,
 };
 
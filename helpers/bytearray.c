@@ -3,7 +3,6 @@
 #include <string.h>
 
 static void bytearray_init(bytearray_t *a);
-static void bytearray_grow_if(bytearray_t *a);
 
 bytearray_t bytearray_new(void)
 {
@@ -17,6 +16,7 @@ static void bytearray_init(bytearray_t *a)
     a->size = 0;
     a->capacity = 0;
     a->data = NULL;
+    a->failed = 0;
 }
 
 int bytearray_resize(bytearray_t *a, unsigned long size)
@@ -33,48 +33,113 @@ int bytearray_resize(bytearray_t *a, unsigned long size)
     return 0;
 }
 
-static void bytearray_grow_if(bytearray_t *a)
+// Makes room for extra more bytes, at least doubling so appends stay amortised O(1).
+int bytearray_reserve(bytearray_t *a, unsigned long extra)
 {
-    if (a->capacity == 0)
-        bytearray_resize(a, 10);
+    if (a->capacity - a->size >= extra)
+        return 1;
+
+    unsigned long capacity = a->capacity ? a->capacity * 2 : 64;
+
+    if (capacity < a->size + extra)
+        capacity = a->size + extra;
 
-    else if (a->size >= a->capacity)
-        bytearray_resize(a, a->capacity * 2);
+    if (!bytearray_resize(a, capacity))
+    {
+        a->failed = 1;
+        return 0;
+    }
+
+    return 1;
 }
 
-inline void bytearray_push(bytearray_t *a, unsigned char c)
+unsigned char *bytearray_extend(bytearray_t *a, unsigned long size)
 {
-    bytearray_grow_if(a);
-    a->data[a->size++] = c;
+    if (!bytearray_reserve(a, size))
+        return NULL;
+
+    unsigned char *p = a->data + a->size;
+    a->size += size;
+    return p;
 }
 
-void bytearray_push_data(bytearray_t *a, unsigned char *bytes, unsigned long size)
+void bytearray_push(bytearray_t *a, unsigned char c)
 {
-    while (size--)
-        bytearray_push(a, *(bytes++));
+    if (a->size < a->capacity || bytearray_reserve(a, 1))
+        a->data[a->size++] = c;
+}
+
+void bytearray_push_data(bytearray_t *a, const unsigned char *bytes, unsigned long size)
+{
+    unsigned char *p = bytearray_extend(a, size);
+
+    if (p && size)
+        memcpy(p, bytes, size);
 }
 
 void bytearray_push_string(bytearray_t *a, const char *str)
 {
     unsigned long size = strlen(str);
-    bytearray_push_data(a, (unsigned char *)str, size);
+    bytearray_push_data(a, (const unsigned char *)str, size);
 }
 
+// Same encoding as readvint: 7 bits per byte, the last one flagged with
+// 0x80, and each continuation offset by one.
 void bytearray_push_vle(bytearray_t *a, unsigned long value)
 {
-    while (1)
+    if (!bytearray_reserve(a, BYTEARRAY_VLE_MAX))
+        return;
+
+    unsigned char *p = a->data + a->size, *start = p;
+
+    while (value >= 0x80)
     {
-        unsigned long x = value & 0x7f;
-
-        value >>= 7;
-        if (value == 0)
-        {
-            bytearray_push(a, 0x80 | x);
-            break;
-        }
-        bytearray_push(a, x);
-        value--;
+        *p++ = value & 0x7f;
+        value = (value >> 7) - 1;
     }
+
+    *p++ = 0x80 | value;
+    a->size += p - start;
+}
+
+void bytearray_push_le16(bytearray_t *a, unsigned int value)
+{
+    unsigned char *p = bytearray_extend(a, 2);
+
+    if (p)
+        p[0] = value, p[1] = value >> 8;
+}
+
+void bytearray_push_le32(bytearray_t *a, unsigned int value)
+{
+    unsigned char *p = bytearray_extend(a, 4);
+
+    if (p)
+        p[0] = value, p[1] = value >> 8, p[2] = value >> 16, p[3] = value >> 24;
+}
+
+void bytearray_push_be16(bytearray_t *a, unsigned int value)
+{
+    unsigned char *p = bytearray_extend(a, 2);
+
+    if (p)
+        p[0] = value >> 8, p[1] = value;
+}
+
+void bytearray_push_be24(bytearray_t *a, unsigned int value)
+{
+    unsigned char *p = bytearray_extend(a, 3);
+
+    if (p)
+        p[0] = value >> 16, p[1] = value >> 8, p[2] = value;
+}
+
+void bytearray_push_be32(bytearray_t *a, unsigned int value)
+{
+    unsigned char *p = bytearray_extend(a, 4);
+
+    if (p)
+        p[0] = value >> 24, p[1] = value >> 16, p[2] = value >> 8, p[3] = value;
 }
 
 void bytearray_close(bytearray_t *a)
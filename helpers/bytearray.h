@@ -1,19 +1,30 @@
 #ifndef HELPERS_BYTEARRAY_H
 #define HELPERS_BYTEARRAY_H
 
+// Longest VLE encoding of an unsigned long.
+#define BYTEARRAY_VLE_MAX 10
+
 typedef struct bytearray
 {
     unsigned long size;
     unsigned long capacity;
     unsigned char *data;
+    int failed; // Set once an allocation failed, the contents are incomplete
 } bytearray_t;
 
 bytearray_t bytearray_new(void);
 int bytearray_resize(bytearray_t *a, unsigned long size);
+int bytearray_reserve(bytearray_t *a, unsigned long extra);
+unsigned char *bytearray_extend(bytearray_t *a, unsigned long size);
 void bytearray_push(bytearray_t *a, unsigned char c);
-void bytearray_push_data(bytearray_t *a, unsigned char *byte, unsigned long size);
+void bytearray_push_data(bytearray_t *a, const unsigned char *bytes, unsigned long size);
 void bytearray_push_string(bytearray_t *a, const char *str);
 void bytearray_push_vle(bytearray_t *a, unsigned long value);
+void bytearray_push_le16(bytearray_t *a, unsigned int value);
+void bytearray_push_le32(bytearray_t *a, unsigned int value);
+void bytearray_push_be16(bytearray_t *a, unsigned int value);
+void bytearray_push_be24(bytearray_t *a, unsigned int value);
+void bytearray_push_be32(bytearray_t *a, unsigned int value);
 void bytearray_close(bytearray_t *a);
 
-#endif // HELPERS_BYTEARRAY_H
\ No newline at end of file
+#endif // HELPERS_BYTEARRAY_H
@@ -0,0 +1,347 @@
+#include "helpers/cache.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <linux/fs.h>
+#endif
+#endif
+
+#define CACHE_SUFFIX ".out"
+#define CACHE_TEMP_PREFIX ".tmp-"
+// Temporary files left alone this long belong to writers that died.
+#define CACHE_TEMP_STALE (60 * 60)
+#define CACHE_COPY_BLOCK (1UL << 20)
+
+void cache_key(char *key, const char *format, unsigned int patch_crc, unsigned long long patch_size,
+    unsigned int input_crc, unsigned long long input_size, unsigned int flags)
+{
+    snprintf(key, CACHE_KEY_MAX, "%s-%08x-%llx-%08x-%llx-%04x" CACHE_SUFFIX, format, patch_crc, patch_size, input_crc,
+        input_size, flags);
+}
+
+#if defined(_WIN32)
+
+int cache_fetch(const char *dir, const char *key, const char *fn, int hardlink)
+{
+    (void)dir, (void)key, (void)fn, (void)hardlink;
+    return 0;
+}
+
+int cache_store(const char *dir, const char *key, const char *fn)
+{
+    (void)dir, (void)key, (void)fn;
+    return 0;
+}
+
+int cache_stat(const char *dir, cache_stat_t *s)
+{
+    (void)dir;
+    memset(s, 0, sizeof(cache_stat_t));
+    return 0;
+}
+
+int cache_prune(const char *dir, unsigned long long limit, cache_stat_t *removed)
+{
+    (void)dir, (void)limit;
+
+    if (removed)
+        memset(removed, 0, sizeof(cache_stat_t));
+
+    return 0;
+}
+
+#else
+
+typedef struct cache_entry
+{
+    char name[CACHE_KEY_MAX];
+    unsigned long long size;
+    time_t used;
+} cache_entry_t;
+
+static int cache_path(char *path, const char *dir, const char *name)
+{
+    int length = snprintf(path, PATH_MAX, "%s/%s", dir, name);
+    return length > 0 && length < PATH_MAX;
+}
+
+static int cache_is_entry(const char *name)
+{
+    size_t length = strlen(name), suffix = strlen(CACHE_SUFFIX);
+    return name[0] != '.' && length > suffix && length < CACHE_KEY_MAX &&
+        strcmp(name + length - suffix, CACHE_SUFFIX) == 0;
+}
+
+static int cache_write_all(int fd, const unsigned char *data, size_t size)
+{
+    while (size)
+    {
+        ssize_t n = write(fd, data, size);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+            return 0;
+
+        data += n;
+        size -= n;
+    }
+
+    return 1;
+}
+
+// Shares the extents where the file system can, copies the bytes otherwise.
+static int cache_copy(int from, int to)
+{
+#if defined(FICLONE)
+    if (ioctl(to, FICLONE, from) == 0)
+        return 1;
+#endif
+
+    unsigned char *buffer = malloc(CACHE_COPY_BLOCK);
+
+    if (!buffer)
+        return 0;
+
+    int ok = 1;
+
+    for (;;)
+    {
+        ssize_t n = read(from, buffer, CACHE_COPY_BLOCK);
+
+        if (n < 0 && errno == EINTR)
+            continue;
+
+        if (n <= 0)
+        {
+            ok = n == 0;
+            break;
+        }
+
+        if (!(ok = cache_write_all(to, buffer, n)))
+            break;
+    }
+
+    free(buffer);
+    return ok;
+}
+
+int cache_fetch(const char *dir, const char *key, const char *fn, int hardlink)
+{
+    char path[PATH_MAX];
+    int from;
+
+    if (!cache_path(path, dir, key) || (from = open(path, O_RDONLY)) < 0)
+        return 0;
+
+    // Never write through an existing output, it may be an earlier hardlink.
+    unlink(fn);
+
+    int ok = hardlink && link(path, fn) == 0;
+
+    if (!ok)
+    {
+        int to = open(fn, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        ok = to >= 0 && cache_copy(from, to);
+
+        if (to >= 0 && close(to) != 0)
+            ok = 0;
+
+        if (!ok)
+            unlink(fn);
+    }
+
+    close(from);
+
+    if (ok)
+        utimes(path, NULL);
+
+    return ok;
+}
+
+int cache_store(const char *dir, const char *key, const char *fn)
+{
+    char temp[PATH_MAX], path[PATH_MAX];
+
+    if (mkdir(dir, 0777) != 0 && errno != EEXIST)
+        return 0;
+
+    if (!cache_path(temp, dir, CACHE_TEMP_PREFIX "XXXXXX") || !cache_path(path, dir, key))
+        return 0;
+
+    int to = mkstemp(temp);
+
+    if (to < 0)
+        return 0;
+
+    int from = open(fn, O_RDONLY);
+    int ok = from >= 0 && cache_copy(from, to) && fchmod(to, 0444) == 0;
+
+    if (from >= 0)
+        close(from);
+
+    ok = close(to) == 0 && ok;
+    ok = ok && rename(temp, path) == 0;
+
+    if (!ok)
+        unlink(temp);
+
+    return ok;
+}
+
+// Lists the entries, and removes stale temporary files when prune is set.
+static int cache_list(const char *dir, cache_entry_t **entries, unsigned long *count, int prune)
+{
+    DIR *d = opendir(dir);
+
+    *entries = NULL;
+    *count = 0;
+
+    if (!d)
+        return errno == ENOENT;
+
+    unsigned long capacity = 0;
+    time_t now = time(NULL);
+    struct dirent *e;
+    int ok = 1;
+
+    while (ok && (e = readdir(d)))
+    {
+        char path[PATH_MAX];
+        struct stat st;
+        int temp = strncmp(e->d_name, CACHE_TEMP_PREFIX, strlen(CACHE_TEMP_PREFIX)) == 0;
+
+        if (!(temp || cache_is_entry(e->d_name)) || !cache_path(path, dir, e->d_name))
+            continue;
+
+        if (lstat(path, &st) != 0 || !S_ISREG(st.st_mode))
+            continue;
+
+        if (temp)
+        {
+            if (prune && now - st.st_mtime > CACHE_TEMP_STALE)
+                unlink(path);
+            continue;
+        }
+
+        if (*count == capacity)
+        {
+            capacity = capacity ? capacity * 2 : 64;
+            cache_entry_t *grown = realloc(*entries, capacity * sizeof(cache_entry_t));
+
+            if (!grown)
+            {
+                ok = 0;
+                break;
+            }
+
+            *entries = grown;
+        }
+
+        cache_entry_t *entry = &(*entries)[(*count)++];
+        strcpy(entry->name, e->d_name);
+        entry->size = st.st_size;
+        entry->used = st.st_mtime;
+    }
+
+    closedir(d);
+
+    if (!ok)
+    {
+        free(*entries);
+        *entries = NULL;
+        *count = 0;
+    }
+
+    return ok;
+}
+
+static void cache_stat_add(cache_stat_t *s, const cache_entry_t *entry)
+{
+    if (!s->entries || entry->used < s->oldest)
+        s->oldest = entry->used;
+
+    if (!s->entries || entry->used > s->newest)
+        s->newest = entry->used;
+
+    s->entries++;
+    s->bytes += entry->size;
+}
+
+int cache_stat(const char *dir, cache_stat_t *s)
+{
+    cache_entry_t *entries;
+    unsigned long count;
+
+    memset(s, 0, sizeof(cache_stat_t));
+
+    if (!cache_list(dir, &entries, &count, 0))
+        return 0;
+
+    for (unsigned long i = 0; i < count; ++i)
+        cache_stat_add(s, &entries[i]);
+
+    free(entries);
+    return 1;
+}
+
+static int cache_entry_compare(const void *a, const void *b)
+{
+    const cache_entry_t *x = a, *y = b;
+    return x->used < y->used ? -1 : x->used > y->used;
+}
+
+int cache_prune(const char *dir, unsigned long long limit, cache_stat_t *removed)
+{
+    cache_entry_t *entries;
+    unsigned long count;
+    cache_stat_t dropped;
+
+    memset(&dropped, 0, sizeof(cache_stat_t));
+
+    if (removed)
+        *removed = dropped;
+
+    if (!cache_list(dir, &entries, &count, 1))
+        return 0;
+
+    unsigned long long total = 0;
+
+    for (unsigned long i = 0; i < count; ++i)
+        total += entries[i].size;
+
+    qsort(entries, count, sizeof(cache_entry_t), cache_entry_compare);
+
+    for (unsigned long i = 0; i < count && total > limit; ++i)
+    {
+        char path[PATH_MAX];
+
+        // Someone else may have pruned it already, it is gone either way.
+        if (!cache_path(path, dir, entries[i].name) || (unlink(path) != 0 && errno != ENOENT))
+            continue;
+
+        total -= entries[i].size;
+        cache_stat_add(&dropped, &entries[i]);
+    }
+
+    free(entries);
+
+    if (removed)
+        *removed = dropped;
+
+    return 1;
+}
+
+#endif
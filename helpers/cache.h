@@ -0,0 +1,37 @@
+#ifndef HELPERS_CACHE_H
+#define HELPERS_CACHE_H
+
+#include <time.h>
+
+// Longest key cache_key writes, terminator included.
+#define CACHE_KEY_MAX 96
+
+/* Content addressed store of patched outputs, shared between processes.
+ *
+ * Entries are read only files named after their key, so any number of
+ * jobs can look up and fill the same directory. New entries are written
+ * to a temporary file and renamed into place, readers never see half an
+ * entry. A hit refreshes the entry's modification time, which is what
+ * pruning goes by. */
+typedef struct cache_stat
+{
+    unsigned long entries;
+    unsigned long long bytes;
+    time_t oldest, newest; // Last use of the entries
+} cache_stat_t;
+
+void cache_key(char *key, const char *format, unsigned int patch_crc, unsigned long long patch_size,
+    unsigned int input_crc, unsigned long long input_size, unsigned int flags);
+
+// Puts the entry for key at fn by reflink, a hardlink when link is set, or
+// a copy. Returns 0 on a miss.
+int cache_fetch(const char *dir, const char *key, const char *fn, int link);
+// Adds fn as the entry for key, the directory is created if needed.
+int cache_store(const char *dir, const char *key, const char *fn);
+
+int cache_stat(const char *dir, cache_stat_t *s);
+// Removes the least recently used entries until at most limit bytes are
+// left, and temporary files abandoned by crashed writers. removed may be NULL.
+int cache_prune(const char *dir, unsigned long long limit, cache_stat_t *removed);
+
+#endif // HELPERS_CACHE_H
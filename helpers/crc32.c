@@ -1,6 +1,7 @@
 #include "helpers/crc32.h"
 #include <stdint.h>
 #include <stdlib.h>
+#include <string.h>
 
 // clang-format off
 
@@ -26,3 +27,78 @@ unsigned int crc32(const void *data, unsigned long length, unsigned int prev)
 
     return ~crc;
 }
+
+// Continues a checksum over length copies of byte.
+unsigned int crc32_fill(unsigned char byte, unsigned long length, unsigned int prev)
+{
+    unsigned char block[256];
+    memset(block, byte, sizeof(block));
+
+    while (length)
+    {
+        unsigned long chunk = length < sizeof(block) ? length : sizeof(block);
+        prev = crc32(block, chunk, prev);
+        length -= chunk;
+    }
+
+    return prev;
+}
+
+// Multiplies vec by a 32x32 matrix over GF(2), one column per word.
+static unsigned int crc32_gf2_times(const unsigned int *matrix, unsigned int vec)
+{
+    unsigned int sum = 0;
+
+    for (; vec; vec >>= 1, matrix++)
+    {
+        if (vec & 1)
+            sum ^= *matrix;
+    }
+
+    return sum;
+}
+
+static void crc32_gf2_square(unsigned int *square, const unsigned int *matrix)
+{
+    for (int n = 0; n < 32; n++)
+        square[n] = crc32_gf2_times(matrix, matrix[n]);
+}
+
+// Appends length2 zero bytes to crc1 by repeated squaring of the operator
+// for one zero bit, then folds crc2 in. Same method as zlib's.
+unsigned int crc32_combine(unsigned int crc1, unsigned int crc2, unsigned long long length2)
+{
+    unsigned int even[32], odd[32];
+
+    if (!length2)
+        return crc1;
+
+    odd[0] = 0xEDB88320;
+    for (int n = 1; n < 32; n++)
+        odd[n] = 1U << (n - 1);
+
+    crc32_gf2_square(even, odd); // Two zero bits
+    crc32_gf2_square(odd, even); // Four
+
+    do
+    {
+        crc32_gf2_square(even, odd);
+
+        if (length2 & 1)
+            crc1 = crc32_gf2_times(even, crc1);
+
+        length2 >>= 1;
+
+        if (!length2)
+            break;
+
+        crc32_gf2_square(odd, even);
+
+        if (length2 & 1)
+            crc1 = crc32_gf2_times(odd, crc1);
+
+        length2 >>= 1;
+    } while (length2);
+
+    return crc1 ^ crc2;
+}
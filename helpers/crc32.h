@@ -2,5 +2,9 @@
 #define HELPERS_CRC32_H
 
 unsigned int crc32(const void *data, unsigned long length, unsigned int prev);
+unsigned int crc32_fill(unsigned char byte, unsigned long length, unsigned int prev);
+// Checksum of two buffers back to back, from each one's checksum and the
+// length of the second.
+unsigned int crc32_combine(unsigned int crc1, unsigned int crc2, unsigned long long length2);
 
 #endif /* HELPERS_CRC32_H */
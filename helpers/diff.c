@@ -0,0 +1,324 @@
+#include "helpers/diff.h"
+#include "helpers/trace.h"
+#include "helpers/utils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Below this every chunk would be too small to be worth a thread.
+#define DIFF_MIN_CHUNK (1UL << 20)
+#define DIFF_CHUNK_ALIGN 4096UL
+#define DIFF_MAX_THREADS 64
+
+typedef struct diff_chunk
+{
+    const unsigned char *patched;
+    const unsigned char *base;
+    unsigned long base_size;
+    unsigned long start, end;
+    diff_runs_t runs;
+    int ok;
+} diff_chunk_t;
+
+static int diff_runs_push(diff_runs_t *r, unsigned long start, unsigned long end)
+{
+    if (r->count == r->capacity)
+    {
+        unsigned long capacity = r->capacity ? r->capacity * 2 : 64;
+        diff_run_t *runs = realloc(r->runs, capacity * sizeof(diff_run_t));
+
+        if (!runs)
+            return 0;
+
+        r->runs = runs;
+        r->capacity = capacity;
+    }
+
+    r->runs[r->count].start = start;
+    r->runs[r->count].end = end;
+    r->count++;
+    r->changed += end - start;
+    return 1;
+}
+
+// First index in [i, end) where the bytes differ, comparing eight at a time.
+static unsigned long diff_skip_equal(const unsigned char *p, const unsigned char *b, unsigned long i, unsigned long end)
+{
+    while (i + 8 <= end)
+    {
+        uint64_t x, y;
+        memcpy(&x, p + i, 8);
+        memcpy(&y, b + i, 8);
+
+        if (x != y)
+            break;
+
+        i += 8;
+    }
+
+    while (i < end && p[i] == b[i])
+        i++;
+
+    return i;
+}
+
+static unsigned long diff_skip_zero(const unsigned char *p, unsigned long i, unsigned long end)
+{
+    while (i + 8 <= end)
+    {
+        uint64_t x;
+        memcpy(&x, p + i, 8);
+
+        if (x)
+            break;
+
+        i += 8;
+    }
+
+    while (i < end && !p[i])
+        i++;
+
+    return i;
+}
+
+unsigned long diff_find_change(const unsigned char *p, const unsigned char *b, unsigned long base_size, unsigned long i,
+    unsigned long end)
+{
+    // Up to shared both files have bytes, past it the base reads as zero.
+    unsigned long shared = base_size < end ? base_size : end;
+
+    if (i < shared)
+        i = diff_skip_equal(p, b, i, shared);
+
+    if (i >= shared)
+        i = diff_skip_zero(p, i, end);
+
+    return i;
+}
+
+unsigned long diff_find_same(const unsigned char *p, const unsigned char *b, unsigned long base_size, unsigned long i,
+    unsigned long end)
+{
+    while (i < end && p[i] != (i < base_size ? b[i] : 0))
+        i++;
+
+    return i;
+}
+
+static void *diff_scan_chunk(void *arg)
+{
+    diff_chunk_t *c = arg;
+    const unsigned char *p = c->patched, *b = c->base;
+    unsigned long i = c->start, end = c->end;
+
+    double traced = trace_begin();
+
+    c->ok = 1;
+
+    while (i < end)
+    {
+        if ((i = diff_find_change(p, b, c->base_size, i, end)) >= end)
+            break;
+
+        unsigned long start = i;
+        i = diff_find_same(p, b, c->base_size, i, end);
+
+        if (!diff_runs_push(&c->runs, start, i))
+        {
+            c->ok = 0;
+            break;
+        }
+    }
+
+    trace_end("diff chunk", NULL, traced);
+    return NULL;
+}
+
+static void *diff_scan_worker(void *arg)
+{
+    trace_thread_name("diff worker");
+    return diff_scan_chunk(arg);
+}
+
+int diff_scan(diff_runs_t *r, const unsigned char *patched, unsigned long patched_size, const unsigned char *base,
+    unsigned long base_size)
+{
+    memset(r, 0, sizeof(diff_runs_t));
+
+    unsigned long threads = cpu_count();
+    if (threads > DIFF_MAX_THREADS)
+        threads = DIFF_MAX_THREADS;
+
+    unsigned long chunk = (patched_size / threads + DIFF_CHUNK_ALIGN - 1) & ~(DIFF_CHUNK_ALIGN - 1);
+    if (chunk < DIFF_MIN_CHUNK)
+        chunk = DIFF_MIN_CHUNK;
+
+    diff_chunk_t chunks[DIFF_MAX_THREADS];
+    pthread_t handles[DIFF_MAX_THREADS];
+    int started[DIFF_MAX_THREADS];
+    unsigned long count = 0;
+
+    for (unsigned long start = 0; count == 0 || start < patched_size; start += chunk)
+    {
+        diff_chunk_t *c = &chunks[count++];
+        memset(c, 0, sizeof(diff_chunk_t));
+        c->patched = patched;
+        c->base = base;
+        c->base_size = base_size;
+        c->start = start;
+        c->end = patched_size - start > chunk ? start + chunk : patched_size;
+    }
+
+    // The calling thread takes the first chunk itself.
+    for (unsigned long i = 1; i < count; ++i)
+        started[i] = pthread_create(&handles[i], NULL, diff_scan_worker, &chunks[i]) == 0;
+
+    diff_scan_chunk(&chunks[0]);
+
+    int ok = 1;
+
+    for (unsigned long i = 0; i < count; ++i)
+    {
+        diff_chunk_t *c = &chunks[i];
+
+        if (i && started[i])
+            pthread_join(handles[i], NULL);
+        else if (i)
+            diff_scan_chunk(c);
+
+        ok = ok && c->ok;
+
+        for (unsigned long j = 0; ok && j < c->runs.count; ++j)
+        {
+            diff_run_t *run = &c->runs.runs[j];
+
+            // Stitch runs that were cut at a chunk boundary.
+            if (j == 0 && r->count && r->runs[r->count - 1].end == run->start)
+            {
+                r->runs[r->count - 1].end = run->end;
+                r->changed += run->end - run->start;
+                continue;
+            }
+
+            ok = diff_runs_push(r, run->start, run->end);
+        }
+
+        diff_runs_close(&c->runs);
+    }
+
+    if (!ok)
+        diff_runs_close(r);
+
+    return ok;
+}
+
+int diff_scan_candidates(diff_runs_t *r, const unsigned char *patched, unsigned long patched_size,
+    const unsigned char *base, unsigned long base_size, const diff_runs_t *candidates)
+{
+    if (!candidates)
+        return diff_scan(r, patched, patched_size, base, base_size);
+
+    memset(r, 0, sizeof(diff_runs_t));
+
+    for (unsigned long c = 0; c < candidates->count; ++c)
+    {
+        unsigned long i = candidates->runs[c].start;
+        unsigned long end = candidates->runs[c].end < patched_size ? candidates->runs[c].end : patched_size;
+
+        while (i < end)
+        {
+            if ((i = diff_find_change(patched, base, base_size, i, end)) >= end)
+                break;
+
+            unsigned long start = i;
+            i = diff_find_same(patched, base, base_size, i, end);
+
+            // Candidates that touch may split a run in two.
+            if (r->count && r->runs[r->count - 1].end == start)
+            {
+                r->runs[r->count - 1].end = i;
+                r->changed += i - start;
+            }
+            else if (!diff_runs_push(r, start, i))
+            {
+                diff_runs_close(r);
+                return 0;
+            }
+        }
+    }
+
+    return 1;
+}
+
+void diff_runs_add(diff_runs_t *r, unsigned long start, unsigned long end)
+{
+    if (start >= end)
+        return;
+
+    diff_run_t *last = r->count ? &r->runs[r->count - 1] : NULL;
+
+    if (last && start >= last->start && start <= last->end)
+    {
+        if (end > last->end)
+        {
+            r->changed += end - last->end;
+            last->end = end;
+        }
+        return;
+    }
+
+    if (!diff_runs_push(r, start, end))
+        r->failed = 1;
+}
+
+static int diff_run_compare(const void *a, const void *b)
+{
+    const diff_run_t *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+void diff_runs_normalise(diff_runs_t *r)
+{
+    if (!r->count)
+        return;
+
+    qsort(r->runs, r->count, sizeof(diff_run_t), diff_run_compare);
+
+    unsigned long count = 1;
+    r->changed = r->runs[0].end - r->runs[0].start;
+
+    for (unsigned long i = 1; i < r->count; ++i)
+    {
+        diff_run_t *last = &r->runs[count - 1], *run = &r->runs[i];
+
+        if (run->start <= last->end)
+        {
+            if (run->end > last->end)
+            {
+                r->changed += run->end - last->end;
+                last->end = run->end;
+            }
+            continue;
+        }
+
+        r->changed += run->end - run->start;
+        r->runs[count++] = *run;
+    }
+
+    r->count = count;
+}
+
+void diff_runs_close(diff_runs_t *r)
+{
+    free(r->runs);
+    memset(r, 0, sizeof(diff_runs_t));
+}
+
+unsigned long diff_runs_seek(const diff_runs_t *r, unsigned long hint, unsigned long offset)
+{
+    while (hint < r->count && r->runs[hint].end <= offset)
+        hint++;
+
+    return hint;
+}
@@ -0,0 +1,49 @@
+#ifndef HELPERS_DIFF_H
+#define HELPERS_DIFF_H
+
+// A maximal span [start, end) where the patched file differs from the base.
+typedef struct diff_run
+{
+    unsigned long start;
+    unsigned long end;
+} diff_run_t;
+
+typedef struct diff_runs
+{
+    diff_run_t *runs;
+    unsigned long count;
+    unsigned long capacity;
+    unsigned long changed; // Total bytes covered by the runs
+    int failed; // diff_runs_add ran out of memory, the runs miss some ranges
+} diff_runs_t;
+
+// Finds every changed run of patched against base, in order. Bytes past the
+// end of base compare against zero. Large files are split into chunks that
+// are scanned in parallel and stitched back together.
+int diff_scan(diff_runs_t *r, const unsigned char *patched, unsigned long patched_size, const unsigned char *base,
+    unsigned long base_size);
+void diff_runs_close(diff_runs_t *r);
+
+// Same as diff_scan, but only looks inside the sorted candidate runs and
+// takes every byte outside of them as unchanged. NULL scans everything.
+int diff_scan_candidates(diff_runs_t *r, const unsigned char *patched, unsigned long patched_size,
+    const unsigned char *base, unsigned long base_size, const diff_runs_t *candidates);
+
+// Appends [start, end) in any order, growing the last run when the two touch.
+// diff_runs_normalise sorts them afterwards and merges the overlaps.
+void diff_runs_add(diff_runs_t *r, unsigned long start, unsigned long end);
+void diff_runs_normalise(diff_runs_t *r);
+
+// Building blocks of diff_scan for callers walking a window at a time: the
+// first index in [i, end) where patched and base differ, or agree again.
+// Indexes are shared by both buffers, base reads as zero from base_size on.
+unsigned long diff_find_change(const unsigned char *p, const unsigned char *b, unsigned long base_size, unsigned long i,
+    unsigned long end);
+unsigned long diff_find_same(const unsigned char *p, const unsigned char *b, unsigned long base_size, unsigned long i,
+    unsigned long end);
+
+// Index of the first run ending after offset, starting the search at hint.
+// Successive calls with growing offsets are amortised O(1).
+unsigned long diff_runs_seek(const diff_runs_t *r, unsigned long hint, unsigned long offset);
+
+#endif // HELPERS_DIFF_H
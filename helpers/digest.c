@@ -0,0 +1,345 @@
+#include "helpers/digest.h"
+#include "helpers/crc32.h"
+#include "helpers/utils.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#define rol32(x, n) ((x) << (n) | (x) >> (32 - (n)))
+#define ror32(x, n) ((x) >> (n) | (x) << (32 - (n)))
+
+static const char *digest_names[DIGEST_COUNT] = { "CRC32", "MD5", "SHA1", "SHA256" };
+
+// clang-format off
+
+static const uint32_t md5_k[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const unsigned char md5_r[16] = { 7, 12, 17, 22, 5, 9, 14, 20, 4, 11, 16, 23, 6, 10, 15, 21 };
+
+static const uint32_t sha256_k[64] =
+{
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+// clang-format on
+
+static uint32_t load32le(const unsigned char *p)
+{
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint32_t load32be(const unsigned char *p)
+{
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | (uint32_t)p[3];
+}
+
+static void store32be(unsigned char *p, uint32_t value)
+{
+    p[0] = value >> 24, p[1] = value >> 16, p[2] = value >> 8, p[3] = value;
+}
+
+static void md5_block(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[16], a = h[0], b = h[1], c = h[2], d = h[3];
+
+    for (int i = 0; i < 16; ++i)
+        w[i] = load32le(p + i * 4);
+
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t f;
+        int g;
+
+        if (i < 16)
+            f = (b & c) | (~b & d), g = i;
+        else if (i < 32)
+            f = (d & b) | (~d & c), g = (5 * i + 1) & 15;
+        else if (i < 48)
+            f = b ^ c ^ d, g = (3 * i + 5) & 15;
+        else
+            f = c ^ (b | ~d), g = (7 * i) & 15;
+
+        uint32_t t = d;
+        d = c;
+        c = b;
+        f += a + md5_k[i] + w[g];
+        b += rol32(f, md5_r[(i >> 4) << 2 | (i & 3)]);
+        a = t;
+    }
+
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d;
+}
+
+static void sha1_block(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[80], a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+
+    for (int i = 0; i < 16; ++i)
+        w[i] = load32be(p + i * 4);
+
+    for (int i = 16; i < 80; ++i)
+    {
+        uint32_t x = w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16];
+        w[i] = rol32(x, 1);
+    }
+
+    for (int i = 0; i < 80; ++i)
+    {
+        uint32_t f, k;
+
+        if (i < 20)
+            f = (b & c) | (~b & d), k = 0x5a827999;
+        else if (i < 40)
+            f = b ^ c ^ d, k = 0x6ed9eba1;
+        else if (i < 60)
+            f = (b & c) | (b & d) | (c & d), k = 0x8f1bbcdc;
+        else
+            f = b ^ c ^ d, k = 0xca62c1d6;
+
+        uint32_t t = rol32(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rol32(b, 30);
+        b = a;
+        a = t;
+    }
+
+    h[0] += a, h[1] += b, h[2] += c, h[3] += d, h[4] += e;
+}
+
+static void sha256_block(uint32_t *h, const unsigned char *p)
+{
+    uint32_t w[64], s[8];
+
+    for (int i = 0; i < 16; ++i)
+        w[i] = load32be(p + i * 4);
+
+    for (int i = 16; i < 64; ++i)
+    {
+        uint32_t s0 = ror32(w[i - 15], 7) ^ ror32(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = ror32(w[i - 2], 17) ^ ror32(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    memcpy(s, h, sizeof(s));
+
+    for (int i = 0; i < 64; ++i)
+    {
+        uint32_t e = s[4], a = s[0];
+        uint32_t t1 = s[7] + (ror32(e, 6) ^ ror32(e, 11) ^ ror32(e, 25)) + ((e & s[5]) ^ (~e & s[6])) + sha256_k[i] +
+            w[i];
+        uint32_t t2 = (ror32(a, 2) ^ ror32(a, 13) ^ ror32(a, 22)) + ((a & s[1]) ^ (a & s[2]) ^ (s[1] & s[2]));
+
+        memmove(s + 1, s, 7 * sizeof(uint32_t));
+        s[4] += t1;
+        s[0] = t1 + t2;
+    }
+
+    for (int i = 0; i < 8; ++i)
+        h[i] += s[i];
+}
+
+// The Merkle-Damgard frame all three share: 64 byte blocks, then a 0x80
+// byte, zeros and the length in bits, little endian for MD5 only.
+static void digest_blocks(void (*block)(uint32_t *, const unsigned char *), uint32_t *h, const unsigned char *data,
+    unsigned long size, int little_endian)
+{
+    unsigned char tail[128];
+    unsigned long whole = size & ~63UL, rest = size - whole;
+    uint64_t bits = (uint64_t)size * 8;
+
+    for (unsigned long i = 0; i < whole; i += 64)
+        block(h, data + i);
+
+    memset(tail, 0, sizeof(tail));
+    memcpy(tail, data + whole, rest);
+    tail[rest] = 0x80;
+
+    unsigned long length = rest < 56 ? 64 : 128;
+
+    for (int i = 0; i < 8; ++i)
+        tail[little_endian ? length - 8 + i : length - 1 - i] = bits >> (i * 8);
+
+    for (unsigned long i = 0; i < length; i += 64)
+        block(h, tail + i);
+}
+
+typedef struct digest_lane
+{
+    digest_t *d;
+    int type;
+    const unsigned char *data;
+    unsigned long size;
+} digest_lane_t;
+
+static void *digest_run(void *arg)
+{
+    digest_lane_t *l = arg;
+    digest_t *d = l->d;
+
+    switch (l->type)
+    {
+    case DIGEST_CRC32:
+        d->crc = crc32(l->data, l->size, 0);
+        break;
+
+    case DIGEST_MD5:
+    {
+        uint32_t h[4] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476 };
+        digest_blocks(md5_block, h, l->data, l->size, 1);
+
+        for (int i = 0; i < 4; ++i)
+            d->md5[i * 4] = h[i], d->md5[i * 4 + 1] = h[i] >> 8, d->md5[i * 4 + 2] = h[i] >> 16,
+                       d->md5[i * 4 + 3] = h[i] >> 24;
+        break;
+    }
+
+    case DIGEST_SHA1:
+    {
+        uint32_t h[5] = { 0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0 };
+        digest_blocks(sha1_block, h, l->data, l->size, 0);
+
+        for (int i = 0; i < 5; ++i)
+            store32be(d->sha1 + i * 4, h[i]);
+        break;
+    }
+
+    case DIGEST_SHA256:
+    {
+        uint32_t h[8] = { 0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab,
+            0x5be0cd19 };
+        digest_blocks(sha256_block, h, l->data, l->size, 0);
+
+        for (int i = 0; i < 8; ++i)
+            store32be(d->sha256 + i * 4, h[i]);
+        break;
+    }
+    }
+
+    return NULL;
+}
+
+int digest_parse(const char *list, unsigned int *types)
+{
+    *types = DIGEST_FLAG(DIGEST_CRC32);
+
+    while (*list)
+    {
+        size_t length = strcspn(list, ",");
+        int found = length == 3 && strncmp(list, "all", 3) == 0;
+
+        if (found)
+            *types = DIGEST_ALL;
+
+        for (int i = 0; !found && i < DIGEST_COUNT; ++i)
+        {
+            if (strlen(digest_names[i]) == length && strncasecmp(list, digest_names[i], length) == 0)
+                *types |= DIGEST_FLAG(i), found = 1;
+        }
+
+        if (!found)
+            return 0;
+
+        list += length + (list[length] == ',');
+    }
+
+    return 1;
+}
+
+void digest_init(digest_t *d, unsigned int types)
+{
+    memset(d, 0, sizeof(digest_t));
+    d->types = types | DIGEST_FLAG(DIGEST_CRC32);
+}
+
+void digest_buffer(digest_t *d, const unsigned char *data, unsigned long size)
+{
+    digest_lane_t lanes[DIGEST_COUNT];
+    pthread_t handles[DIGEST_COUNT];
+    int started[DIGEST_COUNT];
+    int count = 0;
+
+    for (int i = 0; i < DIGEST_COUNT; ++i)
+    {
+        if (!(d->types & DIGEST_FLAG(i)))
+            continue;
+
+        lanes[count].d = d;
+        lanes[count].type = i;
+        lanes[count].data = data;
+        lanes[count].size = size;
+        count++;
+    }
+
+    // One lane per digest while there are cores for them, the calling
+    // thread takes the first.
+    int threads = cpu_count() < (unsigned int)count ? (int)cpu_count() : count;
+
+    for (int i = 1; i < count; ++i)
+        started[i] = i < threads && pthread_create(&handles[i], NULL, digest_run, &lanes[i]) == 0;
+
+    digest_run(&lanes[0]);
+
+    for (int i = 1; i < count; ++i)
+    {
+        if (started[i])
+            pthread_join(handles[i], NULL);
+        else
+            digest_run(&lanes[i]);
+    }
+
+    d->size = size;
+    d->done = 1;
+}
+
+const char *digest_name(int type)
+{
+    return digest_names[type];
+}
+
+void digest_hex(const digest_t *d, int type, char *out)
+{
+    const unsigned char *bytes = NULL;
+    int length = 0;
+
+    switch (type)
+    {
+    case DIGEST_CRC32:
+        snprintf(out, DIGEST_HEX_MAX, "%08x", d->crc);
+        return;
+    case DIGEST_MD5:
+        bytes = d->md5, length = sizeof(d->md5);
+        break;
+    case DIGEST_SHA1:
+        bytes = d->sha1, length = sizeof(d->sha1);
+        break;
+    case DIGEST_SHA256:
+        bytes = d->sha256, length = sizeof(d->sha256);
+        break;
+    }
+
+    for (int i = 0; i < length; ++i)
+        snprintf(out + i * 2, 3, "%02x", bytes[i]);
+}
+
+#undef rol32
+#undef ror32
@@ -0,0 +1,44 @@
+#ifndef HELPERS_DIGEST_H
+#define HELPERS_DIGEST_H
+
+enum digest_type
+{
+    DIGEST_CRC32,
+    DIGEST_MD5,
+    DIGEST_SHA1,
+    DIGEST_SHA256,
+    DIGEST_COUNT
+};
+
+#define DIGEST_FLAG(type) (1U << (type))
+#define DIGEST_ALL (DIGEST_FLAG(DIGEST_COUNT) - 1)
+// Longest hex digest, terminator included.
+#define DIGEST_HEX_MAX 65
+
+/* Every checksum ROM databases identify dumps by, from one pass.
+ *
+ * Each digest asked for gets its own thread over the buffer, so the slowest
+ * one sets the pace instead of their sum. CRC32 always comes along, callers
+ * seed their checksum caches with it. */
+typedef struct digest
+{
+    unsigned int types; // DIGEST_FLAG bits asked for, CRC32 always included
+    int done;
+    unsigned long long size;
+    unsigned int crc;
+    unsigned char md5[16];
+    unsigned char sha1[20];
+    unsigned char sha256[32];
+} digest_t;
+
+// Parses a comma separated list like "md5,sha1", or "all". Returns 0 on an
+// unknown name.
+int digest_parse(const char *list, unsigned int *types);
+void digest_init(digest_t *d, unsigned int types);
+void digest_buffer(digest_t *d, const unsigned char *data, unsigned long size);
+
+const char *digest_name(int type);
+// Lowercase hex of one digest, which must have been asked for.
+void digest_hex(const digest_t *d, int type, char *out);
+
+#endif // HELPERS_DIGEST_H
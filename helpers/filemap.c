@@ -1,14 +1,22 @@
 /* Thin wrapper around mmap and MapViewOfFile. */
 
 #include "helpers/filemap.h"
+#include "helpers/crc32.h"
+#include "helpers/inflate.h"
+#include "helpers/log.h"
+#include "helpers/trace.h"
+#include <pthread.h>
 #include <stdio.h> // fopen, fclose, fseek, ftell
 #include <stdlib.h> // malloc, free
+#include <string.h>
 
 // -------------------------------------------------
 // Filemap API
 // -------------------------------------------------
 
 static void filemap_init(filemap_t *f);
+static int filemap_inflate_open(filemap_t *f, int async);
+static int filemap_inflating(const filemap_t *f);
 
 filemap_t filemap_new(const char *fn, int readonly, const filemap_api_t *const api)
 {
@@ -20,11 +28,28 @@ filemap_t filemap_new(const char *fn, int readonly, const filemap_api_t *const a
     return f;
 }
 
+// Borrowed read-only view over a caller owned buffer, closing it is a no-op.
+filemap_t filemap_new_memory(unsigned char *data, unsigned long size)
+{
+    filemap_t f = filemap_new(NULL, 1, filemap_memory_api);
+    f.handle = data;
+    f.size = size;
+    return f;
+}
+
 static void filemap_init(filemap_t *f)
 {
     f->handle = NULL;
     f->status = FILEMAP_NOT_OPENED;
     f->size = 0;
+    f->has_crc = 0;
+    f->user = NULL;
+#if defined(_WIN32)
+    f->filehandle = INVALID_HANDLE_VALUE;
+    f->maphandle = INVALID_HANDLE_VALUE;
+#else
+    f->fd = -1;
+#endif
 }
 
 int filemap_create(filemap_t *f, unsigned long size)
@@ -41,7 +66,7 @@ int filemap_create(filemap_t *f, unsigned long size)
     return f->_api->create(f);
 }
 
-int filemap_open(filemap_t *f)
+int filemap_open_raw(filemap_t *f)
 {
     if (f->status != FILEMAP_NOT_OPENED)
         return 0;
@@ -50,9 +75,56 @@ int filemap_open(filemap_t *f)
     return f->_api->open(f);
 }
 
+static int filemap_open_contents(filemap_t *f, int async)
+{
+    if (!filemap_open_raw(f))
+        return 0;
+
+    if (!f->readonly || !inflate_is_archive(f->fn, f->handle, f->size))
+        return 1;
+
+    return filemap_inflate_open(f, async);
+}
+
+int filemap_open(filemap_t *f)
+{
+    return filemap_open_contents(f, 0);
+}
+
+int filemap_open_async(filemap_t *f)
+{
+    return filemap_open_contents(f, 1);
+}
+
 void filemap_close(filemap_t *f)
 {
     f->_api->close(f);
+    f->has_crc = 0;
+}
+
+// CRC32 of the first size bytes. A checksum over the whole map is computed
+// once and reused, which lets long lived maps skip rehashing.
+unsigned int filemap_crc32(filemap_t *f, unsigned long size)
+{
+    if (size > f->size)
+        size = f->size;
+
+    // Archives are checksummed while they inflate.
+    if (size == f->size)
+        filemap_finish(f);
+    else
+        filemap_wait(f, size);
+
+    if (size != f->size)
+        return crc32(f->handle, size, 0);
+
+    if (!f->has_crc)
+    {
+        f->crc = crc32(f->handle, f->size, 0);
+        f->has_crc = 1;
+    }
+
+    return f->crc;
 }
 
 // -------------------------------------------------
@@ -310,7 +382,274 @@ static void filemap_buffer_close(filemap_t *f)
         }
 
         free(f->handle);
+        f->handle = NULL;
+    }
+
+    f->status = FILEMAP_NOT_OPENED;
+}
+
+// -------------------------------------------------
+// In-Memory Implementation
+// -------------------------------------------------
+
+// Never touches the filesystem. Created maps are heap buffers owned by the
+// filemap, opened maps are borrowed views over an already set handle.
+
+static int filemap_memory_create(filemap_t *f)
+{
+    return filemap_buffer_create(f);
+}
+
+static int filemap_memory_open(filemap_t *f)
+{
+    if (!f->handle)
+    {
+        f->status = FILEMAP_ERROR;
+        return 0;
     }
+
+    f->status = FILEMAP_OK;
+    return 1;
+}
+
+static void filemap_memory_close(filemap_t *f)
+{
+    if (f->handle && f->type == FILEMAP_TYPE_CREATED)
+        free(f->handle);
+
+    f->handle = NULL;
+    f->status = FILEMAP_NOT_OPENED;
+}
+
+// -------------------------------------------------
+// Compressed File Implementation
+// -------------------------------------------------
+
+// Inflated between two looks at whether to stop, and published at once.
+#define FILEMAP_INFLATE_CHUNK (1UL << 20)
+
+// Contents of a .gz or .zip file in a heap buffer. The archive stays mapped
+// while a helper thread inflates it, publishing how far it got.
+typedef struct filemap_inflate
+{
+    filemap_t archive;
+    inflate_archive_t source;
+    inflate_t decoder;
+    unsigned char *contents;
+    unsigned int crc; // Of the contents, once done
+    unsigned long available; // Leading bytes of the contents inflated
+    int done;
+    int failed;
+    int stop;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int started;
+} filemap_inflate_t;
+
+static void filemap_inflate_close(filemap_t *f);
+static const filemap_api_t filemap_inflate_api__;
+
+static int filemap_inflating(const filemap_t *f)
+{
+    return f->_api && f->_api->close == filemap_inflate_close && f->user;
+}
+
+// The last chunk is only published once the whole contents checked out, a
+// failure zeroes what was left.
+static void filemap_inflate_fill(filemap_inflate_t *z)
+{
+    unsigned char *out = z->contents;
+    unsigned long size = z->source.size, position = 0;
+    unsigned int crc = 0;
+    int stop = 0;
+
+    if (!z->source.stored)
+        inflate_init(&z->decoder, z->source.data, z->source.length);
+
+    while (!stop && position < size)
+    {
+        unsigned long end = size - position > FILEMAP_INFLATE_CHUNK ? position + FILEMAP_INFLATE_CHUNK : size;
+        unsigned long length = end - position;
+        double traced = trace_begin();
+
+        if (z->source.stored)
+            memcpy(out + position, z->source.data + position, length);
+        else
+            length = inflate_run(&z->decoder, out, position, end);
+
+        crc = crc32(out + position, length, crc);
+        position += length;
+        trace_end("inflate", NULL, traced);
+
+        if (position < end || position == size)
+            break;
+
+        pthread_mutex_lock(&z->lock);
+        z->available = position;
+        stop = z->stop;
+        pthread_cond_broadcast(&z->cond);
+        pthread_mutex_unlock(&z->lock);
+    }
+
+    // Reads past the end of the contents, which has to be the end of the stream.
+    if (!z->source.stored && position == size)
+        inflate_run(&z->decoder, out, position, position);
+
+    int ok = position == size && crc == z->source.crc && (z->source.stored || z->decoder.state == INFLATE_DONE);
+
+    if (!ok)
+        memset(out + position, 0, size - position);
+
+    pthread_mutex_lock(&z->lock);
+    z->available = size;
+    z->crc = crc;
+    z->failed = !ok;
+    z->done = 1;
+    pthread_cond_broadcast(&z->cond);
+    pthread_mutex_unlock(&z->lock);
+}
+
+static void *filemap_inflate_run(void *arg)
+{
+    filemap_inflate_t *z = arg;
+
+    trace_thread_name("inflate");
+    filemap_inflate_fill(z);
+    return NULL;
+}
+
+// Swaps the opened archive in f for its contents.
+static int filemap_inflate_open(filemap_t *f, int async)
+{
+    filemap_inflate_t *z = calloc(1, sizeof(filemap_inflate_t));
+    unsigned char *contents = NULL;
+
+    if (z && !inflate_archive_open(&z->source, f->handle, f->size))
+        gible_error("Cannot decompress %s: %s.", f->fn, z->source.error);
+    else if (z)
+        contents = malloc(z->source.size ? z->source.size : 1);
+
+    if (!contents)
+    {
+        free(z);
+        f->_api->close(f);
+        f->status = FILEMAP_ERROR;
+        return 0;
+    }
+
+    pthread_mutex_init(&z->lock, NULL);
+    pthread_cond_init(&z->cond, NULL);
+
+    z->archive = *f;
+    z->contents = contents;
+    f->handle = contents;
+    f->size = z->source.size;
+    f->user = z;
+    f->_api = &filemap_inflate_api__;
+#if defined(_WIN32)
+    f->filehandle = INVALID_HANDLE_VALUE;
+    f->maphandle = INVALID_HANDLE_VALUE;
+#else
+    f->fd = -1;
+#endif
+
+    if (async)
+        z->started = pthread_create(&z->thread, NULL, filemap_inflate_run, z) == 0;
+
+    if (z->started)
+        return 1;
+
+    filemap_inflate_fill(z);
+
+    if (z->failed)
+    {
+        gible_error("Cannot decompress %s, it is corrupt.", f->fn);
+        filemap_close(f);
+        f->status = FILEMAP_ERROR;
+        return 0;
+    }
+
+    f->crc = z->crc;
+    f->has_crc = 1;
+    return 1;
+}
+
+// Only ever reached through the archive's api.
+static int filemap_inflate_refuse(filemap_t *f)
+{
+    f->status = FILEMAP_ERROR;
+    return 0;
+}
+
+// Puts the archive's own api back, so the map can be opened again.
+static void filemap_inflate_close(filemap_t *f)
+{
+    filemap_inflate_t *z = f->user;
+
+    if (!z)
+    {
+        f->status = FILEMAP_NOT_OPENED;
+        return;
+    }
+
+    if (z->started)
+    {
+        pthread_mutex_lock(&z->lock);
+        z->stop = 1;
+        pthread_mutex_unlock(&z->lock);
+        pthread_join(z->thread, NULL);
+    }
+
+    pthread_mutex_destroy(&z->lock);
+    pthread_cond_destroy(&z->cond);
+    free(z->contents);
+
+    filemap_t archive = z->archive;
+    free(z);
+
+    archive._api->close(&archive);
+    *f = archive;
+}
+
+unsigned long filemap_wait(const filemap_t *f, unsigned long end)
+{
+    if (!filemap_inflating(f))
+        return f->size;
+
+    filemap_inflate_t *z = f->user;
+
+    if (end > f->size)
+        end = f->size;
+
+    pthread_mutex_lock(&z->lock);
+
+    while (!z->done && z->available < end)
+        pthread_cond_wait(&z->cond, &z->lock);
+
+    unsigned long available = z->failed ? 0 : z->available;
+    pthread_mutex_unlock(&z->lock);
+    return available;
+}
+
+int filemap_finish(filemap_t *f)
+{
+    if (!filemap_inflating(f))
+        return 1;
+
+    const filemap_inflate_t *z = f->user;
+    filemap_wait(f, f->size);
+
+    if (z->failed)
+        return 0;
+
+    if (!f->has_crc)
+    {
+        f->crc = z->crc;
+        f->has_crc = 1;
+    }
+
+    return 1;
 }
 
 // -------------------------------------------------
@@ -329,5 +668,18 @@ const filemap_api_t filemap_buffer_api__ = {
     .close = filemap_buffer_close
 };
 
+const filemap_api_t filemap_memory_api__ = {
+    .create = filemap_memory_create,
+    .open = filemap_memory_open,
+    .close = filemap_memory_close
+};
+
+static const filemap_api_t filemap_inflate_api__ = {
+    .create = filemap_inflate_refuse,
+    .open = filemap_inflate_refuse,
+    .close = filemap_inflate_close
+};
+
 const filemap_api_t *const filemap_mmap_api = &filemap_mmap_api__;
 const filemap_api_t *const filemap_buffer_api = &filemap_buffer_api__;
+const filemap_api_t *const filemap_memory_api = &filemap_memory_api__;
@@ -37,6 +37,8 @@ typedef struct filemap
     unsigned char readonly;
     unsigned long size;
     unsigned char *handle;
+    unsigned int crc; // Cached by filemap_crc32, valid while has_crc is set.
+    unsigned char has_crc;
 #if defined(_WIN32)
     HANDLE filehandle;
     HANDLE maphandle;
@@ -44,14 +46,33 @@ typedef struct filemap
     int fd;
 #endif
     const filemap_api_t *_api;
+    void *user; // Free for use by custom filemap_api_t implementations.
 } filemap_t;
 
 filemap_t filemap_new(const char *fn, int readonly, const filemap_api_t *const api);
+filemap_t filemap_new_memory(unsigned char *data, unsigned long size);
 int filemap_create(filemap_t *f, unsigned long size);
+// Read-only .gz and .zip files are opened as their contents, inflated
+// into memory.
 int filemap_open(filemap_t *f);
+// Same, except that the contents keep inflating on a helper thread after it
+// returns. Readers wait for the bytes they need with filemap_wait.
+int filemap_open_async(filemap_t *f);
+// Maps compressed files as they are.
+int filemap_open_raw(filemap_t *f);
 void filemap_close(filemap_t *f);
+// Blocks until the first end bytes of a map still inflating are there and
+// returns how many are, 0 once inflating failed. The last bytes only come
+// once the contents matched the archive's checksum. Other maps return their
+// size right away.
+unsigned long filemap_wait(const filemap_t *f, unsigned long end);
+// Waits for the whole map and seeds its checksum from the archive, 0 when
+// inflating failed.
+int filemap_finish(filemap_t *f);
+unsigned int filemap_crc32(filemap_t *f, unsigned long size);
 
 extern const filemap_api_t *const filemap_mmap_api;
 extern const filemap_api_t *const filemap_buffer_api;
+extern const filemap_api_t *const filemap_memory_api;
 
 #endif /* HELPERS_FILEMAP_H */
@@ -1,10 +1,12 @@
 #include "helpers/format.h"
+#include <string.h>
 
 // clang-format off
 
 extern const patch_format_t ips_format;
 extern const patch_format_t ips32_format;
 extern const patch_format_t bps_format;
+extern const patch_format_t gbl_format;
 extern const patch_format_t ups_format;
 
 const patch_format_t *const patch_formats[] = { 
@@ -12,7 +14,138 @@ const patch_format_t *const patch_formats[] = {
     &ips32_format, 
     &ups_format, 
     &bps_format, 
+    &gbl_format, 
     NULL 
 };
 
-// clang-format on
\ No newline at end of file
+// clang-format on
+
+// Finds the format whose header matches the patch and accepts it.
+const patch_format_t *patch_format_detect(patch_apply_context_t *c)
+{
+    for (const patch_format_t *const *format = patch_formats; *format; format++)
+    {
+        const char *header = (*format)->header;
+
+        if (c->patch.size < strlen(header) || strncmp((char *)c->patch.handle, header, strlen(header)) != 0)
+            continue;
+
+        if ((*format)->apply_check && !(*format)->apply_check(c))
+            continue;
+
+        return *format;
+    }
+
+    return NULL;
+}
+
+static int check_extension(const char *fname, const char *ext)
+{
+    if (fname == NULL || ext == NULL)
+        return 0;
+    unsigned long length = strlen(fname), ext_len = strlen(ext);
+    if (!length || !ext_len || length < ext_len)
+        return 0;
+    return strcmp(fname + length - ext_len, ext) == 0;
+}
+
+int patch_format_matches_extension(const patch_format_t *format, const char *fn)
+{
+    return check_extension(fn, format->ext);
+}
+
+// Finds the format creating files ending in fn's extension that accepts the inputs.
+const patch_format_t *patch_format_for_create(patch_create_context_t *c, const char *fn)
+{
+    for (const patch_format_t *const *format = patch_formats; *format; format++)
+    {
+        if (!check_extension(fn, (*format)->ext))
+            continue;
+
+        if ((*format)->create_check && !(*format)->create_check(c))
+            continue;
+
+        return *format;
+    }
+
+    return NULL;
+}
+
+// Why patch_format_for_create found nothing for fn, NULL when there is no
+// more to say than that the type is unsupported.
+const char *patch_format_create_error(const patch_create_context_t *c, const char *fn)
+{
+    if (check_extension(fn, ips_format.ext) && c->patched.size < c->base.size)
+        return "IPS patches cannot shrink a file, use UPS, BPS or GBL instead.";
+
+    return NULL;
+}
+
+unsigned int patch_output_crc32(patch_apply_context_t *c)
+{
+    if (c->digest && !c->digest->done && !c->output.has_crc)
+    {
+        digest_buffer(c->digest, c->output.handle, c->output.size);
+        c->output.crc = c->digest->crc;
+        c->output.has_crc = 1;
+    }
+
+    return filemap_crc32(&c->output, c->output.size);
+}
+
+// -------------------------------------------------
+// Patched Views
+// -------------------------------------------------
+
+int patch_view_open(patch_view_t *v, filemap_t patch, filemap_t input)
+{
+    memset(v, 0, sizeof(patch_view_t));
+    v->patch = patch;
+    v->input = input;
+
+    patch_apply_context_t c;
+    memset(&c, 0, sizeof(patch_apply_context_t));
+    c.patch = patch;
+    c.input = input;
+
+    v->format = patch_format_detect(&c);
+
+    if (!v->format)
+    {
+        patch_view_close(v);
+        return (gible_error("Unsupported Patch Type."), APPLY_RET_INVALID_PATCH);
+    }
+
+    if (!v->format->view_open)
+    {
+        gible_error("%s patches cannot be viewed.", v->format->name);
+        patch_view_close(v);
+        return APPLY_RET_FAILURE;
+    }
+
+    if (v->format->view_open(v) != APPLY_RET_SUCCESS)
+    {
+        patch_view_close(v);
+        return APPLY_RET_FAILURE;
+    }
+
+    return APPLY_RET_SUCCESS;
+}
+
+int patch_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length)
+{
+    if (offset > v->size || length > v->size - offset)
+        return APPLY_ERROR("Range is past the end of the patched file.");
+
+    return length ? v->format->view_read(v, offset, out, length) : APPLY_RET_SUCCESS;
+}
+
+void patch_view_close(patch_view_t *v)
+{
+    if (v->format && v->format->view_close && v->index)
+        v->format->view_close(v);
+
+    filemap_close(&v->patch);
+    filemap_close(&v->input);
+    v->index = NULL;
+}
@@ -1,8 +1,13 @@
 #ifndef HELPERS_FORMAT_H
 #define HELPERS_FORMAT_H
 
+#include "helpers/diff.h"
+#include "helpers/digest.h"
 #include "helpers/filemap.h"
 #include "helpers/log.h"
+#include "helpers/progress.h"
+#include "helpers/stats.h"
+#include "helpers/stream.h"
 #include <stdint.h>
 
 // Common return values
@@ -40,11 +45,26 @@ typedef struct apply_flags
     unsigned char strict_crc; // Aborts patching on checksum mismatch
     unsigned char ignore_crc; // Don't even bother with checksum
     int use_buffer; // Uses malloc and fread instead of mmap
+    int stats; // STATS_OUTPUT_* bits, 0 when off
+    const char *trace; // Timeline output file, NULL when off
+    int progress; // PROGRESS_OUTPUT_* bits, 0 when off
+    const char *undo; // Reverse patch written after applying, NULL when off
+    const char *cache; // Output cache directory, NULL when off
+    int cache_limit; // In MB, 0 never prunes
+    int cache_link; // Hardlinks cache hits instead of copying them
+    unsigned int hash; // DIGEST_FLAG bits reported for the output, 0 when off
+    const char *hash_dat; // DAT file the output digests go to, NULL when off
 } apply_flags_t;
 
 typedef struct create_flags
 {
     int use_buffer;
+    int best; // Creates every eligible format and keeps the smallest
+    int verify; // With best, applies each candidate before accepting it
+    int stream; // Reads the inputs a block at a time instead of mapping them
+    int stats; // STATS_OUTPUT_* bits, 0 when off
+    const char *trace; // Timeline output file, NULL when off
+    int progress; // PROGRESS_OUTPUT_* bits, 0 when off
 } create_flags_t;
 
 typedef struct patch_apply_context
@@ -53,6 +73,18 @@ typedef struct patch_apply_context
     filemap_t input;
     filemap_t output;
     const apply_flags_t *flags;
+
+    // Checksums indexed by CRC_*. crc_known holds the FLAG_CRC_* bits of the
+    // ones computed, crc_stored those with an expected value from the patch.
+    unsigned int crc[3];
+    unsigned int expected_crc[3];
+    unsigned char crc_known;
+    unsigned char crc_stored;
+
+    stats_t *stats; // NULL unless stats or a trace were asked for
+    progress_t *progress; // Output bytes written, NULL when nobody watches
+    diff_runs_t *touched; // Gets the output ranges the patch wrote, may be NULL
+    digest_t *digest; // Filled alongside the output CRC, may be NULL
 } patch_apply_context_t;
 
 typedef struct patch_create_context
@@ -61,14 +93,42 @@ typedef struct patch_create_context
     filemap_t base;
     filemap_t output;
     const create_flags_t *flags;
+    stats_t *stats; // NULL unless stats or a trace were asked for
+    progress_t *progress; // Patched bytes encoded, NULL when nobody watches
+    const diff_runs_t *candidates; // Only ranges that may differ, NULL for all
 } patch_create_context_t;
 
+// Read only access to the output of patch over input, decoded on demand
+// through an index the format builds when the view is opened.
+typedef struct patch_view
+{
+    filemap_t patch;
+    filemap_t input;
+    unsigned long size; // Of the patched output
+    void *index; // Owned by the format
+    const struct patch_format *format;
+
+    // Checksums the patch carries, FLAG_CRC_* bits in crc_stored. Views
+    // never check them themselves.
+    unsigned int expected_crc[3];
+    unsigned char crc_stored;
+} patch_view_t;
+
 typedef int (*apply_main)(patch_apply_context_t *);
 typedef int (*create_main)(patch_create_context_t *);
+typedef int (*create_stream)(patch_create_context_t *, stream_t *patched, stream_t *base);
+typedef int (*create_view)(patch_create_context_t *, patch_view_t *patched);
+typedef int (*compose_main)(filemap_t *first, filemap_t *second, filemap_t *output);
 
 typedef int (*apply_check)(patch_apply_context_t *);
+typedef int (*apply_verify)(patch_apply_context_t *);
+typedef int (*apply_input)(const filemap_t *patch, unsigned int *crc, unsigned long *size);
 typedef int (*create_check)(patch_create_context_t *);
 
+typedef int (*view_open)(patch_view_t *);
+typedef int (*view_read)(const patch_view_t *, unsigned long offset, unsigned char *out, unsigned long length);
+typedef void (*view_close)(patch_view_t *);
+
 typedef struct patch_format
 {
     const char *name;
@@ -80,8 +140,52 @@ typedef struct patch_format
 
     apply_check apply_check;
     create_check create_check;
+
+    // Optional. Creates the patch from two forward only streams, with the
+    // patched and base maps left unopened but for their sizes.
+    create_stream create_stream;
+
+    // Optional. Creates the patch from the view of another patch over the
+    // base, without the patched file ever being assembled. The patched and
+    // base maps are left unopened but for their sizes, the view's input
+    // takes the base's place.
+    create_view create_view;
+
+    // Optional. Writes a single patch doing first then second, from the two
+    // opened patches alone. Returns CREATE_RET_* codes.
+    compose_main compose;
+
+    // Optional. view_open validates the patch and indexes it, view_read
+    // then decodes any range of the output in time proportional to it.
+    view_open view_open;
+    view_read view_read;
+    view_close view_close;
+
+    // Optional. Checks a patch and fills in every crc without creating the
+    // output, falls back to applying into memory when NULL.
+    apply_verify apply_verify;
+
+    // Optional. Reads the CRC32 and size of the input the patch was made
+    // for, from its header and footer alone. Returns 0 when it has none.
+    apply_input apply_input;
 } patch_format_t;
 
 extern const patch_format_t *const patch_formats[];
 
+const patch_format_t *patch_format_detect(patch_apply_context_t *c);
+const patch_format_t *patch_format_for_create(patch_create_context_t *c, const char *fn);
+int patch_format_matches_extension(const patch_format_t *format, const char *fn);
+const char *patch_format_create_error(const patch_create_context_t *c, const char *fn);
+
+// CRC32 of the whole output. Computes the digests asked for in the same
+// pass when c->digest is set, formats call it instead of filemap_crc32.
+unsigned int patch_output_crc32(patch_apply_context_t *c);
+
+// Takes over opened patch and input maps, closing them on failure too.
+int patch_view_open(patch_view_t *v, filemap_t patch, filemap_t input);
+// Reads [offset, offset + length), which must lie within v->size. Both
+// return APPLY_RET_* codes.
+int patch_view_read(const patch_view_t *v, unsigned long offset, unsigned char *out, unsigned long length);
+void patch_view_close(patch_view_t *v);
+
 #endif /* HELPERS_FORMAT_H */
@@ -0,0 +1,653 @@
+#include "helpers/inflate.h"
+#include "helpers/utils.h"
+#include <string.h>
+#include <strings.h>
+
+// clang-format off
+
+static const uint16_t length_base[29] = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258
+};
+static const uint8_t length_extra[29] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0
+};
+static const uint16_t distance_base[30] = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097,
+    6145, 8193, 12289, 16385, 24577
+};
+static const uint8_t distance_extra[30] = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13
+};
+// Order the code length code lengths come in.
+static const uint8_t code_order[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+// clang-format on
+
+// -------------------------------------------------
+// Bits
+// -------------------------------------------------
+
+// Tops the bit buffer up to at least 57 bits, zeros past the end of the input.
+static void inflate_refill(inflate_t *d)
+{
+    while (d->bit_count <= 56)
+    {
+        uint64_t byte = d->in_pos < d->in_size ? d->in[d->in_pos] : 0;
+        d->bits |= byte << d->bit_count;
+        d->bit_count += 8;
+        d->in_pos++;
+    }
+}
+
+static void inflate_drop(inflate_t *d, int count)
+{
+    d->bits >>= count;
+    d->bit_count -= count;
+}
+
+static unsigned int inflate_bits(inflate_t *d, int count)
+{
+    if (d->bit_count < count)
+        inflate_refill(d);
+
+    unsigned int value = d->bits & ((1ULL << count) - 1);
+    inflate_drop(d, count);
+    return value;
+}
+
+// Whether the bits used so far include padding past the end of the input.
+static int inflate_overrun(const inflate_t *d)
+{
+    return (uint64_t)d->in_pos * 8 - d->bit_count > (uint64_t)d->in_size * 8;
+}
+
+// -------------------------------------------------
+// Huffman Codes
+// -------------------------------------------------
+
+// Builds the canonical code for lengths[0, count), 0 when it is over-subscribed.
+static int inflate_build(inflate_table_t *t, const unsigned char *lengths, int count)
+{
+    unsigned int offsets[16], next[16];
+
+    memset(t->counts, 0, sizeof(t->counts));
+    memset(t->fast, 0, sizeof(t->fast));
+
+    for (int i = 0; i < count; ++i)
+        t->counts[lengths[i]]++;
+
+    t->counts[0] = 0;
+
+    int left = 1;
+
+    for (int length = 1; length < 16; ++length)
+    {
+        left = (left << 1) - t->counts[length];
+
+        if (left < 0)
+            return 0;
+    }
+
+    offsets[1] = next[1] = 0;
+
+    for (int length = 1; length < 15; ++length)
+    {
+        offsets[length + 1] = offsets[length] + t->counts[length];
+        next[length + 1] = (next[length] + t->counts[length]) << 1;
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        int length = lengths[i];
+
+        if (!length)
+            continue;
+
+        t->symbols[offsets[length]++] = i;
+        unsigned int code = next[length]++, reversed = 0;
+
+        if (length > INFLATE_FAST_BITS)
+            continue;
+
+        // Codes are stored from their first bit on, the lookup goes by the low bits.
+        for (int bit = 0; bit < length; ++bit)
+            reversed |= ((code >> bit) & 1) << (length - 1 - bit);
+
+        for (unsigned int k = reversed; k < (1U << INFLATE_FAST_BITS); k += 1U << length)
+            t->fast[k] = i << 4 | length;
+    }
+
+    return 1;
+}
+
+// Next symbol of t without using up its bits, -1 when t has no such code.
+static int inflate_decode(inflate_t *d, const inflate_table_t *t, int *length)
+{
+    if (d->bit_count < 15)
+        inflate_refill(d);
+
+    unsigned int entry = t->fast[d->bits & ((1U << INFLATE_FAST_BITS) - 1)];
+
+    if (entry)
+    {
+        *length = entry & 15;
+        return entry >> 4;
+    }
+
+    uint64_t bits = d->bits;
+    int code = 0, first = 0, index = 0;
+
+    for (int bit_length = 1; bit_length < 16; ++bit_length)
+    {
+        code |= bits & 1;
+        bits >>= 1;
+
+        int count = t->counts[bit_length];
+
+        if (code - count < first)
+        {
+            *length = bit_length;
+            return t->symbols[index + code - first];
+        }
+
+        index += count;
+        first = (first + count) << 1;
+        code <<= 1;
+    }
+
+    return -1;
+}
+
+// -------------------------------------------------
+// Block Headers
+// -------------------------------------------------
+
+static int inflate_fixed(inflate_t *d)
+{
+    unsigned char lengths[288];
+
+    memset(lengths, 8, 144);
+    memset(lengths + 144, 9, 112);
+    memset(lengths + 256, 7, 24);
+    memset(lengths + 280, 8, 8);
+    inflate_build(&d->lengths, lengths, 288);
+
+    memset(lengths, 5, 30);
+    inflate_build(&d->distances, lengths, 30);
+
+    d->state = INFLATE_CODES;
+    return 1;
+}
+
+static int inflate_dynamic(inflate_t *d)
+{
+    unsigned char lengths[286 + 30];
+
+    int literals = inflate_bits(d, 5) + 257;
+    int distances = inflate_bits(d, 5) + 1;
+    int codes = inflate_bits(d, 4) + 4;
+
+    if (literals > 286 || distances > 30)
+        return 0;
+
+    memset(lengths, 0, 19);
+
+    for (int i = 0; i < codes; ++i)
+        lengths[code_order[i]] = inflate_bits(d, 3);
+
+    // The literal table is free until the lengths it is built from are read.
+    if (!inflate_build(&d->lengths, lengths, 19))
+        return 0;
+
+    for (int i = 0; i < literals + distances;)
+    {
+        int length, repeat, value = 0;
+        int symbol = inflate_decode(d, &d->lengths, &length);
+
+        if (symbol < 0)
+            return 0;
+
+        inflate_drop(d, length);
+
+        if (symbol < 16)
+        {
+            lengths[i++] = symbol;
+            continue;
+        }
+
+        if (symbol == 16)
+        {
+            if (!i)
+                return 0;
+
+            value = lengths[i - 1];
+            repeat = 3 + inflate_bits(d, 2);
+        }
+        else
+        {
+            repeat = symbol == 17 ? 3 + inflate_bits(d, 3) : 11 + inflate_bits(d, 7);
+        }
+
+        if (repeat > literals + distances - i)
+            return 0;
+
+        memset(lengths + i, value, repeat);
+        i += repeat;
+    }
+
+    if (!lengths[256] || !inflate_build(&d->lengths, lengths, literals) ||
+        !inflate_build(&d->distances, lengths + literals, distances))
+        return 0;
+
+    d->state = INFLATE_CODES;
+    return 1;
+}
+
+static int inflate_header(inflate_t *d)
+{
+    d->final = inflate_bits(d, 1);
+
+    switch (inflate_bits(d, 2))
+    {
+    case 0:
+        break;
+    case 1:
+        return inflate_fixed(d);
+    case 2:
+        return inflate_dynamic(d);
+    default:
+        return 0;
+    }
+
+    inflate_drop(d, d->bit_count & 7);
+    unsigned int length = inflate_bits(d, 16), check = inflate_bits(d, 16);
+
+    // Stored bytes are copied straight from the input, give back the ones
+    // already in the bit buffer.
+    d->in_pos -= d->bit_count / 8;
+    d->bits = 0;
+    d->bit_count = 0;
+
+    if (length != (~check & 0xffff) || d->in_pos > d->in_size)
+        return 0;
+
+    d->stored = length;
+    d->state = INFLATE_STORED;
+    return 1;
+}
+
+// -------------------------------------------------
+// Decoder
+// -------------------------------------------------
+
+static uint64_t inflate_load64(const unsigned char *p)
+{
+    uint64_t value = 0;
+
+    for (int i = 7; i >= 0; --i)
+        value = value << 8 | p[i];
+
+    return value;
+}
+
+// Literals and whole matches while there is room for the longest match and
+// input for the longest symbol, with the bit buffer in registers. Stops
+// before anything else, the end of a block or a long code, and returns the
+// new position.
+static unsigned long inflate_fast(inflate_t *d, unsigned char *out, unsigned long position, unsigned long end)
+{
+    const uint16_t *literals = d->lengths.fast, *distances = d->distances.fast;
+    const unsigned long mask = (1UL << INFLATE_FAST_BITS) - 1;
+    uint64_t bits = d->bits;
+    int bit_count = d->bit_count;
+    unsigned long in_pos = d->in_pos;
+
+    while (end - position >= 258 && d->in_size >= 8 && in_pos <= d->in_size - 8)
+    {
+        // A match takes at most 48 bits. Bits past bit_count already hold
+        // the next bytes, the or keeps them.
+        if (bit_count < 48)
+        {
+            bits |= inflate_load64(d->in + in_pos) << bit_count;
+            in_pos += (63 - bit_count) >> 3;
+            bit_count |= 56;
+        }
+
+        unsigned int entry = literals[bits & mask];
+
+        if (!entry || (entry >> 4) == 256)
+            break;
+
+        if ((entry >> 4) < 256)
+        {
+            out[position++] = entry >> 4;
+            bits >>= entry & 15;
+            bit_count -= entry & 15;
+            continue;
+        }
+
+        // At most 5 + 10 + 13 more bits, committed once the match checks out.
+        unsigned int symbol = (entry >> 4) - 257;
+        uint64_t next = bits >> (entry & 15);
+        int used = entry & 15;
+
+        if (symbol >= 29)
+            break;
+
+        unsigned long length = length_base[symbol] + (next & ((1U << length_extra[symbol]) - 1));
+        next >>= length_extra[symbol];
+        used += length_extra[symbol];
+
+        entry = distances[next & mask];
+
+        if (!entry || (entry >> 4) >= 30)
+            break;
+
+        symbol = entry >> 4;
+        next >>= entry & 15;
+        used += entry & 15;
+
+        unsigned long distance = distance_base[symbol] + (next & ((1U << distance_extra[symbol]) - 1));
+        used += distance_extra[symbol];
+
+        if (distance > position)
+            break;
+
+        bits >>= used;
+        bit_count -= used;
+
+        const unsigned char *from = out + position - distance;
+
+        if (distance >= length)
+            memcpy(out + position, from, length);
+        else
+            for (unsigned long i = 0; i < length; ++i)
+                out[position + i] = from[i];
+
+        position += length;
+    }
+
+    d->bits = bits;
+    d->bit_count = bit_count;
+    d->in_pos = in_pos;
+    return position;
+}
+
+void inflate_init(inflate_t *d, const unsigned char *data, unsigned long size)
+{
+    memset(d, 0, sizeof(inflate_t));
+    d->in = data;
+    d->in_size = size;
+    d->state = INFLATE_HEADER;
+}
+
+unsigned long inflate_run(inflate_t *d, unsigned char *out, unsigned long position, unsigned long end)
+{
+    unsigned long start = position;
+
+    // Keeps going at the end of the output until something has to be
+    // written, so the last piece also reads the end of the stream.
+    for (;;)
+    {
+        if (d->match_length)
+        {
+            if (position == end)
+                break;
+
+            unsigned long length = d->match_length < end - position ? d->match_length : end - position;
+            const unsigned char *from = out + position - d->match_distance;
+
+            if (d->match_distance >= length)
+                memcpy(out + position, from, length);
+            else
+                for (unsigned long i = 0; i < length; ++i)
+                    out[position + i] = from[i];
+
+            position += length;
+            d->match_length -= length;
+            continue;
+        }
+
+        if (d->state == INFLATE_HEADER)
+        {
+            if (!inflate_header(d) || inflate_overrun(d))
+                d->state = INFLATE_ERROR;
+
+            continue;
+        }
+
+        if (d->state == INFLATE_STORED)
+        {
+            if (!d->stored)
+            {
+                d->state = d->final ? INFLATE_DONE : INFLATE_HEADER;
+                continue;
+            }
+
+            if (position == end)
+                break;
+
+            unsigned long length = d->stored < end - position ? d->stored : end - position;
+
+            if (length > d->in_size - d->in_pos)
+            {
+                d->state = INFLATE_ERROR;
+                break;
+            }
+
+            memcpy(out + position, d->in + d->in_pos, length);
+            d->in_pos += length;
+            d->stored -= length;
+            position += length;
+            continue;
+        }
+
+        if (d->state != INFLATE_CODES)
+            break;
+
+        if (end - position >= 258)
+            position = inflate_fast(d, out, position, end);
+
+        int length;
+        int symbol = inflate_decode(d, &d->lengths, &length);
+
+        if (symbol < 0)
+        {
+            d->state = INFLATE_ERROR;
+            break;
+        }
+
+        if (symbol != 256 && position == end)
+            break;
+
+        inflate_drop(d, length);
+
+        if (symbol < 256)
+        {
+            out[position++] = symbol;
+        }
+        else if (symbol == 256)
+        {
+            d->state = d->final ? INFLATE_DONE : INFLATE_HEADER;
+        }
+        else
+        {
+            if ((symbol -= 257) >= 29)
+            {
+                d->state = INFLATE_ERROR;
+                break;
+            }
+
+            d->match_length = length_base[symbol] + inflate_bits(d, length_extra[symbol]);
+            symbol = inflate_decode(d, &d->distances, &length);
+
+            if (symbol < 0 || symbol >= 30)
+            {
+                d->state = INFLATE_ERROR;
+                d->match_length = 0;
+                break;
+            }
+
+            inflate_drop(d, length);
+            d->match_distance = distance_base[symbol] + inflate_bits(d, distance_extra[symbol]);
+
+            if (d->match_distance > position)
+            {
+                d->state = INFLATE_ERROR;
+                d->match_length = 0;
+                break;
+            }
+        }
+
+        if (inflate_overrun(d))
+        {
+            d->state = INFLATE_ERROR;
+            d->match_length = 0;
+            break;
+        }
+    }
+
+    return position - start;
+}
+
+// -------------------------------------------------
+// Archives
+// -------------------------------------------------
+
+static unsigned int read16le(const unsigned char *ptr)
+{
+    return ptr[0] | ptr[1] << 8;
+}
+
+static int inflate_extension(const char *fn, const char *ext)
+{
+    size_t length = strlen(fn), ext_len = strlen(ext);
+    return length > ext_len && strcasecmp(fn + length - ext_len, ext) == 0;
+}
+
+int inflate_is_archive(const char *fn, const unsigned char *data, unsigned long size)
+{
+    if (!fn)
+        return 0;
+
+    if (inflate_extension(fn, ".gz"))
+        return size >= 2 && data[0] == 0x1f && data[1] == 0x8b;
+
+    if (inflate_extension(fn, ".zip"))
+        return size >= 4 && memcmp(data, "PK\3\4", 4) == 0;
+
+    return 0;
+}
+
+#define ARCHIVE_ERROR(msg) (a->error = (msg), 0)
+
+// RFC 1952, a single member. Its size is only known modulo 4GB, a bigger
+// file fails the size check at the end.
+static int inflate_gzip(inflate_archive_t *a, const unsigned char *data, unsigned long size)
+{
+    unsigned long position = 10;
+    int flags = size >= 10 ? data[3] : 0;
+
+    if (size < 18 || data[2] != 8 || (flags & 0xe0))
+        return ARCHIVE_ERROR("Only deflated gzip files are supported");
+
+    if (flags & 4)
+        position += 2 + read16le(data + position);
+
+    for (int field = 8; field <= 16; field <<= 1)
+    {
+        if (!(flags & field))
+            continue;
+
+        while (position < size && data[position])
+            position++;
+
+        position++;
+    }
+
+    if (flags & 2)
+        position += 2;
+
+    if (position > size - 8)
+        return ARCHIVE_ERROR("The gzip file is truncated");
+
+    a->data = data + position;
+    a->length = size - 8 - position;
+    a->crc = read32le(data + size - 8);
+    a->size = read32le(data + size - 4);
+    return 1;
+}
+
+// Reads the entry through the central directory, where the sizes are even
+// when the local header defers them to a data descriptor.
+static int inflate_zip(inflate_archive_t *a, const unsigned char *data, unsigned long size)
+{
+    if (size < 22)
+        return ARCHIVE_ERROR("The zip file is truncated");
+
+    unsigned long end = size - 22, stop = end > 0xffff ? end - 0xffff : 0;
+
+    while (memcmp(data + end, "PK\5\6", 4) != 0)
+    {
+        if (end-- == stop)
+            return ARCHIVE_ERROR("The zip file has no central directory");
+    }
+
+    if (read16le(data + end + 10) != 1)
+        return ARCHIVE_ERROR("Only zip files holding a single file are supported");
+
+    unsigned long entry = read32le(data + end + 16);
+
+    if (entry > size - 46 || memcmp(data + entry, "PK\1\2", 4) != 0)
+        return ARCHIVE_ERROR("The zip central directory is corrupt");
+
+    const unsigned char *e = data + entry;
+    unsigned int flags = read16le(e + 8), method = read16le(e + 10), name = read16le(e + 28);
+    unsigned long compressed = read32le(e + 20), local = read32le(e + 42);
+
+    a->crc = read32le(e + 16);
+    a->size = read32le(e + 24);
+
+    if (compressed == 0xffffffff || a->size == 0xffffffff || local == 0xffffffff)
+        return ARCHIVE_ERROR("ZIP64 files are not supported");
+
+    if (flags & 1)
+        return ARCHIVE_ERROR("Encrypted zip files are not supported");
+
+    if (method != 0 && method != 8)
+        return ARCHIVE_ERROR("Only stored or deflated zip entries are supported");
+
+    if (name > size - entry - 46)
+        return ARCHIVE_ERROR("The zip central directory is corrupt");
+
+    if (name && e[46 + name - 1] == '/')
+        return ARCHIVE_ERROR("The zip file holds a directory");
+
+    if (local > size - 30 || memcmp(data + local, "PK\3\4", 4) != 0)
+        return ARCHIVE_ERROR("The zip local header is corrupt");
+
+    unsigned long start = local + 30 + read16le(data + local + 26) + read16le(data + local + 28);
+
+    if (start > size || compressed > size - start || (method == 0 && compressed != a->size))
+        return ARCHIVE_ERROR("The zip file is truncated");
+
+    a->data = data + start;
+    a->length = compressed;
+    a->stored = method == 0;
+    return 1;
+}
+
+int inflate_archive_open(inflate_archive_t *a, const unsigned char *data, unsigned long size)
+{
+    memset(a, 0, sizeof(inflate_archive_t));
+
+    if (size >= 2 && data[0] == 0x1f && data[1] == 0x8b)
+        return inflate_gzip(a, data, size);
+
+    if (size >= 4 && memcmp(data, "PK\3\4", 4) == 0)
+        return inflate_zip(a, data, size);
+
+    return ARCHIVE_ERROR("Unknown archive type");
+}
+
+#undef ARCHIVE_ERROR
@@ -0,0 +1,71 @@
+#ifndef HELPERS_INFLATE_H
+#define HELPERS_INFLATE_H
+
+#include <stdint.h>
+
+// Farthest back a DEFLATE match reaches.
+#define INFLATE_WINDOW 32768UL
+// Codes up to this long decode with a single table lookup.
+#define INFLATE_FAST_BITS 10
+
+enum inflate_state
+{
+    INFLATE_HEADER,
+    INFLATE_STORED,
+    INFLATE_CODES,
+    INFLATE_DONE,
+    INFLATE_ERROR
+};
+
+// Canonical Huffman code, longer codes fall back to walking the counts.
+typedef struct inflate_table
+{
+    uint16_t fast[1 << INFLATE_FAST_BITS]; // Symbol << 4 | length, 0 for longer codes
+    uint16_t counts[16]; // Codes of each length
+    uint16_t symbols[288]; // Ordered by code
+} inflate_table_t;
+
+/* RFC 1951 decoder over a stream held whole in memory.
+ *
+ * Output comes out in pieces of any size, a match cut by the end of one
+ * piece carries on into the next, so callers can fill fixed size blocks
+ * or publish a flat buffer as it grows. */
+typedef struct inflate
+{
+    const unsigned char *in;
+    unsigned long in_size;
+    unsigned long in_pos; // Runs past in_size while the bit buffer holds padding
+    uint64_t bits;
+    int bit_count;
+
+    int state;
+    int final; // The current block is the last one
+    unsigned long stored; // Bytes left in a stored block
+    unsigned long match_length, match_distance; // Rest of a match cut by the end of the output
+    inflate_table_t lengths, distances;
+} inflate_t;
+
+void inflate_init(inflate_t *d, const unsigned char *data, unsigned long size);
+// Decodes into out[position, end). out[0, position) must hold the output
+// right before it, at least INFLATE_WINDOW bytes once there are that many.
+// Returns the bytes written, fewer only at the end of the stream or on an
+// error, which state tells apart.
+unsigned long inflate_run(inflate_t *d, unsigned char *out, unsigned long position, unsigned long end);
+
+// A file compressed by gzip, or a zip archive holding a single file.
+typedef struct inflate_archive
+{
+    const unsigned char *data; // DEFLATE stream, or the bytes themselves when stored
+    unsigned long length;
+    int stored;
+    unsigned long size; // Of the contents
+    unsigned int crc; // Of the contents
+    const char *error; // Why the archive was refused
+} inflate_archive_t;
+
+// Whether fn names a .gz or .zip file and data starts like one.
+int inflate_is_archive(const char *fn, const unsigned char *data, unsigned long size);
+// Finds the compressed contents, 0 with error set when they cannot be read.
+int inflate_archive_open(inflate_archive_t *a, const unsigned char *data, unsigned long size);
+
+#endif // HELPERS_INFLATE_H
@@ -0,0 +1,439 @@
+#include "helpers/library.h"
+#include "helpers/inflate.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#if !defined(_WIN32)
+#include <dirent.h>
+#include <unistd.h>
+#endif
+
+#define LIBRARY_MAGIC "GIBLELIB"
+#define LIBRARY_VERSION 2
+#define LIBRARY_MIN_BUCKETS 16
+
+// Nanoseconds where the platform has them, files rewritten within the same
+// second would look unchanged otherwise.
+static int64_t library_mtime(const struct stat *st)
+{
+#if defined(__APPLE__)
+    return (int64_t)st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+#elif defined(__linux__)
+    return (int64_t)st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+#else
+    return (int64_t)st->st_mtime * 1000000000;
+#endif
+}
+
+const char *library_default_path(void)
+{
+    static char path[4096];
+    const char *home = getenv("HOME");
+
+    if (getenv("GIBLE_LIBRARY") && *getenv("GIBLE_LIBRARY"))
+        return getenv("GIBLE_LIBRARY");
+
+#if defined(_WIN32)
+    if (!home)
+        home = getenv("USERPROFILE");
+#endif
+
+    if (!home)
+        return ".gible-library";
+
+    snprintf(path, sizeof(path), "%s/.gible-library", home);
+    return path;
+}
+
+int library_open(library_t *l, const char *fn)
+{
+    memset(l, 0, sizeof(library_t));
+    l->map = filemap_new(fn, 1, filemap_mmap_api);
+    filemap_open(&l->map);
+
+    if (l->map.status != FILEMAP_OK)
+        return 0;
+
+    const library_header_t *header = (const library_header_t *)l->map.handle;
+    unsigned long size = l->map.size;
+
+    int valid = size >= sizeof(library_header_t) && memcmp(header->magic, LIBRARY_MAGIC, 8) == 0 &&
+        header->version == LIBRARY_VERSION && header->buckets && !(header->buckets & (header->buckets - 1)) &&
+        header->paths == sizeof(library_header_t) + (uint64_t)header->buckets * sizeof(library_slot_t) &&
+        header->paths <= size && (header->paths == size || l->map.handle[size - 1] == '\0');
+
+    if (!valid)
+    {
+        filemap_close(&l->map);
+        return 0;
+    }
+
+    l->header = header;
+    l->slots = (const library_slot_t *)(header + 1);
+    l->paths = (const char *)l->map.handle + header->paths;
+    return 1;
+}
+
+const char *library_find(const library_t *l, unsigned int crc, unsigned long long size)
+{
+    if (!l->header)
+        return NULL;
+
+    uint32_t mask = l->header->buckets - 1;
+    uint64_t paths_size = l->map.size - l->header->paths;
+
+    for (uint32_t i = crc & mask, n = 0; n <= mask && l->slots[i].used; i = (i + 1) & mask, ++n)
+    {
+        const library_slot_t *slot = &l->slots[i];
+        struct stat st;
+
+        if (slot->crc != crc || slot->size != size || slot->path >= paths_size)
+            continue;
+
+        const char *path = l->paths + slot->path;
+
+        if (stat(path, &st) == 0 && (uint64_t)st.st_size == slot->file_size && library_mtime(&st) == slot->mtime)
+            return path;
+    }
+
+    return NULL;
+}
+
+void library_close(library_t *l)
+{
+    if (l->header)
+        filemap_close(&l->map);
+
+    memset(l, 0, sizeof(library_t));
+}
+
+// -------------------------------------------------
+// Updates
+// -------------------------------------------------
+
+#if defined(_WIN32)
+
+int library_update(const char *fn, char *const *dirs, int count, library_update_stats_t *stats)
+{
+    (void)fn, (void)dirs, (void)count;
+    memset(stats, 0, sizeof(library_update_stats_t));
+    return 0;
+}
+
+#else
+
+typedef struct library_entry
+{
+    char *path;
+    uint32_t crc;
+    uint64_t size;
+    uint64_t file_size;
+    int64_t mtime;
+} library_entry_t;
+
+typedef struct library_entries
+{
+    library_entry_t *items;
+    unsigned long count;
+    unsigned long capacity;
+    int failed;
+} library_entries_t;
+
+// Takes ownership of path.
+static void library_push(library_entries_t *e, char *path, uint32_t crc, uint64_t size, uint64_t file_size,
+    int64_t mtime)
+{
+    if (e->count == e->capacity)
+    {
+        unsigned long capacity = e->capacity ? e->capacity * 2 : 256;
+        library_entry_t *items = realloc(e->items, capacity * sizeof(library_entry_t));
+
+        if (!items)
+        {
+            free(path);
+            e->failed = 1;
+            return;
+        }
+
+        e->items = items;
+        e->capacity = capacity;
+    }
+
+    library_entry_t *entry = &e->items[e->count++];
+    entry->path = path;
+    entry->crc = crc;
+    entry->size = size;
+    entry->file_size = file_size;
+    entry->mtime = mtime;
+}
+
+static void library_entries_close(library_entries_t *e)
+{
+    for (unsigned long i = 0; i < e->count; ++i)
+        free(e->items[i].path);
+
+    free(e->items);
+    memset(e, 0, sizeof(library_entries_t));
+}
+
+static int library_entry_compare(const void *a, const void *b)
+{
+    return strcmp(((const library_entry_t *)a)->path, ((const library_entry_t *)b)->path);
+}
+
+static const library_entry_t *library_previous(const library_entries_t *old, const char *path)
+{
+    library_entry_t key;
+    key.path = (char *)path;
+    return old->count ? bsearch(&key, old->items, old->count, sizeof(library_entry_t), library_entry_compare) : NULL;
+}
+
+// Opens file the way inputs are, passing over archives that could not be
+// one without a word, like any other file that cannot be read.
+static int library_open_file(filemap_t *file)
+{
+    inflate_archive_t archive;
+
+    if (!filemap_open_raw(file))
+        return 0;
+
+    int refused = inflate_is_archive(file->fn, file->handle, file->size) &&
+        !inflate_archive_open(&archive, file->handle, file->size);
+
+    filemap_close(file);
+    return !refused && filemap_open(file);
+}
+
+// Recurses into dir, skipping hidden files and symbolic links. Files that
+// kept their size and mtime keep their checksum too.
+static void library_walk(const char *dir, const library_entries_t *old, library_entries_t *out,
+    library_update_stats_t *stats)
+{
+    DIR *d = opendir(dir);
+    struct dirent *e;
+
+    if (!d)
+        return;
+
+    while (!out->failed && (e = readdir(d)))
+    {
+        struct stat st;
+        size_t length = strlen(dir) + strlen(e->d_name) + 2;
+        char *path = malloc(length);
+
+        if (e->d_name[0] == '.' || !path)
+        {
+            out->failed = out->failed || !path;
+            free(path);
+            continue;
+        }
+
+        snprintf(path, length, "%s/%s", dir, e->d_name);
+
+        if (lstat(path, &st) != 0 || !(S_ISDIR(st.st_mode) || (S_ISREG(st.st_mode) && st.st_size > 0)))
+        {
+            free(path);
+            continue;
+        }
+
+        if (S_ISDIR(st.st_mode))
+        {
+            library_walk(path, old, out, stats);
+            free(path);
+            continue;
+        }
+
+        const library_entry_t *previous = library_previous(old, path);
+        uint32_t crc;
+        uint64_t size;
+
+        if (previous && previous->file_size == (uint64_t)st.st_size && previous->mtime == library_mtime(&st))
+        {
+            crc = previous->crc;
+            size = previous->size;
+        }
+        else
+        {
+            filemap_t file = filemap_new(path, 1, filemap_mmap_api);
+
+            if (!library_open_file(&file))
+            {
+                free(path);
+                continue;
+            }
+
+            crc = filemap_crc32(&file, file.size);
+            size = file.size;
+            filemap_close(&file);
+            stats->hashed++;
+        }
+
+        stats->files++;
+        library_push(out, path, crc, size, st.st_size, library_mtime(&st));
+    }
+
+    closedir(d);
+}
+
+static int library_under(const char *path, char *const *dirs, int count)
+{
+    for (int i = 0; i < count; ++i)
+    {
+        size_t length = strlen(dirs[i]);
+
+        if (strncmp(path, dirs[i], length) == 0 && (path[length] == '/' || (length && dirs[i][length - 1] == '/')))
+            return 1;
+    }
+
+    return 0;
+}
+
+static int library_write(const char *fn, const library_entries_t *e)
+{
+    uint32_t buckets = LIBRARY_MIN_BUCKETS;
+    while (buckets < e->count * 2)
+        buckets *= 2;
+
+    library_slot_t *slots = calloc(buckets, sizeof(library_slot_t));
+    size_t length = strlen(fn) + 8;
+    char *temp = malloc(length);
+
+    if (!slots || !temp)
+    {
+        free(slots);
+        free(temp);
+        return 0;
+    }
+
+    uint64_t offset = 0;
+
+    for (unsigned long i = 0; i < e->count; ++i)
+    {
+        uint32_t slot = e->items[i].crc & (buckets - 1);
+
+        while (slots[slot].used)
+            slot = (slot + 1) & (buckets - 1);
+
+        slots[slot].crc = e->items[i].crc;
+        slots[slot].used = 1;
+        slots[slot].size = e->items[i].size;
+        slots[slot].file_size = e->items[i].file_size;
+        slots[slot].mtime = e->items[i].mtime;
+        slots[slot].path = offset;
+        offset += strlen(e->items[i].path) + 1;
+    }
+
+    library_header_t header;
+    memset(&header, 0, sizeof(library_header_t));
+    memcpy(header.magic, LIBRARY_MAGIC, 8);
+    header.version = LIBRARY_VERSION;
+    header.buckets = buckets;
+    header.count = e->count;
+    header.paths = sizeof(library_header_t) + (uint64_t)buckets * sizeof(library_slot_t);
+
+    // Readers keep mapping the old table until the new one is renamed over it.
+    snprintf(temp, length, "%s.XXXXXX", fn);
+    int fd = mkstemp(temp);
+    FILE *fp = fd >= 0 ? fdopen(fd, "wb") : NULL;
+    int ok = fp != NULL;
+
+    if (fd >= 0 && !fp)
+        close(fd);
+
+    ok = ok && fwrite(&header, sizeof(library_header_t), 1, fp) == 1;
+    ok = ok && fwrite(slots, sizeof(library_slot_t), buckets, fp) == buckets;
+
+    for (unsigned long i = 0; ok && i < e->count; ++i)
+        ok = fwrite(e->items[i].path, strlen(e->items[i].path) + 1, 1, fp) == 1;
+
+    if (fp)
+        ok = fclose(fp) == 0 && ok;
+
+    ok = ok && chmod(temp, 0644) == 0 && rename(temp, fn) == 0;
+
+    if (!ok && fd >= 0)
+        unlink(temp);
+
+    free(slots);
+    free(temp);
+    return ok;
+}
+
+int library_update(const char *fn, char *const *dirs, int count, library_update_stats_t *stats)
+{
+    library_entries_t old, out;
+    library_t l;
+
+    memset(stats, 0, sizeof(library_update_stats_t));
+    memset(&old, 0, sizeof(library_entries_t));
+    memset(&out, 0, sizeof(library_entries_t));
+
+    if (library_open(&l, fn))
+    {
+        for (uint32_t i = 0; i < l.header->buckets; ++i)
+        {
+            const library_slot_t *slot = &l.slots[i];
+
+            if (!slot->used || slot->path >= l.map.size - l.header->paths)
+                continue;
+
+            char *path = strdup(l.paths + slot->path);
+
+            if (path)
+                library_push(&old, path, slot->crc, slot->size, slot->file_size, slot->mtime);
+            else
+                old.failed = 1;
+        }
+
+        library_close(&l);
+        qsort(old.items, old.count, sizeof(library_entry_t), library_entry_compare);
+    }
+
+    for (int i = 0; i < count; ++i)
+    {
+        int nested = 0;
+
+        // Directories given twice or inside another one would be walked twice.
+        for (int j = 0; j < count; ++j)
+        {
+            if (j != i && library_under(dirs[i], &dirs[j], 1))
+                nested = 1;
+
+            if (j < i && strcmp(dirs[i], dirs[j]) == 0)
+                nested = 1;
+        }
+
+        if (!nested)
+            library_walk(dirs[i], &old, &out, stats);
+    }
+
+    qsort(out.items, out.count, sizeof(library_entry_t), library_entry_compare);
+
+    // Entries elsewhere stay, the ones under the directories were replaced.
+    for (unsigned long i = 0; i < old.count; ++i)
+    {
+        if (!library_under(old.items[i].path, dirs, count))
+        {
+            library_push(&out, old.items[i].path, old.items[i].crc, old.items[i].size, old.items[i].file_size,
+                old.items[i].mtime);
+            old.items[i].path = NULL;
+        }
+        else if (!library_previous(&out, old.items[i].path))
+        {
+            stats->removed++;
+        }
+    }
+
+    int failed = old.failed || out.failed;
+    library_entries_close(&old);
+
+    stats->total = out.count;
+
+    int ok = !failed && library_write(fn, &out);
+    library_entries_close(&out);
+    return ok;
+}
+
+#endif
@@ -0,0 +1,64 @@
+#ifndef HELPERS_LIBRARY_H
+#define HELPERS_LIBRARY_H
+
+#include "helpers/filemap.h"
+#include <stdint.h>
+
+/* Persistent table from CRC32 and size to the files with those contents.
+ *
+ * The file is a hash table of fixed size slots keyed by CRC32, followed by
+ * the paths. Lookups map it and probe a few slots, they never read the
+ * indexed files, only stat the match to make sure it was not changed
+ * since. Updates reuse the checksum of every file whose size and mtime
+ * did not change and write a new table renamed over the old one.
+ *
+ * Compressed files are indexed by their contents, which is what inputs
+ * are opened as. */
+typedef struct library_header
+{
+    char magic[8];
+    uint32_t version; // LIBRARY_VERSION, a table from another byte order never matches
+    uint32_t buckets; // Power of two
+    uint64_t count;
+    uint64_t paths; // Offset of the NUL terminated paths
+} library_header_t;
+
+typedef struct library_slot
+{
+    uint32_t crc;
+    uint32_t used; // 0 for an empty slot
+    uint64_t size; // Of the contents
+    uint64_t file_size; // On disk, differs for compressed files
+    int64_t mtime; // In nanoseconds
+    uint64_t path; // Offset in the paths
+} library_slot_t;
+
+typedef struct library
+{
+    filemap_t map;
+    const library_header_t *header;
+    const library_slot_t *slots;
+    const char *paths;
+} library_t;
+
+typedef struct library_update_stats
+{
+    unsigned long files; // Indexed under the scanned directories
+    unsigned long hashed; // Of those, new or changed since the last update
+    unsigned long removed; // Entries under the directories that are gone
+    unsigned long total; // Entries in the table
+} library_update_stats_t;
+
+// $GIBLE_LIBRARY, or .gible-library in the home directory.
+const char *library_default_path(void);
+
+int library_open(library_t *l, const char *fn);
+// Path of an indexed file with this checksum and size that is still the
+// same as when it was indexed, NULL when there is none.
+const char *library_find(const library_t *l, unsigned int crc, unsigned long long size);
+void library_close(library_t *l);
+
+// Indexes every file under dirs into fn, keeping what it holds elsewhere.
+int library_update(const char *fn, char *const *dirs, int count, library_update_stats_t *stats);
+
+#endif // HELPERS_LIBRARY_H
@@ -1,12 +1,33 @@
 #include "helpers/log.h"
 #include <stdarg.h>
 
+static __thread gible_log_handler_t log_handler = NULL;
+static __thread void *log_user = NULL;
+
+void gible_log_set_handler(gible_log_handler_t handler, void *user)
+{
+    log_handler = handler;
+    log_user = user;
+}
+
 void gible_log(int level, const char *fmt, ...)
 {
     static const char *level_strings[] = { "", "INFO", "WARN", "ERROR" };
 
     va_list args;
 
+    if (log_handler)
+    {
+        char msg[512];
+
+        va_start(args, fmt);
+        vsnprintf(msg, sizeof(msg), fmt, args);
+        va_end(args);
+
+        log_handler(log_user, level, msg);
+        return;
+    }
+
     if (level != LOG_LVL_MSG)
         fprintf(stdout, "[%s] ", level_strings[level]);
 
@@ -14,4 +35,4 @@ void gible_log(int level, const char *fmt, ...)
     vfprintf(stdout, fmt, args);
     va_end(args);
     fprintf(stdout, "\n");
-}
\ No newline at end of file
+}
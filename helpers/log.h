@@ -16,6 +16,12 @@ enum log_level
 #define gible_warn(...) gible_log(LOG_LVL_WARN, __VA_ARGS__)
 #define gible_error(...) gible_log(LOG_LVL_ERROR, __VA_ARGS__)
 
+// Receives a fully formatted line, without the level prefix or newline.
+typedef void (*gible_log_handler_t)(void *user, int level, const char *msg);
+
 void gible_log(int level, const char *fmt, ...);
 
+// Redirects gible_log for the calling thread only. NULL restores stdout.
+void gible_log_set_handler(gible_log_handler_t handler, void *user);
+
 #endif // HELPERS_LOG_H
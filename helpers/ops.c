@@ -0,0 +1,377 @@
+#include "helpers/ops.h"
+#include "helpers/trace.h"
+#include "helpers/utils.h"
+#include <pthread.h>
+#include <string.h>
+
+// Ops shorter than this run on the calling thread.
+#define OPS_MIN_SLICE (8UL << 20)
+#define OPS_MAX_THREADS 64
+// How many ops ahead the executor prefetches sources for.
+#define OPS_PREFETCH_AHEAD 8
+
+#if defined(__GNUC__)
+#define ops_prefetch(p) __builtin_prefetch(p)
+#else
+#define ops_prefetch(p) ((void)(p))
+#endif
+
+typedef struct ops_slice
+{
+    const patch_ops_t *o;
+    const patch_op_t *op;
+    unsigned long start, end; // Within the op
+} ops_slice_t;
+
+void patch_ops_init(patch_ops_t *o, const unsigned char *input, unsigned long input_size, unsigned char *output,
+    unsigned long output_size)
+{
+    o->count = 0;
+    o->input = input;
+    o->input_size = input_size;
+    o->output = output;
+    o->output_size = output_size;
+    o->touched = NULL;
+    o->input_map = NULL;
+    o->input_ready = 0;
+    o->failed = 0;
+}
+
+// Plain loop over restrict pointers, which the compiler turns into vector xors.
+static void ops_xor(unsigned char *restrict out, const unsigned char *restrict a, const unsigned char *restrict b,
+    unsigned long length)
+{
+    for (unsigned long i = 0; i < length; ++i)
+        out[i] = a[i] ^ b[i];
+}
+
+// Input bytes from + [0, length) that exist, the rest read as zero. Offsets
+// wrap around like the byte loops' unsigned counters did.
+static unsigned long ops_input_span(const patch_ops_t *o, unsigned long from, unsigned long length, int *inside)
+{
+    *inside = from < o->input_size;
+
+    if (*inside)
+        return length < o->input_size - from ? length : o->input_size - from;
+
+    if (from + length < from)
+        return 0 - from;
+
+    return length;
+}
+
+static void ops_run_slice(const patch_ops_t *o, const patch_op_t *op, unsigned long start, unsigned long end)
+{
+    unsigned char *out = o->output + op->offset + start;
+    unsigned long length = end - start;
+
+    switch (op->type)
+    {
+    case PATCH_OP_COPY_INPUT:
+    case PATCH_OP_XOR_INPUT:
+    {
+        unsigned long from = op->from + start;
+        const unsigned char *data = op->data + start;
+
+        while (length)
+        {
+            int inside;
+            unsigned long n = ops_input_span(o, from, length, &inside);
+
+            if (op->type == PATCH_OP_COPY_INPUT)
+            {
+                if (inside)
+                    memcpy(out, o->input + from, n);
+                else
+                    memset(out, 0, n);
+            }
+            else
+            {
+                if (inside)
+                    ops_xor(out, o->input + from, data, n);
+                else
+                    memcpy(out, data, n);
+
+                data += n;
+            }
+
+            out += n;
+            from += n;
+            length -= n;
+        }
+        break;
+    }
+
+    case PATCH_OP_LITERAL:
+        memcpy(out, op->data + start, length);
+        break;
+
+    case PATCH_OP_FILL:
+        memset(out, op->byte, length);
+        break;
+
+    case PATCH_OP_COPY_OUTPUT:
+    {
+        const unsigned char *from = o->output + op->from + start;
+
+        // Each pass doubles the repeated span until it covers the op.
+        while (length)
+        {
+            unsigned long n = (unsigned long)(out - from);
+            if (n > length)
+                n = length;
+
+            memcpy(out, from, n);
+            out += n;
+            length -= n;
+        }
+        break;
+    }
+    }
+}
+
+static const char *const ops_names[] = {
+    [PATCH_OP_COPY_INPUT] = "copy input",
+    [PATCH_OP_LITERAL] = "literal",
+    [PATCH_OP_FILL] = "fill",
+    [PATCH_OP_XOR_INPUT] = "xor input",
+    [PATCH_OP_COPY_OUTPUT] = "copy output",
+};
+
+// One slice of a split op, a segment of its own in the trace.
+static void ops_run_traced(const ops_slice_t *s)
+{
+    double traced = trace_begin();
+    ops_run_slice(s->o, s->op, s->start, s->end);
+    trace_end("apply slice", ops_names[s->op->type], traced);
+}
+
+static void *ops_slice_worker(void *arg)
+{
+    trace_thread_name("apply worker");
+    ops_run_traced(arg);
+    return NULL;
+}
+
+static void ops_run(const patch_ops_t *o, const patch_op_t *op)
+{
+    unsigned long threads = cpu_count();
+    if (threads > OPS_MAX_THREADS)
+        threads = OPS_MAX_THREADS;
+    if (threads > op->length / OPS_MIN_SLICE)
+        threads = op->length / OPS_MIN_SLICE;
+
+    // Overlapping output copies depend on their own bytes, keep them whole.
+    int overlaps = op->type == PATCH_OP_COPY_OUTPUT && op->offset - op->from < op->length;
+
+    if (threads < 2 || overlaps)
+    {
+        ops_run_slice(o, op, 0, op->length);
+        return;
+    }
+
+    ops_slice_t slices[OPS_MAX_THREADS];
+    pthread_t handles[OPS_MAX_THREADS];
+    int started[OPS_MAX_THREADS];
+    unsigned long slice = op->length / threads;
+
+    for (unsigned long i = 0; i < threads; ++i)
+    {
+        slices[i].o = o;
+        slices[i].op = op;
+        slices[i].start = i * slice;
+        slices[i].end = i == threads - 1 ? op->length : (i + 1) * slice;
+    }
+
+    // The calling thread takes the first slice itself.
+    for (unsigned long i = 1; i < threads; ++i)
+        started[i] = pthread_create(&handles[i], NULL, ops_slice_worker, &slices[i]) == 0;
+
+    ops_run_traced(&slices[0]);
+
+    for (unsigned long i = 1; i < threads; ++i)
+    {
+        if (started[i])
+            pthread_join(handles[i], NULL);
+        else
+            ops_run_traced(&slices[i]);
+    }
+}
+
+static void ops_prefetch_op(const patch_ops_t *o, const patch_op_t *op)
+{
+    if (op->type == PATCH_OP_COPY_INPUT || op->type == PATCH_OP_XOR_INPUT)
+    {
+        if (op->from < o->input_size)
+            ops_prefetch(o->input + op->from);
+    }
+
+    if (op->type == PATCH_OP_LITERAL || op->type == PATCH_OP_XOR_INPUT)
+        ops_prefetch(op->data);
+
+    ops_prefetch(o->output + op->offset);
+}
+
+// Input bytes op reads that may not have been inflated yet, 0 when none.
+static unsigned long ops_pending(const patch_ops_t *o, const patch_op_t *op)
+{
+    int inside;
+
+    if (!o->input_map || o->failed || (op->type != PATCH_OP_COPY_INPUT && op->type != PATCH_OP_XOR_INPUT))
+        return 0;
+
+    unsigned long span = ops_input_span(o, op->from, op->length, &inside);
+    return inside && op->from + span > o->input_ready ? span : 0;
+}
+
+// Runs op a piece at a time, each as soon as the input it reads is there.
+static void ops_run_arriving(patch_ops_t *o, const patch_op_t *op, unsigned long span)
+{
+    unsigned long start = 0;
+
+    while (start < op->length)
+    {
+        unsigned long end = op->length;
+
+        if (start < span && !o->failed)
+        {
+            unsigned long ready = filemap_wait(o->input_map, op->from + start + 1);
+
+            if (!ready)
+                o->failed = 1;
+            else if ((o->input_ready = ready) < op->from + span)
+                end = ready - op->from;
+        }
+
+        ops_run_slice(o, op, start, end);
+        start = end;
+    }
+}
+
+void patch_ops_flush(patch_ops_t *o)
+{
+    for (unsigned long i = 0; i < o->count; ++i)
+    {
+        if (i + OPS_PREFETCH_AHEAD < o->count)
+            ops_prefetch_op(o, &o->ops[i + OPS_PREFETCH_AHEAD]);
+
+        const patch_op_t *op = &o->ops[i];
+        unsigned long pending = ops_pending(o, op);
+
+        if (pending)
+            ops_run_arriving(o, op, pending);
+        else if (op->length < OPS_MIN_SLICE * 2)
+            ops_run_slice(o, op, 0, op->length);
+        else
+            ops_run(o, op);
+    }
+
+    o->count = 0;
+}
+
+// An inflated input is only known to be right once all of it checked out.
+int patch_ops_finish(patch_ops_t *o)
+{
+    patch_ops_flush(o);
+
+    if (o->input_map && o->input_ready && !o->failed && !filemap_wait(o->input_map, o->input_map->size))
+        o->failed = 1;
+
+    return !o->failed;
+}
+
+// Copying input bytes to where they already were changes nothing, except
+// past the end of the input where they read as zero.
+static void ops_touch(patch_ops_t *o, unsigned char type, unsigned long offset, unsigned long length,
+    unsigned long from)
+{
+    unsigned long end = offset + length;
+
+    if (type == PATCH_OP_COPY_INPUT && from == offset)
+        offset = offset > o->input_size ? offset : o->input_size;
+
+    if (offset < end)
+        diff_runs_add(o->touched, offset, end);
+}
+
+// Clips the op to the output and queues it, extending the previous op
+// instead when it carries on right where that one stopped.
+static void ops_push(patch_ops_t *o, unsigned char type, unsigned long offset, unsigned long length,
+    unsigned long from, const unsigned char *data, unsigned char byte)
+{
+    if (offset >= o->output_size || !length)
+        return;
+
+    if (length > o->output_size - offset)
+        length = o->output_size - offset;
+
+    if (o->touched)
+        ops_touch(o, type, offset, length, from);
+
+    if (o->count)
+    {
+        patch_op_t *last = &o->ops[o->count - 1];
+
+        int follows = last->type == type && last->offset + last->length == offset;
+
+        switch (type)
+        {
+        case PATCH_OP_COPY_INPUT:
+        case PATCH_OP_COPY_OUTPUT:
+            follows = follows && last->from + last->length == from;
+            break;
+        case PATCH_OP_LITERAL:
+            follows = follows && last->data + last->length == data;
+            break;
+        case PATCH_OP_FILL:
+            follows = follows && last->byte == byte;
+            break;
+        case PATCH_OP_XOR_INPUT:
+            follows = follows && last->from + last->length == from && last->data + last->length == data;
+            break;
+        }
+
+        if (follows)
+        {
+            last->length += length;
+            return;
+        }
+    }
+
+    if (o->count == PATCH_OPS_BATCH)
+        patch_ops_flush(o);
+
+    patch_op_t *op = &o->ops[o->count++];
+    op->type = type;
+    op->byte = byte;
+    op->offset = offset;
+    op->length = length;
+    op->from = from;
+    op->data = data;
+}
+
+void patch_ops_copy_input(patch_ops_t *o, unsigned long offset, unsigned long from, unsigned long length)
+{
+    ops_push(o, PATCH_OP_COPY_INPUT, offset, length, from, NULL, 0);
+}
+
+void patch_ops_literal(patch_ops_t *o, unsigned long offset, const unsigned char *data, unsigned long length)
+{
+    ops_push(o, PATCH_OP_LITERAL, offset, length, 0, data, 0);
+}
+
+void patch_ops_fill(patch_ops_t *o, unsigned long offset, unsigned char byte, unsigned long length)
+{
+    ops_push(o, PATCH_OP_FILL, offset, length, 0, NULL, byte);
+}
+
+void patch_ops_xor_input(patch_ops_t *o, unsigned long offset, unsigned long from, const unsigned char *data,
+    unsigned long length)
+{
+    ops_push(o, PATCH_OP_XOR_INPUT, offset, length, from, data, 0);
+}
+
+void patch_ops_copy_output(patch_ops_t *o, unsigned long offset, unsigned long from, unsigned long length)
+{
+    ops_push(o, PATCH_OP_COPY_OUTPUT, offset, length, from, NULL, 0);
+}
@@ -0,0 +1,71 @@
+#ifndef HELPERS_OPS_H
+#define HELPERS_OPS_H
+
+#include "helpers/diff.h"
+#include "helpers/filemap.h"
+
+// Operations decoded before the executor runs them in one go.
+#define PATCH_OPS_BATCH 512
+
+enum patch_op_type
+{
+    PATCH_OP_COPY_INPUT, // output = input[from...], zero past the input
+    PATCH_OP_LITERAL, // output = data
+    PATCH_OP_FILL, // output = byte
+    PATCH_OP_XOR_INPUT, // output = input[from...] ^ data
+    PATCH_OP_COPY_OUTPUT // output = output[from...], may overlap with a period
+};
+
+typedef struct patch_op
+{
+    unsigned char type;
+    unsigned char byte;
+    unsigned long offset; // Where the op writes in the output
+    unsigned long length;
+    unsigned long from; // Input or output offset read from
+    const unsigned char *data; // Literal or xor'ed bytes in the patch
+} patch_op_t;
+
+/* Common form of every format's apply loop.
+ *
+ * Decoders parse their patch into ops and push them here, the executor
+ * runs each batch with bulk copies, fills and word sized xors, prefetching
+ * the sources of the ops ahead. Long ops that don't read the output are
+ * split across threads. Writes past output_size are dropped, so decoders
+ * may push ops running over the end like the old byte loops did. */
+typedef struct patch_ops
+{
+    patch_op_t ops[PATCH_OPS_BATCH];
+    unsigned long count;
+
+    const unsigned char *input;
+    unsigned long input_size;
+    unsigned char *output;
+    unsigned long output_size;
+
+    // When set, every output range an op may have changed is added here.
+    diff_runs_t *touched;
+    // When set, ops reading the input wait for its bytes, which may still
+    // be inflating, and run as they come in.
+    const filemap_t *input_map;
+    unsigned long input_ready; // Leading input bytes known to be there
+    int failed; // The input failed to inflate
+} patch_ops_t;
+
+void patch_ops_init(patch_ops_t *o, const unsigned char *input, unsigned long input_size, unsigned char *output,
+    unsigned long output_size);
+// Runs whatever is queued.
+void patch_ops_flush(patch_ops_t *o);
+// Same, and makes sure the input read checked out. The output is complete
+// afterwards, 0 when the input failed to inflate.
+int patch_ops_finish(patch_ops_t *o);
+
+void patch_ops_copy_input(patch_ops_t *o, unsigned long offset, unsigned long from, unsigned long length);
+void patch_ops_literal(patch_ops_t *o, unsigned long offset, const unsigned char *data, unsigned long length);
+void patch_ops_fill(patch_ops_t *o, unsigned long offset, unsigned char byte, unsigned long length);
+void patch_ops_xor_input(patch_ops_t *o, unsigned long offset, unsigned long from, const unsigned char *data,
+    unsigned long length);
+// from must be below offset, the bytes in between repeat if length is longer.
+void patch_ops_copy_output(patch_ops_t *o, unsigned long offset, unsigned long from, unsigned long length);
+
+#endif // HELPERS_OPS_H
@@ -0,0 +1,107 @@
+#include "helpers/perf.h"
+#include <errno.h>
+#include <string.h>
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+const char *const perf_counter_names[] = {
+    [PERF_CYCLES] = "cycles",
+    [PERF_INSTRUCTIONS] = "instructions",
+    [PERF_CACHE_MISSES] = "cache_misses",
+    [PERF_BRANCH_MISSES] = "branch_misses",
+    [PERF_DTLB_MISSES] = "dtlb_misses",
+};
+
+#if defined(__linux__)
+
+static const struct
+{
+    unsigned int type;
+    unsigned long long config;
+} perf_events[] = {
+    [PERF_CYCLES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_CACHE_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    [PERF_BRANCH_MISSES] = { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    [PERF_DTLB_MISSES] = { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB | PERF_COUNT_HW_CACHE_OP_READ << 8 |
+                                                   PERF_COUNT_HW_CACHE_RESULT_MISS << 16 },
+};
+
+int perf_open(perf_t *p)
+{
+    int opened = 0;
+    p->error = 0;
+    p->available = 0;
+
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = perf_events[i].type;
+        attr.config = perf_events[i].config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.inherit = 1;
+
+        p->fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+
+        if (p->fds[i] >= 0)
+            opened++, p->available |= 1 << i;
+        else if (!p->error)
+            p->error = errno;
+    }
+
+    return opened;
+}
+
+void perf_read(const perf_t *p, unsigned long long values[PERF_COUNTER_COUNT])
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        values[i] = 0;
+
+        if (p->fds[i] >= 0 && read(p->fds[i], &values[i], sizeof(values[i])) != sizeof(values[i]))
+            values[i] = 0;
+    }
+}
+
+void perf_close(perf_t *p)
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+    {
+        if (p->fds[i] >= 0)
+            close(p->fds[i]);
+
+        p->fds[i] = -1;
+    }
+}
+
+#else
+
+int perf_open(perf_t *p)
+{
+    for (int i = 0; i < PERF_COUNTER_COUNT; ++i)
+        p->fds[i] = -1;
+
+    p->available = 0;
+    p->error = ENOSYS;
+    return 0;
+}
+
+void perf_read(const perf_t *p, unsigned long long values[PERF_COUNTER_COUNT])
+{
+    (void)p;
+    memset(values, 0, PERF_COUNTER_COUNT * sizeof(*values));
+}
+
+void perf_close(perf_t *p)
+{
+    (void)p;
+}
+
+#endif
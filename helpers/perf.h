@@ -0,0 +1,32 @@
+#ifndef HELPERS_PERF_H
+#define HELPERS_PERF_H
+
+/* Hardware counters through perf_event_open, counting the calling thread
+ * and any thread it starts afterwards. Counters the kernel refuses, as in
+ * containers or under perf_event_paranoid, are left out individually. */
+
+enum perf_counter
+{
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_BRANCH_MISSES,
+    PERF_DTLB_MISSES,
+    PERF_COUNTER_COUNT
+};
+
+typedef struct perf
+{
+    int fds[PERF_COUNTER_COUNT]; // -1 when unavailable or closed
+    unsigned int available; // 1 << PERF_* of each counter that opened, kept after closing
+    int error; // errno of the first counter that failed to open
+} perf_t;
+
+extern const char *const perf_counter_names[];
+
+// Returns the number of counters opened, 0 when none are available.
+int perf_open(perf_t *p);
+void perf_read(const perf_t *p, unsigned long long values[PERF_COUNTER_COUNT]);
+void perf_close(perf_t *p);
+
+#endif // HELPERS_PERF_H
@@ -0,0 +1,121 @@
+#include "helpers/progress.h"
+#include <stdio.h>
+#include <time.h>
+
+#define PROGRESS_INTERVAL_MS 250
+#define PROGRESS_POLL_MS 50
+
+// -------------------------------------------------
+// Worker Side
+// -------------------------------------------------
+
+unsigned long long progress_start(progress_t *p, unsigned long long total)
+{
+    if (!p)
+        return PROGRESS_NEVER;
+
+    p->total = total;
+    __atomic_store_n(&p->done, 0, __ATOMIC_RELAXED);
+    return PROGRESS_BLOCK;
+}
+
+unsigned long long progress_report(progress_t *p, unsigned long long done)
+{
+    __atomic_store_n(&p->done, done, __ATOMIC_RELAXED);
+
+    if (p->callback)
+        p->callback(p->user, done, p->total);
+
+    return done + PROGRESS_BLOCK;
+}
+
+void progress_finish(progress_t *p)
+{
+    if (p)
+        progress_report(p, p->total);
+}
+
+// -------------------------------------------------
+// Reporter Thread
+// -------------------------------------------------
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+static void progress_print(progress_reporter_t *r, double elapsed_ms, int last)
+{
+    unsigned long long done = __atomic_load_n(&r->progress->done, __ATOMIC_RELAXED);
+    unsigned long long total = r->progress->total;
+    double rate = elapsed_ms > 0 ? done / 1048576.0 / (elapsed_ms / 1e3) : 0;
+
+    if (r->output & PROGRESS_OUTPUT_JSON)
+    {
+        fprintf(stderr, "{\"stage\": %d, \"done\": %llu, \"total\": %llu, \"mb_per_s\": %.2f}\n", r->progress->stage,
+            done, total, rate);
+        return;
+    }
+
+    fprintf(stderr, "\r[%5.1f%%] %.1f / %.1f MB, %.1f MB/s%s", total ? done * 100.0 / total : 100.0,
+        done / 1048576.0, total / 1048576.0, rate, last ? "\n" : "");
+}
+
+static void *progress_reporter_run(void *arg)
+{
+    progress_reporter_t *r = arg;
+    double start = now_ms(), last = start;
+    unsigned long long printed = PROGRESS_NEVER;
+    int stage = 0;
+
+    while (!r->stop)
+    {
+        struct timespec poll = { 0, PROGRESS_POLL_MS * 1000000L };
+        nanosleep(&poll, NULL);
+
+        double now = now_ms();
+        unsigned long long done = __atomic_load_n(&r->progress->done, __ATOMIC_RELAXED);
+
+        // A new stage restarts the rate.
+        if (r->progress->stage != stage)
+            stage = r->progress->stage, start = now;
+
+        // Nothing to show until the worker knows how much there is to do.
+        if (now - last < PROGRESS_INTERVAL_MS || done == printed || !r->progress->total)
+            continue;
+
+        progress_print(r, now - start, 0);
+        fflush(stderr);
+
+        printed = done;
+        last = now;
+    }
+
+    // Text always ends the line, JSON only adds a sample if it moved.
+    int moved = __atomic_load_n(&r->progress->done, __ATOMIC_RELAXED) != printed;
+
+    if (printed != PROGRESS_NEVER && (moved || !(r->output & PROGRESS_OUTPUT_JSON)))
+        progress_print(r, now_ms() - start, 1);
+
+    return NULL;
+}
+
+void progress_reporter_start(progress_reporter_t *r, progress_t *p, int output)
+{
+    r->progress = p;
+    r->output = output;
+    r->stop = 0;
+    r->started = pthread_create(&r->thread, NULL, progress_reporter_run, r) == 0;
+}
+
+void progress_reporter_stop(progress_reporter_t *r)
+{
+    if (!r->started)
+        return;
+
+    r->stop = 1;
+    pthread_join(r->thread, NULL);
+    r->started = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef HELPERS_PROGRESS_H
+#define HELPERS_PROGRESS_H
+
+#include <pthread.h>
+
+// Bytes between two updates from the hot loops.
+#define PROGRESS_BLOCK (1ULL << 20)
+#define PROGRESS_NEVER (~0ULL)
+
+typedef void (*progress_fn)(void *user, unsigned long long done, unsigned long long total);
+
+typedef struct progress
+{
+    unsigned long long done; // Relaxed atomic, written by the worker only
+    unsigned long long total;
+    int stage; // Chained patch being applied, from 1
+
+    // Optional, called inline by the worker at every update.
+    progress_fn callback;
+    void *user;
+} progress_t;
+
+// The loops keep the next threshold in a local, so with progress off the
+// only cost is comparing against PROGRESS_NEVER once per block of work.
+unsigned long long progress_start(progress_t *p, unsigned long long total);
+unsigned long long progress_report(progress_t *p, unsigned long long done);
+void progress_finish(progress_t *p);
+
+#define progress_tick(p, next, done) \
+    do \
+    { \
+        if ((unsigned long long)(done) >= (next)) \
+            (next) = progress_report((p), (done)); \
+    } while (0)
+
+#define PROGRESS_OUTPUT_TEXT (1 << 0)
+#define PROGRESS_OUTPUT_JSON (1 << 1)
+
+// Samples a progress_t from its own thread and prints a rate limited line
+// to stderr, or one JSON object per sample.
+typedef struct progress_reporter
+{
+    progress_t *progress;
+    int output;
+    volatile int stop;
+    pthread_t thread;
+    int started;
+} progress_reporter_t;
+
+void progress_reporter_start(progress_reporter_t *r, progress_t *p, int output);
+void progress_reporter_stop(progress_reporter_t *r);
+
+#endif // HELPERS_PROGRESS_H
@@ -0,0 +1,235 @@
+#include "helpers/stats.h"
+#include "helpers/trace.h"
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#if !defined(_WIN32)
+#include <sys/resource.h>
+#endif
+
+static const char *phase_names[] = {
+    [STATS_PHASE_OPEN] = "open",
+    [STATS_PHASE_CRC] = "crc",
+    [STATS_PHASE_DIFF] = "diff",
+    [STATS_PHASE_APPLY] = "apply",
+    [STATS_PHASE_CREATE] = "create",
+    [STATS_PHASE_CLOSE] = "close",
+};
+
+static const char *counter_names[] = {
+    [STATS_BPS_SOURCE_READ] = "bps_source_read",
+    [STATS_BPS_TARGET_READ] = "bps_target_read",
+    [STATS_BPS_SOURCE_COPY] = "bps_source_copy",
+    [STATS_BPS_TARGET_COPY] = "bps_target_copy",
+    [STATS_IPS_RECORD] = "ips_record",
+    [STATS_IPS_RLE] = "ips_rle",
+    [STATS_UPS_HUNK] = "ups_hunk",
+    [STATS_GBL_BLOCK] = "gbl_block",
+};
+
+static double now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+void stats_init(stats_t *s)
+{
+    memset(s, 0, sizeof(stats_t));
+}
+
+int stats_enable_perf(stats_t *s)
+{
+    if (!perf_open(&s->perf))
+        return 0;
+
+    s->has_perf = 1;
+    perf_read(&s->perf, s->perf_mark);
+    return 1;
+}
+
+// Charges the time and counters since the last mark to the innermost phase.
+static void stats_charge(stats_t *s, double now)
+{
+    unsigned long long values[PERF_COUNTER_COUNT];
+
+    if (s->has_perf)
+        perf_read(&s->perf, values);
+
+    if (s->depth > 0)
+    {
+        int phase = s->stack[s->depth - 1];
+        s->phase_ms[phase] += now - s->mark;
+
+        for (int i = 0; s->has_perf && i < PERF_COUNTER_COUNT; ++i)
+            s->perf_phase[phase][i] += values[i] - s->perf_mark[i];
+    }
+
+    s->mark = now;
+
+    if (s->has_perf)
+        memcpy(s->perf_mark, values, sizeof(values));
+}
+
+void stats_phase_begin(stats_t *s, int phase)
+{
+    if (!s || s->depth == STATS_MAX_DEPTH)
+        return;
+
+    stats_charge(s, now_ms());
+    s->started[s->depth] = s->mark;
+    s->stack[s->depth++] = phase;
+}
+
+void stats_phase_end(stats_t *s)
+{
+    if (!s || s->depth == 0)
+        return;
+
+    stats_charge(s, now_ms());
+    s->depth--;
+
+    if (trace_on)
+        trace_event(phase_names[s->stack[s->depth]], NULL, s->started[s->depth] * 1e3, s->mark * 1e3);
+}
+
+void stats_finish(stats_t *s)
+{
+    if (!s)
+        return;
+
+    if (s->has_perf)
+        perf_close(&s->perf);
+
+#if !defined(_WIN32)
+    struct rusage usage;
+
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+        s->user_ms = usage.ru_utime.tv_sec * 1e3 + usage.ru_utime.tv_usec / 1e3;
+        s->sys_ms = usage.ru_stime.tv_sec * 1e3 + usage.ru_stime.tv_usec / 1e3;
+        s->max_rss_kb = usage.ru_maxrss;
+        s->minflt = usage.ru_minflt;
+        s->majflt = usage.ru_majflt;
+    }
+#endif
+}
+
+static void stats_print_perf_json(const stats_t *s)
+{
+    if (!s->has_perf)
+    {
+        fprintf(stderr, ", \"perf\": null, \"perf_error\": \"%s\"", strerror(s->perf.error));
+        return;
+    }
+
+    fprintf(stderr, ", \"perf\": {");
+
+    for (int i = 0; i < STATS_PHASE_COUNT; ++i)
+    {
+        fprintf(stderr, "%s\"%s\": {", i ? ", " : "", phase_names[i]);
+
+        for (int j = 0; j < PERF_COUNTER_COUNT; ++j)
+        {
+            if (s->perf.available & (1 << j))
+                fprintf(stderr, "%s\"%s\": %llu", j ? ", " : "", perf_counter_names[j], s->perf_phase[i][j]);
+            else
+                fprintf(stderr, "%s\"%s\": null", j ? ", " : "", perf_counter_names[j]);
+        }
+
+        fprintf(stderr, "}");
+    }
+
+    fprintf(stderr, "}");
+}
+
+static void stats_print_perf_text(const stats_t *s)
+{
+    fprintf(stderr, "Counters:\n");
+
+    if (!s->has_perf)
+    {
+        fprintf(stderr, "  unavailable (%s)\n", strerror(s->perf.error));
+        return;
+    }
+
+    fprintf(stderr, "  %-8s", "");
+
+    for (int j = 0; j < PERF_COUNTER_COUNT; ++j)
+        fprintf(stderr, " %14s", perf_counter_names[j]);
+
+    fprintf(stderr, "\n");
+
+    for (int i = 0; i < STATS_PHASE_COUNT; ++i)
+    {
+        if (s->phase_ms[i] <= 0)
+            continue;
+
+        fprintf(stderr, "  %-8s", phase_names[i]);
+
+        for (int j = 0; j < PERF_COUNTER_COUNT; ++j)
+        {
+            if (s->perf.available & (1 << j))
+                fprintf(stderr, " %14llu", s->perf_phase[i][j]);
+            else
+                fprintf(stderr, " %14s", "-");
+        }
+
+        fprintf(stderr, "\n");
+    }
+}
+
+// Printed to stderr so it never mixes with the regular messages.
+void stats_print(const stats_t *s, int output)
+{
+    if (!s)
+        return;
+
+    if (output & STATS_OUTPUT_JSON)
+    {
+        fprintf(stderr, "{\"phases_ms\": {");
+
+        for (int i = 0; i < STATS_PHASE_COUNT; ++i)
+            fprintf(stderr, "%s\"%s\": %.3f", i ? ", " : "", phase_names[i], s->phase_ms[i]);
+
+        fprintf(stderr, "}, \"actions\": {");
+
+        for (int i = 0; i < STATS_COUNTER_COUNT; ++i)
+            fprintf(stderr, "%s\"%s\": {\"count\": %llu, \"bytes\": %llu}", i ? ", " : "", counter_names[i],
+                s->count[i], s->bytes[i]);
+
+        fprintf(stderr, "}");
+
+        if (output & STATS_PERF_COUNTERS)
+            stats_print_perf_json(s);
+
+        fprintf(stderr,
+            ", \"user_ms\": %.3f, \"sys_ms\": %.3f, \"max_rss_kb\": %ld, \"minflt\": %ld, \"majflt\": %ld}\n",
+            s->user_ms, s->sys_ms, s->max_rss_kb, s->minflt, s->majflt);
+        return;
+    }
+
+    fprintf(stderr, "Phases:\n");
+
+    for (int i = 0; i < STATS_PHASE_COUNT; ++i)
+        if (s->phase_ms[i] > 0)
+            fprintf(stderr, "  %-16s %12.3f ms\n", phase_names[i], s->phase_ms[i]);
+
+    fprintf(stderr, "Actions:\n");
+
+    for (int i = 0; i < STATS_COUNTER_COUNT; ++i)
+        if (s->count[i])
+            fprintf(stderr, "  %-16s %12llu x %14llu bytes\n", counter_names[i], s->count[i], s->bytes[i]);
+
+    if (output & STATS_PERF_COUNTERS)
+        stats_print_perf_text(s);
+
+    fprintf(stderr, "Resources:\n");
+    fprintf(stderr, "  %-16s %12.3f ms\n", "user", s->user_ms);
+    fprintf(stderr, "  %-16s %12.3f ms\n", "sys", s->sys_ms);
+    fprintf(stderr, "  %-16s %12ld KB\n", "max rss", s->max_rss_kb);
+    fprintf(stderr, "  %-16s %12ld\n", "minor faults", s->minflt);
+    fprintf(stderr, "  %-16s %12ld\n", "major faults", s->majflt);
+}
@@ -0,0 +1,80 @@
+#ifndef HELPERS_STATS_H
+#define HELPERS_STATS_H
+
+#include "helpers/perf.h"
+
+// Output modes for --stats, kept in the action flags.
+#define STATS_OUTPUT_TEXT (1 << 0)
+#define STATS_OUTPUT_JSON (1 << 1)
+#define STATS_PERF_COUNTERS (1 << 2) // Adds hardware counters per phase
+
+enum stats_phase
+{
+    STATS_PHASE_OPEN,
+    STATS_PHASE_CRC,
+    STATS_PHASE_DIFF,
+    STATS_PHASE_APPLY,
+    STATS_PHASE_CREATE,
+    STATS_PHASE_CLOSE,
+    STATS_PHASE_COUNT
+};
+
+enum stats_counter
+{
+    STATS_BPS_SOURCE_READ, // Same order as the BPS actions
+    STATS_BPS_TARGET_READ,
+    STATS_BPS_SOURCE_COPY,
+    STATS_BPS_TARGET_COPY,
+    STATS_IPS_RECORD,
+    STATS_IPS_RLE,
+    STATS_UPS_HUNK,
+    STATS_GBL_BLOCK,
+    STATS_COUNTER_COUNT
+};
+
+#define STATS_MAX_DEPTH 8
+
+typedef struct stats
+{
+    // Phases are exclusive, starting one pauses the phase it is nested in.
+    double phase_ms[STATS_PHASE_COUNT];
+    int stack[STATS_MAX_DEPTH];
+    double started[STATS_MAX_DEPTH]; // Inclusive start of each open phase, for --trace
+    int depth;
+    double mark;
+
+    // Hardware counters, charged to phases like the timings.
+    perf_t perf;
+    int has_perf;
+    unsigned long long perf_mark[PERF_COUNTER_COUNT];
+    unsigned long long perf_phase[STATS_PHASE_COUNT][PERF_COUNTER_COUNT];
+
+    unsigned long long count[STATS_COUNTER_COUNT];
+    unsigned long long bytes[STATS_COUNTER_COUNT];
+
+    // Filled by stats_finish.
+    double user_ms, sys_ms;
+    long max_rss_kb;
+    long minflt, majflt;
+} stats_t;
+
+// Every function accepts NULL and does nothing, so instrumented code only
+// pays a pointer check when stats are off. While tracing, each phase is
+// also recorded as a timeline event.
+void stats_init(stats_t *s);
+int stats_enable_perf(stats_t *s); // 0 when no counter could be opened
+void stats_phase_begin(stats_t *s, int phase);
+void stats_phase_end(stats_t *s);
+void stats_finish(stats_t *s);
+void stats_print(const stats_t *s, int output);
+
+static inline void stats_count(stats_t *s, int counter, unsigned long long bytes)
+{
+    if (s)
+    {
+        s->count[counter]++;
+        s->bytes[counter] += bytes;
+    }
+}
+
+#endif // HELPERS_STATS_H
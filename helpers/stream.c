@@ -0,0 +1,222 @@
+#include "helpers/stream.h"
+#include "helpers/crc32.h"
+#include "helpers/log.h"
+#include "helpers/trace.h"
+#include <stdlib.h>
+#include <string.h>
+
+// Next block into blocks[fill], read from the file or inflated after the
+// window copied from the end of blocks[previous]. Errors stick in failed,
+// an archive's are only known once its end is reached.
+static unsigned long stream_read(stream_t *s, int fill, int previous)
+{
+    if (s->fp)
+    {
+        unsigned long length = fread(s->blocks[fill], 1, STREAM_BLOCK, s->fp);
+        s->failed = s->failed || (length < STREAM_BLOCK && ferror(s->fp));
+        return length;
+    }
+
+    unsigned char *block = s->blocks[fill];
+    unsigned long length = s->size - s->position < STREAM_BLOCK ? s->size - s->position : STREAM_BLOCK;
+    unsigned long history = s->position < s->history ? s->position : s->history;
+
+    if (s->decoder)
+    {
+        memmove(block - history, s->blocks[previous] + s->lengths[previous] - history, history);
+        length = inflate_run(s->decoder, block - history, history, history + length);
+    }
+    else
+    {
+        memcpy(block, s->source.data + s->position, length);
+    }
+
+    s->crc = crc32(block, length, s->crc);
+    s->position += length;
+
+    if (s->position < s->size && length == STREAM_BLOCK)
+        return length;
+
+    // Reads past the end of the contents, which has to be the end of the stream.
+    if (s->decoder && s->position == s->size)
+        inflate_run(s->decoder, block - history, history + length, history + length);
+
+    if (s->position != s->size || s->crc != s->source.crc || (s->decoder && s->decoder->state != INFLATE_DONE))
+        s->failed = 1;
+
+    return length;
+}
+
+static int stream_inflate_open(stream_t *s, const char *fn)
+{
+    if (!inflate_archive_open(&s->source, s->archive.handle, s->archive.size))
+        return (gible_error("Cannot decompress %s: %s.", fn, s->source.error), 0);
+
+    if (!s->source.stored)
+    {
+        if (!(s->decoder = malloc(sizeof(inflate_t))))
+            return 0;
+
+        inflate_init(s->decoder, s->source.data, s->source.length);
+        s->history = INFLATE_WINDOW;
+    }
+
+    s->size = s->source.size;
+    return 1;
+}
+
+static void *stream_run(void *arg)
+{
+    stream_t *s = arg;
+
+    trace_thread_name("read ahead");
+    pthread_mutex_lock(&s->lock);
+
+    while (!s->stop && !s->done)
+    {
+        while (s->ready && !s->stop)
+            pthread_cond_wait(&s->cond, &s->lock);
+
+        if (s->stop)
+            break;
+
+        // The caller only ever holds the other block, read without the lock.
+        int fill = s->fill;
+        pthread_mutex_unlock(&s->lock);
+
+        double traced = trace_begin();
+        unsigned long length = stream_read(s, fill, fill ^ 1);
+        trace_end("read ahead", NULL, traced);
+
+        pthread_mutex_lock(&s->lock);
+        s->lengths[fill] = length;
+        s->fill ^= 1;
+        s->ready = 1;
+        s->done = length < STREAM_BLOCK;
+
+        pthread_cond_broadcast(&s->cond);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+int stream_open(stream_t *s, const char *fn)
+{
+    memset(s, 0, sizeof(stream_t));
+
+    s->archive = filemap_new(fn, 1, filemap_mmap_api);
+    filemap_open_raw(&s->archive);
+
+    if (s->archive.status == FILEMAP_OK && inflate_is_archive(fn, s->archive.handle, s->archive.size))
+    {
+        if (!stream_inflate_open(s, fn))
+        {
+            free(s->decoder);
+            filemap_close(&s->archive);
+            return 0;
+        }
+    }
+    else
+    {
+        filemap_close(&s->archive);
+
+        if (!(s->fp = fopen(fn, "rb")))
+            return 0;
+
+        if (fseek(s->fp, 0, SEEK_END) != 0 || (long)(s->size = ftell(s->fp)) < 0 || fseek(s->fp, 0, SEEK_SET) != 0)
+        {
+            fclose(s->fp);
+            s->fp = NULL;
+            return 0;
+        }
+    }
+
+    pthread_mutex_init(&s->lock, NULL);
+    pthread_cond_init(&s->cond, NULL);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        unsigned char *buffer = malloc(s->history + STREAM_BLOCK);
+        s->blocks[i] = buffer ? buffer + s->history : NULL;
+    }
+
+    if (!s->blocks[0] || !s->blocks[1])
+    {
+        stream_close(s);
+        return 0;
+    }
+
+    s->started = pthread_create(&s->thread, NULL, stream_run, s) == 0;
+
+    return 1;
+}
+
+unsigned long stream_next(stream_t *s, const unsigned char **data)
+{
+    // Without a helper, read in place.
+    if (!s->started)
+    {
+        unsigned long length = s->done ? 0 : stream_read(s, 0, 0);
+
+        s->lengths[0] = length;
+        s->done = s->done || length < STREAM_BLOCK;
+        *data = s->blocks[0];
+        return length;
+    }
+
+    pthread_mutex_lock(&s->lock);
+
+    while (!s->ready && !s->done)
+        pthread_cond_wait(&s->cond, &s->lock);
+
+    unsigned long length = 0;
+
+    if (s->ready)
+    {
+        int taken = s->fill ^ 1;
+        *data = s->blocks[taken];
+        length = s->lengths[taken];
+        s->ready = 0;
+        pthread_cond_broadcast(&s->cond);
+    }
+
+    pthread_mutex_unlock(&s->lock);
+    return length;
+}
+
+void stream_close(stream_t *s)
+{
+    if (s->started)
+    {
+        pthread_mutex_lock(&s->lock);
+        s->stop = 1;
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+
+        pthread_join(s->thread, NULL);
+        s->started = 0;
+    }
+
+    if (!s->fp && s->archive.status != FILEMAP_OK)
+        return;
+
+    for (int i = 0; i < 2; ++i)
+    {
+        if (s->blocks[i])
+            free(s->blocks[i] - s->history);
+
+        s->blocks[i] = NULL;
+    }
+
+    pthread_mutex_destroy(&s->lock);
+    pthread_cond_destroy(&s->cond);
+
+    if (s->fp)
+        fclose(s->fp);
+
+    s->fp = NULL;
+    free(s->decoder);
+    s->decoder = NULL;
+    filemap_close(&s->archive);
+}
@@ -0,0 +1,48 @@
+#ifndef HELPERS_STREAM_H
+#define HELPERS_STREAM_H
+
+#include "helpers/filemap.h"
+#include "helpers/inflate.h"
+#include <pthread.h>
+#include <stdio.h>
+
+// Size of the blocks a stream hands out, two of them are in memory at once.
+#define STREAM_BLOCK (1UL << 20)
+
+/* Forward only reader over a file, one STREAM_BLOCK at a time.
+ *
+ * A helper thread reads the next block while the caller works on the
+ * current one, so the disk and the diff overlap and memory use does not
+ * depend on the file size. Falls back to plain reads without a thread.
+ *
+ * A .gz or .zip file is mapped and inflated block by block instead, each
+ * block kept after a copy of the window its matches reach back into. */
+typedef struct stream
+{
+    FILE *fp;
+    unsigned long size; // Of the contents for an archive
+    unsigned char *blocks[2];
+    unsigned long lengths[2];
+    unsigned long history; // Bytes allocated before each block for the window
+    filemap_t archive;
+    inflate_archive_t source;
+    inflate_t *decoder;
+    unsigned long position; // Contents inflated so far
+    unsigned int crc; // Of those
+    int fill; // Block the helper reads into next
+    int ready; // blocks[fill ^ 1] holds a block the caller has not taken
+    int done; // The helper read the end of the file
+    int stop;
+    int failed;
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int started;
+} stream_t;
+
+int stream_open(stream_t *s, const char *fn);
+// Next block of the file, valid until the following call. Returns 0 at the end.
+unsigned long stream_next(stream_t *s, const unsigned char **data);
+void stream_close(stream_t *s);
+
+#endif // HELPERS_STREAM_H
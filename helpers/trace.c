@@ -0,0 +1,168 @@
+#include "helpers/trace.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define TRACE_RING_SIZE 16384 // Events kept per thread, a power of two
+
+typedef struct trace_record
+{
+    const char *name;
+    const char *detail;
+    double start, end;
+} trace_record_t;
+
+typedef struct trace_ring
+{
+    struct trace_ring *next;
+    unsigned int tid;
+    const char *thread_name;
+    unsigned long written; // Every event ever recorded, published with release
+    trace_record_t records[TRACE_RING_SIZE];
+} trace_ring_t;
+
+volatile int trace_on = 0;
+
+static trace_ring_t *trace_rings = NULL;
+static unsigned int trace_generation = 0;
+static unsigned int trace_next_tid = 0;
+static double trace_origin = 0;
+
+// A thread's ring is only valid for the trace it was registered in.
+static __thread trace_ring_t *trace_ring = NULL;
+static __thread unsigned int trace_ring_generation = 0;
+
+double trace_now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static trace_ring_t *trace_ring_get(void)
+{
+    unsigned int generation = __atomic_load_n(&trace_generation, __ATOMIC_ACQUIRE);
+
+    if (trace_ring && trace_ring_generation == generation)
+        return trace_ring;
+
+    trace_ring_t *r = calloc(1, sizeof(trace_ring_t));
+    if (!r)
+        return NULL;
+
+    r->tid = __atomic_add_fetch(&trace_next_tid, 1, __ATOMIC_RELAXED);
+    r->next = __atomic_load_n(&trace_rings, __ATOMIC_RELAXED);
+
+    while (!__atomic_compare_exchange_n(&trace_rings, &r->next, r, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+        ;
+
+    trace_ring = r;
+    trace_ring_generation = generation;
+    return r;
+}
+
+void trace_start(void)
+{
+    trace_origin = trace_now();
+    __atomic_add_fetch(&trace_generation, 1, __ATOMIC_RELEASE);
+    trace_on = 1;
+    trace_thread_name("main");
+}
+
+void trace_event(const char *name, const char *detail, double start, double end)
+{
+    trace_ring_t *r = trace_ring_get();
+    if (!r)
+        return;
+
+    trace_record_t *record = &r->records[r->written & (TRACE_RING_SIZE - 1)];
+    record->name = name;
+    record->detail = detail;
+    record->start = start;
+    record->end = end;
+
+    __atomic_store_n(&r->written, r->written + 1, __ATOMIC_RELEASE);
+}
+
+void trace_thread_name(const char *name)
+{
+    trace_ring_t *r;
+
+    if (trace_on && (r = trace_ring_get()))
+        r->thread_name = name;
+}
+
+static void trace_write_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+
+    for (; *s; s++)
+    {
+        if (*s == '"' || *s == '\\')
+            fputc('\\', fp);
+
+        if ((unsigned char)*s < 0x20)
+            fprintf(fp, "\\u%04x", *s);
+        else
+            fputc(*s, fp);
+    }
+
+    fputc('"', fp);
+}
+
+// Every thread that recorded must have finished by now.
+int trace_stop(const char *fn)
+{
+    trace_on = 0;
+
+    trace_ring_t *rings = __atomic_exchange_n(&trace_rings, NULL, __ATOMIC_ACQUIRE);
+    FILE *fp = fopen(fn, "w");
+    int first = 1;
+
+    if (fp)
+        fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [");
+
+    while (rings)
+    {
+        trace_ring_t *r = rings;
+        unsigned long written = __atomic_load_n(&r->written, __ATOMIC_ACQUIRE);
+        unsigned long i = written > TRACE_RING_SIZE ? written - TRACE_RING_SIZE : 0;
+
+        if (fp && r->thread_name)
+        {
+            fprintf(fp, "%s\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": ",
+                first ? "" : ",", r->tid);
+            trace_write_string(fp, r->thread_name);
+            fprintf(fp, "}}");
+            first = 0;
+        }
+
+        for (; fp && i < written; ++i)
+        {
+            const trace_record_t *record = &r->records[i & (TRACE_RING_SIZE - 1)];
+
+            fprintf(fp, "%s\n{\"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f, \"name\": ",
+                first ? "" : ",", r->tid, record->start - trace_origin, record->end - record->start);
+            trace_write_string(fp, record->name);
+
+            if (record->detail)
+            {
+                fprintf(fp, ", \"args\": {\"detail\": ");
+                trace_write_string(fp, record->detail);
+                fprintf(fp, "}");
+            }
+
+            fprintf(fp, "}");
+            first = 0;
+        }
+
+        rings = r->next;
+        free(r);
+    }
+
+    if (!fp)
+        return 0;
+
+    fprintf(fp, "\n]}\n");
+    return fclose(fp) == 0;
+}
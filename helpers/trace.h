@@ -0,0 +1,31 @@
+#ifndef HELPERS_TRACE_H
+#define HELPERS_TRACE_H
+
+/* Timeline recorder for --trace, written as Chrome Trace Event JSON that
+ * chrome://tracing and Perfetto open directly.
+ *
+ * Each thread records into its own ring buffer, registered once with a
+ * lock-free push, so recording never takes a lock or touches another
+ * thread's memory. When a ring is full the oldest events are overwritten.
+ * Names and details must outlive the trace, string literals or argv. */
+
+extern volatile int trace_on;
+
+void trace_start(void);
+int trace_stop(const char *fn); // Writes the timeline, 0 if it can't be written
+double trace_now(void); // Microseconds, same clock as the stats
+void trace_event(const char *name, const char *detail, double start, double end);
+void trace_thread_name(const char *name);
+
+static inline double trace_begin(void)
+{
+    return trace_on ? trace_now() : 0;
+}
+
+static inline void trace_end(const char *name, const char *detail, double start)
+{
+    if (trace_on)
+        trace_event(name, detail, start, trace_now());
+}
+
+#endif // HELPERS_TRACE_H
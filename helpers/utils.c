@@ -3,6 +3,7 @@
 #include <sys/stat.h>
 
 #if defined(_WIN32)
+#include <windows.h>
 #include <io.h>
 #define F_OK 0
 #define access _access
@@ -23,6 +24,14 @@ inline unsigned int read32le(const unsigned char *ptr)
     return ptr[0] | ptr[1] << 8 | ptr[2] << 16 | ptr[3] << 24;
 }
 
+void write32le(unsigned char *ptr, unsigned int value)
+{
+    ptr[0] = value;
+    ptr[1] = value >> 8;
+    ptr[2] = value >> 16;
+    ptr[3] = value >> 24;
+}
+
 inline unsigned long readvint(unsigned char **stream)
 {
     unsigned long result = 0, shift = 0;
@@ -54,3 +63,16 @@ int are_filenames_same(const char *pfn, const char *ifn, const char *ofn)
 
     return 0;
 }
+
+// Number of online processors, at least 1.
+unsigned int cpu_count(void)
+{
+#if defined(_WIN32)
+    SYSTEM_INFO info;
+    GetSystemInfo(&info);
+    return info.dwNumberOfProcessors ? info.dwNumberOfProcessors : 1;
+#else
+    long count = sysconf(_SC_NPROCESSORS_ONLN);
+    return count > 0 ? count : 1;
+#endif
+}
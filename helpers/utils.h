@@ -10,6 +10,8 @@
 int file_exists(const char *fn);
 unsigned long readvint(unsigned char **stream);
 unsigned int read32le(const unsigned char *ptr);
+void write32le(unsigned char *ptr, unsigned int value);
 int are_filenames_same(const char *pfn, const char *ifn, const char *ofn);
+unsigned int cpu_count(void);
 
 #endif /* HELPERS_UTIL_H */
@@ -0,0 +1,185 @@
+#include "helpers/writer.h"
+#include "helpers/crc32.h"
+#include <string.h>
+
+int writer_open(writer_t *w, filemap_t *output)
+{
+    memset(w, 0, sizeof(writer_t));
+    w->output = output;
+    w->buffer = bytearray_new();
+
+    int streamed = output->fn && (output->_api == filemap_mmap_api || output->_api == filemap_buffer_api);
+
+    if (streamed && !(w->fp = fopen(output->fn, "wb")))
+        return 0;
+
+    return 1;
+}
+
+static void writer_flush(writer_t *w)
+{
+    if (!w->fp || !w->buffer.size)
+        return;
+
+    writer_crc32(w);
+
+    if (fwrite(w->buffer.data, 1, w->buffer.size, w->fp) != w->buffer.size)
+        w->failed = 1;
+
+    w->flushed += w->buffer.size;
+    w->buffer.size = 0;
+    w->crc_pos = 0;
+}
+
+int writer_finish(writer_t *w)
+{
+    filemap_t *output = w->output;
+    int ok = !w->failed && !w->buffer.failed;
+
+    if (w->fp)
+    {
+        writer_flush(w);
+        ok = fclose(w->fp) == 0 && ok && !w->failed;
+        w->fp = NULL;
+
+        if (!ok)
+            remove(output->fn);
+
+        bytearray_close(&w->buffer);
+        return ok;
+    }
+
+    if (!ok)
+    {
+        bytearray_close(&w->buffer);
+        return 0;
+    }
+
+    // Memory maps own a heap buffer, which may as well be this one.
+    if (output->_api == filemap_memory_api && output->status == FILEMAP_NOT_OPENED && !output->readonly &&
+        w->buffer.data)
+    {
+        output->type = FILEMAP_TYPE_CREATED;
+        output->handle = w->buffer.data;
+        output->size = w->buffer.size;
+        output->status = FILEMAP_OK;
+        return 1;
+    }
+
+    ok = filemap_create(output, w->buffer.size);
+
+    if (ok && w->buffer.size)
+        memcpy(output->handle, w->buffer.data, w->buffer.size);
+
+    bytearray_close(&w->buffer);
+    return ok;
+}
+
+void writer_abort(writer_t *w)
+{
+    if (w->fp)
+    {
+        fclose(w->fp);
+        remove(w->output->fn);
+        w->fp = NULL;
+    }
+
+    bytearray_close(&w->buffer);
+}
+
+void writer_reserve(writer_t *w, unsigned long size)
+{
+    if (!w->fp)
+        bytearray_reserve(&w->buffer, size);
+}
+
+unsigned char *writer_extend(writer_t *w, unsigned long size)
+{
+    if (w->fp && w->buffer.size + size > WRITER_CHUNK)
+        writer_flush(w);
+
+    return bytearray_extend(&w->buffer, size);
+}
+
+void writer_push(writer_t *w, unsigned char c)
+{
+    unsigned char *p = writer_extend(w, 1);
+
+    if (p)
+        *p = c;
+}
+
+void writer_push_data(writer_t *w, const unsigned char *bytes, unsigned long size)
+{
+    while (size)
+    {
+        unsigned long n = size < WRITER_CHUNK ? size : WRITER_CHUNK;
+        unsigned char *p = writer_extend(w, n);
+
+        if (!p)
+            return;
+
+        memcpy(p, bytes, n);
+        bytes += n;
+        size -= n;
+    }
+}
+
+void writer_push_string(writer_t *w, const char *str)
+{
+    writer_push_data(w, (const unsigned char *)str, strlen(str));
+}
+
+void writer_push_vle(writer_t *w, unsigned long value)
+{
+    if (w->fp && w->buffer.size + BYTEARRAY_VLE_MAX > WRITER_CHUNK)
+        writer_flush(w);
+
+    bytearray_push_vle(&w->buffer, value);
+}
+
+void writer_push_le32(writer_t *w, unsigned int value)
+{
+    unsigned char *p = writer_extend(w, 4);
+
+    if (p)
+        p[0] = value, p[1] = value >> 8, p[2] = value >> 16, p[3] = value >> 24;
+}
+
+void writer_push_be16(writer_t *w, unsigned int value)
+{
+    unsigned char *p = writer_extend(w, 2);
+
+    if (p)
+        p[0] = value >> 8, p[1] = value;
+}
+
+void writer_push_be24(writer_t *w, unsigned int value)
+{
+    unsigned char *p = writer_extend(w, 3);
+
+    if (p)
+        p[0] = value >> 16, p[1] = value >> 8, p[2] = value;
+}
+
+void writer_push_be32(writer_t *w, unsigned int value)
+{
+    unsigned char *p = writer_extend(w, 4);
+
+    if (p)
+        p[0] = value >> 24, p[1] = value >> 16, p[2] = value >> 8, p[3] = value;
+}
+
+unsigned long long writer_size(const writer_t *w)
+{
+    return w->flushed + w->buffer.size;
+}
+
+// Catches up over whatever was pushed since the last call. File outputs
+// hash each chunk right before writing it out.
+unsigned int writer_crc32(writer_t *w)
+{
+    w->crc = crc32(w->buffer.data + w->crc_pos, w->buffer.size - w->crc_pos, w->crc);
+    w->crc_pos = w->buffer.size;
+    return w->crc;
+}
@@ -0,0 +1,47 @@
+#ifndef HELPERS_WRITER_H
+#define HELPERS_WRITER_H
+
+#include "helpers/bytearray.h"
+#include "helpers/filemap.h"
+#include <stdio.h>
+
+// Largest block writer_extend hands out, and the flush size for files.
+#define WRITER_CHUNK (64UL * 1024)
+
+/* Emits a patch of unknown size straight into a create output.
+ *
+ * Outputs backed by a file are streamed through a WRITER_CHUNK buffer, so
+ * only one chunk of the patch is ever in memory. Anything else is built in
+ * one growing buffer that memory filemaps adopt as is, and other backends
+ * receive with a single copy. A CRC of everything written is kept as the
+ * bytes go out, for footers that checksum the patch itself. */
+typedef struct writer
+{
+    filemap_t *output;
+    FILE *fp; // NULL when building in memory
+    bytearray_t buffer;
+    unsigned long long flushed; // Bytes already written to fp
+    unsigned long crc_pos; // Buffer offset the crc covers up to
+    unsigned int crc;
+    int failed;
+} writer_t;
+
+int writer_open(writer_t *w, filemap_t *output);
+int writer_finish(writer_t *w); // Returns 0 if anything failed along the way
+void writer_abort(writer_t *w);
+
+void writer_reserve(writer_t *w, unsigned long size); // Sizing hint, in memory only
+unsigned char *writer_extend(writer_t *w, unsigned long size); // size <= WRITER_CHUNK
+void writer_push(writer_t *w, unsigned char c);
+void writer_push_data(writer_t *w, const unsigned char *bytes, unsigned long size);
+void writer_push_string(writer_t *w, const char *str);
+void writer_push_vle(writer_t *w, unsigned long value);
+void writer_push_le32(writer_t *w, unsigned int value);
+void writer_push_be16(writer_t *w, unsigned int value);
+void writer_push_be24(writer_t *w, unsigned int value);
+void writer_push_be32(writer_t *w, unsigned int value);
+
+unsigned long long writer_size(const writer_t *w);
+unsigned int writer_crc32(writer_t *w); // Of every byte pushed so far
+
+#endif // HELPERS_WRITER_H
@@ -0,0 +1,275 @@
+#include "lib/gible.h"
+#include "helpers/filemap.h"
+#include "helpers/format.h"
+#include "helpers/log.h"
+#include <stdlib.h>
+#include <string.h>
+
+// -------------------------------------------------
+// Caller Allocated Output
+// -------------------------------------------------
+
+static void *default_alloc(void *user, size_t size)
+{
+    (void)user;
+    return malloc(size);
+}
+
+static void default_free(void *user, void *ptr)
+{
+    (void)user;
+    free(ptr);
+}
+
+static const gible_allocator_t default_allocator = {
+    .alloc = default_alloc,
+    .free = default_free,
+    .user = NULL,
+};
+
+static int output_create(filemap_t *f)
+{
+    const gible_allocator_t *a = f->user;
+
+    if (!(f->handle = a->alloc(a->user, f->size ? f->size : 1)))
+    {
+        f->status = FILEMAP_ERROR;
+        return 0;
+    }
+
+    f->status = FILEMAP_OK;
+    return 1;
+}
+
+static int output_open(filemap_t *f)
+{
+    f->status = FILEMAP_ERROR;
+    return 0;
+}
+
+static void output_close(filemap_t *f)
+{
+    const gible_allocator_t *a = f->user;
+
+    if (f->handle)
+        a->free(a->user, f->handle);
+
+    f->handle = NULL;
+    f->status = FILEMAP_NOT_OPENED;
+}
+
+static const filemap_api_t output_api = {
+    .create = output_create,
+    .open = output_open,
+    .close = output_close
+};
+
+static filemap_t output_new(const gible_options_t *options)
+{
+    filemap_t f = filemap_new(NULL, 0, &output_api);
+    f.user = (void *)(options && options->allocator ? options->allocator : &default_allocator);
+    return f;
+}
+
+// Hands the output over to the caller, or releases it on failure.
+static int output_finish(filemap_t *f, int return_code, gible_buffer_t *output)
+{
+    if (return_code != 0 || f->status != FILEMAP_OK)
+    {
+        filemap_close(f);
+        return GIBLE_ERROR;
+    }
+
+    output->data = f->handle;
+    output->size = f->size;
+    return GIBLE_OK;
+}
+
+// -------------------------------------------------
+// Logging
+// -------------------------------------------------
+
+static void discard_log(void *user, int level, const char *msg)
+{
+    (void)user, (void)level, (void)msg;
+}
+
+static void log_begin(const gible_options_t *options)
+{
+    if (options && options->log)
+        gible_log_set_handler(options->log, options->log_user);
+    else
+        gible_log_set_handler(discard_log, NULL);
+}
+
+static void log_end(void)
+{
+    gible_log_set_handler(NULL, NULL);
+}
+
+// -------------------------------------------------
+// Progress
+// -------------------------------------------------
+
+static progress_t *progress_begin(const gible_options_t *options, progress_t *p)
+{
+    if (!options || !options->progress)
+        return NULL;
+
+    memset(p, 0, sizeof(progress_t));
+    p->callback = options->progress;
+    p->user = options->progress_user;
+    return p;
+}
+
+// -------------------------------------------------
+// Entry Points
+// -------------------------------------------------
+
+int gible_apply(const void *patch, size_t patch_size, const void *input, size_t input_size,
+    const gible_options_t *options, gible_buffer_t *output)
+{
+    apply_flags_t flags;
+    memset(&flags, 0, sizeof(apply_flags_t));
+
+    if (options)
+    {
+        flags.strict_crc = options->strict_crc;
+        flags.ignore_crc = options->ignore_crc;
+    }
+
+    output->data = NULL;
+    output->size = 0;
+
+    progress_t progress;
+
+    patch_apply_context_t c;
+    c.flags = &flags;
+    c.stats = NULL;
+    c.progress = progress_begin(options, &progress);
+    c.touched = NULL;
+    c.digest = NULL;
+    c.patch = filemap_new_memory((unsigned char *)patch, patch_size);
+    c.input = filemap_new_memory((unsigned char *)input, input_size);
+    c.output = output_new(options);
+
+    filemap_open(&c.patch);
+    filemap_open(&c.input);
+
+    log_begin(options);
+
+    int return_code = APPLY_RET_FAILURE;
+    const patch_format_t *format = patch_format_detect(&c);
+
+    if (format)
+        return_code = format->apply_main(&c);
+    else
+        gible_error("Unsupported Patch Type.");
+
+    log_end();
+
+    return output_finish(&c.output, return_code, output);
+}
+
+int gible_create_patch(const void *patched, size_t patched_size, const void *base, size_t base_size,
+    const char *format_ext, const gible_options_t *options, gible_buffer_t *output)
+{
+    create_flags_t flags;
+    memset(&flags, 0, sizeof(create_flags_t));
+
+    output->data = NULL;
+    output->size = 0;
+
+    progress_t progress;
+
+    patch_create_context_t c;
+    c.flags = &flags;
+    c.stats = NULL;
+    c.progress = progress_begin(options, &progress);
+    c.candidates = NULL;
+    c.patched = filemap_new_memory((unsigned char *)patched, patched_size);
+    c.base = filemap_new_memory((unsigned char *)base, base_size);
+    c.output = output_new(options);
+
+    filemap_open(&c.patched);
+    filemap_open(&c.base);
+
+    log_begin(options);
+
+    int return_code = CREATE_RET_FAILURE;
+    const patch_format_t *format = patch_format_for_create(&c, format_ext);
+
+    if (format)
+        return_code = format->create_main(&c);
+    else
+        gible_error("Unsupported Patch Type.");
+
+    log_end();
+
+    return output_finish(&c.output, return_code, output);
+}
+
+// -------------------------------------------------
+// Patched Views
+// -------------------------------------------------
+
+struct gible_view
+{
+    patch_view_t view;
+    gible_options_t options; // Only the log callback is used after opening
+};
+
+int gible_view_open(const void *patch, size_t patch_size, const void *input, size_t input_size,
+    const gible_options_t *options, gible_view_t **view)
+{
+    gible_view_t *v = calloc(1, sizeof(gible_view_t));
+    *view = NULL;
+
+    if (!v)
+        return GIBLE_ERROR;
+
+    if (options)
+        v->options = *options;
+
+    filemap_t p = filemap_new_memory((unsigned char *)patch, patch_size);
+    filemap_t i = filemap_new_memory((unsigned char *)input, input_size);
+
+    filemap_open(&p);
+    filemap_open(&i);
+
+    log_begin(options);
+    int return_code = patch_view_open(&v->view, p, i);
+    log_end();
+
+    if (return_code != APPLY_RET_SUCCESS)
+    {
+        free(v);
+        return GIBLE_ERROR;
+    }
+
+    *view = v;
+    return GIBLE_OK;
+}
+
+size_t gible_view_size(const gible_view_t *view)
+{
+    return view->view.size;
+}
+
+int gible_view_read(const gible_view_t *view, size_t offset, void *buffer, size_t length)
+{
+    log_begin(&view->options);
+    int return_code = patch_view_read(&view->view, offset, buffer, length);
+    log_end();
+
+    return return_code == APPLY_RET_SUCCESS ? GIBLE_OK : GIBLE_ERROR;
+}
+
+void gible_view_close(gible_view_t *view)
+{
+    if (!view)
+        return;
+
+    patch_view_close(&view->view);
+    free(view);
+}
@@ -0,0 +1,86 @@
+#ifndef LIB_GIBLE_H
+#define LIB_GIBLE_H
+
+/* Embeddable interface to gible, built as libgible.a / libgible.so by `make lib`.
+ *
+ * Everything works on caller owned memory: patches, inputs and outputs are
+ * plain buffers, and the output is allocated once through the caller's
+ * allocator and written in place. Nothing is printed, messages go to the
+ * log callback (or nowhere). Calls share no state and may run concurrently
+ * from different threads. */
+
+#include <stddef.h>
+
+#define GIBLE_OK 0
+#define GIBLE_ERROR 1
+
+// Same bit layout as the CLI flags: patch, input, output.
+#define GIBLE_CRC_PATCH (1 << 0)
+#define GIBLE_CRC_INPUT (1 << 1)
+#define GIBLE_CRC_OUTPUT (1 << 2)
+#define GIBLE_CRC_ALL (GIBLE_CRC_PATCH | GIBLE_CRC_INPUT | GIBLE_CRC_OUTPUT)
+
+// Log levels passed to gible_log_fn.
+#define GIBLE_LOG_MSG 0
+#define GIBLE_LOG_INFO 1
+#define GIBLE_LOG_WARN 2
+#define GIBLE_LOG_ERROR 3
+
+typedef struct gible_allocator
+{
+    void *(*alloc)(void *user, size_t size);
+    void (*free)(void *user, void *ptr);
+    void *user;
+} gible_allocator_t;
+
+typedef void (*gible_log_fn)(void *user, int level, const char *msg);
+
+// Called from the calling thread about once per MB of output, and once at
+// the end. Should return quickly, it runs inside the patching loop.
+typedef void (*gible_progress_fn)(void *user, unsigned long long done, unsigned long long total);
+
+typedef struct gible_options
+{
+    unsigned char strict_crc; // GIBLE_CRC_* checks that abort on mismatch.
+    unsigned char ignore_crc; // GIBLE_CRC_* checks that are skipped.
+
+    const gible_allocator_t *allocator; // Output allocator, NULL for malloc/free.
+
+    gible_log_fn log; // NULL discards messages.
+    void *log_user;
+
+    gible_progress_fn progress; // NULL for no progress reports.
+    void *progress_user;
+} gible_options_t;
+
+typedef struct gible_buffer
+{
+    unsigned char *data; // Allocated through options->allocator, owned by the caller.
+    size_t size;
+} gible_buffer_t;
+
+// Applies an IPS, IPS32, UPS, BPS or GBL patch to input. On success *output holds
+// the result, on failure it is left empty and nothing stays allocated.
+int gible_apply(const void *patch, size_t patch_size, const void *input, size_t input_size,
+    const gible_options_t *options, gible_buffer_t *output);
+
+// Creates a patch turning base into patched. format is an extension such as
+// "ips", "ups", "bps" or "gbl"; "ips" picks IPS32 for outputs over 16MB.
+int gible_create_patch(const void *patched, size_t patched_size, const void *base, size_t base_size,
+    const char *format, const gible_options_t *options, gible_buffer_t *output);
+
+// Read only view of the output of a patch, decoded on demand. Opening walks
+// the patch once to index it, after which a read costs about as much as the
+// bytes it returns and the whole output is never produced. Checksums are
+// not checked. patch and input must outlive the view, which may be read
+// from several threads at once.
+typedef struct gible_view gible_view_t;
+
+int gible_view_open(const void *patch, size_t patch_size, const void *input, size_t input_size,
+    const gible_options_t *options, gible_view_t **view);
+size_t gible_view_size(const gible_view_t *view);
+// Fails for ranges past gible_view_size.
+int gible_view_read(const gible_view_t *view, size_t offset, void *buffer, size_t length);
+void gible_view_close(gible_view_t *view);
+
+#endif // LIB_GIBLE_H